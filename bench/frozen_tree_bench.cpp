@@ -0,0 +1,114 @@
+#include "src/frozen_tree.h"
+#include "src/node_rules.h"
+#include "src/two_three_tree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+//! Node of a copy of the tree with the same shape and the same layout: a heap block per node, with its keys and
+//! children in vectors of their own.
+struct PlainNode {
+    std::vector<NVis::Key> keys;
+    std::vector<std::unique_ptr<PlainNode>> children;
+};
+
+//! Copies the tree from the snapshot its observers get, so that it can be searched without anything but the descent.
+std::unique_ptr<PlainNode> CopyTree(NVis::TwoThreeTree& tree) {
+    std::unordered_map<NVis::MemoryAddress, NVis::NodeInfo> nodes;
+    NVis::MemoryAddress root = nullptr;
+    NVis::Observer<NVis::TreeActionsBatch> observer(
+        [&](const NVis::TreeActionsBatch& actions) {
+            for (const auto& action : actions) {
+                if (action.action_type == NVis::ENodeAction::Create) {
+                    nodes[action.node_address] = *action.data;
+                } else if (action.action_type == NVis::ENodeAction::MakeRoot) {
+                    root = action.node_address;
+                }
+            }
+        },
+        [](const NVis::TreeActionsBatch&) {}, []() {});
+    tree.SubscribeObserver(&observer);
+    auto copy = [&nodes](auto& self, NVis::MemoryAddress address) -> std::unique_ptr<PlainNode> {
+        auto& info = nodes.at(address);
+        auto vertex = std::make_unique<PlainNode>();
+        vertex->keys = std::move(info.keys);
+        for (auto child : info.children) {
+            vertex->children.emplace_back(self(self, child));
+        }
+        return vertex;
+    };
+    return root == nullptr ? nullptr : copy(copy, root);
+}
+
+//! The descent of `TwoThreeTree::Contains` without tracing, metrics, observers, the filter and the finger.
+bool ContainsByDescent(const PlainNode* vertex, NVis::Key x) {
+    if (vertex == nullptr) {
+        return false;
+    }
+    while (!vertex->children.empty()) {
+        vertex = vertex->children[NVis::ChildIndexFor(vertex->keys.begin(), vertex->keys.end(), x)].get();
+    }
+    return std::binary_search(vertex->keys.begin(), vertex->keys.end(), x);
+}
+} // namespace
+
+//! Compares random lookups in a 2-3 tree with the same lookups in its frozen copy. The tree is measured twice: through
+//! the public `Contains`, which pays for tracing, metrics and notifying observers even when nobody listens, and by a
+//! plain descent over a copy of the same shape, which is what the layout alone costs. The count of keys is the first
+//! argument, 10M by default. Keys are even, lookups are uniform over the same range, so about half of them miss.
+int main(int argc, char* argv[]) {
+    using namespace NVis;
+    using Clock = std::chrono::steady_clock;
+    constexpr int kSeed = 41;
+    constexpr ssize_t kLookupCount = 10'000'000;
+
+    ssize_t key_count = argc > 1 ? std::atoll(argv[1]) : 10'000'000;
+    std::mt19937 mt(kSeed);
+    std::vector<Key> keys(key_count);
+    for (ssize_t index = 0; index < key_count; ++index) {
+        // Even keys only, so that odd lookups always miss.
+        keys[index] = static_cast<Key>(index * 2);
+    }
+    std::vector<Key> lookups(kLookupCount);
+    std::uniform_int_distribution<ssize_t> lookup_rng(0, 2 * key_count);
+    for (auto& x : lookups) {
+        x = static_cast<Key>(lookup_rng(mt));
+    }
+
+    TwoThreeTree tree;
+    tree.Build(keys);
+    auto frozen = Freeze(tree);
+    auto plain = CopyTree(tree);
+    keys = {};
+
+    auto measure = [&lookups](const char* name, auto&& contains) {
+        auto start = Clock::now();
+        ssize_t found = 0;
+        for (auto x : lookups) {
+            found += contains(x);
+        }
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        auto per_lookup = elapsed.count() / std::ssize(lookups);
+        std::cout << name << ": " << per_lookup << " ns per lookup, " << found << " found\n";
+        return std::pair(per_lookup, found);
+    };
+    auto [tree_time, tree_found] = measure("2-3 tree", [&tree](Key x) { return tree.Contains(x); });
+    auto [raw_time, raw_found] =
+        measure("2-3 tree, plain descent", [&plain](Key x) { return ContainsByDescent(plain.get(), x); });
+    auto [frozen_time, frozen_found] = measure("frozen", [&frozen](Key x) { return frozen.Contains(x); });
+    std::cout << "keys: " << key_count << ", speedup: " << tree_time / frozen_time << "x over Contains, "
+              << raw_time / frozen_time << "x over a plain descent\n";
+    if (tree_found != frozen_found || raw_found != frozen_found) {
+        std::cerr << "Trees disagree on the found keys\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include "src/tree_drawing_model.h"
+#include "src/two_three_tree.h"
+
+#include <QApplication>
+
+#include <cstdlib>
+#include <iostream>
+
+//! Fills a tree with keys from 1 to N, draws it once and prints memory usage of the tree and of the drawing model. The
+//! count of keys is the first argument, 100K by default. Scene items need a GUI application for their fonts, so it runs
+//! on the offscreen platform unless another one is asked for, and no display is needed.
+int main(int argc, char* argv[]) {
+    using namespace NVis;
+    Key key_count = argc > 1 ? std::atoll(argv[1]) : 100'000;
+    if (key_count < 0) {
+        std::cerr << "Expected a non-negative count of keys" << std::endl;
+        return 1;
+    }
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication qt_runtime(argc, argv);
+
+    TwoThreeTree tree;
+    if (key_count > 0) {
+        tree.ApplyBatch(EBatchOperation::Insert, {KeyRange{.first = 1, .last = key_count}});
+        tree.PublishBatchSummary();
+    }
+    std::cout << tree.MemoryStats() << '\n';
+
+    TreeDrawingModel drawing_model;
+    Observer<TreeActionsBatch> drawer(
+        [&drawing_model](const TreeActionsBatch& actions) { drawing_model.DrawActions(actions); },
+        [](const TreeActionsBatch&) {}, []() {});
+    tree.SubscribeObserver(&drawer);
+    drawing_model.Flush();
+    std::cout << drawing_model.MemoryStats();
+    return 0;
+}
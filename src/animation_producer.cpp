@@ -1,11 +1,14 @@
 #include "animation_producer.h"
 
+#include "tracer.h"
+
 namespace NVis {
 
 AnimationProducer::AnimationProducer(TreeDrawingModel* drawing_model)
     : port_([this](const TreeActionsBatch& changes) { this->HandleNotification(changes); },
             [this](const TreeActionsBatch& changes) { this->HandleNotification(changes); }, []() {}),
       animation_timer_(),
+      timeline_(kKeyframeInterval, kTimelineMemoryBudget),
       drawing_model_(drawing_model) {
     animation_timer_.setSingleShot(true);
     QObject::connect(&animation_timer_, &QTimer::timeout, [this]() { this->AnimateQueries(); });
@@ -15,7 +18,38 @@ Observer<TreeActionsBatch>* AnimationProducer::GetTreeActionsPort() {
     return &port_;
 }
 
+void AnimationProducer::Play(TreeSteps steps) {
+    FinishAnimationImmediately();
+    steps_.emplace(std::move(steps));
+    AnimateQueries();
+}
+
+void AnimationProducer::SeekToOperation(ssize_t operation) {
+    FinishAnimationImmediately();
+    if (operation < timeline_.GetFirstOperation() || operation >= timeline_.GetOperationCount()) {
+        return;
+    }
+    TraceSpan span("SeekToOperation", "animation", "operation", operation);
+    if (drawing_model_) {
+        drawing_model_->DrawFrame(timeline_.Seek(timeline_.GetFrameAfterOperation(operation)));
+    }
+    is_seeking_ = true;
+}
+
+const AnimationTimeline& AnimationProducer::GetTimeline() const {
+    return timeline_;
+}
+
+bool AnimationProducer::IsSeeking() const {
+    return is_seeking_;
+}
+
 void AnimationProducer::HandleNotification(const TreeActionsBatch& actions) {
+    if (steps_ && !steps_->IsDone()) {
+        // Either the step due now or the rest of the operation finished at once, nothing to wait for in both cases.
+        Draw(actions);
+        return;
+    }
     // TODO: rewrite this in few `assert(std::find_if(...) == ...)`
     for (ssize_t action_ind = 0; action_ind < std::ssize(actions); ++action_ind) {
         const auto& action = actions[action_ind];
@@ -34,9 +68,19 @@ void AnimationProducer::HandleNotification(const TreeActionsBatch& actions) {
 }
 
 void AnimationProducer::AnimateQueries() {
-    if (drawing_model_) {
-        drawing_model_->DrawActions(storage_.front());
+    if (steps_) {
+        TraceSpan span("AnimateStep", "animation");
+        if (steps_->Next()) {
+            animation_timer_.start(kDelayBetweenFrames);
+            return;
+        }
+        steps_.reset();
     }
+    TraceSpan span("AnimateQueries", "animation", "queued", std::ssize(storage_));
+    if (storage_.empty()) {
+        return;
+    }
+    Draw(storage_.front());
     storage_.pop();
     if (!storage_.empty()) {
         animation_timer_.start(kDelayBetweenFrames);
@@ -44,10 +88,13 @@ void AnimationProducer::AnimateQueries() {
 }
 
 void AnimationProducer::FinishAnimationImmediately() {
+    TraceSpan span("FinishAnimationImmediately", "animation", "queued", std::ssize(storage_));
+    if (steps_) {
+        steps_->Finish();
+        steps_.reset();
+    }
     while (!storage_.empty()) {
-        if (drawing_model_) {
-            drawing_model_->DrawActions(storage_.front());
-        }
+        Draw(storage_.front());
         storage_.pop();
     }
     if (animation_timer_.isActive()) {
@@ -55,4 +102,19 @@ void AnimationProducer::FinishAnimationImmediately() {
     }
 }
 
+void AnimationProducer::Draw(const TreeActionsBatch& actions) {
+    if (drawing_model_) {
+        if (is_seeking_) {
+            // The view shows a past frame, while the actions apply to the present one.
+            auto frame = timeline_.Seek(timeline_.GetFrameCount());
+            frame.actions = actions;
+            drawing_model_->DrawFrame(frame);
+        } else {
+            drawing_model_->DrawActions(actions);
+        }
+    }
+    is_seeking_ = false;
+    timeline_.Record(actions);
+}
+
 } // namespace NVis
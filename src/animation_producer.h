@@ -1,11 +1,14 @@
 #pragma once
 
+#include "animation_timeline.h"
 #include "observer.h"
 #include "tree_action.h"
 #include "tree_drawing_model.h"
+#include "tree_steps.h"
 
 #include <QTimer>
 
+#include <optional>
 #include <queue>
 
 namespace NVis {
@@ -14,19 +17,38 @@ class AnimationProducer {
 public:
     AnimationProducer(TreeDrawingModel* drawing_model);
     Observer<TreeActionsBatch>* GetTreeActionsPort();
+    //! Animates a single operation going step by step: a step is made only when its frame is due, so steps aren't
+    //! stored at all. Whatever has been animated before is finished first.
+    void Play(TreeSteps steps);
+    //! Draws at once everything left to animate, including the rest of the operation being played.
+    void FinishAnimationImmediately();
+
+    //! Shows the state left by the `operation`-th operation drawn so far, see `AnimationTimeline`. Anything still to
+    //! animate is drawn first. The next change of the tree brings the view back to the present.
+    void SeekToOperation(ssize_t operation);
+    const AnimationTimeline& GetTimeline() const;
+    //! Whether the view shows the past after `SeekToOperation`.
+    bool IsSeeking() const;
 
 private:
     void HandleNotification(const TreeActionsBatch& actions);
     //! Draws animation of all the stored changes in Model frame by frame using a call to drawing model and calling
     //! itself with `QTimer`. This animation "loop" can be cancelled by `HandleNotification`.
     void AnimateQueries();
-    void FinishAnimationImmediately();
+    //! Draws `actions` and records them in the timeline.
+    void Draw(const TreeActionsBatch& actions);
 
     static constexpr int kDelayBetweenFrames = 300;
+    static constexpr ssize_t kKeyframeInterval = 64;
+    static constexpr ssize_t kTimelineMemoryBudget = ssize_t{64} << 20;
 
     Observer<TreeActionsBatch> port_;
     std::queue<TreeActionsBatch> storage_;
+    //! The operation being played by `Play`. Its steps come through `port_` like any other notification.
+    std::optional<TreeSteps> steps_;
     QTimer animation_timer_;
+    AnimationTimeline timeline_;
+    bool is_seeking_ = false;
     TreeDrawingModel* drawing_model_;
 };
 
@@ -0,0 +1,156 @@
+#include "animation_timeline.h"
+
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+namespace NVis {
+
+AnimationTimeline::AnimationTimeline(ssize_t keyframe_interval, ssize_t memory_budget)
+    : keyframe_interval_(keyframe_interval), memory_budget_(memory_budget) {
+    assert(keyframe_interval_ > 0 && "Keyframe interval must be positive");
+}
+
+void AnimationTimeline::Record(const TreeActionsBatch& actions) {
+    auto frame = GetFrameCount();
+    if (keyframes_.empty() || frame - keyframes_.back().frame >= keyframe_interval_) {
+        AddKeyframe(frame);
+    }
+    if (!actions.empty() && actions.front().action_type == ENodeAction::StartQuery) {
+        operation_starts_.emplace_back(frame);
+    }
+    auto bytes = MeasureBatch(actions);
+    frames_.emplace_back(Frame{.actions = actions, .bytes = bytes});
+    bytes_ += bytes;
+    current_.Apply(actions);
+    while (bytes_ > memory_budget_ && keyframes_.size() > 1) {
+        ForgetOldest();
+    }
+    if (bytes_ > memory_budget_) {
+        ForgetAll();
+    }
+}
+
+ssize_t AnimationTimeline::GetFirstFrame() const {
+    return first_frame_;
+}
+
+ssize_t AnimationTimeline::GetFrameCount() const {
+    return first_frame_ + std::ssize(frames_);
+}
+
+ssize_t AnimationTimeline::GetFirstOperation() const {
+    return first_operation_;
+}
+
+ssize_t AnimationTimeline::GetOperationCount() const {
+    return first_operation_ + std::ssize(operation_starts_);
+}
+
+ssize_t AnimationTimeline::GetFrameAfterOperation(ssize_t operation) const {
+    assert(operation >= GetFirstOperation() && operation < GetOperationCount() && "Operation isn't remembered");
+    auto next = operation + 1 - first_operation_;
+    return next < std::ssize(operation_starts_) ? operation_starts_[next] : GetFrameCount();
+}
+
+TimelineFrame AnimationTimeline::Seek(ssize_t frame) const {
+    assert(frame >= GetFirstFrame() && frame <= GetFrameCount() && "Frame isn't remembered");
+    assert(!keyframes_.empty() && keyframes_.front().frame == first_frame_ && "History doesn't start at a keyframe");
+    // Keyframes are `keyframe_interval_` frames apart, except where the history has started over.
+    auto keyframe = std::prev(std::upper_bound(keyframes_.begin(), keyframes_.end(), frame,
+                                               [](ssize_t frame, const Keyframe& keyframe) {
+                                                   return frame < keyframe.frame;
+                                               }));
+    auto state = keyframe->state;
+    for (auto replayed = keyframe->frame; replayed < frame; ++replayed) {
+        state.Apply(frames_[replayed - first_frame_].actions);
+    }
+    TreeActionsBatch described;
+    state.AppendCreation(described);
+    return TimelineFrame{
+        .state = std::move(described),
+        .actions = frame < GetFrameCount() ? frames_[frame - first_frame_].actions : TreeActionsBatch{},
+    };
+}
+
+ssize_t AnimationTimeline::MemoryBytes() const {
+    return bytes_;
+}
+
+ssize_t AnimationTimeline::MeasureBatch(const TreeActionsBatch& actions) {
+    auto memory = MeasureVector(actions);
+    for (const auto& action : actions) {
+        if (action.data) {
+            memory += MeasureVector(action.data->keys);
+            memory += MeasureVector(action.data->children);
+        }
+    }
+    return memory.used_bytes + memory.slack_bytes + memory.allocation_count * kAllocationOverheadBytes;
+}
+
+ssize_t AnimationTimeline::MeasureUnshared(const ObservedTree& state, const ObservedTree& other) {
+    VectorMemory memory;
+    ssize_t table_bytes = 0;
+    for (ssize_t index = 0; index < ObservedTree::kShardCount; ++index) {
+        auto shard = state.GetShard(index);
+        if (shard == nullptr || shard == other.GetShard(index)) {
+            continue;
+        }
+        for (const auto& [address, info] : *shard) {
+            memory += MeasureVector(info.keys);
+            memory += MeasureVector(info.children);
+        }
+        auto table = MeasureHashTable(*shard);
+        table_bytes += table.bytes + table.allocation_count * kAllocationOverheadBytes;
+    }
+    // Its own table of shards, whatever they are.
+    using ShardPointer = std::shared_ptr<ObservedTree::Shard>;
+    memory.used_bytes += ObservedTree::kShardCount * static_cast<ssize_t>(sizeof(ShardPointer));
+    ++memory.allocation_count;
+    return memory.used_bytes + memory.slack_bytes + memory.allocation_count * kAllocationOverheadBytes + table_bytes;
+}
+
+void AnimationTimeline::AddKeyframe(ssize_t frame) {
+    if (!keyframes_.empty()) {
+        // Until now the last keyframe was counted as sharing everything with the current state.
+        auto& last = keyframes_.back();
+        auto bytes = MeasureUnshared(last.state, current_);
+        bytes_ += bytes - last.bytes;
+        last.bytes = bytes;
+    }
+    auto bytes = MeasureUnshared(current_, current_);
+    keyframes_.emplace_back(Keyframe{.frame = frame, .state = current_, .bytes = bytes});
+    bytes_ += bytes;
+}
+
+void AnimationTimeline::ForgetOldest() {
+    assert(keyframes_.size() > 1 && "Forgetting the only keyframe");
+    bytes_ -= keyframes_.front().bytes;
+    keyframes_.pop_front();
+    while (first_frame_ < keyframes_.front().frame) {
+        bytes_ -= frames_.front().bytes;
+        frames_.pop_front();
+        ++first_frame_;
+    }
+    while (!operation_starts_.empty() && operation_starts_.front() < first_frame_) {
+        operation_starts_.pop_front();
+        ++first_operation_;
+    }
+}
+
+void AnimationTimeline::ForgetAll() {
+    auto frame = GetFrameCount();
+    first_operation_ = GetOperationCount();
+    operation_starts_.clear();
+    frames_.clear();
+    first_frame_ = frame;
+    keyframes_.clear();
+    bytes_ = 0;
+    AddKeyframe(frame);
+}
+
+} // namespace NVis
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "tree_action.h"
+
+#include <deque>
+
+namespace NVis {
+
+//! A frame rebuilt by `AnimationTimeline`: the drawing state before the frame, as a batch creating every node of it,
+//! and the actions of the frame itself, to be highlighted on top of that state.
+struct TimelineFrame {
+    TreeActionsBatch state;
+    TreeActionsBatch actions;
+};
+
+//! History of the batches drawn by the animation, every batch being a frame, which can be looked at again from any
+//! point. Besides the batches, a copy of the drawing state is kept every `keyframe_interval` frames, so a past frame is
+//! rebuilt from the keyframe before it by replaying at most `keyframe_interval` batches, not the whole history.
+//! Keyframes are copies of `ObservedTree`, which share all but the shards changed between them, so taking one on every
+//! drawn frame costs O(ObservedTree::kShardCount) rather than a copy of the whole tree.
+//!
+//! Once the history takes more than `memory_budget` bytes, the oldest frames are forgotten a keyframe interval at a
+//! time. If even the last interval doesn't fit, as after a batch bringing a large tree at once, the history starts
+//! over from the current state. Frames and operations are numbered from the start of recording, and forgotten ones keep
+//! their numbers.
+class AnimationTimeline {
+public:
+    AnimationTimeline(ssize_t keyframe_interval, ssize_t memory_budget);
+
+    void Record(const TreeActionsBatch& actions);
+
+    //! Remembered frames are `[GetFirstFrame(), GetFrameCount())`.
+    ssize_t GetFirstFrame() const;
+    ssize_t GetFrameCount() const;
+    //! Operations are runs of frames starting with `StartQuery`. Remembered ones are
+    //! `[GetFirstOperation(), GetOperationCount())`.
+    ssize_t GetFirstOperation() const;
+    ssize_t GetOperationCount() const;
+    //! The frame where the state left by the `operation`-th operation is seen, which is the first frame of the next
+    //! one, or `GetFrameCount()` for the last one.
+    ssize_t GetFrameAfterOperation(ssize_t operation) const;
+
+    //! Rebuilds a remembered `frame`. `GetFrameCount()` gives the current state with no actions.
+    TimelineFrame Seek(ssize_t frame) const;
+
+    //! Estimate of the bytes taken by the remembered batches and keyframes. Shards of keyframes are counted once,
+    //! and the ones the current state shares aren't counted: they would be there without the history.
+    ssize_t MemoryBytes() const;
+
+private:
+    struct Frame {
+        TreeActionsBatch actions;
+        ssize_t bytes;
+    };
+    //! The state before the `frame`-th frame.
+    struct Keyframe {
+        ssize_t frame;
+        ObservedTree state;
+        //! Bytes of its shards which the next keyframe doesn't share. The last one is measured against the current
+        //! state when it's taken, and again once the next one is.
+        ssize_t bytes;
+    };
+
+    static ssize_t MeasureBatch(const TreeActionsBatch& actions);
+    //! Bytes of shards of `state` which `other` doesn't share.
+    static ssize_t MeasureUnshared(const ObservedTree& state, const ObservedTree& other);
+    void AddKeyframe(ssize_t frame);
+    //! Forgets the frames before the second keyframe.
+    void ForgetOldest();
+    //! Forgets every frame, keeping the current state as the only keyframe.
+    void ForgetAll();
+
+    ssize_t keyframe_interval_;
+    ssize_t memory_budget_;
+    ObservedTree current_;
+    std::deque<Frame> frames_;
+    std::deque<Keyframe> keyframes_;
+    //! First frames of remembered operations.
+    std::deque<ssize_t> operation_starts_;
+    ssize_t first_frame_ = 0;
+    ssize_t first_operation_ = 0;
+    ssize_t bytes_ = 0;
+};
+
+} // namespace NVis
@@ -1,5 +1,14 @@
 #include "application.h"
 
+#include "tracer.h"
+
+#include <QDebug>
+#include <QSignalBlocker>
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
 namespace NVis {
 
 Application::Application()
@@ -7,18 +16,79 @@ Application::Application()
       drawing_model_(),
       window_(),
       model_(),
-      controller_(&model_, window_.GetKeyEdit()) {
+      controller_(&model_, &animation_producer_, window_.GetKeyEdit(), window_.GetProgressBar()) {
+    if (auto trace_file = std::getenv(kTraceFileVariable)) {
+        trace_file_ = trace_file;
+        Tracer::Instance().Start();
+    }
 
     QObject::connect(window_.GetInsertButton(), &QPushButton::clicked, &controller_, &Controller::OnInsertButtonClick);
     QObject::connect(window_.GetEraseButton(), &QPushButton::clicked, &controller_, &Controller::OnEraseButtonClick);
     QObject::connect(window_.GetSearchButton(), &QPushButton::clicked, &controller_, &Controller::OnSearchButtonClick);
+    QObject::connect(window_.GetLoadFileButton(), &QPushButton::clicked, &controller_,
+                     &Controller::OnLoadFileButtonClick);
+    QObject::connect(window_.GetCancelButton(), &QPushButton::clicked, &controller_, &Controller::OnCancelButtonClick);
 
-    model_.SubscribeObserver(animation_producer_.GetTreeActionsPort());
+    if (auto shm_name = std::getenv(kShmViewVariable)) {
+        if (auto ring = ShmRing::Open(shm_name)) {
+            shm_view_ = std::make_unique<ShmTreeView>(std::move(*ring));
+        } else {
+            qWarning() << "Failed to open shared memory segment" << shm_name;
+        }
+    }
+    if (shm_view_) {
+        // The tree belongs to another process, there's nothing to edit here.
+        shm_view_->SubscribeObserver(animation_producer_.GetTreeActionsPort());
+        window_.GetKeyEdit()->setEnabled(false);
+        window_.GetInsertButton()->setEnabled(false);
+        window_.GetEraseButton()->setEnabled(false);
+        window_.GetSearchButton()->setEnabled(false);
+        window_.GetLoadFileButton()->setEnabled(false);
+        QObject::connect(&shm_poll_timer_, &QTimer::timeout, [this]() { shm_view_->Poll(); });
+        shm_poll_timer_.start(kShmPollIntervalMs);
+    } else {
+        model_.SubscribeObserverStreaming(animation_producer_.GetTreeActionsPort(), kSnapshotChunkSize);
+    }
     window_.SubscribeViewWidgetTo(drawing_model_.GetScenePort());
+
+    QObject::connect(window_.GetTimelineSlider(), &QSlider::valueChanged,
+                     [this](int operation) { animation_producer_.SeekToOperation(operation); });
+    QObject::connect(&timeline_timer_, &QTimer::timeout, [this]() { this->RefreshTimelineSlider(); });
+    timeline_timer_.start(kTimelineRefreshIntervalMs);
+
+    if constexpr (kMetricsEnabled) {
+        QObject::connect(&metrics_timer_, &QTimer::timeout, [this]() { this->RefreshMetricsOverlay(); });
+        metrics_timer_.start(kMetricsRefreshIntervalMs);
+    }
+}
+
+Application::~Application() {
+    if (trace_file_) {
+        Tracer::Instance().Stop();
+        if (!Tracer::Instance().WriteChromeJsonFile(*trace_file_)) {
+            qWarning() << "Failed to write trace to" << QString::fromStdString(*trace_file_);
+        }
+    }
 }
 
 void Application::ShowWindow() {
     window_.show();
 }
 
+void Application::RefreshTimelineSlider() {
+    const auto& timeline = animation_producer_.GetTimeline();
+    auto slider = window_.GetTimelineSlider();
+    // Moving the slider here mustn't be taken for the user seeking.
+    QSignalBlocker blocker(slider);
+    auto first = static_cast<int>(timeline.GetFirstOperation());
+    slider->setRange(first, std::max(first, static_cast<int>(timeline.GetOperationCount()) - 1));
+    if (!animation_producer_.IsSeeking()) {
+        slider->setValue(slider->maximum());
+    }
+}
+
+void Application::RefreshMetricsOverlay() {
+    window_.SetOverlayText(QString::fromStdString(FormatMetrics(model_.GetMetrics())));
+}
+
 } // namespace NVis
@@ -2,10 +2,17 @@
 
 #include "animation_producer.h"
 #include "controller.h"
+#include "shm_tree_transport.h"
 #include "tree_drawing_model.h"
 #include "two_three_tree.h"
 #include "window.h"
 
+#include <QTimer>
+
+#include <memory>
+#include <optional>
+#include <string>
+
 namespace NVis {
 
 class Application {
@@ -15,16 +22,36 @@ public:
     Application(Application&&) = delete;
     Application& operator=(const Application&) = delete;
     Application& operator=(Application&&) = delete;
-    ~Application() = default;
+    //! Writes the trace, if tracing was requested.
+    ~Application();
 
     void ShowWindow();
 
 private:
+    static constexpr ssize_t kSnapshotChunkSize = 256;
+    static constexpr int kMetricsRefreshIntervalMs = 500;
+    static constexpr int kTimelineRefreshIntervalMs = 200;
+    static constexpr int kShmPollIntervalMs = 16;
+    //! Environment variable with a path to write Chrome trace-event JSON to on exit. Tracing is off without it.
+    static constexpr const char* kTraceFileVariable = "NVIS_TRACE_FILE";
+    //! Environment variable with a name of a shared memory segment of `ShmTreePublisher`. With it, the window shows the
+    //! tree of another process instead of its own.
+    static constexpr const char* kShmViewVariable = "NVIS_SHM_VIEW";
+
+    void RefreshMetricsOverlay();
+    //! Fits the scrubber to the operations in the timeline. It follows the last one unless the user looks at the past.
+    void RefreshTimelineSlider();
+
     AnimationProducer animation_producer_;
     TreeDrawingModel drawing_model_;
     Window window_;
     TwoThreeTree model_;
     Controller controller_;
+    QTimer metrics_timer_;
+    QTimer timeline_timer_;
+    std::unique_ptr<ShmTreeView> shm_view_;
+    QTimer shm_poll_timer_;
+    std::optional<std::string> trace_file_;
 };
 
 } // namespace NVis
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace NVis {
+
+inline constexpr size_t kCacheLineBytes = 64;
+
+//! Allocates arrays aligned to cache lines, so a known part of an array takes a known set of lines.
+template <typename T>
+struct CacheAlignedAllocator {
+    using value_type = T;
+
+    CacheAlignedAllocator() = default;
+    template <typename TOther>
+    CacheAlignedAllocator(const CacheAlignedAllocator<TOther>& /* other */) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{kCacheLineBytes}));
+    }
+    void deallocate(T* pointer, size_t /* count */) {
+        ::operator delete(pointer, std::align_val_t{kCacheLineBytes});
+    }
+
+    friend bool operator==(const CacheAlignedAllocator& /* lhs */, const CacheAlignedAllocator& /* rhs */) {
+        return true;
+    }
+};
+
+} // namespace NVis
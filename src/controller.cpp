@@ -1,7 +1,10 @@
 #include "controller.h"
 
+#include <QFile>
+#include <QFileDialog>
 #include <QMessageBox>
 
+#include <cassert>
 #include <optional>
 
 namespace NVis {
@@ -12,46 +15,89 @@ void ShowIncorrectInputMessage() {
     error_box.setText("Input contains not a valid number!");
     error_box.exec();
 }
+
+void ShowIncorrectFileMessage() {
+    QMessageBox error_box;
+    error_box.setText("File can't be read or contains not a valid list of keys!");
+    error_box.exec();
+}
 } // namespace
 
-Controller::Controller(Model* model, QLineEdit* key_edit) : model_(model), key_edit_(key_edit) {}
+Controller::Controller(Model* model, AnimationProducer* animation_producer, QLineEdit* key_edit,
+                       QProgressBar* progress_bar)
+    : model_(model), animation_producer_(animation_producer), key_edit_(key_edit), progress_bar_(progress_bar) {
+    if (progress_bar_) {
+        progress_bar_->setRange(0, kProgressBarScale);
+        progress_bar_->hide();
+    }
+    QObject::connect(&progress_timer_, &QTimer::timeout, [this]() { this->PollBulkOperation(); });
+}
 
 void Controller::OnInsertButtonClick() {
-    if (!model_) {
+    if (!model_ || IsBulkOperationRunning()) {
         return;
     }
-    auto maybe_key = TryGetKeyFromEdit();
-    if (!maybe_key) {
+    auto maybe_ranges = TryGetKeyRangesFromEdit();
+    if (!maybe_ranges) {
         ShowIncorrectInputMessage();
     } else {
-        model_->Insert(*maybe_key);
+        ApplyKeyRanges(EBatchOperation::Insert, std::move(*maybe_ranges));
     }
 }
 
 void Controller::OnEraseButtonClick() {
-    if (!model_) {
+    if (!model_ || IsBulkOperationRunning()) {
         return;
     }
-    auto maybe_key = TryGetKeyFromEdit();
-    if (!maybe_key) {
+    auto maybe_ranges = TryGetKeyRangesFromEdit();
+    if (!maybe_ranges) {
         ShowIncorrectInputMessage();
     } else {
-        model_->Erase(*maybe_key);
+        ApplyKeyRanges(EBatchOperation::Erase, std::move(*maybe_ranges));
     }
 }
 
 void Controller::OnSearchButtonClick() {
-    if (!model_) {
+    if (!model_ || IsBulkOperationRunning()) {
         return;
     }
     auto maybe_key = TryGetKeyFromEdit();
     if (!maybe_key) {
         ShowIncorrectInputMessage();
+    } else if (animation_producer_) {
+        animation_producer_->Play(model_->ContainsSteps(*maybe_key));
     } else {
         model_->Contains(*maybe_key);
     }
 }
 
+void Controller::OnLoadFileButtonClick() {
+    if (!model_ || IsBulkOperationRunning()) {
+        return;
+    }
+    auto file_name = QFileDialog::getOpenFileName(nullptr, "Load keys");
+    if (file_name.isEmpty()) {
+        return;
+    }
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        ShowIncorrectFileMessage();
+        return;
+    }
+    auto maybe_ranges = ParseKeyRanges(file.readAll().toStdString());
+    if (!maybe_ranges) {
+        ShowIncorrectFileMessage();
+    } else {
+        StartBulkOperation(EBatchOperation::Insert, std::move(*maybe_ranges));
+    }
+}
+
+void Controller::OnCancelButtonClick() {
+    if (IsBulkOperationRunning()) {
+        bulk_worker_.request_stop();
+    }
+}
+
 std::optional<Key> Controller::TryGetKeyFromEdit() const {
     if (!key_edit_) {
         return std::nullopt;
@@ -67,4 +113,67 @@ std::optional<Key> Controller::TryGetKeyFromEdit() const {
     }
 }
 
+std::optional<std::vector<KeyRange>> Controller::TryGetKeyRangesFromEdit() const {
+    if (!key_edit_) {
+        return std::nullopt;
+    }
+    auto input = key_edit_->text();
+    key_edit_->setText("");
+    return ParseKeyRanges(input.toStdString());
+}
+
+void Controller::ApplyKeyRanges(EBatchOperation operation, std::vector<KeyRange> ranges) {
+    if (CountKeys(ranges) != 1) {
+        StartBulkOperation(operation, std::move(ranges));
+    } else if (animation_producer_) {
+        auto key = ranges[0].first;
+        animation_producer_->Play(operation == EBatchOperation::Insert ? model_->InsertSteps(key)
+                                                                       : model_->EraseSteps(key));
+    } else if (operation == EBatchOperation::Insert) {
+        model_->Insert(ranges[0].first);
+    } else {
+        model_->Erase(ranges[0].first);
+    }
+}
+
+void Controller::StartBulkOperation(EBatchOperation operation, std::vector<KeyRange> ranges) {
+    assert(!IsBulkOperationRunning() && "Starting a bulk operation while another one is running");
+    bulk_key_count_ = CountKeys(ranges);
+    bulk_progress_.store(0, std::memory_order_relaxed);
+    is_bulk_finished_.store(false, std::memory_order_relaxed);
+    if (animation_producer_) {
+        // The operation being played would otherwise be finished by the worker, notifying from its thread.
+        animation_producer_->FinishAnimationImmediately();
+    }
+    if (progress_bar_) {
+        progress_bar_->setValue(0);
+        progress_bar_->show();
+    }
+    bulk_worker_ = std::jthread([this, operation, ranges = std::move(ranges)](std::stop_token stop) {
+        model_->ApplyBatch(operation, ranges, stop, &bulk_progress_);
+        is_bulk_finished_.store(true, std::memory_order_release);
+    });
+    progress_timer_.start(kProgressPollInterval);
+}
+
+void Controller::PollBulkOperation() {
+    if (!is_bulk_finished_.load(std::memory_order_acquire)) {
+        if (progress_bar_ && bulk_key_count_ > 0) {
+            progress_bar_->setValue(
+                static_cast<int>(bulk_progress_.load(std::memory_order_relaxed) * kProgressBarScale / bulk_key_count_));
+        }
+        return;
+    }
+    progress_timer_.stop();
+    bulk_worker_.join();
+    if (progress_bar_) {
+        progress_bar_->hide();
+    }
+    model_->PublishBatchSummary();
+}
+
+bool Controller::IsBulkOperationRunning() const {
+    return bulk_worker_.joinable();
+}
+
 } // namespace NVis
@@ -1,10 +1,17 @@
 #pragma once
 
+#include "animation_producer.h"
+#include "key_ranges.h"
 #include "two_three_tree.h"
 
 #include <QLineEdit>
 #include <QObject>
+#include <QProgressBar>
 #include <QPushButton>
+#include <QTimer>
+
+#include <atomic>
+#include <thread>
 
 namespace NVis {
 
@@ -13,18 +20,41 @@ using Model = TwoThreeTree;
 class Controller : public QObject {
     Q_OBJECT
 public:
-    Controller(Model* model, QLineEdit* key_edit);
+    //! Single-key operations are played step by step by `animation_producer` if it's given.
+    Controller(Model* model, AnimationProducer* animation_producer, QLineEdit* key_edit, QProgressBar* progress_bar);
 
 public slots:
     void OnInsertButtonClick();
     void OnEraseButtonClick();
     void OnSearchButtonClick();
+    void OnLoadFileButtonClick();
+    void OnCancelButtonClick();
 
 private:
     std::optional<Key> TryGetKeyFromEdit() const;
+    std::optional<std::vector<KeyRange>> TryGetKeyRangesFromEdit() const;
+
+    //! Applies a single key right away, so every step is animated. Anything bigger goes to a bulk worker.
+    void ApplyKeyRanges(EBatchOperation operation, std::vector<KeyRange> ranges);
+    void StartBulkOperation(EBatchOperation operation, std::vector<KeyRange> ranges);
+    //! Runs on GUI thread by `progress_timer_`: shows progress and publishes the result once the worker is done.
+    void PollBulkOperation();
+    bool IsBulkOperationRunning() const;
+
+    static constexpr int kProgressPollInterval = 50;
+    static constexpr int kProgressBarScale = 1000;
 
     Model* model_ = nullptr;
+    AnimationProducer* animation_producer_ = nullptr;
     QLineEdit* key_edit_ = nullptr;
+    QProgressBar* progress_bar_ = nullptr;
+    QTimer progress_timer_;
+
+    ssize_t bulk_key_count_ = 0;
+    std::atomic<ssize_t> bulk_progress_ = 0;
+    std::atomic<bool> is_bulk_finished_ = false;
+    // Declared last to be joined before anything it touches is destroyed.
+    std::jthread bulk_worker_;
 };
 
 } // namespace NVis
@@ -0,0 +1,191 @@
+#include "flat_tree_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <utility>
+#include <vector>
+
+namespace NVis {
+
+std::optional<FlatTreeFile> FlatTreeFile::Open(const std::string& path, EFlatTreeCheck check) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return std::nullopt;
+    }
+    struct stat file_stat {};
+    if (fstat(descriptor, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(FlatTreeHeader))) {
+        close(descriptor);
+        return std::nullopt;
+    }
+    auto mapped_bytes = static_cast<ssize_t>(file_stat.st_size);
+    void* mapping = mmap(nullptr, mapped_bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    // Mapping stays valid after the descriptor is closed.
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        return std::nullopt;
+    }
+    FlatTreeFile file(mapping, mapped_bytes, file_stat.st_dev, file_stat.st_ino);
+    const auto& header = *file.header_;
+    auto expected_bytes = sizeof(FlatTreeHeader) + header.node_count * sizeof(FlatNode);
+    if (header.magic != FlatTreeHeader::kMagic || header.version != FlatTreeHeader::kVersion ||
+        header.key_size != sizeof(Key) || header.node_count > UINT32_MAX ||
+        expected_bytes != static_cast<uint64_t>(mapped_bytes) || (check == EFlatTreeCheck::Full && !file.Verify())) {
+        return std::nullopt;
+    }
+    return file;
+}
+
+FlatTreeFile::FlatTreeFile(void* mapping, ssize_t mapped_bytes, dev_t device, ino_t inode)
+    : mapping_(mapping),
+      mapped_bytes_(mapped_bytes),
+      header_(static_cast<const FlatTreeHeader*>(mapping)),
+      nodes_(reinterpret_cast<const FlatNode*>(static_cast<const char*>(mapping) + sizeof(FlatTreeHeader))),
+      device_(device),
+      inode_(inode) {}
+
+FlatTreeFile::FlatTreeFile(FlatTreeFile&& other) noexcept
+    : mapping_(std::exchange(other.mapping_, nullptr)),
+      mapped_bytes_(std::exchange(other.mapped_bytes_, 0)),
+      header_(std::exchange(other.header_, nullptr)),
+      nodes_(std::exchange(other.nodes_, nullptr)),
+      device_(other.device_),
+      inode_(other.inode_),
+      is_valid_(other.is_valid_) {}
+
+FlatTreeFile& FlatTreeFile::operator=(FlatTreeFile&& other) noexcept {
+    if (this != &other) {
+        if (mapping_) {
+            munmap(mapping_, mapped_bytes_);
+        }
+        mapping_ = std::exchange(other.mapping_, nullptr);
+        mapped_bytes_ = std::exchange(other.mapped_bytes_, 0);
+        header_ = std::exchange(other.header_, nullptr);
+        nodes_ = std::exchange(other.nodes_, nullptr);
+        device_ = other.device_;
+        inode_ = other.inode_;
+        is_valid_ = other.is_valid_;
+    }
+    return *this;
+}
+
+FlatTreeFile::~FlatTreeFile() {
+    if (mapping_) {
+        munmap(mapping_, mapped_bytes_);
+    }
+}
+
+bool FlatTreeFile::Contains(const Key& x) const {
+    if (GetNodeCount() == 0) {
+        return false;
+    }
+    auto index = GetRootIndex();
+    if (!IsValidNode(index)) {
+        return false;
+    }
+    const auto* vertex = &GetNode(index);
+    while (vertex->child_count != 0) {
+        auto next_index = vertex->child_count - 1;
+        for (uint32_t child_index = 0; child_index < vertex->key_count; ++child_index) {
+            if (x <= vertex->keys[child_index]) {
+                next_index = child_index;
+                break;
+            }
+        }
+        index = vertex->children[next_index];
+        if (!IsValidNode(index)) {
+            return false;
+        }
+        vertex = &GetNode(index);
+    }
+    for (uint32_t key_index = 0; key_index < vertex->key_count; ++key_index) {
+        if (vertex->keys[key_index] == x) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FlatTreeFile::IsMappedFrom(const std::string& path) const {
+    struct stat file_stat {};
+    return stat(path.c_str(), &file_stat) == 0 && file_stat.st_dev == device_ && file_stat.st_ino == inode_;
+}
+
+bool FlatTreeFile::IsValidNode(ssize_t index) const {
+    const auto& node = GetNode(index);
+    if (node.key_count == 0 || node.key_count > FlatNode::kMaxKeys ||
+        (node.child_count != 0 && node.child_count != node.key_count)) {
+        return false;
+    }
+    for (uint32_t key_index = 1; key_index < node.key_count; ++key_index) {
+        if (!(node.keys[key_index - 1] < node.keys[key_index])) {
+            return false;
+        }
+    }
+    for (uint32_t child = 0; child < node.child_count; ++child) {
+        if (node.children[child] >= index) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FlatTreeFile::Verify() const {
+    if (is_valid_) {
+        return *is_valid_;
+    }
+    is_valid_ = false;
+    std::vector<bool> has_parent(GetNodeCount());
+    for (ssize_t index = 0; index < GetNodeCount(); ++index) {
+        if (!IsValidNode(index)) {
+            return false;
+        }
+        const auto& node = GetNode(index);
+        for (uint32_t child = 0; child < node.child_count; ++child) {
+            auto child_index = node.children[child];
+            if (has_parent[child_index]) {
+                return false;
+            }
+            has_parent[child_index] = true;
+        }
+    }
+    // A node without a parent other than the root wouldn't be reachable, yet readers of all nodes would see it.
+    for (ssize_t index = 0; index + 1 < GetNodeCount(); ++index) {
+        if (!has_parent[index]) {
+            return false;
+        }
+    }
+    is_valid_ = true;
+    return true;
+}
+
+FlatTreeWriter::FlatTreeWriter(const std::string& path) : output_(path, std::ios::binary | std::ios::trunc) {
+    // Placeholder, the real header is written once the count of nodes is known.
+    FlatTreeHeader header{};
+    output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+uint32_t FlatTreeWriter::Append(const FlatNode& node) {
+    assert(node_count_ < UINT32_MAX && "Too many nodes for flat tree file");
+    output_.write(reinterpret_cast<const char*>(&node), sizeof(node));
+    return static_cast<uint32_t>(node_count_++);
+}
+
+bool FlatTreeWriter::Finish(ssize_t key_count) {
+    FlatTreeHeader header{
+        .magic = FlatTreeHeader::kMagic,
+        .version = FlatTreeHeader::kVersion,
+        .key_size = sizeof(Key),
+        .node_count = node_count_,
+        .key_count = static_cast<uint64_t>(key_count),
+    };
+    output_.seekp(0);
+    output_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output_.close();
+    return !output_.fail();
+}
+
+} // namespace NVis
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "tree_action.h"
+
+#include <sys/types.h>
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <type_traits>
+
+namespace NVis {
+
+//! One node of a 2-3 tree in the flat file. Nodes refer to children by their indices in the file instead of pointers,
+//! so the file can be used right where it's mapped.
+struct FlatNode {
+    static constexpr int kMaxKeys = 3;
+
+    uint32_t key_count;
+    //! Either zero for a leaf or equal to `key_count`.
+    uint32_t child_count;
+    std::array<Key, kMaxKeys> keys;
+    std::array<uint32_t, kMaxKeys> children;
+};
+
+//! The file starts with this header, followed by `node_count` nodes in post-order: children always go before their
+//! parents and the root is the last one. Numbers are stored in the native byte order.
+struct FlatTreeHeader {
+    static constexpr std::array<char, 8> kMagic = {'N', 'V', 'I', 'S', '2', '3', 'T', '\0'};
+    static constexpr uint32_t kVersion = 1;
+
+    std::array<char, 8> magic;
+    uint32_t version;
+    //! Guards against files written by a build with a different `Key`.
+    uint32_t key_size;
+    uint64_t node_count;
+    uint64_t key_count;
+};
+
+static_assert(std::is_trivially_copyable_v<FlatNode> && std::is_trivially_copyable_v<FlatTreeHeader>);
+static_assert(sizeof(FlatTreeHeader) % alignof(FlatNode) == 0, "Nodes must stay aligned after the header");
+
+//! How much opening a flat tree file checks its nodes.
+enum class EFlatTreeCheck : uint8_t {
+    //! Only the header. Readers check every node they read instead, so a descent touches only the pages on its way,
+    //! and readers of the whole file verify it first.
+    Lazy,
+    //! Every node, so a malformed file is rejected right away. Touches every page of the file.
+    Full,
+};
+
+//! Read-only view of a flat tree file mapped into memory.
+class FlatTreeFile {
+public:
+    //! Returns `std::nullopt` if the file can't be mapped, isn't a flat tree of this build, or, if `check` is
+    //! `EFlatTreeCheck::Full`, its nodes don't form a tree.
+    static std::optional<FlatTreeFile> Open(const std::string& path, EFlatTreeCheck check = EFlatTreeCheck::Lazy);
+
+    FlatTreeFile(const FlatTreeFile&) = delete;
+    FlatTreeFile& operator=(const FlatTreeFile&) = delete;
+    FlatTreeFile(FlatTreeFile&& other) noexcept;
+    FlatTreeFile& operator=(FlatTreeFile&& other) noexcept;
+    ~FlatTreeFile();
+
+    ssize_t GetNodeCount() const {
+        return static_cast<ssize_t>(header_->node_count);
+    }
+    ssize_t GetKeyCount() const {
+        return static_cast<ssize_t>(header_->key_count);
+    }
+    const FlatNode& GetNode(ssize_t index) const {
+        return nodes_[index];
+    }
+    //! Index of the root. The file must not be empty.
+    ssize_t GetRootIndex() const {
+        return GetNodeCount() - 1;
+    }
+    ssize_t GetMappedBytes() const {
+        return mapped_bytes_;
+    }
+
+    //! Tells whether `address` points to a node of the file, the way observers know them.
+    bool HoldsNode(const void* address) const {
+        auto begin = reinterpret_cast<uintptr_t>(nodes_);
+        auto offset = reinterpret_cast<uintptr_t>(address) - begin;
+        return reinterpret_cast<uintptr_t>(address) >= begin && offset < GetNodeCount() * sizeof(FlatNode);
+    }
+
+    //! Checks what reading the node at `index` alone relies on: its keys are sorted and within `kMaxKeys`, there are as
+    //! many children as keys, if any, and they go before the node. Takes O(1).
+    bool IsValidNode(ssize_t index) const;
+    //! Checks that every node is valid and every one but the root has exactly one parent, so nodes form a tree.
+    //! Balance and separators aren't checked, `BPlusTree::Audit` reports those. Touches every page the first time,
+    //! the result is kept.
+    bool Verify() const;
+
+    //! Descends from the root like a tree does, touching only the pages on the way. A malformed node on the way reads
+    //! as a miss.
+    bool Contains(const Key& x) const;
+    //! Tells whether `path` names the mapped file. It must not be written while mapped: truncating it makes reads of
+    //! the mapping fault.
+    bool IsMappedFrom(const std::string& path) const;
+
+private:
+    FlatTreeFile(void* mapping, ssize_t mapped_bytes, dev_t device, ino_t inode);
+
+    void* mapping_;
+    ssize_t mapped_bytes_;
+    const FlatTreeHeader* header_;
+    const FlatNode* nodes_;
+    dev_t device_;
+    ino_t inode_;
+    //! Result of `Verify()`, once it has run.
+    mutable std::optional<bool> is_valid_;
+};
+
+//! Writes nodes one by one, so the tree doesn't have to be copied into a flat form in memory first.
+class FlatTreeWriter {
+public:
+    explicit FlatTreeWriter(const std::string& path);
+
+    //! Appends `node` and returns its index for its parent to refer to. Children must be appended before parents.
+    uint32_t Append(const FlatNode& node);
+    //! Writes the header. Returns `false` if anything failed to be written.
+    bool Finish(ssize_t key_count);
+
+private:
+    std::ofstream output_;
+    uint64_t node_count_ = 0;
+};
+
+} // namespace NVis
@@ -0,0 +1,111 @@
+#include "frozen_tree.h"
+
+#include "cache_aligned_allocator.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+
+namespace NVis {
+
+namespace {
+//! Descendants four levels below a key fill one cache line.
+constexpr ssize_t kPrefetchStride = kCacheLineBytes / sizeof(Key);
+
+//! A hint only: prefetching an address out of the array doesn't fault, so it's computed as an integer.
+void Prefetch(uintptr_t address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(reinterpret_cast<const void*>(address));
+#endif
+}
+} // namespace
+
+FrozenTree::FrozenTree(const std::vector<Key>& keys) {
+    assert(std::adjacent_find(keys.begin(), keys.end(), std::greater_equal<Key>()) == keys.end() &&
+           "Keys to freeze aren't sorted or repeat");
+    if (keys.empty()) {
+        return;
+    }
+    layout_.resize(keys.size() + 1);
+    ssize_t next_key = 0;
+    Fill(keys, next_key, 1);
+}
+
+ssize_t FrozenTree::Size() const {
+    return layout_.empty() ? 0 : std::ssize(layout_) - 1;
+}
+
+bool FrozenTree::Contains(const Key& x) const {
+    auto index = LowerBoundIndex(x);
+    return index != 0 && layout_[index] == x;
+}
+
+FrozenTree::Iterator FrozenTree::LowerBound(const Key& x) const {
+    return Iterator(this, LowerBoundIndex(x));
+}
+
+FrozenTree::Iterator FrozenTree::begin() const {
+    if (layout_.empty()) {
+        return end();
+    }
+    // The leftmost key of the tree.
+    ssize_t index = 1;
+    while (2 * index <= Size()) {
+        index *= 2;
+    }
+    return Iterator(this, index);
+}
+
+FrozenTree::Iterator FrozenTree::end() const {
+    return Iterator(this, 0);
+}
+
+std::vector<Key> FrozenTree::GetKeys() const {
+    return std::vector<Key>(begin(), end());
+}
+
+VectorMemory FrozenTree::MeasureMemory() const {
+    return MeasureVector(layout_);
+}
+
+ssize_t FrozenTree::LowerBoundIndex(const Key& x) const {
+    auto size = Size();
+    const auto* keys = layout_.data();
+    auto keys_address = reinterpret_cast<uintptr_t>(keys);
+    ssize_t index = 1;
+    while (index <= size) {
+        Prefetch(keys_address + index * kPrefetchStride * sizeof(Key));
+        index = 2 * index + (keys[index] < x);
+    }
+    // The descent went right after every key less than `x` and left after the answer. Dropping the trailing right
+    // turns and the last left one leads back to the answer, or to 0 if every turn was to the right.
+    return index >> (std::countr_one(static_cast<size_t>(index)) + 1);
+}
+
+ssize_t FrozenTree::Next(ssize_t index) const {
+    assert(index != 0 && "Incrementing the end of a frozen tree");
+    if (2 * index + 1 <= Size()) {
+        // The leftmost key of the right subtree.
+        index = 2 * index + 1;
+        while (2 * index <= Size()) {
+            index *= 2;
+        }
+        return index;
+    }
+    // The nearest ancestor whose left subtree this key is in.
+    index >>= std::countr_one(static_cast<size_t>(index));
+    return index >> 1;
+}
+
+void FrozenTree::Fill(const std::vector<Key>& keys, ssize_t& next_key, ssize_t index) {
+    if (index > Size()) {
+        return;
+    }
+    Fill(keys, next_key, 2 * index);
+    layout_[index] = keys[next_key++];
+    Fill(keys, next_key, 2 * index + 1);
+}
+
+} // namespace NVis
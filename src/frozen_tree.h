@@ -0,0 +1,95 @@
+#pragma once
+
+#include "cache_aligned_allocator.h"
+#include "memory_stats.h"
+#include "tree_action.h"
+
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+namespace NVis {
+
+//! Immutable set of keys in the Eytzinger layout: one array holds the keys as a complete binary search tree in BFS
+//! order, the children of the `k`-th key being the `2k`-th and the `(2k + 1)`-th ones. A search reads no pointers, and
+//! the top levels, which every search passes, share a few cache lines.
+//!
+//! Descents are branchless: a comparison picks the child arithmetically, so there are no mispredictions to pay for.
+//! While a level is compared, the line holding all 16 descendants four levels below is prefetched, hiding the latency
+//! of memory behind the comparisons.
+class FrozenTree {
+public:
+    //! Walks keys in increasing order. In-order successor of a key in the layout is found in O(1) amortized.
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Key;
+        using difference_type = ptrdiff_t;
+        using pointer = const Key*;
+        using reference = const Key&;
+
+        Iterator() = default;
+        Iterator(const FrozenTree* tree, ssize_t index) : tree_(tree), index_(index) {}
+
+        const Key& operator*() const {
+            return tree_->layout_[index_];
+        }
+        Iterator& operator++() {
+            index_ = tree_->Next(index_);
+            return *this;
+        }
+        Iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+            return lhs.index_ == rhs.index_;
+        }
+
+    private:
+        const FrozenTree* tree_ = nullptr;
+        //! Position in the layout, 0 for the end.
+        ssize_t index_ = 0;
+    };
+
+    FrozenTree() = default;
+    //! `keys` must be sorted without repeats.
+    explicit FrozenTree(const std::vector<Key>& keys);
+
+    ssize_t Size() const;
+    bool Contains(const Key& x) const;
+    //! Returns the first key not less than `x`. Keys of a range are scanned from there on with `++`.
+    Iterator LowerBound(const Key& x) const;
+    Iterator begin() const;
+    Iterator end() const;
+    //! Returns all the keys in increasing order. Takes O(n).
+    std::vector<Key> GetKeys() const;
+
+    VectorMemory MeasureMemory() const;
+
+private:
+    //! Position of the first key not less than `x` in the layout, or 0 if there's none.
+    ssize_t LowerBoundIndex(const Key& x) const;
+    //! Position of the next key in increasing order, or 0 after the last one.
+    ssize_t Next(ssize_t index) const;
+    //! Fills the subtree of the `index`-th key in order from `keys`, starting at `next_key`.
+    void Fill(const std::vector<Key>& keys, ssize_t& next_key, ssize_t index);
+
+    //! Keys start from the first element, the zeroth one is a placeholder to make the indices of children simple.
+    std::vector<Key, CacheAlignedAllocator<Key>> layout_;
+};
+
+//! Makes a read-only copy of the keys of a set `tree`, e.g. of a `TwoThreeTree`. The tree stays as it was.
+template <typename TTree>
+FrozenTree Freeze(const TTree& tree) {
+    return FrozenTree(tree.GetKeys());
+}
+
+//! Fills an empty set `tree` with the keys of `frozen` to change them again. Takes O(n).
+template <typename TTree>
+void Thaw(const FrozenTree& frozen, TTree& tree) {
+    tree.Build(frozen.GetKeys());
+}
+
+} // namespace NVis
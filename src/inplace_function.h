@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace NVis {
+
+template <typename TSignature, size_t Capacity>
+class InplaceFunction;
+
+//! Type-erased callable like `std::function`, but it keeps the callable inside its own buffer of `Capacity` bytes and
+//! never allocates. Calling it costs exactly one indirect call. Callables that don't fit are rejected at compile time,
+//! so capture a pointer to a bigger state instead of the state itself.
+template <typename TResult, typename... TArgs, size_t Capacity>
+class InplaceFunction<TResult(TArgs...), Capacity> {
+public:
+    template <typename TCallable>
+        requires(!std::is_same_v<std::decay_t<TCallable>, InplaceFunction> &&
+                 std::is_invocable_r_v<TResult, std::decay_t<TCallable>&, TArgs...>)
+    InplaceFunction(TCallable&& callable) {
+        using TStored = std::decay_t<TCallable>;
+        static_assert(sizeof(TStored) <= Capacity, "Callable doesn't fit in InplaceFunction, capture less");
+        static_assert(alignof(TStored) <= alignof(std::max_align_t), "Callable is overaligned for InplaceFunction");
+        ::new (static_cast<void*>(storage_)) TStored(std::forward<TCallable>(callable));
+        invoke_ = [](std::byte* storage, TArgs... args) -> TResult {
+            return (*std::launder(reinterpret_cast<TStored*>(storage)))(std::forward<TArgs>(args)...);
+        };
+        destroy_ = [](std::byte* storage) { std::launder(reinterpret_cast<TStored*>(storage))->~TStored(); };
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+    InplaceFunction(InplaceFunction&&) = delete;
+    InplaceFunction& operator=(InplaceFunction&&) = delete;
+
+    ~InplaceFunction() {
+        destroy_(storage_);
+    }
+
+    TResult operator()(TArgs... args) const {
+        return invoke_(storage_, std::forward<TArgs>(args)...);
+    }
+
+private:
+    // Callable may be stateful, and calling it doesn't change the `InplaceFunction` itself.
+    alignas(std::max_align_t) mutable std::byte storage_[Capacity];
+    TResult (*invoke_)(std::byte*, TArgs...);
+    void (*destroy_)(std::byte*);
+};
+
+} // namespace NVis
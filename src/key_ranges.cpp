@@ -0,0 +1,69 @@
+#include "key_ranges.h"
+
+#include <charconv>
+
+namespace NVis {
+
+namespace {
+bool IsSeparator(char c) {
+    return c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+std::optional<Key> TryParseKey(std::string_view token) {
+    Key key;
+    auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), key);
+    if (error != std::errc() || end != token.data() + token.size()) {
+        return std::nullopt;
+    }
+    return key;
+}
+} // namespace
+
+std::optional<std::vector<KeyRange>> ParseKeyRanges(std::string_view input) {
+    static constexpr std::string_view kRangeDelimiter = "..";
+
+    std::vector<KeyRange> ranges;
+    size_t position = 0;
+    while (position < input.size()) {
+        if (IsSeparator(input[position])) {
+            ++position;
+            continue;
+        }
+        auto token_end = position;
+        while (token_end < input.size() && !IsSeparator(input[token_end])) {
+            ++token_end;
+        }
+        auto token = input.substr(position, token_end - position);
+        position = token_end;
+
+        auto delimiter_position = token.find(kRangeDelimiter);
+        if (delimiter_position == std::string_view::npos) {
+            auto key = TryParseKey(token);
+            if (!key) {
+                return std::nullopt;
+            }
+            ranges.emplace_back(KeyRange{.first = *key, .last = *key});
+            continue;
+        }
+        auto first = TryParseKey(token.substr(0, delimiter_position));
+        auto last = TryParseKey(token.substr(delimiter_position + kRangeDelimiter.size()));
+        if (!first || !last || *first > *last) {
+            return std::nullopt;
+        }
+        ranges.emplace_back(KeyRange{.first = *first, .last = *last});
+    }
+    if (ranges.empty()) {
+        return std::nullopt;
+    }
+    return ranges;
+}
+
+ssize_t CountKeys(const std::vector<KeyRange>& ranges) {
+    ssize_t count = 0;
+    for (const auto& range : ranges) {
+        count += static_cast<ssize_t>(range.last) - static_cast<ssize_t>(range.first) + 1;
+    }
+    return count;
+}
+
+} // namespace NVis
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "tree_action.h"
+
+#include <optional>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+namespace NVis {
+
+//! Closed range of keys `[first, last]`. A single key `x` is represented as `[x, x]`.
+struct KeyRange {
+    Key first;
+    Key last;
+};
+
+//! Parses a list of keys and key ranges. Items are separated by commas and/or whitespace, a range is written as
+//! `a..b` with `a <= b`. Returns `std::nullopt` if input is empty or contains anything but valid items, e.g.
+//! `"1..1000, 5, -3"` gives `{[1, 1000], [5, 5], [-3, -3]}`.
+std::optional<std::vector<KeyRange>> ParseKeyRanges(std::string_view input);
+
+//! Returns the total number of keys in `ranges`, counting repeats.
+ssize_t CountKeys(const std::vector<KeyRange>& ranges);
+
+} // namespace NVis
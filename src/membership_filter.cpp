@@ -0,0 +1,106 @@
+#include "membership_filter.h"
+
+#include <algorithm>
+#include <array>
+
+namespace NVis {
+
+namespace {
+constexpr ssize_t kBlockBits = 512;
+
+//! Odd multipliers picking a bit of every word from the same 32 bits of a hash, as in split block Bloom filters of
+//! Parquet.
+constexpr std::array<uint32_t, 8> kSalts = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+//! Finalizer of MurmurHash3: consecutive keys get unrelated hashes.
+uint64_t Hash(const Key& x) {
+    auto hash = static_cast<uint64_t>(static_cast<uint32_t>(x));
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint64_t BitInWord(uint64_t hash, ssize_t word) {
+    return uint64_t{1} << ((static_cast<uint32_t>(hash) * kSalts[word]) >> 26);
+}
+} // namespace
+
+double MembershipFilterStats::FalsePositiveRate() const {
+    auto miss_count = rejected_count + false_positive_count;
+    return miss_count == 0 ? 0.0 : static_cast<double>(false_positive_count) / static_cast<double>(miss_count);
+}
+
+MembershipFilter::MembershipFilter(ssize_t capacity) : capacity_(std::max(capacity, kMinCapacity)) {
+    auto block_count = (capacity_ * kBitsPerKey + kBlockBits - 1) / kBlockBits;
+    words_.resize(block_count * kWordsPerBlock);
+}
+
+void MembershipFilter::Add(const Key& x) {
+    auto hash = Hash(x);
+    auto* block = words_.data() + BlockOffset(hash);
+    for (ssize_t word = 0; word < kWordsPerBlock; ++word) {
+        block[word] |= BitInWord(hash, word);
+    }
+    ++stats_.key_count;
+}
+
+bool MembershipFilter::MayContain(const Key& x) {
+    ++stats_.query_count;
+    auto hash = Hash(x);
+    const auto* block = words_.data() + BlockOffset(hash);
+    uint64_t missing = 0;
+    for (ssize_t word = 0; word < kWordsPerBlock; ++word) {
+        missing |= BitInWord(hash, word) & ~block[word];
+    }
+    if (missing != 0) {
+        ++stats_.rejected_count;
+        return false;
+    }
+    return true;
+}
+
+void MembershipFilter::CountFalsePositive() {
+    ++stats_.false_positive_count;
+}
+
+void MembershipFilter::CountErased(ssize_t count) {
+    stats_.stale_count += count;
+}
+
+bool MembershipFilter::NeedsRebuild() const {
+    return stats_.key_count > capacity_ || stats_.stale_count * 2 > stats_.key_count;
+}
+
+void MembershipFilter::Rebuild(const std::vector<Key>& keys) {
+    auto stats = stats_;
+    *this = MembershipFilter(2 * std::ssize(keys));
+    stats_ = stats;
+    stats_.key_count = 0;
+    stats_.stale_count = 0;
+    ++stats_.rebuild_count;
+    for (const auto& key : keys) {
+        Add(key);
+    }
+}
+
+MembershipFilterStats MembershipFilter::GetStats() const {
+    auto stats = stats_;
+    stats.memory = MeasureMemory();
+    return stats;
+}
+
+VectorMemory MembershipFilter::MeasureMemory() const {
+    return MeasureVector(words_);
+}
+
+ssize_t MembershipFilter::BlockOffset(uint64_t hash) const {
+    // Maps the upper half of the hash to a block by multiplying instead of taking a remainder.
+    auto block_count = static_cast<uint64_t>(std::ssize(words_) / kWordsPerBlock);
+    return static_cast<ssize_t>(((hash >> 32) * block_count) >> 32) * kWordsPerBlock;
+}
+
+} // namespace NVis
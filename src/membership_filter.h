@@ -0,0 +1,71 @@
+#pragma once
+
+#include "cache_aligned_allocator.h"
+#include "memory_stats.h"
+#include "tree_action.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace NVis {
+
+struct MembershipFilterStats {
+    //! Queries asked since the filter was enabled.
+    ssize_t query_count = 0;
+    //! Queries answered "definitely not there" without touching the tree.
+    ssize_t rejected_count = 0;
+    //! Queries the filter let through, but the key wasn't there.
+    ssize_t false_positive_count = 0;
+    //! Keys added since the last rebuild, including the ones erased since then.
+    ssize_t key_count = 0;
+    //! Keys erased since the last rebuild. The filter can't forget them, so they pass it until the next rebuild.
+    ssize_t stale_count = 0;
+    ssize_t rebuild_count = 0;
+    VectorMemory memory;
+
+    //! Share of misses the filter has failed to reject.
+    double FalsePositiveRate() const;
+};
+
+//! Blocked Bloom filter of keys: tells for sure that a key isn't in a set, or that it may be there. The bits of a key
+//! are all in one block of a cache line, a bit in every word of it, so a query reads one line whatever the size of
+//! the filter, at the cost of a bit higher false positive rate than a classic Bloom filter of the same size.
+//!
+//! Keys can be added but not removed. The owner counts erased keys with `CountErased` and rebuilds the filter from
+//! the actual keys once `NeedsRebuild` says so: either too many keys have been erased, or too many have been added
+//! for the size of the filter.
+class MembershipFilter {
+public:
+    //! Sized for `capacity` keys, or some minimum.
+    explicit MembershipFilter(ssize_t capacity = 0);
+
+    void Add(const Key& x);
+    //! Returns `false` only if `x` hasn't been added since the last rebuild. Counts the query in stats.
+    bool MayContain(const Key& x);
+    //! Tells that a query let through by `MayContain` has turned out to be a miss.
+    void CountFalsePositive();
+    void CountErased(ssize_t count = 1);
+
+    bool NeedsRebuild() const;
+    //! Replaces the contents with `keys`, sized with room for as many keys more. Stats of queries are kept.
+    void Rebuild(const std::vector<Key>& keys);
+
+    MembershipFilterStats GetStats() const;
+    VectorMemory MeasureMemory() const;
+
+private:
+    //! A block of 8 words of 64 bits takes a cache line, and a key sets one bit in every word of its block.
+    static constexpr ssize_t kWordsPerBlock = 8;
+    //! Gives about 3% of false positives at full capacity and about 0.1% right after a rebuild.
+    static constexpr ssize_t kBitsPerKey = 8;
+    static constexpr ssize_t kMinCapacity = 1024;
+
+    //! Index of the first word of the block of a key with `hash`.
+    ssize_t BlockOffset(uint64_t hash) const;
+
+    std::vector<uint64_t, CacheAlignedAllocator<uint64_t>> words_;
+    ssize_t capacity_ = 0;
+    MembershipFilterStats stats_;
+};
+
+} // namespace NVis
@@ -0,0 +1,106 @@
+#include "memory_stats.h"
+
+#include <cstddef>
+
+namespace NVis {
+
+VectorMemory& VectorMemory::operator+=(const VectorMemory& other) {
+    used_bytes += other.used_bytes;
+    slack_bytes += other.slack_bytes;
+    allocation_count += other.allocation_count;
+    return *this;
+}
+
+HashTableMemory MeasureHashTable(ssize_t size, ssize_t bucket_count, ssize_t element_bytes) {
+    // Next pointer and cached hash, rounded up like the element itself.
+    static constexpr ssize_t kNodeHeaderBytes = sizeof(void*) + sizeof(size_t);
+    static constexpr ssize_t kAlignment = alignof(std::max_align_t);
+
+    auto node_bytes = (kNodeHeaderBytes + element_bytes + kAlignment - 1) / kAlignment * kAlignment;
+    auto bucket_bytes = bucket_count > 1 ? bucket_count * static_cast<ssize_t>(sizeof(void*)) : 0;
+    return HashTableMemory{
+        .size = size,
+        .bucket_count = bucket_count,
+        .bytes = bucket_bytes + size * node_bytes,
+        .allocation_count = size + (bucket_bytes > 0 ? 1 : 0),
+    };
+}
+
+ssize_t TreeMemoryStats::AllocationCount() const {
+    // Every node outside slabs is a block of its own, and so is every slab.
+    return node_count - slab_node_count + slab_count + keys.allocation_count + children.allocation_count +
+           values.allocation_count + membership_filter.allocation_count + buffers.allocation_count;
+}
+
+ssize_t TreeMemoryStats::DeadSlabBytes() const {
+    return slab_bytes - slab_live_bytes;
+}
+
+ssize_t TreeMemoryStats::AllocatorOverheadBytes() const {
+    return AllocationCount() * kAllocationOverheadBytes;
+}
+
+ssize_t TreeMemoryStats::TotalBytes() const {
+    return node_bytes + keys.used_bytes + keys.slack_bytes + children.used_bytes + children.slack_bytes +
+           values.used_bytes + values.slack_bytes + membership_filter.used_bytes + membership_filter.slack_bytes +
+           buffers.used_bytes + buffers.slack_bytes + mapped_bytes + DeadSlabBytes() + AllocatorOverheadBytes();
+}
+
+double TreeMemoryStats::BytesPerKey() const {
+    return key_count == 0 ? 0.0 : static_cast<double>(TotalBytes()) / static_cast<double>(key_count);
+}
+
+ssize_t DrawingModelMemoryStats::AllocationCount() const {
+    return keys.allocation_count + children.allocation_count + address_to_node.allocation_count +
+           visited_nodes.allocation_count + render_data.allocation_count;
+}
+
+ssize_t DrawingModelMemoryStats::AllocatorOverheadBytes() const {
+    return AllocationCount() * kAllocationOverheadBytes;
+}
+
+ssize_t DrawingModelMemoryStats::TotalBytes() const {
+    // `node_bytes` live inside the nodes of `address_to_node`, so they are already counted there.
+    return keys.used_bytes + keys.slack_bytes + children.used_bytes + children.slack_bytes + address_to_node.bytes +
+           visited_nodes.bytes + render_data.used_bytes + render_data.slack_bytes + AllocatorOverheadBytes();
+}
+
+std::ostream& operator<<(std::ostream& output, const TreeMemoryStats& stats) {
+    output << "tree nodes: " << stats.node_count << " (leaves: " << stats.leaf_count
+           << ", in slabs: " << stats.slab_node_count << ")\n"
+           << "keys: " << stats.key_count << '\n'
+           << "node objects: " << stats.node_bytes << " B\n"
+           << "key vectors: " << stats.keys.used_bytes << " B used, " << stats.keys.slack_bytes << " B slack\n"
+           << "child vectors: " << stats.children.used_bytes << " B used, " << stats.children.slack_bytes
+           << " B slack\n"
+           << "slabs: " << stats.slab_count << ", " << stats.slab_bytes << " B, " << stats.slab_live_bytes
+           << " B live, " << stats.DeadSlabBytes() << " B dead\n"
+           << "value vectors: " << stats.values.used_bytes << " B used, " << stats.values.slack_bytes << " B slack\n"
+           << "membership filter: " << stats.membership_filter.used_bytes << " B\n"
+           << "buffers: " << stats.buffers.used_bytes + stats.buffers.slack_bytes << " B\n"
+           << "mapped file: " << stats.mapped_bytes << " B\n"
+           << "allocator overhead: " << stats.AllocatorOverheadBytes() << " B in " << stats.AllocationCount()
+           << " blocks\n"
+           << "total: " << stats.TotalBytes() << " B, " << stats.BytesPerKey() << " B per key\n";
+    return output;
+}
+
+std::ostream& operator<<(std::ostream& output, const DrawingModelMemoryStats& stats) {
+    output << "drawn nodes: " << stats.node_count << '\n'
+           << "node objects: " << stats.node_bytes << " B\n"
+           << "key vectors: " << stats.keys.used_bytes << " B used, " << stats.keys.slack_bytes << " B slack\n"
+           << "child vectors: " << stats.children.used_bytes << " B used, " << stats.children.slack_bytes
+           << " B slack\n"
+           << "address_to_node_: " << stats.address_to_node.size << " elements, " << stats.address_to_node.bucket_count
+           << " buckets, " << stats.address_to_node.bytes << " B\n"
+           << "visited_nodes_: " << stats.visited_nodes.size << " elements, " << stats.visited_nodes.bucket_count
+           << " buckets, " << stats.visited_nodes.bytes << " B\n"
+           << "render data: " << stats.render_data.used_bytes << " B used, " << stats.render_data.slack_bytes
+           << " B slack\n"
+           << "allocator overhead: " << stats.AllocatorOverheadBytes() << " B in " << stats.AllocationCount()
+           << " blocks\n"
+           << "total: " << stats.TotalBytes() << " B\n";
+    return output;
+}
+
+} // namespace NVis
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace NVis {
+
+//! Bytes the allocator spends on every heap block besides the requested size: the chunk header and the rounding up to
+//! the alignment. It's an estimate for glibc's malloc on 64-bit platforms; other allocators differ a bit.
+inline constexpr ssize_t kAllocationOverheadBytes = 16;
+
+//! Heap usage of a vector: bytes in use, bytes reserved but unused, and allocator blocks.
+struct VectorMemory {
+    ssize_t used_bytes = 0;
+    ssize_t slack_bytes = 0;
+    ssize_t allocation_count = 0;
+
+    VectorMemory& operator+=(const VectorMemory& other);
+};
+
+template <typename T, typename TAllocator>
+VectorMemory MeasureVector(const std::vector<T, TAllocator>& vector) {
+    return VectorMemory{
+        .used_bytes = std::ssize(vector) * static_cast<ssize_t>(sizeof(T)),
+        .slack_bytes = static_cast<ssize_t>((vector.capacity() - vector.size()) * sizeof(T)),
+        .allocation_count = vector.capacity() > 0 ? 1 : 0,
+    };
+}
+
+//! Heap usage of a node-based hash table: the bucket array plus one block per element. `element_bytes` is the size of
+//! a stored value, the node also keeps a pointer to the next one and a cached hash. A table with a single bucket is
+//! assumed to use the static one and not to allocate it.
+struct HashTableMemory {
+    ssize_t size = 0;
+    ssize_t bucket_count = 0;
+    ssize_t bytes = 0;
+    ssize_t allocation_count = 0;
+};
+
+HashTableMemory MeasureHashTable(ssize_t size, ssize_t bucket_count, ssize_t element_bytes);
+
+template <typename TKey, typename TValue>
+HashTableMemory MeasureHashTable(const std::unordered_map<TKey, TValue>& map) {
+    return MeasureHashTable(std::ssize(map), static_cast<ssize_t>(map.bucket_count()),
+                            sizeof(typename std::unordered_map<TKey, TValue>::value_type));
+}
+
+template <typename TKey>
+HashTableMemory MeasureHashTable(const std::unordered_set<TKey>& set) {
+    return MeasureHashTable(std::ssize(set), static_cast<ssize_t>(set.bucket_count()), sizeof(TKey));
+}
+
+struct TreeMemoryStats {
+    ssize_t node_count = 0;
+    ssize_t leaf_count = 0;
+    //! Count of keys stored in the tree. Copies of keys in internal nodes aren't counted.
+    ssize_t key_count = 0;
+    //! Bytes of `Node` objects themselves, without the vectors' buffers.
+    ssize_t node_bytes = 0;
+    //! Nodes relocated into slabs by compaction, which aren't heap blocks of their own.
+    ssize_t slab_node_count = 0;
+    //! Slabs holding nodes or buffers of the tree and their whole size. A slab is freed only with its last object, so
+    //! after churn a few survivors may pin a whole slab: the bytes of it other than `slab_live_bytes` are dead, but
+    //! still taken. Slabs may be shared with trees split off this one.
+    ssize_t slab_count = 0;
+    ssize_t slab_bytes = 0;
+    //! Bytes of nodes and buffers of the tree lying in slabs, which are counted in `node_bytes` and the vectors.
+    ssize_t slab_live_bytes = 0;
+    //! Buffers of nodes, each a heap block unless it's in a slab.
+    VectorMemory keys;
+    VectorMemory children;
+    //! Arrays of values in leaves of a map. Memory the values own themselves isn't counted.
+    VectorMemory values;
+    //! Bit array of the membership filter in front of `Contains`, if it's enabled.
+    VectorMemory membership_filter;
+    //! Buffers the tree keeps between operations, such as the path of a mutation.
+    VectorMemory buffers;
+    //! Size of the flat file the tree is read from, if it hasn't been converted to nodes yet.
+    ssize_t mapped_bytes = 0;
+
+    ssize_t AllocationCount() const;
+    ssize_t AllocatorOverheadBytes() const;
+    //! Slab bytes not taken by the tree: headers, rounding and objects already gone.
+    ssize_t DeadSlabBytes() const;
+    ssize_t TotalBytes() const;
+    double BytesPerKey() const;
+};
+
+struct DrawingModelMemoryStats {
+    ssize_t node_count = 0;
+    //! Bytes of drawable nodes stored in the hash table, without the vectors' buffers.
+    ssize_t node_bytes = 0;
+    VectorMemory keys;
+    VectorMemory children;
+    HashTableMemory address_to_node;
+    HashTableMemory visited_nodes;
+    //! Rows, cells and lines laid out for painting. Three buffers of them are kept, only the shown one is counted.
+    VectorMemory render_data;
+
+    ssize_t AllocationCount() const;
+    ssize_t AllocatorOverheadBytes() const;
+    ssize_t TotalBytes() const;
+};
+
+std::ostream& operator<<(std::ostream& output, const TreeMemoryStats& stats);
+std::ostream& operator<<(std::ostream& output, const DrawingModelMemoryStats& stats);
+
+} // namespace NVis
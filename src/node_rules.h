@@ -0,0 +1,45 @@
+#pragma once
+
+#include "tree_action.h"
+
+#include <algorithm>
+
+namespace NVis {
+
+// Rules of descending, splitting and merging nodes of a B+ tree whose internal nodes keep maximums of their children as
+// keys, usable in constant evaluation. Only these decisions are shared by `BPlusTree` and `StaticTwoThreeTree`: the
+// loops applying them, over the path, separators, splits and merges, are written separately in each tree, since
+// `BPlusTree` interleaves them with notifications and step-by-step coroutines. That the two give trees of the same
+// shape for the same operations is checked by `static_tree_ut.cpp`, which should be extended along with any change
+// to those loops.
+
+//! Height a tree needs to hold `key_count` keys with at least `fanout` children in every node.
+constexpr ssize_t MinHeightHolding(ssize_t fanout, ssize_t key_count) {
+    ssize_t height = 0;
+    for (ssize_t capacity = fanout; capacity < key_count; capacity *= fanout) {
+        ++height;
+    }
+    return height;
+}
+
+//! Index of the child to descend to for `x` from an internal node with keys `[keys_begin, keys_end)`: the first child
+//! whose maximum isn't less than `x`, or the last one if `x` is greater than all of them.
+template <typename TIterator>
+constexpr ssize_t ChildIndexFor(TIterator keys_begin, TIterator keys_end, const Key& x) {
+    ssize_t child_index = std::lower_bound(keys_begin, keys_end, x) - keys_begin;
+    return std::min<ssize_t>(child_index, (keys_end - keys_begin) - 1);
+}
+
+//! An overflowed node of `key_count` keys is cut in two: keys before the returned index stay in the first half, the
+//! rest go to the second one.
+constexpr ssize_t SplitPoint(ssize_t key_count) {
+    return key_count / 2;
+}
+
+//! Whether an underfull node which is the `index_in_parent`-th child is merged into its left sibling. Only the first
+//! child has none, so it's merged into the right one.
+constexpr bool MergesIntoLeft(ssize_t index_in_parent) {
+    return index_in_parent > 0;
+}
+
+} // namespace NVis
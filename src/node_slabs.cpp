@@ -0,0 +1,64 @@
+#include "node_slabs.h"
+
+#include <cassert>
+#include <new>
+
+namespace NVis {
+
+NodeSlabs& NodeSlabs::Instance() {
+    static auto* slabs = new NodeSlabs;
+    return *slabs;
+}
+
+auto NodeSlabs::Allocate(ssize_t object_bytes) -> Slab* {
+    assert(object_bytes > 0 && "Slab must hold something");
+    auto bytes = static_cast<ssize_t>(sizeof(Slab)) + object_bytes;
+    auto slab = new (::operator new(static_cast<size_t>(bytes)))
+        Slab{.reference_count = 1, .bytes = bytes, .filled_bytes = sizeof(Slab)};
+    slab_count_.fetch_add(1, std::memory_order_relaxed);
+    slab_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    return slab;
+}
+
+void* NodeSlabs::Carve(Slab* slab, ssize_t bytes) {
+    auto rounded_bytes = RoundUp(bytes);
+    if (slab->filled_bytes + rounded_bytes > slab->bytes) {
+        return nullptr;
+    }
+    auto object = reinterpret_cast<char*>(slab) + slab->filled_bytes;
+    slab->filled_bytes += rounded_bytes;
+    slab->reference_count.fetch_add(1, std::memory_order_relaxed);
+    return object;
+}
+
+void NodeSlabs::Seal(Slab* slab) {
+    assert(slab->filled_bytes == slab->bytes && "Slab isn't filled");
+    slab->filled_bytes = slab->bytes;
+    Release(slab);
+}
+
+void NodeSlabs::Acquire(Slab* slab) {
+    slab->reference_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NodeSlabs::Release(Slab* slab) {
+    auto left_count = slab->reference_count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    assert(left_count >= 0 && "Slab released twice");
+    if (left_count > 0) {
+        return;
+    }
+    slab_count_.fetch_sub(1, std::memory_order_relaxed);
+    slab_bytes_.fetch_sub(slab->bytes, std::memory_order_relaxed);
+    slab->~Slab();
+    ::operator delete(slab);
+}
+
+ssize_t NodeSlabs::GetSlabCount() const {
+    return slab_count_.load(std::memory_order_relaxed);
+}
+
+ssize_t NodeSlabs::GetSlabBytes() const {
+    return slab_bytes_.load(std::memory_order_relaxed);
+}
+
+} // namespace NVis
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "memory_stats.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace NVis {
+
+//! Slabs: blocks holding many tree nodes and their buffers one after another, which `BPlusTree::CompactSlice` relocates
+//! nodes into. An object in a slab is destroyed one by one like any other. Every slab starts with a header counting
+//! references to it, and the objects keep a pointer to the header of their slab, so releasing one takes neither a
+//! lookup nor a lock: the slab is freed when its last reference is gone.
+//!
+//! The registry itself only counts slabs of the whole process, for statistics.
+class NodeSlabs {
+public:
+    //! Header of a slab, followed by its objects.
+    struct alignas(std::max_align_t) Slab {
+        //! Live objects, allocators which may free them, and the one filling the slab until it's sealed.
+        std::atomic<ssize_t> reference_count;
+        ssize_t bytes;
+        //! Offset of the free space from the header, `bytes` once the slab is sealed.
+        ssize_t filled_bytes;
+    };
+
+    //! Objects are aligned like `operator new` does, so each of them takes a multiple of it.
+    static constexpr ssize_t kAlignment = alignof(std::max_align_t);
+    static constexpr ssize_t RoundUp(ssize_t bytes) {
+        return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    //! Never destroyed, so trees destroyed at exit still find it.
+    static NodeSlabs& Instance();
+
+    NodeSlabs(const NodeSlabs&) = delete;
+    NodeSlabs& operator=(const NodeSlabs&) = delete;
+    NodeSlabs(NodeSlabs&&) = delete;
+    NodeSlabs& operator=(NodeSlabs&&) = delete;
+
+    //! Allocates a slab for objects of `object_bytes` in total, each rounded up by `RoundUp`. The caller holds a
+    //! reference until it seals the slab.
+    Slab* Allocate(ssize_t object_bytes);
+    //! Takes the next `bytes` of `slab` for an object, or returns nullptr if the slab is sealed or has no room left.
+    static void* Carve(Slab* slab, ssize_t bytes);
+    //! Stops carving objects from `slab` and drops the reference of the caller of `Allocate`.
+    void Seal(Slab* slab);
+    static bool Contains(const Slab* slab, const void* object) {
+        auto begin = reinterpret_cast<uintptr_t>(slab);
+        auto address = reinterpret_cast<uintptr_t>(object);
+        return begin < address && address < begin + static_cast<uintptr_t>(slab->bytes);
+    }
+
+    static void Acquire(Slab* slab);
+    //! Drops a reference to `slab` and frees the slab if it was the last one. References may be dropped from
+    //! different threads.
+    void Release(Slab* slab);
+
+    ssize_t GetSlabCount() const;
+    ssize_t GetSlabBytes() const;
+
+private:
+    NodeSlabs() = default;
+
+    std::atomic<ssize_t> slab_count_ = 0;
+    std::atomic<ssize_t> slab_bytes_ = 0;
+};
+
+//! Allocator of buffers of nodes which may be relocated into a slab. Buffers allocated while the slab is filled are
+//! carved from it, later ones, as when a buffer grows, come from the heap. The allocator holds a reference to its slab
+//! to tell them apart when freeing. Without a slab it's `std::allocator`, only wider by a pointer.
+//!
+//! The slab moves and swaps along with the buffer, and copies of a container allocate on the heap.
+template <typename T>
+class SlabAllocator {
+public:
+    static_assert(alignof(T) <= NodeSlabs::kAlignment, "Slabs don't align over-aligned types");
+
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    SlabAllocator() = default;
+    explicit SlabAllocator(NodeSlabs::Slab* slab) : slab_(slab) {
+        if (slab_ != nullptr) {
+            NodeSlabs::Acquire(slab_);
+        }
+    }
+    SlabAllocator(const SlabAllocator& other) : SlabAllocator(other.slab_) {}
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>& other) : SlabAllocator(other.GetSlab()) {}
+    SlabAllocator& operator=(const SlabAllocator& other) {
+        SlabAllocator copy(other);
+        std::swap(slab_, copy.slab_);
+        return *this;
+    }
+    ~SlabAllocator() {
+        if (slab_ != nullptr) {
+            NodeSlabs::Instance().Release(slab_);
+        }
+    }
+
+    T* allocate(size_t count) {
+        auto bytes = static_cast<ssize_t>(count * sizeof(T));
+        if (slab_ != nullptr) {
+            if (auto object = NodeSlabs::Carve(slab_, bytes)) {
+                return static_cast<T*>(object);
+            }
+        }
+        return static_cast<T*>(::operator new(static_cast<size_t>(bytes)));
+    }
+    void deallocate(T* object, size_t) {
+        if (IsInSlab(object)) {
+            NodeSlabs::Instance().Release(slab_);
+        } else {
+            ::operator delete(object);
+        }
+    }
+    SlabAllocator select_on_container_copy_construction() const {
+        return {};
+    }
+
+    NodeSlabs::Slab* GetSlab() const {
+        return slab_;
+    }
+    bool IsInSlab(const T* object) const {
+        return slab_ != nullptr && NodeSlabs::Contains(slab_, object);
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>& other) const {
+        return slab_ == other.GetSlab();
+    }
+
+private:
+    NodeSlabs::Slab* slab_ = nullptr;
+};
+
+//! Same as for other vectors, except that a buffer in a slab isn't a heap block of its own.
+template <typename T>
+VectorMemory MeasureVector(const std::vector<T, SlabAllocator<T>>& vector) {
+    auto memory = MeasureVector<T, SlabAllocator<T>>(vector);
+    if (vector.get_allocator().IsInSlab(vector.data())) {
+        memory.allocation_count = 0;
+    }
+    return memory;
+}
+
+} // namespace NVis
@@ -1,13 +1,27 @@
 #pragma once
 
+#include "inplace_function.h"
+
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <functional>
-#include <list>
+#include <optional>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 namespace NVis {
 
+//! Set of kinds of notifications an observer wants to get. Meaning of bits is defined by the domain of `TData`, so
+//! `Observable` only combines the masks and hands them to its filter.
+using InterestMask = uint32_t;
+
+inline constexpr InterestMask kInterestedInEverything = ~InterestMask{0};
+
+//! Size of a buffer for each of observer's callbacks. Enough for a lambda capturing six pointers or references.
+inline constexpr size_t kObserverCallbackCapacity = 6 * sizeof(void*);
+
 template <typename TData>
 class Observable;
 
@@ -17,10 +31,12 @@ class Observer {
 
 public:
     template <typename TSub, typename TNotify, typename TUnsub>
-    Observer(TSub&& on_subscribe, TNotify&& on_notify, TUnsub&& on_unsubscribe)
+    Observer(TSub&& on_subscribe, TNotify&& on_notify, TUnsub&& on_unsubscribe,
+             InterestMask interest = kInterestedInEverything)
         : on_subscribe_(std::forward<TSub>(on_subscribe)),
           on_notify_(std::forward<TNotify>(on_notify)),
-          on_unsubscribe_(std::forward<TUnsub>(on_unsubscribe)) {}
+          on_unsubscribe_(std::forward<TUnsub>(on_unsubscribe)),
+          interest_(interest) {}
 
     Observer(const Observer&) = delete;
     Observer& operator=(const Observer&) = delete;
@@ -40,6 +56,9 @@ public:
     bool IsSubscribed() const {
         return observable_ != nullptr;
     }
+    InterestMask GetInterest() const {
+        return interest_;
+    }
 
 private:
     void SetObservable(Observable<TData>* observable) {
@@ -47,17 +66,25 @@ private:
     }
     Observable<TData>* observable_ = nullptr;
 
-    std::function<void(const TData&)> on_subscribe_;
-    std::function<void(const TData&)> on_notify_;
-    std::function<void()> on_unsubscribe_;
+    // Callbacks are kept inline to not allocate on construction and to not chase pointers on notification.
+    InplaceFunction<void(const TData&), kObserverCallbackCapacity> on_subscribe_;
+    InplaceFunction<void(const TData&), kObserverCallbackCapacity> on_notify_;
+    InplaceFunction<void(), kObserverCallbackCapacity> on_unsubscribe_;
+    InterestMask interest_;
+    //! Set by observable for observers which need filtering not only by interest.
+    bool is_always_filtered_ = false;
 };
 
 template <typename TData>
 class Observable {
 public:
+    //! Filter gets data and an observer and returns the part of data the observer is interested in, or `std::nullopt`
+    //! if there's nothing to deliver.
+    using Filter = std::function<std::optional<TData>(const TData&, const Observer<TData>&)>;
+
     template <typename TSubscribeDataFunc>
-    Observable(TSubscribeDataFunc&& subscribe_data_func)
-        : subscribe_data_(std::forward<TSubscribeDataFunc>(subscribe_data_func)) {}
+    Observable(TSubscribeDataFunc&& subscribe_data_func, Filter filter = nullptr)
+        : subscribe_data_(std::forward<TSubscribeDataFunc>(subscribe_data_func)), filter_(std::move(filter)) {}
 
     Observable() = delete;
     Observable(const Observable&) = delete;
@@ -72,28 +99,125 @@ public:
     }
 
     void Subscribe(Observer<TData>* observer) {
+        Attach(observer);
+        auto data = subscribe_data_();
+        if (!NeedsFilter(*observer)) {
+            observer->on_subscribe_(data);
+        } else if (auto filtered = filter_(data, *observer)) {
+            observer->on_subscribe_(*filtered);
+        }
+    }
+    //! Same as `Subscribe`, but the observer gets `subscribe_data` as is instead of what the observable produces, and
+    //! every notification for it goes through the filter until `SetAlwaysFiltered(observer, false)`. This allows to
+    //! feed an observer its initial state piece by piece.
+    void SubscribeWithData(Observer<TData>* observer, const TData& subscribe_data) {
+        Attach(observer);
+        observer->is_always_filtered_ = true;
+        observer->on_subscribe_(subscribe_data);
+    }
+    void SetAlwaysFiltered(Observer<TData>* observer, bool is_always_filtered) {
+        assert(IsSubscribed(observer) && "Changing filtering of a foreign observer");
+        observer->is_always_filtered_ = is_always_filtered;
+    }
+    bool IsSubscribed(const Observer<TData>* observer) const {
+        return std::find(subscribers_.begin(), subscribers_.end(), observer) != subscribers_.end();
+    }
+
+    //! Observers may subscribe and unsubscribe from their callbacks. The ones subscribed during the notification don't
+    //! get it, the ones unsubscribed before their turn don't get it either.
+    void Notify(TData data) const {
+        ++dispatch_depth_;
+        // Indices stay valid while the vector grows, and detached observers leave holes until the dispatch is over.
+        auto subscriber_count = std::ssize(subscribers_);
+        for (ssize_t index = 0; index < subscriber_count; ++index) {
+            auto subscriber = subscribers_[index];
+            if (subscriber == nullptr) {
+                continue;
+            }
+            // Most observers are interested in everything, so data is copied only for the picky ones.
+            if (!NeedsFilter(*subscriber)) {
+                subscriber->on_notify_(data);
+            } else if (auto filtered = filter_(data, *subscriber)) {
+                subscriber->on_notify_(*filtered);
+            }
+        }
+        if (--dispatch_depth_ == 0) {
+            std::erase(subscribers_, nullptr);
+        }
+    }
+    ssize_t GetSubscriberCount() const {
+        return std::ssize(subscribers_) - std::count(subscribers_.begin(), subscribers_.end(), nullptr);
+    }
+    //! Delivers `data` to one of subscribers as is.
+    void NotifyOne(Observer<TData>* observer, const TData& data) const {
+        assert(IsSubscribed(observer) && "Notifying a foreign observer");
+        observer->on_notify_(data);
+    }
+    //! Returns union of interests of all the current subscribers. Nothing outside of it has to be produced at all.
+    InterestMask GetInterest() const {
+        return interest_;
+    }
+
+private:
+    void Attach(Observer<TData>* observer) {
         assert(observer != nullptr && "Trying to subscribe non-existing observer");
         if (observer->IsSubscribed()) {
             observer->Unsubscribe();
         }
         subscribers_.emplace_back(observer);
         observer->SetObservable(this);
-        observer->on_subscribe_(subscribe_data_());
+        observer->is_always_filtered_ = false;
+        interest_ |= observer->interest_;
     }
-    void Notify(TData data) const {
-        for (auto subscriber : subscribers_) {
-            subscriber->on_notify_(data);
-        }
+    bool NeedsFilter(const Observer<TData>& observer) const {
+        return filter_ && (observer.interest_ != kInterestedInEverything || observer.is_always_filtered_);
     }
-
-private:
     void Detach(Observer<TData>* observer) {
         observer->on_unsubscribe_();
-        subscribers_.remove(observer);
+        auto it = std::find(subscribers_.begin(), subscribers_.end(), observer);
+        if (dispatch_depth_ > 0) {
+            // Erasing would shift the observers which are yet to be notified.
+            *it = nullptr;
+        } else {
+            subscribers_.erase(it);
+        }
+        interest_ = 0;
+        for (auto subscriber : subscribers_) {
+            if (subscriber != nullptr) {
+                interest_ |= subscriber->interest_;
+            }
+        }
     }
-    std::list<Observer<TData>*> subscribers_;
+    // Contiguous, since it's traversed on every notification and rarely changed. Holes left by observers detached
+    // during a notification are swept once it's over, which a const notification must be able to do.
+    mutable std::vector<Observer<TData>*> subscribers_;
+    //! Depth of nested `Notify` calls, since a callback may notify again.
+    mutable int dispatch_depth_ = 0;
     std::function<TData()> subscribe_data_;
+    Filter filter_;
+    InterestMask interest_ = 0;
     friend Observer<TData>;
 };
 
+//! Observable with a set of callbacks fixed at compile time. There's no subscribing and unsubscribing: callbacks are
+//! stored by value and called directly, so the compiler can inline the whole notification. Suitable for hot paths
+//! where the set of listeners is known in advance, e.g. metrics.
+template <typename TData, typename... TCallbacks>
+class StaticObservable {
+public:
+    explicit StaticObservable(TCallbacks... callbacks) : callbacks_(std::move(callbacks)...) {}
+
+    void Notify(const TData& data) const {
+        std::apply([&data](const auto&... callback) { (callback(data), ...); }, callbacks_);
+    }
+
+private:
+    std::tuple<TCallbacks...> callbacks_;
+};
+
+template <typename TData, typename... TCallbacks>
+StaticObservable<TData, std::decay_t<TCallbacks>...> MakeStaticObservable(TCallbacks&&... callbacks) {
+    return StaticObservable<TData, std::decay_t<TCallbacks>...>(std::forward<TCallbacks>(callbacks)...);
+}
+
 } // namespace NVis
@@ -0,0 +1,166 @@
+#include "packed_keys.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <utility>
+
+namespace NVis {
+
+namespace {
+constexpr int kWordBits = 64;
+
+ssize_t DataWordCount(ssize_t key_count, int width) {
+    return (key_count * width + kWordBits - 1) / kWordBits;
+}
+} // namespace
+
+PackedKeys::PackedKeys(std::initializer_list<Key> keys) {
+    assign(keys.begin(), keys.end());
+}
+
+Key PackedKeys::operator[](ssize_t index) const {
+    assert(index >= 0 && index < size_ && "Packed key index out of range");
+    auto offset = BlockOffset(index / kBlockSize);
+    auto header = words_[offset];
+    auto width = BlockWidth(header);
+    if (width == 0) {
+        return BlockBase(header);
+    }
+    auto bit = (index % kBlockSize) * width;
+    const auto* data = words_.data() + offset + 1;
+    auto shift = bit % kWordBits;
+    auto difference = data[bit / kWordBits] >> shift;
+    if (shift + width > kWordBits) {
+        difference |= data[bit / kWordBits + 1] << (kWordBits - shift);
+    }
+    difference &= (uint64_t{1} << width) - 1;
+    return static_cast<Key>(static_cast<int64_t>(BlockBase(header)) + static_cast<int64_t>(difference));
+}
+
+void PackedKeys::Set(ssize_t index, const Key& key) {
+    assert(index >= 0 && index < size_ && "Packed key index out of range");
+    auto offset = BlockOffset(index / kBlockSize);
+    auto header = words_[offset];
+    auto width = BlockWidth(header);
+    auto difference = static_cast<int64_t>(key) - BlockBase(header);
+    if (difference < 0 || (width < kWordBits && difference >= (int64_t{1} << width))) {
+        auto keys = Decode();
+        keys[index] = key;
+        Encode(keys);
+        return;
+    }
+    if (width == 0) {
+        return;
+    }
+    auto bit = (index % kBlockSize) * width;
+    auto* data = words_.data() + offset + 1;
+    auto shift = bit % kWordBits;
+    auto mask = (uint64_t{1} << width) - 1;
+    auto& low_word = data[bit / kWordBits];
+    low_word = (low_word & ~(mask << shift)) | (static_cast<uint64_t>(difference) << shift);
+    if (shift + width > kWordBits) {
+        auto& high_word = data[bit / kWordBits + 1];
+        auto high_bits = shift + width - kWordBits;
+        high_word = (high_word & ~((uint64_t{1} << high_bits) - 1)) |
+                    (static_cast<uint64_t>(difference) >> (kWordBits - shift));
+    }
+}
+
+PackedKeys::Iterator PackedKeys::insert(Iterator position, const Key& key) {
+    auto keys = Decode();
+    keys.insert(keys.begin() + position.index_, key);
+    Encode(keys);
+    return Iterator(this, position.index_);
+}
+
+PackedKeys::Iterator PackedKeys::erase(Iterator first, Iterator last) {
+    auto keys = Decode();
+    keys.erase(keys.begin() + first.index_, keys.begin() + last.index_);
+    Encode(keys);
+    return Iterator(this, first.index_);
+}
+
+void PackedKeys::resize(size_t size) {
+    auto keys = Decode();
+    keys.resize(size);
+    Encode(keys);
+}
+
+void PackedKeys::clear() {
+    words_.clear();
+    words_.shrink_to_fit();
+    size_ = 0;
+}
+
+VectorMemory PackedKeys::MeasureMemory() const {
+    return MeasureVector(words_);
+}
+
+ssize_t PackedKeys::BlockOffset(ssize_t block) const {
+    ssize_t offset = 0;
+    for (ssize_t previous = 0; previous < block; ++previous) {
+        offset += 1 + DataWordCount(kBlockSize, BlockWidth(words_[offset]));
+    }
+    return offset;
+}
+
+ssize_t PackedKeys::BlockKeyCount(ssize_t block) const {
+    return std::min(kBlockSize, size_ - block * kBlockSize);
+}
+
+Key PackedKeys::BlockBase(uint64_t header) {
+    return static_cast<Key>(static_cast<int32_t>(static_cast<uint32_t>(header)));
+}
+
+int PackedKeys::BlockWidth(uint64_t header) {
+    return static_cast<int>(header >> kWidthShift);
+}
+
+std::vector<Key> PackedKeys::Decode() const {
+    std::vector<Key> keys;
+    keys.reserve(size_);
+    for (ssize_t index = 0; index < size_; ++index) {
+        keys.emplace_back((*this)[index]);
+    }
+    return keys;
+}
+
+void PackedKeys::Encode(const std::vector<Key>& keys) {
+    static_assert(sizeof(Key) <= sizeof(uint32_t), "Block header has room for a 32-bit base only");
+    size_ = std::ssize(keys);
+    auto block_count = (size_ + kBlockSize - 1) / kBlockSize;
+    auto get_frame = [this, &keys](ssize_t block) {
+        auto first = keys.begin() + block * kBlockSize;
+        auto [min_it, max_it] = std::minmax_element(first, first + BlockKeyCount(block));
+        return std::pair(*min_it, std::bit_width(static_cast<uint64_t>(static_cast<int64_t>(*max_it) - *min_it)));
+    };
+    // Frames are found twice to allocate the exact size at once.
+    ssize_t word_count = 0;
+    for (ssize_t block = 0; block < block_count; ++block) {
+        word_count += 1 + DataWordCount(BlockKeyCount(block), get_frame(block).second);
+    }
+    Words words;
+    words.reserve(word_count);
+    for (ssize_t block = 0; block < block_count; ++block) {
+        auto first = keys.begin() + block * kBlockSize;
+        auto last = first + BlockKeyCount(block);
+        auto [base, width] = get_frame(block);
+        words.emplace_back(static_cast<uint64_t>(static_cast<uint32_t>(base)) |
+                           (static_cast<uint64_t>(width) << kWidthShift));
+        auto data_offset = std::ssize(words);
+        words.resize(data_offset + DataWordCount(last - first, width));
+        ssize_t bit = 0;
+        for (auto it = first; it != last && width > 0; ++it, bit += width) {
+            auto difference = static_cast<uint64_t>(static_cast<int64_t>(*it) - base);
+            auto shift = bit % kWordBits;
+            words[data_offset + bit / kWordBits] |= difference << shift;
+            if (shift + width > kWordBits) {
+                words[data_offset + bit / kWordBits + 1] |= difference >> (kWordBits - shift);
+            }
+        }
+    }
+    words_ = std::move(words);
+}
+
+} // namespace NVis
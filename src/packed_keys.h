@@ -0,0 +1,220 @@
+#pragma once
+
+#include "memory_stats.h"
+#include "node_slabs.h"
+#include "tree_action.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace NVis {
+
+//! Sequence of keys stored with frame-of-reference encoding: keys are cut into blocks of `kBlockSize`, and every block
+//! keeps its minimum and the differences from it, packed with as many bits as the largest difference needs. Dense keys
+//! take a few bits each instead of `sizeof(Key)` bytes.
+//!
+//! A key is decoded in place by its index, so searches over `begin()`/`end()` touch only the keys they compare with.
+//! Mostly mimics `std::vector<Key>` to be usable as the key storage of `BPlusTree`, but changing the count of keys
+//! re-encodes the whole sequence, so it's meant for nodes of tens of keys. Changing a single key is done in place if
+//! the new key fits the frame of its block.
+class PackedKeys {
+public:
+    static constexpr ssize_t kBlockSize = 64;
+
+    using value_type = Key;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+
+    //! Read-only random access iterator, dereferencing decodes one key.
+    class Iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = Key;
+        using difference_type = ptrdiff_t;
+        using pointer = void;
+        using reference = Key;
+
+        Iterator() = default;
+        Iterator(const PackedKeys* keys, ssize_t index) : keys_(keys), index_(index) {}
+
+        Key operator*() const {
+            return (*keys_)[index_];
+        }
+        Key operator[](difference_type offset) const {
+            return (*keys_)[index_ + offset];
+        }
+
+        Iterator& operator++() {
+            ++index_;
+            return *this;
+        }
+        Iterator operator++(int) {
+            auto copy = *this;
+            ++index_;
+            return copy;
+        }
+        Iterator& operator--() {
+            --index_;
+            return *this;
+        }
+        Iterator operator--(int) {
+            auto copy = *this;
+            --index_;
+            return copy;
+        }
+        Iterator& operator+=(difference_type offset) {
+            index_ += offset;
+            return *this;
+        }
+        Iterator& operator-=(difference_type offset) {
+            index_ -= offset;
+            return *this;
+        }
+        friend Iterator operator+(Iterator it, difference_type offset) {
+            return it += offset;
+        }
+        friend Iterator operator+(difference_type offset, Iterator it) {
+            return it += offset;
+        }
+        friend Iterator operator-(Iterator it, difference_type offset) {
+            return it -= offset;
+        }
+        friend difference_type operator-(const Iterator& lhs, const Iterator& rhs) {
+            return lhs.index_ - rhs.index_;
+        }
+        friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+            return lhs.index_ == rhs.index_;
+        }
+        friend auto operator<=>(const Iterator& lhs, const Iterator& rhs) {
+            return lhs.index_ <=> rhs.index_;
+        }
+
+    private:
+        friend class PackedKeys;
+
+        const PackedKeys* keys_ = nullptr;
+        ssize_t index_ = 0;
+    };
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+
+    //! Result of indexing a mutable sequence: reads like a key, assigning to it changes the key.
+    class Reference {
+    public:
+        Reference(PackedKeys* keys, ssize_t index) : keys_(keys), index_(index) {}
+
+        operator Key() const {
+            return std::as_const(*keys_)[index_];
+        }
+        Reference& operator=(const Key& key) {
+            keys_->Set(index_, key);
+            return *this;
+        }
+
+    private:
+        PackedKeys* keys_;
+        ssize_t index_;
+    };
+
+    //! Words of blocks, they go into slabs along with nodes of `BPlusTree`.
+    using Words = std::vector<uint64_t, SlabAllocator<uint64_t>>;
+
+    PackedKeys() = default;
+    PackedKeys(std::initializer_list<Key> keys);
+    //! Copy taking its buffer from `allocator`, as vectors do.
+    PackedKeys(const PackedKeys& other, const SlabAllocator<uint64_t>& allocator)
+        : words_(other.words_, allocator), size_(other.size_) {}
+    template <typename TIterator>
+    PackedKeys(TIterator first, TIterator last) {
+        assign(first, last);
+    }
+
+    size_t size() const {
+        return static_cast<size_t>(size_);
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    Key operator[](ssize_t index) const;
+    Reference operator[](ssize_t index) {
+        return Reference(this, index);
+    }
+    Key front() const {
+        return (*this)[0];
+    }
+    Key back() const {
+        return (*this)[size_ - 1];
+    }
+    Iterator begin() const {
+        return Iterator(this, 0);
+    }
+    Iterator end() const {
+        return Iterator(this, size_);
+    }
+
+    //! Replaces the key at `index`. Takes O(1) if `key` fits the frame of its block, re-encodes everything otherwise.
+    void Set(ssize_t index, const Key& key);
+
+    template <typename TIterator>
+    void assign(TIterator first, TIterator last) {
+        Encode(std::vector<Key>(first, last));
+    }
+    Iterator insert(Iterator position, const Key& key);
+    template <typename TIterator>
+    Iterator insert(Iterator position, TIterator first, TIterator last) {
+        auto keys = Decode();
+        keys.insert(keys.begin() + position.index_, first, last);
+        Encode(keys);
+        return Iterator(this, position.index_);
+    }
+    Iterator emplace(Iterator position, const Key& key) {
+        return insert(position, key);
+    }
+    void emplace_back(const Key& key) {
+        insert(end(), key);
+    }
+    Iterator erase(Iterator position) {
+        return erase(position, position + 1);
+    }
+    Iterator erase(Iterator first, Iterator last);
+    //! New keys, if any, are zeros.
+    void resize(size_t size);
+    //! Does nothing: the size of the encoding isn't known beforehand. Kept for compatibility with `std::vector`.
+    void reserve(size_t /* size */) {}
+    void clear();
+
+    //! Heap usage of the encoded keys.
+    VectorMemory MeasureMemory() const;
+    SlabAllocator<uint64_t> get_allocator() const {
+        return words_.get_allocator();
+    }
+
+private:
+    //! Every block starts with a header word: the minimum of the block in the lower half, the bit width of the
+    //! differences above it. Packed differences follow, a difference may cross the boundary of two words.
+    static constexpr int kWidthShift = 32;
+
+    //! Index of the header word of block `block`.
+    ssize_t BlockOffset(ssize_t block) const;
+    ssize_t BlockKeyCount(ssize_t block) const;
+    static Key BlockBase(uint64_t header);
+    static int BlockWidth(uint64_t header);
+
+    std::vector<Key> Decode() const;
+    void Encode(const std::vector<Key>& keys);
+
+    Words words_;
+    ssize_t size_ = 0;
+};
+
+//! Same as for `std::vector`, so the memory of a tree is measured alike whatever stores its keys.
+inline VectorMemory MeasureVector(const PackedKeys& keys) {
+    return keys.MeasureMemory();
+}
+
+} // namespace NVis
@@ -0,0 +1,392 @@
+#include "sharded_tree.h"
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <latch>
+#include <limits>
+#include <unordered_map>
+
+namespace NVis {
+
+ShardedTree::Shard::Shard()
+    : collector([](const TreeActionsBatch&) {},
+                [this](const TreeActionsBatch& actions) { this->collected.emplace_back(actions); }, []() {}) {
+    // Subscribing before the worker starts, after that the tree belongs to the worker.
+    tree.SubscribeObserver(&collector);
+    worker = std::jthread([this](std::stop_token stop) {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(mutex);
+                if (!has_tasks.wait(lock, stop, [this]() { return !tasks.empty(); })) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    });
+}
+
+void ShardedTree::Shard::Run(std::function<void()> task) {
+    {
+        std::lock_guard lock(mutex);
+        tasks.emplace_back(std::move(task));
+    }
+    has_tasks.notify_one();
+}
+
+ShardedTree::ShardedTree(ssize_t shard_count)
+    : observable_([this]() { return this->ProduceWholeTreeInfo(); }) {
+    assert(shard_count > 0 && "Sharded tree needs at least one shard");
+    auto min_key = static_cast<int64_t>(std::numeric_limits<Key>::min());
+    auto width = (static_cast<int64_t>(std::numeric_limits<Key>::max()) - min_key + 1) / shard_count;
+    for (ssize_t shard = 0; shard < shard_count; ++shard) {
+        shards_.emplace_back(std::make_unique<Shard>());
+        lower_bounds_.emplace_back(static_cast<Key>(min_key + shard * width));
+    }
+}
+
+bool ShardedTree::Contains(const Key& x) {
+    auto& shard = *shards_[ShardOf(x)];
+    auto result = shard.tree.Contains(x);
+    ForwardNotifications(shard);
+    return result;
+}
+
+bool ShardedTree::Insert(const Key& x) {
+    auto& shard = *shards_[ShardOf(x)];
+    auto result = shard.tree.Insert(x);
+    shard.size += result ? 1 : 0;
+    ForwardNotifications(shard);
+    return result;
+}
+
+bool ShardedTree::Erase(const Key& x) {
+    auto& shard = *shards_[ShardOf(x)];
+    auto result = shard.tree.Erase(x);
+    shard.size -= result ? 1 : 0;
+    ForwardNotifications(shard);
+    return result;
+}
+
+std::vector<bool> ShardedTree::ContainsMany(const std::vector<Key>& keys) {
+    TraceSpan span("ShardedContainsMany", "sharded", "keys", std::ssize(keys));
+    std::vector<std::vector<ssize_t>> shard_positions(shards_.size());
+    for (ssize_t position = 0; position < std::ssize(keys); ++position) {
+        shard_positions[ShardOf(keys[position])].emplace_back(position);
+    }
+    // Bytes rather than bits, so that workers never write to the same memory location.
+    std::vector<char> found(keys.size());
+    RunOnShards(ListInvolved(shard_positions), [&](ssize_t shard) {
+        for (auto position : shard_positions[shard]) {
+            found[position] = shards_[shard]->tree.Contains(keys[position]);
+        }
+    });
+    ForwardNotifications();
+    return std::vector<bool>(found.begin(), found.end());
+}
+
+BatchResult ShardedTree::ApplyBatch(EBatchOperation operation, const std::vector<KeyRange>& ranges,
+                                    std::stop_token stop) {
+    TraceSpan span("ShardedApplyBatch", "sharded", "ranges", std::ssize(ranges));
+    std::vector<std::vector<KeyRange>> shard_ranges(shards_.size());
+    for (const auto& range : ranges) {
+        assert(range.first <= range.last && "Incorrect range of keys");
+        for (auto shard = ShardOf(range.first); shard < std::ssize(shards_); ++shard) {
+            if (lower_bounds_[shard] > range.last) {
+                break;
+            }
+            auto first = std::max(range.first, lower_bounds_[shard]);
+            auto last =
+                shard + 1 < std::ssize(shards_) ? std::min(range.last, lower_bounds_[shard + 1] - 1) : range.last;
+            shard_ranges[shard].emplace_back(KeyRange{.first = first, .last = last});
+        }
+    }
+    auto involved = ListInvolved(shard_ranges);
+    RunOnShards(involved, [&](ssize_t shard_index) {
+        auto& shard = *shards_[shard_index];
+        shard.last_result = shard.tree.ApplyBatch(operation, shard_ranges[shard_index], stop);
+        shard.tree.PublishBatchSummary();
+    });
+
+    BatchResult result;
+    for (auto shard_index : involved) {
+        auto& shard = *shards_[shard_index];
+        result.processed_count += shard.last_result.processed_count;
+        result.changed_count += shard.last_result.changed_count;
+        result.is_cancelled = result.is_cancelled || shard.last_result.is_cancelled;
+        shard.size += operation == EBatchOperation::Insert ? shard.last_result.changed_count
+                                                           : -shard.last_result.changed_count;
+    }
+    ForwardNotifications();
+    MaybeRebalance();
+    return result;
+}
+
+void ShardedTree::Rebalance() {
+    TraceSpan span("Rebalance", "sharded");
+    auto total = Size();
+    auto shard_count = std::ssize(shards_);
+    if (total < shard_count) {
+        return;
+    }
+    std::vector<std::vector<Key>> shard_keys(shards_.size());
+    RunOnShards(AllShards(), [&](ssize_t shard) { shard_keys[shard] = shards_[shard]->tree.GetKeys(); });
+
+    // Shards own increasing ranges, so their keys go in order one after another.
+    std::vector<Key> new_lower_bounds = {lower_bounds_.front()};
+    ssize_t rank = 0;
+    for (ssize_t shard = 0; shard < shard_count; ++shard) {
+        for (auto key : shard_keys[shard]) {
+            auto next_bound = std::ssize(new_lower_bounds);
+            if (next_bound < shard_count && rank == next_bound * total / shard_count) {
+                new_lower_bounds.emplace_back(key);
+            }
+            ++rank;
+        }
+    }
+    assert(std::ssize(new_lower_bounds) == shard_count && "Not enough keys to place shard boundaries");
+
+    // Counts of keys below every boundary before and after tell which way keys cross it.
+    std::vector<ssize_t> old_below(shard_count + 1, total);
+    std::vector<ssize_t> new_below(shard_count + 1, total);
+    for (ssize_t shard = 0; shard < shard_count; ++shard) {
+        old_below[shard] = shard == 0 ? 0 : old_below[shard - 1] + std::ssize(shard_keys[shard - 1]);
+        new_below[shard] = shard * total / shard_count;
+    }
+    lower_bounds_ = std::move(new_lower_bounds);
+
+    // Keys going up cross boundaries from the bottom and keys going down from the top, so the ones moving over several
+    // shards pass through each of them on the way. Workers are idle meanwhile, so the trees are cut and joined here.
+    for (ssize_t boundary = 1; boundary < shard_count; ++boundary) {
+        if (old_below[boundary] > new_below[boundary]) {
+            MoveAcross(boundary, true);
+        }
+    }
+    for (ssize_t boundary = shard_count - 1; boundary > 0; --boundary) {
+        if (old_below[boundary] < new_below[boundary]) {
+            MoveAcross(boundary, false);
+        }
+    }
+    for (ssize_t shard = 0; shard < shard_count; ++shard) {
+        shards_[shard]->size = new_below[shard + 1] - new_below[shard];
+    }
+}
+
+void ShardedTree::SubscribeObserver(Observer<TreeActionsBatch>* observer) {
+    observable_.Subscribe(observer);
+}
+
+ssize_t ShardedTree::GetShardCount() const {
+    return std::ssize(shards_);
+}
+
+ssize_t ShardedTree::GetShardSize(ssize_t shard) const {
+    return shards_[shard]->size;
+}
+
+Key ShardedTree::GetShardLowerBound(ssize_t shard) const {
+    return lower_bounds_[shard];
+}
+
+ssize_t ShardedTree::Size() const {
+    ssize_t result = 0;
+    for (const auto& shard : shards_) {
+        result += shard->size;
+    }
+    return result;
+}
+
+ssize_t ShardedTree::ShardOf(const Key& x) const {
+    return std::upper_bound(lower_bounds_.begin(), lower_bounds_.end(), x) - lower_bounds_.begin() - 1;
+}
+
+void ShardedTree::RunOnShards(const std::vector<ssize_t>& shard_indices, const std::function<void(ssize_t)>& task) {
+    std::latch finished(std::ssize(shard_indices));
+    for (auto shard_index : shard_indices) {
+        shards_[shard_index]->Run([shard_index, &task, &finished]() {
+            task(shard_index);
+            finished.count_down();
+        });
+    }
+    finished.wait();
+}
+
+template <typename TWork>
+std::vector<ssize_t> ShardedTree::ListInvolved(const std::vector<std::vector<TWork>>& per_shard) {
+    std::vector<ssize_t> result;
+    for (ssize_t shard = 0; shard < std::ssize(per_shard); ++shard) {
+        if (!per_shard[shard].empty()) {
+            result.emplace_back(shard);
+        }
+    }
+    return result;
+}
+
+std::vector<ssize_t> ShardedTree::AllShards() const {
+    std::vector<ssize_t> result(shards_.size());
+    for (ssize_t shard = 0; shard < std::ssize(result); ++shard) {
+        result[shard] = shard;
+    }
+    return result;
+}
+
+void ShardedTree::MaybeRebalance() {
+    auto total = Size();
+    if (total < kMinKeysToRebalance) {
+        return;
+    }
+    ssize_t max_size = 0;
+    for (const auto& shard : shards_) {
+        max_size = std::max(max_size, shard->size);
+    }
+    if (static_cast<double>(max_size) * static_cast<double>(shards_.size()) > kMaxSkew * static_cast<double>(total)) {
+        Rebalance();
+    }
+}
+
+void ShardedTree::MoveAcross(ssize_t boundary, bool is_upward) {
+    TraceSpan span("MoveAcross", "sharded", "boundary", boundary);
+    auto& lower = *shards_[boundary - 1];
+    auto& upper = *shards_[boundary];
+    auto& source = is_upward ? lower : upper;
+    auto& target = is_upward ? upper : lower;
+    TwoThreeTree moving;
+    if (is_upward) {
+        lower.tree.Split(lower_bounds_[boundary], moving);
+        upper.tree.JoinLeft(moving);
+    } else {
+        upper.tree.SplitLeft(lower_bounds_[boundary], moving);
+        lower.tree.Join(moving);
+    }
+    // Moved nodes keep their addresses, so observers have to see them leave before they arrive.
+    ForwardNotifications(source);
+    ForwardNotifications(target);
+}
+
+void ShardedTree::ForwardNotifications() {
+    for (auto& shard : shards_) {
+        ForwardNotifications(*shard);
+    }
+}
+
+void ShardedTree::ForwardNotifications(Shard& shard) {
+    auto collected = std::move(shard.collected);
+    shard.collected.clear();
+    for (const auto& actions : collected) {
+        observable_.Notify(RewriteShardBatch(shard, actions));
+    }
+}
+
+TreeActionsBatch ShardedTree::RewriteShardBatch(Shard& shard, const TreeActionsBatch& actions) {
+    TreeActionsBatch result;
+    result.reserve(actions.size() + 2);
+    // A new root is created before it's made the root, so its maximum has to be remembered until then.
+    std::unordered_map<MemoryAddress, Key> maximums;
+    bool is_root_changed = false;
+    for (const auto& action : actions) {
+        switch (action.action_type) {
+        case ENodeAction::Create:
+        case ENodeAction::Change:
+            if (action.data && !action.data->keys.empty()) {
+                maximums[action.node_address] = action.data->keys.back();
+                if (action.node_address == shard.root) {
+                    shard.max_key = action.data->keys.back();
+                    is_root_changed = true;
+                }
+            }
+            result.emplace_back(action);
+            break;
+        case ENodeAction::MakeRoot:
+            shard.root = action.node_address;
+            if (shard.root == nullptr) {
+                shard.max_key.reset();
+            } else if (auto maximum = maximums.find(shard.root); maximum != maximums.end()) {
+                shard.max_key = maximum->second;
+            }
+            // Otherwise a child has become the root, and the maximum stays the same.
+            is_root_changed = true;
+            break;
+        case ENodeAction::EndQuery:
+            break;
+        default:
+            result.emplace_back(action);
+            break;
+        }
+    }
+    if (is_root_changed) {
+        AppendSyntheticRootUpdate(result);
+    }
+    if (!actions.empty() && actions.back().action_type == ENodeAction::EndQuery) {
+        result.emplace_back(actions.back());
+    }
+    return result;
+}
+
+void ShardedTree::AppendSyntheticRootUpdate(TreeActionsBatch& actions) {
+    auto root = DescribeSyntheticRoot();
+    MemoryAddress root_address = &synthetic_root_;
+    if (root.children.empty()) {
+        if (shown_synthetic_root_) {
+            actions.emplace_back(TreeAction{.node_address = root_address, .action_type = ENodeAction::Delete});
+            actions.emplace_back(TreeAction{.action_type = ENodeAction::MakeRoot});
+            shown_synthetic_root_.reset();
+        }
+        return;
+    }
+    if (!shown_synthetic_root_) {
+        actions.emplace_back(
+            TreeAction{.node_address = root_address, .action_type = ENodeAction::Create, .data = root});
+        actions.emplace_back(TreeAction{.node_address = root_address, .action_type = ENodeAction::MakeRoot});
+    } else if (shown_synthetic_root_->keys != root.keys || shown_synthetic_root_->children != root.children) {
+        actions.emplace_back(
+            TreeAction{.node_address = root_address, .action_type = ENodeAction::Change, .data = root});
+    }
+    shown_synthetic_root_ = std::move(root);
+}
+
+NodeInfo ShardedTree::DescribeSyntheticRoot() const {
+    NodeInfo result;
+    for (const auto& shard : shards_) {
+        if (shard->root != nullptr) {
+            assert(shard->max_key && "Unknown maximum of a non-empty shard");
+            result.keys.emplace_back(*shard->max_key);
+            result.children.emplace_back(shard->root);
+        }
+    }
+    return result;
+}
+
+TreeActionsBatch ShardedTree::ProduceWholeTreeInfo() {
+    std::vector<TreeActionsBatch> snapshots(shards_.size());
+    RunOnShards(AllShards(), [&](ssize_t shard) {
+        auto& snapshot = snapshots[shard];
+        Observer<TreeActionsBatch> grabber([&snapshot](const TreeActionsBatch& actions) { snapshot = actions; },
+                                           [](const TreeActionsBatch&) {}, []() {});
+        shards_[shard]->tree.SubscribeObserver(&grabber);
+    });
+
+    TreeActionsBatch result = {TreeAction{.action_type = ENodeAction::StartQuery}};
+    for (const auto& snapshot : snapshots) {
+        for (const auto& action : snapshot) {
+            if (action.action_type == ENodeAction::Create) {
+                result.emplace_back(action);
+            }
+        }
+    }
+    if (shown_synthetic_root_) {
+        result.emplace_back(TreeAction{
+            .node_address = &synthetic_root_, .action_type = ENodeAction::Create, .data = *shown_synthetic_root_});
+    }
+    result.emplace_back(TreeAction{
+        .node_address = shown_synthetic_root_ ? &synthetic_root_ : nullptr, .action_type = ENodeAction::MakeRoot});
+    result.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    return result;
+}
+
+} // namespace NVis
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "key_ranges.h"
+#include "observer.h"
+#include "tree_action.h"
+#include "two_three_tree.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace NVis {
+
+//! Set of independent `TwoThreeTree`s, each owning a contiguous range of the key space and having a worker thread of
+//! its own. Batches are split by shard and applied by the workers in parallel. Workers run only the tasks of the call
+//! in progress, which waits for them, so between calls the trees are free: single-key operations run right on the
+//! calling thread in the shard owning the key, since a hand-off to a worker would cost more than the operation. When a
+//! batch leaves the shards too skewed, shard boundaries are moved and the keys beyond them migrate between shards.
+//!
+//! Observers see the shards as one tree: a synthetic root node, which isn't a proper 2-3 node, has the roots of
+//! non-empty shards as children and their maximums as keys. Notifications of shards are delivered on the thread calling
+//! the sharded tree, one shard after another, so the stream is an ordinary `TreeActionsBatch` timeline.
+//!
+//! Methods must be called from one thread, like the ones of `TwoThreeTree`.
+class ShardedTree {
+public:
+    //! Splits the whole key space into `shard_count` ranges of equal width.
+    explicit ShardedTree(ssize_t shard_count);
+
+    ShardedTree(const ShardedTree&) = delete;
+    ShardedTree& operator=(const ShardedTree&) = delete;
+    ShardedTree(ShardedTree&&) = delete;
+    ShardedTree& operator=(ShardedTree&&) = delete;
+    ~ShardedTree() = default;
+
+    bool Contains(const Key& x);
+    bool Insert(const Key& x);
+    bool Erase(const Key& x);
+    //! Looks up all of `keys`, every shard its own part of them on its worker, in parallel. Returns whether each key
+    //! is there, in the order of `keys`.
+    std::vector<bool> ContainsMany(const std::vector<Key>& keys);
+
+    //! Applies `operation` to the parts of `ranges` owned by each shard in parallel. Every shard's net effect comes to
+    //! observers as one summarized batch, like with `TwoThreeTree::ApplyBatch`. May rebalance shards afterwards.
+    BatchResult ApplyBatch(EBatchOperation operation, const std::vector<KeyRange>& ranges, std::stop_token stop = {});
+
+    //! Moves shard boundaries so every shard owns about the same count of keys, and migrates keys accordingly. Keys
+    //! cross a boundary as one range: a shard splits off the part beyond it and the neighbour joins it, which takes
+    //! O(log n) for the trees and O(k) for notifying about k moved keys. Finding the new boundaries takes O(n).
+    void Rebalance();
+
+    void SubscribeObserver(Observer<TreeActionsBatch>* observer);
+
+    ssize_t GetShardCount() const;
+    //! Count of keys in shard `shard`.
+    ssize_t GetShardSize(ssize_t shard) const;
+    //! The least key shard `shard` owns. Shard owns keys up to the lower bound of the next one.
+    Key GetShardLowerBound(ssize_t shard) const;
+    ssize_t Size() const;
+
+private:
+    //! Skew after a batch which triggers rebalancing: the largest shard holds this many times more than the average.
+    static constexpr double kMaxSkew = 1.5;
+    //! Small trees aren't rebalanced, moving keys would cost more than the skew.
+    static constexpr ssize_t kMinKeysToRebalance = 1024;
+
+    struct Shard {
+        Shard();
+
+        //! Queues `task` to the worker of the shard.
+        void Run(std::function<void()> task);
+
+        TwoThreeTree tree;
+        //! Batches the tree has notified about since the last delivery to observers. Filled on the worker.
+        std::vector<TreeActionsBatch> collected;
+        Observer<TreeActionsBatch> collector;
+        ssize_t size = 0;
+        //! Root and maximum of the tree as observers know them.
+        MemoryAddress root = nullptr;
+        std::optional<Key> max_key;
+        BatchResult last_result;
+
+        std::mutex mutex;
+        std::condition_variable_any has_tasks;
+        std::deque<std::function<void()>> tasks;
+        // Declared last, so the worker stops before anything it uses is destroyed.
+        std::jthread worker;
+    };
+
+    ssize_t ShardOf(const Key& x) const;
+    //! Runs `task(shard_index)` on the workers of every shard in `shard_indices` and waits until they all finish.
+    void RunOnShards(const std::vector<ssize_t>& shard_indices, const std::function<void(ssize_t)>& task);
+    std::vector<ssize_t> AllShards() const;
+    //! Shards which have anything in `per_shard`.
+    template <typename TWork>
+    static std::vector<ssize_t> ListInvolved(const std::vector<std::vector<TWork>>& per_shard);
+    void MaybeRebalance();
+    //! Moves the keys on the wrong side of the lower bound of shard `boundary` over it: up, from the shard below to
+    //! it, if `is_upward`, or down otherwise.
+    void MoveAcross(ssize_t boundary, bool is_upward);
+
+    //! Delivers batches collected from shards to observers.
+    void ForwardNotifications();
+    void ForwardNotifications(Shard& shard);
+    //! Replaces `MakeRoot` actions of a shard with updates of the synthetic root.
+    TreeActionsBatch RewriteShardBatch(Shard& shard, const TreeActionsBatch& actions);
+    //! Appends actions bringing observers' synthetic root in line with the current roots of shards.
+    void AppendSyntheticRootUpdate(TreeActionsBatch& actions);
+    NodeInfo DescribeSyntheticRoot() const;
+    TreeActionsBatch ProduceWholeTreeInfo();
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<Key> lower_bounds_;
+    //! Only its address is used: it's the address of the synthetic root.
+    char synthetic_root_ = 0;
+    //! State of the synthetic root observers know, `std::nullopt` when all shards are empty and there's no root.
+    std::optional<NodeInfo> shown_synthetic_root_;
+    Observable<TreeActionsBatch> observable_;
+};
+
+} // namespace NVis
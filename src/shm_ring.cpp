@@ -0,0 +1,159 @@
+#include "shm_ring.h"
+
+#include "tree_action.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bit>
+#include <cassert>
+#include <new>
+#include <utility>
+
+namespace NVis {
+
+std::optional<ShmRing> ShmRing::Create(const std::string& name, ssize_t capacity) {
+    assert(capacity > 0 && std::has_single_bit(static_cast<uint64_t>(capacity)) && "Capacity must be a power of two");
+    shm_unlink(name.c_str());
+    int descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (descriptor < 0) {
+        return std::nullopt;
+    }
+    auto mapped_bytes = static_cast<ssize_t>(sizeof(ShmRingHeader) + capacity * sizeof(uint64_t));
+    if (ftruncate(descriptor, mapped_bytes) != 0) {
+        close(descriptor);
+        shm_unlink(name.c_str());
+        return std::nullopt;
+    }
+    void* mapping = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    // Mapping stays valid after the descriptor is closed.
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return std::nullopt;
+    }
+    // The segment is zero-filled, which is a valid state of the atomics, but the header has to be constructed anyway.
+    auto header = new (mapping) ShmRingHeader{
+        .magic = ShmRingHeader::kMagic,
+        .version = ShmRingHeader::kVersion,
+        .key_size = sizeof(Key),
+        .capacity = static_cast<uint64_t>(capacity),
+        .claimed_position = 0,
+        .published_position = 0,
+        .resync_requests = 0,
+    };
+    auto words = reinterpret_cast<std::atomic<uint64_t>*>(header + 1);
+    for (ssize_t index = 0; index < capacity; ++index) {
+        new (words + index) std::atomic<uint64_t>(0);
+    }
+    return ShmRing(mapping, mapped_bytes, name);
+}
+
+std::optional<ShmRing> ShmRing::Open(const std::string& name) {
+    int descriptor = shm_open(name.c_str(), O_RDWR, 0);
+    if (descriptor < 0) {
+        return std::nullopt;
+    }
+    struct stat segment_stat {};
+    if (fstat(descriptor, &segment_stat) != 0 || segment_stat.st_size < static_cast<off_t>(sizeof(ShmRingHeader))) {
+        close(descriptor);
+        return std::nullopt;
+    }
+    auto mapped_bytes = static_cast<ssize_t>(segment_stat.st_size);
+    // Consumers write too: they request resyncs.
+    void* mapping = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        return std::nullopt;
+    }
+    ShmRing ring(mapping, mapped_bytes, std::string());
+    const auto& header = *ring.header_;
+    auto expected_bytes = sizeof(ShmRingHeader) + header.capacity * sizeof(uint64_t);
+    if (header.magic != ShmRingHeader::kMagic || header.version != ShmRingHeader::kVersion ||
+        header.key_size != sizeof(Key) || !std::has_single_bit(header.capacity) ||
+        expected_bytes != static_cast<uint64_t>(mapped_bytes)) {
+        return std::nullopt;
+    }
+    return ring;
+}
+
+ShmRing::ShmRing(void* mapping, ssize_t mapped_bytes, std::string owned_name)
+    : mapping_(mapping),
+      mapped_bytes_(mapped_bytes),
+      header_(static_cast<ShmRingHeader*>(mapping)),
+      words_(reinterpret_cast<std::atomic<uint64_t>*>(static_cast<char*>(mapping) + sizeof(ShmRingHeader))),
+      owned_name_(std::move(owned_name)) {}
+
+ShmRing::ShmRing(ShmRing&& other) noexcept
+    : mapping_(std::exchange(other.mapping_, nullptr)),
+      mapped_bytes_(std::exchange(other.mapped_bytes_, 0)),
+      header_(std::exchange(other.header_, nullptr)),
+      words_(std::exchange(other.words_, nullptr)),
+      owned_name_(std::exchange(other.owned_name_, std::string())) {}
+
+ShmRing& ShmRing::operator=(ShmRing&& other) noexcept {
+    if (this != &other) {
+        Close();
+        mapping_ = std::exchange(other.mapping_, nullptr);
+        mapped_bytes_ = std::exchange(other.mapped_bytes_, 0);
+        header_ = std::exchange(other.header_, nullptr);
+        words_ = std::exchange(other.words_, nullptr);
+        owned_name_ = std::exchange(other.owned_name_, std::string());
+    }
+    return *this;
+}
+
+ShmRing::~ShmRing() {
+    Close();
+}
+
+void ShmRing::Close() {
+    if (mapping_) {
+        munmap(mapping_, mapped_bytes_);
+        mapping_ = nullptr;
+    }
+    if (!owned_name_.empty()) {
+        shm_unlink(owned_name_.c_str());
+        owned_name_.clear();
+    }
+}
+
+void ShmRing::Write(std::span<const uint64_t> words) {
+    assert(std::ssize(words) <= GetCapacity() && "Words don't fit the ring");
+    auto mask = header_->capacity - 1;
+    auto position = header_->published_position.load(std::memory_order_relaxed);
+    auto end = position + words.size();
+    header_->claimed_position.store(end, std::memory_order_relaxed);
+    // Whoever sees any of the words below sees the claim above too, see `IsIntact`.
+    std::atomic_thread_fence(std::memory_order_release);
+    for (auto word : words) {
+        words_[position & mask].store(word, std::memory_order_relaxed);
+        ++position;
+    }
+    header_->published_position.store(end, std::memory_order_release);
+}
+
+uint64_t ShmRing::GetPublishedPosition() const {
+    return header_->published_position.load(std::memory_order_acquire);
+}
+
+uint64_t ShmRing::ReadWord(uint64_t position) const {
+    return words_[position & (header_->capacity - 1)].load(std::memory_order_relaxed);
+}
+
+bool ShmRing::IsIntact(uint64_t position) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header_->claimed_position.load(std::memory_order_relaxed) - position <= header_->capacity;
+}
+
+void ShmRing::RequestResync() {
+    header_->resync_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t ShmRing::GetResyncRequests() const {
+    return header_->resync_requests.load(std::memory_order_relaxed);
+}
+
+} // namespace NVis
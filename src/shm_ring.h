@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace NVis {
+
+//! The shared memory segment of `ShmRing` starts with this header, followed by `capacity` words of the ring. Positions
+//! count words written since the segment was created, a word at position `p` is stored at `p % capacity`.
+struct ShmRingHeader {
+    static constexpr std::array<char, 8> kMagic = {'N', 'V', 'I', 'S', 'R', 'I', 'N', 'G'};
+    static constexpr uint32_t kVersion = 1;
+
+    std::array<char, 8> magic;
+    uint32_t version;
+    //! Guards against a producer built with a different `Key`.
+    uint32_t key_size;
+    uint64_t capacity;
+    //! The producer is about to overwrite words up to here. Words before `claimed_position - capacity` are gone.
+    std::atomic<uint64_t> claimed_position;
+    //! Words before this are written completely.
+    std::atomic<uint64_t> published_position;
+    //! Bumped by a consumer which has lost track, see `ShmTreePublisher::ServeResync`.
+    std::atomic<uint64_t> resync_requests;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Atomics in shared memory must not hide a lock");
+static_assert(sizeof(ShmRingHeader) % sizeof(uint64_t) == 0, "Words must stay aligned after the header");
+
+//! Ring of 64-bit words in a POSIX shared memory segment with a single producer, which never waits, and any number of
+//! consumers, which read at their own pace. A consumer that falls behind by more than the capacity finds out that its
+//! words have been overwritten instead of reading garbage: it copies words first and checks `IsIntact` after.
+//!
+//! Words are atomics accessed with relaxed ordering, so a torn read is a detectable event rather than a data race.
+class ShmRing {
+public:
+    //! Creates a segment `name` (such as "/nvis") of `capacity` words, which must be a power of two, replacing an
+    //! older segment of that name. The segment is removed when the ring is destroyed. Returns `std::nullopt` if the
+    //! segment can't be created.
+    static std::optional<ShmRing> Create(const std::string& name, ssize_t capacity);
+    //! Maps a segment created by another `ShmRing`, possibly in another process. Returns `std::nullopt` if there's no
+    //! such segment or it isn't a ring of this build.
+    static std::optional<ShmRing> Open(const std::string& name);
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+    ShmRing(ShmRing&& other) noexcept;
+    ShmRing& operator=(ShmRing&& other) noexcept;
+    ~ShmRing();
+
+    ssize_t GetCapacity() const {
+        return static_cast<ssize_t>(header_->capacity);
+    }
+
+    //! Appends `words`, overwriting the oldest ones. There must be at most `GetCapacity()` of them. Producer only.
+    void Write(std::span<const uint64_t> words);
+
+    uint64_t GetPublishedPosition() const;
+    uint64_t ReadWord(uint64_t position) const;
+    //! Whether the words read from `position` on are still the ones published there, so whatever has been read from
+    //! them is valid. Call after reading.
+    bool IsIntact(uint64_t position) const;
+
+    void RequestResync();
+    uint64_t GetResyncRequests() const;
+
+private:
+    ShmRing(void* mapping, ssize_t mapped_bytes, std::string owned_name);
+    //! Unmaps the segment and removes it if it's owned.
+    void Close();
+
+    void* mapping_;
+    ssize_t mapped_bytes_;
+    ShmRingHeader* header_;
+    std::atomic<uint64_t>* words_;
+    //! Name to remove on destruction, empty for rings which have been opened.
+    std::string owned_name_;
+};
+
+} // namespace NVis
@@ -0,0 +1,258 @@
+#include "shm_tree_transport.h"
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+namespace NVis {
+
+namespace {
+// A record header holds the length of the record in words in the low half and its kind above.
+constexpr int kRecordKindShift = 32;
+constexpr uint64_t kWordCountMask = (uint64_t{1} << kRecordKindShift) - 1;
+
+// An action is its address and a word with its type, whether it has data, and counts of keys and children. Keys
+// follow two per word, then children one per word.
+constexpr uint64_t kActionTypeMask = 0xff;
+constexpr uint64_t kHasDataFlag = uint64_t{1} << 8;
+constexpr int kKeyCountShift = 16;
+constexpr int kChildCountShift = 40;
+constexpr uint64_t kCountMask = (uint64_t{1} << 24) - 1;
+constexpr int kSecondKeyShift = 32;
+
+static_assert(sizeof(Key) <= sizeof(uint32_t), "Two keys must fit a word");
+
+uint64_t MakeRecordHeader(ssize_t word_count, EShmRecord kind) {
+    return static_cast<uint64_t>(word_count) | (static_cast<uint64_t>(kind) << kRecordKindShift);
+}
+
+void EncodeActions(const TreeActionsBatch& actions, std::vector<uint64_t>& words) {
+    for (const auto& action : actions) {
+        words.emplace_back(reinterpret_cast<uintptr_t>(action.node_address));
+        auto description = static_cast<uint64_t>(action.action_type);
+        if (!action.data) {
+            words.emplace_back(description);
+            continue;
+        }
+        const auto& keys = action.data->keys;
+        const auto& children = action.data->children;
+        assert(keys.size() <= kCountMask && children.size() <= kCountMask && "Node is too big to encode");
+        words.emplace_back(description | kHasDataFlag | (static_cast<uint64_t>(keys.size()) << kKeyCountShift) |
+                           (static_cast<uint64_t>(children.size()) << kChildCountShift));
+        for (size_t index = 0; index < keys.size(); index += 2) {
+            uint64_t word = static_cast<uint32_t>(keys[index]);
+            if (index + 1 < keys.size()) {
+                word |= static_cast<uint64_t>(static_cast<uint32_t>(keys[index + 1])) << kSecondKeyShift;
+            }
+            words.emplace_back(word);
+        }
+        for (auto child : children) {
+            words.emplace_back(reinterpret_cast<uintptr_t>(child));
+        }
+    }
+}
+
+TreeActionsBatch DecodeActions(std::span<const uint64_t> words) {
+    TreeActionsBatch actions;
+    size_t position = 0;
+    while (position < words.size()) {
+        assert(position + 2 <= words.size() && "Truncated action");
+        TreeAction action{
+            .node_address = reinterpret_cast<MemoryAddress>(static_cast<uintptr_t>(words[position])),
+            .action_type = static_cast<ENodeAction>(words[position + 1] & kActionTypeMask),
+        };
+        auto description = words[position + 1];
+        position += 2;
+        if (description & kHasDataFlag) {
+            auto key_count = (description >> kKeyCountShift) & kCountMask;
+            auto child_count = (description >> kChildCountShift) & kCountMask;
+            assert(position + (key_count + 1) / 2 + child_count <= words.size() && "Truncated node");
+            NodeInfo info;
+            info.keys.reserve(key_count);
+            for (size_t index = 0; index < key_count; ++index) {
+                auto word = words[position + index / 2];
+                auto half = index % 2 == 0 ? word : word >> kSecondKeyShift;
+                info.keys.emplace_back(static_cast<Key>(static_cast<uint32_t>(half)));
+            }
+            position += (key_count + 1) / 2;
+            info.children.reserve(child_count);
+            for (size_t index = 0; index < child_count; ++index) {
+                info.children.emplace_back(reinterpret_cast<MemoryAddress>(static_cast<uintptr_t>(words[position])));
+                ++position;
+            }
+            action.data = std::move(info);
+        }
+        actions.emplace_back(std::move(action));
+    }
+    return actions;
+}
+} // namespace
+
+ShmTreePublisher::ShmTreePublisher(ShmRing ring)
+    : ring_(std::move(ring)),
+      observer_([this](const TreeActionsBatch& actions) { this->Publish(actions, EShmRecord::Snapshot); },
+                [this](const TreeActionsBatch& actions) { this->Publish(actions, EShmRecord::Batch); }, []() {}) {}
+
+Observer<TreeActionsBatch>* ShmTreePublisher::GetObserver() {
+    return &observer_;
+}
+
+ssize_t ShmTreePublisher::GetDroppedCount() const {
+    return dropped_count_;
+}
+
+bool ShmTreePublisher::TakeResyncRequests() {
+    auto requests = ring_.GetResyncRequests();
+    if (requests == served_requests_) {
+        return false;
+    }
+    served_requests_ = requests;
+    return true;
+}
+
+ssize_t ShmTreePublisher::GetSnapshotChunkSize(ssize_t max_node_size) const {
+    // A chunk takes a quarter of the ring at most, so the batches published between chunks fit as well.
+    static constexpr ssize_t kChunksPerRing = 4;
+    // A node is its address, a description, its keys two per word and its children.
+    auto node_words = 2 + (max_node_size + 1) / 2 + max_node_size;
+    return std::max<ssize_t>(1, ring_.GetCapacity() / kChunksPerRing / node_words);
+}
+
+void ShmTreePublisher::Publish(const TreeActionsBatch& actions, EShmRecord kind) {
+    TraceSpan span("PublishToShm", "transport", "actions", std::ssize(actions));
+    if (is_streaming_snapshot_ && std::any_of(actions.begin(), actions.end(), [](const TreeAction& action) {
+            return action.action_type == ENodeAction::MakeRoot;
+        })) {
+        is_streaming_snapshot_ = false;
+    }
+    record_.clear();
+    // The header is filled in when the length is known.
+    record_.emplace_back(0);
+    EncodeActions(actions, record_);
+    if (std::ssize(record_) > ring_.GetCapacity()) {
+        ++dropped_count_;
+        record_.assign(1, MakeRecordHeader(1, EShmRecord::Lost));
+    } else {
+        record_.front() = MakeRecordHeader(std::ssize(record_), kind);
+    }
+    ring_.Write(record_);
+}
+
+ShmTreeView::ShmTreeView(ShmRing ring)
+    : ring_(std::move(ring)),
+      read_position_(ring_.GetPublishedPosition()),
+      observable_([this]() { return this->ProduceWholeTreeInfo(); }) {
+    ring_.RequestResync();
+}
+
+void ShmTreeView::SubscribeObserver(Observer<TreeActionsBatch>* observer) {
+    observable_.Subscribe(observer);
+}
+
+ssize_t ShmTreeView::Poll() {
+    TraceSpan span("PollShm", "transport");
+    ssize_t delivered_count = 0;
+    auto published = ring_.GetPublishedPosition();
+    while (read_position_ < published) {
+        auto available = published - read_position_;
+        if (available > static_cast<uint64_t>(ring_.GetCapacity())) {
+            ++overrun_count_;
+            Resync(published);
+            break;
+        }
+        // The header may be torn as well as the rest, nothing read is trusted until `IsIntact`.
+        auto header = ring_.ReadWord(read_position_);
+        auto word_count = std::min(header & kWordCountMask, available);
+        record_.resize(word_count);
+        for (uint64_t index = 0; index < word_count; ++index) {
+            record_[index] = ring_.ReadWord(read_position_ + index);
+        }
+        if (!ring_.IsIntact(read_position_)) {
+            ++overrun_count_;
+            Resync(published);
+            break;
+        }
+        assert(word_count > 0 && word_count == (header & kWordCountMask) && "Malformed record");
+        read_position_ += word_count;
+        auto kind = static_cast<EShmRecord>(header >> kRecordKindShift);
+        if (kind == EShmRecord::Lost) {
+            Resync(read_position_);
+            continue;
+        }
+        if (kind == EShmRecord::Batch && !is_synced_ && !is_staging_) {
+            continue;
+        }
+        auto actions = DecodeActions(std::span<const uint64_t>(record_).subspan(1));
+        if (kind == EShmRecord::Snapshot) {
+            // Even if someone else has asked for it, the publisher streams the tree anew, so every view starts over.
+            is_synced_ = false;
+            is_staging_ = true;
+            staged_ = {};
+        }
+        if (!is_staging_) {
+            Deliver(std::move(actions));
+            ++delivered_count;
+        } else if (Stage(actions)) {
+            DeliverStaged();
+            ++delivered_count;
+        }
+    }
+    return delivered_count;
+}
+
+bool ShmTreeView::IsSynced() const {
+    return is_synced_;
+}
+
+ssize_t ShmTreeView::GetOverrunCount() const {
+    return overrun_count_;
+}
+
+void ShmTreeView::Resync(uint64_t position) {
+    read_position_ = position;
+    is_synced_ = false;
+    is_staging_ = false;
+    // Asked again even if not synced yet, the snapshot asked for before may be the one which has been lost.
+    ring_.RequestResync();
+}
+
+bool ShmTreeView::Stage(const TreeActionsBatch& actions) {
+    staged_.Apply(actions);
+    // The last chunk makes the root known, and so does a live batch emptying the tree.
+    return std::any_of(actions.begin(), actions.end(),
+                       [](const TreeAction& action) { return action.action_type == ENodeAction::MakeRoot; });
+}
+
+void ShmTreeView::DeliverStaged() {
+    // Observers may know an outdated tree, which is replaced as a whole within one query.
+    TreeActionsBatch actions;
+    actions.reserve(known_.GetNodeCount() + staged_.GetNodeCount() + 3);
+    actions.emplace_back(TreeAction{.action_type = ENodeAction::StartQuery});
+    known_.ForEachNode([&actions](MemoryAddress address, const NodeInfo&) {
+        actions.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+    });
+    staged_.AppendCreation(actions);
+    actions.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    known_ = std::exchange(staged_, {});
+    is_staging_ = false;
+    is_synced_ = true;
+    observable_.Notify(std::move(actions));
+}
+
+void ShmTreeView::Deliver(TreeActionsBatch actions) {
+    known_.Apply(actions);
+    observable_.Notify(std::move(actions));
+}
+
+TreeActionsBatch ShmTreeView::ProduceWholeTreeInfo() const {
+    TreeActionsBatch actions = {TreeAction{.action_type = ENodeAction::StartQuery}};
+    known_.AppendCreation(actions);
+    actions.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    return actions;
+}
+
+} // namespace NVis
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "observer.h"
+#include "shm_ring.h"
+#include "tree_action.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace NVis {
+
+//! Kinds of records in the ring of a shared memory transport. A record is a word with its length in words and its
+//! kind, followed by encoded actions.
+enum class EShmRecord : uint8_t {
+    //! Actions of a notification.
+    Batch,
+    //! The data an observer gets on subscription, which starts a snapshot. Snapshots are streamed in chunks, so the
+    //! batches up to the one with `MakeRoot` bring the rest of the tree. Consumers which have lost track start over
+    //! from it.
+    Snapshot,
+    //! A batch the ring is too small for has been dropped, so every consumer has lost track.
+    Lost,
+};
+
+//! Producer end of a live view of a tree in another process: an observer which encodes batches into a `ShmRing`.
+//! It never waits for consumers, the cost for the writer is encoding and copying the actions.
+class ShmTreePublisher {
+public:
+    explicit ShmTreePublisher(ShmRing ring);
+
+    ShmTreePublisher(const ShmTreePublisher&) = delete;
+    ShmTreePublisher& operator=(const ShmTreePublisher&) = delete;
+    ShmTreePublisher(ShmTreePublisher&&) = delete;
+    ShmTreePublisher& operator=(ShmTreePublisher&&) = delete;
+
+    //! Subscribe it to the tree to be shown.
+    Observer<TreeActionsBatch>* GetObserver();
+
+    //! Consumers which have fallen behind the ring ask for a snapshot. The snapshot is only given to observers on
+    //! subscription, so this subscribes again if anyone has asked since the last call. A tree may be larger than the
+    //! ring, so the snapshot is streamed in chunks taking a fraction of the ring each, and this also sends the next
+    //! chunk in case the tree is idle. It must be called by the writer between operations of `tree`, which is where
+    //! `GetObserver()` is subscribed; when nobody asks and no snapshot is streamed, it costs one atomic load.
+    template <typename TTree>
+    void ServeResync(TTree& tree) {
+        if (TakeResyncRequests()) {
+            is_streaming_snapshot_ = true;
+            tree.SubscribeObserverStreaming(&observer_, GetSnapshotChunkSize(TTree::kMaxNodeSize));
+        } else if (is_streaming_snapshot_) {
+            tree.PumpSnapshots();
+        }
+    }
+
+    //! Batches which haven't fit the ring.
+    ssize_t GetDroppedCount() const;
+
+private:
+    bool TakeResyncRequests();
+    //! Count of nodes of at most `max_node_size` keys which fit a chunk of a snapshot.
+    ssize_t GetSnapshotChunkSize(ssize_t max_node_size) const;
+    void Publish(const TreeActionsBatch& actions, EShmRecord kind);
+
+    ShmRing ring_;
+    uint64_t served_requests_ = 0;
+    //! Set until the snapshot the observer is subscribed with ends with `MakeRoot`.
+    bool is_streaming_snapshot_ = false;
+    ssize_t dropped_count_ = 0;
+    //! Encoded record, kept to not allocate on every notification.
+    std::vector<uint64_t> record_;
+    Observer<TreeActionsBatch> observer_;
+};
+
+//! Consumer end: reads batches from a `ShmRing` on `Poll()` and notifies its observers, such as `AnimationProducer`.
+//! When the consumer finds that the ring has overrun it, it asks the producer for a snapshot and skips everything up
+//! to it. The snapshot comes in chunks, which are collected aside together with the batches between them. Once it's
+//! complete, observers get one batch which deletes every node they know and creates the ones of the snapshot.
+class ShmTreeView {
+public:
+    //! Asks for a snapshot right away, since it's unknown what has been published before.
+    explicit ShmTreeView(ShmRing ring);
+
+    ShmTreeView(const ShmTreeView&) = delete;
+    ShmTreeView& operator=(const ShmTreeView&) = delete;
+    ShmTreeView(ShmTreeView&&) = delete;
+    ShmTreeView& operator=(ShmTreeView&&) = delete;
+
+    //! Subscribes `observer` and sends it the tree as far as the view knows it.
+    void SubscribeObserver(Observer<TreeActionsBatch>* observer);
+
+    //! Delivers the batches published since the last call and returns how many there were.
+    ssize_t Poll();
+    //! Whether the view follows the tree, that is it has got a whole snapshot since the last overrun.
+    bool IsSynced() const;
+    ssize_t GetOverrunCount() const;
+
+private:
+    //! Forgets the rest of the ring up to `position` and waits for a snapshot.
+    void Resync(uint64_t position);
+    //! Collects a record of a snapshot being received. Returns `true` when the snapshot has become complete.
+    bool Stage(const TreeActionsBatch& actions);
+    //! Replaces the tree observers know with the collected snapshot.
+    void DeliverStaged();
+    void Deliver(TreeActionsBatch actions);
+    TreeActionsBatch ProduceWholeTreeInfo() const;
+
+    ShmRing ring_;
+    uint64_t read_position_;
+    bool is_synced_ = false;
+    //! Set from a `Snapshot` record until the batch which completes it.
+    bool is_staging_ = false;
+    ssize_t overrun_count_ = 0;
+    //! The tree as observers know it.
+    ObservedTree known_;
+    //! The part of a snapshot received so far.
+    ObservedTree staged_;
+    std::vector<uint64_t> record_;
+    Observable<TreeActionsBatch> observable_;
+};
+
+} // namespace NVis
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "node_rules.h"
+#include "tree_action.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <span>
+
+namespace NVis {
+
+//! 2-3 tree of at most `kMaxKeys` keys in storage of fixed capacity, usable in constant evaluation: a static set of
+//! keys, such as a table of opcodes or of reserved ID ranges, can be built at compile time and embedded as read-only
+//! data, with nothing to do at startup. Nodes refer to each other by indices in one array, there are no allocations and
+//! no observers.
+//!
+//! Nodes are descended, split and merged by the rules of `node_rules.h`, which `BPlusTree` follows as well, so the
+//! same inserts and erases give a tree of the same shape as `TwoThreeTree`. Only the rules are shared: the loops below
+//! repeat the ones of `BPlusTree` by hand and must be changed together with them.
+template <ssize_t kMaxKeys>
+class StaticTwoThreeTree {
+    static_assert(kMaxKeys > 0, "Tree must have room for keys");
+
+    static constexpr ssize_t kMinFanout = 2;
+    static constexpr ssize_t kMaxFanout = 3;
+    //! Every node but the root has at least two keys or children, so there are never more nodes than keys.
+    static constexpr ssize_t kMaxNodes = kMaxKeys;
+    static constexpr ssize_t kMaxPathLength = MinHeightHolding(kMinFanout, kMaxKeys) + 1;
+    static constexpr int32_t kNoNode = -1;
+
+    struct Node {
+        //! There's room for one more key than a node may have, for the moment between an insert or a merge and the
+        //! split which follows it.
+        std::array<Key, kMaxFanout + 1> keys{};
+        //! Indices of children in `nodes_`, as many as keys for internal nodes.
+        std::array<int32_t, kMaxFanout + 1> children{};
+        ssize_t key_count = 0;
+        bool is_leaf = true;
+    };
+
+    //! A node and its index in the children of the previous node of the path, like `BPlusTree::PathStep`.
+    struct PathStep {
+        int32_t node = kNoNode;
+        ssize_t index_in_parent = -1;
+    };
+    struct Path {
+        std::array<PathStep, kMaxPathLength> steps{};
+        ssize_t length = 0;
+    };
+
+public:
+    constexpr StaticTwoThreeTree() {
+        // Nodes are taken from the back of the free list, so the tree fills the array from the front.
+        for (ssize_t index = 0; index < kMaxNodes; ++index) {
+            free_nodes_[index] = static_cast<int32_t>(kMaxNodes - 1 - index);
+        }
+    }
+
+    //! Inserts `keys` one by one, in any order.
+    constexpr StaticTwoThreeTree(std::initializer_list<Key> keys) : StaticTwoThreeTree() {
+        for (auto key : keys) {
+            Insert(key);
+        }
+    }
+
+    constexpr bool Contains(const Key& x) const {
+        if (root_ == kNoNode) {
+            return false;
+        }
+        const auto& leaf = nodes_[FindLeaf(x)];
+        auto position = std::lower_bound(leaf.keys.begin(), leaf.keys.begin() + leaf.key_count, x);
+        return position != leaf.keys.begin() + leaf.key_count && *position == x;
+    }
+
+    //! Returns the least key which isn't less than `x`, or `std::nullopt` if there's no such key.
+    constexpr std::optional<Key> LowerBound(const Key& x) const {
+        if (root_ == kNoNode) {
+            return std::nullopt;
+        }
+        // Separators are maximums of subtrees, so the descent finds the leaf of the answer if there's one at all.
+        const auto& leaf = nodes_[FindLeaf(x)];
+        auto position = std::lower_bound(leaf.keys.begin(), leaf.keys.begin() + leaf.key_count, x);
+        if (position == leaf.keys.begin() + leaf.key_count) {
+            return std::nullopt;
+        }
+        return *position;
+    }
+
+    //! Inserts the key `x` if it isn't there yet and returns whether it was inserted. The tree must have room for it;
+    //! in constant evaluation, a tree running out of room doesn't compile.
+    constexpr bool Insert(const Key& x) {
+        if (root_ == kNoNode) {
+            root_ = Allocate();
+            nodes_[root_].keys[0] = x;
+            nodes_[root_].key_count = 1;
+            ++size_;
+            return true;
+        }
+        auto path = Descend(x);
+        auto& leaf = nodes_[path.steps[path.length - 1].node];
+        auto position = std::lower_bound(leaf.keys.begin(), leaf.keys.begin() + leaf.key_count, x) - leaf.keys.begin();
+        if (position < leaf.key_count && leaf.keys[position] == x) {
+            return false;
+        }
+        assert(size_ < kMaxKeys && "Static tree is full");
+        InsertAt(leaf.keys, leaf.key_count, position, x);
+        ++leaf.key_count;
+        ++size_;
+        UpdateKeys(path);
+        SplitNode(path, path.length - 1);
+        return true;
+    }
+
+    //! Erases the key `x` if it's there and returns whether it was erased.
+    constexpr bool Erase(const Key& x) {
+        if (root_ == kNoNode) {
+            return false;
+        }
+        auto path = Descend(x);
+        const auto& leaf = nodes_[path.steps[path.length - 1].node];
+        auto key_index = std::lower_bound(leaf.keys.begin(), leaf.keys.begin() + leaf.key_count, x) - leaf.keys.begin();
+        if (key_index == leaf.key_count || leaf.keys[key_index] != x) {
+            return false;
+        }
+        --size_;
+        // Repeats `BPlusTree::Erase`: a node which has got too few keys is merged into a sibling, and either the
+        // sibling overflows and is split back in two, or the parent loses a key and may be merged in turn.
+        for (auto depth = path.length - 1;; --depth) {
+            auto& vertex = nodes_[path.steps[depth].node];
+            EraseAt(vertex.keys, vertex.key_count, key_index);
+            if (!vertex.is_leaf) {
+                Free(vertex.children[key_index]);
+                EraseAt(vertex.children, vertex.key_count, key_index);
+            }
+            --vertex.key_count;
+            if (vertex.is_leaf) {
+                UpdateKeys(path);
+            }
+            if (vertex.key_count >= kMinFanout) {
+                break;
+            }
+            if (depth == 0) {
+                // Root may have fewer keys, as long as it's not an internal node with a single child.
+                if (!vertex.is_leaf && vertex.key_count == 1) {
+                    Free(root_);
+                    root_ = vertex.children[0];
+                } else if (vertex.key_count == 0) {
+                    Free(root_);
+                    root_ = kNoNode;
+                }
+                break;
+            }
+            auto& parent = nodes_[path.steps[depth - 1].node];
+            auto index = path.steps[depth].index_in_parent;
+            auto is_left = MergesIntoLeft(index);
+            auto sibling_index = is_left ? index - 1 : index + 1;
+            auto& sibling = nodes_[parent.children[sibling_index]];
+            MoveAllInto(vertex, sibling, is_left);
+            if (is_left) {
+                parent.keys[sibling_index] = sibling.keys[sibling.key_count - 1];
+            }
+            if (sibling.key_count > kMaxFanout) {
+                Free(path.steps[depth].node);
+                EraseAt(parent.keys, parent.key_count, index);
+                EraseAt(parent.children, parent.key_count, index);
+                --parent.key_count;
+                // After `vertex` is erased from `parent`, a right sibling takes its place.
+                auto new_index = is_left ? sibling_index : index;
+                path.steps[depth] = PathStep{.node = parent.children[new_index], .index_in_parent = new_index};
+                SplitNode(path, depth);
+                break;
+            }
+            // The emptied node is erased from the parent on the next level.
+            key_index = index;
+        }
+        return true;
+    }
+
+    constexpr ssize_t GetSize() const {
+        return size_;
+    }
+
+    //! Height of the tree, where leaves are of height 0, or -1 for an empty tree.
+    constexpr ssize_t GetHeight() const {
+        ssize_t height = -1;
+        for (auto node = root_; node != kNoNode; node = nodes_[node].is_leaf ? kNoNode : nodes_[node].children[0]) {
+            ++height;
+        }
+        return height;
+    }
+
+    //! Calls `visit(depth, keys)` for every node in pre-order, where `keys` is a `std::span<const Key>`.
+    template <typename TVisit>
+    constexpr void VisitNodes(TVisit&& visit) const {
+        if (root_ != kNoNode) {
+            VisitSubtree(root_, 0, visit);
+        }
+    }
+
+    //! Calls `visit(key)` for every key in increasing order.
+    template <typename TVisit>
+    constexpr void VisitKeys(TVisit&& visit) const {
+        if (root_ != kNoNode) {
+            VisitLeafKeys(root_, visit);
+        }
+    }
+
+private:
+    constexpr int32_t Allocate() {
+        assert(free_count_ > 0 && "Static tree is out of nodes");
+        auto node = free_nodes_[--free_count_];
+        nodes_[node] = Node{};
+        return node;
+    }
+
+    constexpr void Free(int32_t node) {
+        free_nodes_[free_count_++] = node;
+    }
+
+    //! Path from the root to the leaf where `x` belongs.
+    constexpr Path Descend(const Key& x) const {
+        Path path;
+        PathStep step{.node = root_, .index_in_parent = -1};
+        while (true) {
+            path.steps[path.length++] = step;
+            const auto& vertex = nodes_[step.node];
+            if (vertex.is_leaf) {
+                break;
+            }
+            auto index = ChildIndexFor(vertex.keys.begin(), vertex.keys.begin() + vertex.key_count, x);
+            step = PathStep{.node = vertex.children[index], .index_in_parent = index};
+        }
+        return path;
+    }
+
+    constexpr int32_t FindLeaf(const Key& x) const {
+        auto node = root_;
+        while (!nodes_[node].is_leaf) {
+            const auto& vertex = nodes_[node];
+            node = vertex.children[ChildIndexFor(vertex.keys.begin(), vertex.keys.begin() + vertex.key_count, x)];
+        }
+        return node;
+    }
+
+    //! Repeats `BPlusTree::UpdateKeys`: separators along `path` become maximums of their children again, up to the
+    //! first one which already is.
+    constexpr void UpdateKeys(const Path& path) {
+        for (auto depth = path.length - 1; depth > 0; --depth) {
+            const auto& child = nodes_[path.steps[depth].node];
+            auto& separator = nodes_[path.steps[depth - 1].node].keys[path.steps[depth].index_in_parent];
+            auto maximum = child.keys[child.key_count - 1];
+            if (separator == maximum) {
+                break;
+            }
+            separator = maximum;
+        }
+    }
+
+    //! Repeats `BPlusTree::SplitNode`: splits the node at `depth` while it overflows and goes up the path.
+    constexpr void SplitNode(const Path& path, ssize_t depth) {
+        while (nodes_[path.steps[depth].node].key_count > kMaxFanout) {
+            SplitOnce(path, depth);
+            if (depth == 0) {
+                return;
+            }
+            --depth;
+        }
+    }
+
+    //! The first half stays in the node, the second one goes to a new node right after it.
+    constexpr void SplitOnce(const Path& path, ssize_t depth) {
+        auto first_index = path.steps[depth].node;
+        auto second_index = Allocate();
+        auto& first = nodes_[first_index];
+        auto& second = nodes_[second_index];
+        auto middle = SplitPoint(first.key_count);
+        second.is_leaf = first.is_leaf;
+        second.key_count = first.key_count - middle;
+        std::copy(first.keys.begin() + middle, first.keys.begin() + first.key_count, second.keys.begin());
+        if (!first.is_leaf) {
+            std::copy(first.children.begin() + middle, first.children.begin() + first.key_count,
+                      second.children.begin());
+        }
+        first.key_count = middle;
+        auto first_maximum = first.keys[first.key_count - 1];
+        auto second_maximum = second.keys[second.key_count - 1];
+        if (depth == 0) {
+            auto root_index = Allocate();
+            auto& root = nodes_[root_index];
+            root.is_leaf = false;
+            root.key_count = 2;
+            root.keys[0] = first_maximum;
+            root.keys[1] = second_maximum;
+            root.children[0] = first_index;
+            root.children[1] = second_index;
+            root_ = root_index;
+            return;
+        }
+        auto& parent = nodes_[path.steps[depth - 1].node];
+        auto index = path.steps[depth].index_in_parent;
+        parent.keys[index] = first_maximum;
+        InsertAt(parent.keys, parent.key_count, index + 1, second_maximum);
+        InsertAt(parent.children, parent.key_count, index + 1, second_index);
+        ++parent.key_count;
+    }
+
+    static constexpr void MoveAllInto(Node& underfull, Node& sibling, bool is_sibling_left) {
+        auto count = underfull.key_count;
+        // Children of leaves are never read, so they are moved along with keys either way.
+        if (!is_sibling_left) {
+            std::copy_backward(sibling.keys.begin(), sibling.keys.begin() + sibling.key_count,
+                               sibling.keys.begin() + sibling.key_count + count);
+            std::copy_backward(sibling.children.begin(), sibling.children.begin() + sibling.key_count,
+                               sibling.children.begin() + sibling.key_count + count);
+        }
+        auto position = is_sibling_left ? sibling.key_count : 0;
+        std::copy(underfull.keys.begin(), underfull.keys.begin() + count, sibling.keys.begin() + position);
+        std::copy(underfull.children.begin(), underfull.children.begin() + count, sibling.children.begin() + position);
+        sibling.key_count += count;
+        underfull.key_count = 0;
+    }
+
+    template <typename TItem, size_t kSize>
+    static constexpr void InsertAt(std::array<TItem, kSize>& items, ssize_t count, ssize_t position, TItem item) {
+        std::copy_backward(items.begin() + position, items.begin() + count, items.begin() + count + 1);
+        items[position] = item;
+    }
+
+    template <typename TItem, size_t kSize>
+    static constexpr void EraseAt(std::array<TItem, kSize>& items, ssize_t count, ssize_t position) {
+        std::copy(items.begin() + position + 1, items.begin() + count, items.begin() + position);
+    }
+
+    template <typename TVisit>
+    constexpr void VisitSubtree(int32_t node, ssize_t depth, TVisit& visit) const {
+        const auto& vertex = nodes_[node];
+        visit(depth, std::span<const Key>(vertex.keys.data(), vertex.key_count));
+        if (!vertex.is_leaf) {
+            for (ssize_t index = 0; index < vertex.key_count; ++index) {
+                VisitSubtree(vertex.children[index], depth + 1, visit);
+            }
+        }
+    }
+
+    template <typename TVisit>
+    constexpr void VisitLeafKeys(int32_t node, TVisit& visit) const {
+        const auto& vertex = nodes_[node];
+        for (ssize_t index = 0; index < vertex.key_count; ++index) {
+            if (vertex.is_leaf) {
+                visit(vertex.keys[index]);
+            } else {
+                VisitLeafKeys(vertex.children[index], visit);
+            }
+        }
+    }
+
+    std::array<Node, kMaxNodes> nodes_{};
+    //! Indices of unused nodes, a stack.
+    std::array<int32_t, kMaxNodes> free_nodes_{};
+    ssize_t free_count_ = kMaxNodes;
+    int32_t root_ = kNoNode;
+    ssize_t size_ = 0;
+};
+
+} // namespace NVis
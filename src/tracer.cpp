@@ -0,0 +1,80 @@
+#include "tracer.h"
+
+#include <fstream>
+#include <iomanip>
+
+namespace NVis {
+
+Tracer& Tracer::Instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::Start() {
+    std::lock_guard lock(mutex_);
+    events_.clear();
+    dropped_count_ = 0;
+    start_time_ = std::chrono::steady_clock::now();
+    is_enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::Stop() {
+    is_enabled_.store(false, std::memory_order_relaxed);
+}
+
+void Tracer::Record(const Event& event) {
+    auto thread_index = CurrentThreadIndex();
+    std::lock_guard lock(mutex_);
+    if (std::ssize(events_) >= kMaxEvents) {
+        ++dropped_count_;
+        return;
+    }
+    events_.emplace_back(event).thread_index = thread_index;
+}
+
+ssize_t Tracer::GetDroppedCount() const {
+    std::lock_guard lock(mutex_);
+    return dropped_count_;
+}
+
+void Tracer::WriteChromeJson(std::ostream& output) const {
+    using Microseconds = std::chrono::duration<double, std::micro>;
+
+    std::lock_guard lock(mutex_);
+    // Nanosecond precision without exponents, which trace viewers don't expect.
+    output << std::fixed << std::setprecision(3);
+    output << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool is_first = true;
+    for (const auto& event : events_) {
+        if (!is_first) {
+            output << ',';
+        }
+        is_first = false;
+        // Names are literals from our own code, so they need no escaping.
+        output << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"X\""
+               << ",\"ts\":" << Microseconds(event.start - start_time_).count()
+               << ",\"dur\":" << Microseconds(event.duration).count() << ",\"pid\":1,\"tid\":" << event.thread_index;
+        if (event.arg_name) {
+            output << ",\"args\":{\"" << event.arg_name << "\":" << event.arg_value << '}';
+        }
+        output << '}';
+    }
+    output << "]}\n";
+}
+
+bool Tracer::WriteChromeJsonFile(const std::string& path) const {
+    std::ofstream output(path);
+    if (!output) {
+        return false;
+    }
+    WriteChromeJson(output);
+    return static_cast<bool>(output);
+}
+
+int Tracer::CurrentThreadIndex() {
+    static std::atomic<int> thread_count = 0;
+    thread_local int thread_index = ++thread_count;
+    return thread_index;
+}
+
+} // namespace NVis
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace NVis {
+
+//! Process-wide recorder of timestamped spans, exported as Chrome trace-event JSON which opens in Perfetto or
+//! chrome://tracing. Tracing is off until `Start()`, and while it's off a span costs one relaxed atomic load.
+class Tracer {
+public:
+    //! Names and categories of spans are never copied, so they must be string literals or live as long as the tracer.
+    struct Event {
+        const char* name;
+        const char* category;
+        //! Name of the only integer argument of the span or `nullptr` if there's none.
+        const char* arg_name;
+        int64_t arg_value;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::duration duration;
+        int thread_index;
+    };
+
+    //! Spans beyond this count are dropped, so a forgotten tracer doesn't eat all the memory.
+    static constexpr ssize_t kMaxEvents = ssize_t{1} << 20;
+
+    static Tracer& Instance();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    Tracer(Tracer&&) = delete;
+    Tracer& operator=(Tracer&&) = delete;
+
+    //! Drops previously recorded spans and starts recording new ones.
+    void Start();
+    void Stop();
+    bool IsEnabled() const {
+        return is_enabled_.load(std::memory_order_relaxed);
+    }
+
+    void Record(const Event& event);
+    ssize_t GetDroppedCount() const;
+
+    void WriteChromeJson(std::ostream& output) const;
+    //! Returns `false` if the file can't be written.
+    bool WriteChromeJsonFile(const std::string& path) const;
+
+private:
+    Tracer() = default;
+
+    //! Small stable number of the calling thread, Perfetto shows one track per number.
+    static int CurrentThreadIndex();
+
+    std::atomic<bool> is_enabled_ = false;
+    mutable std::mutex mutex_;
+    std::chrono::steady_clock::time_point start_time_;
+    std::vector<Event> events_;
+    ssize_t dropped_count_ = 0;
+};
+
+//! Records the time between its construction and destruction as a span, if tracing was on at construction.
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* category, const char* arg_name = nullptr, int64_t arg_value = 0)
+        : is_enabled_(Tracer::Instance().IsEnabled()) {
+        if (is_enabled_) {
+            event_ = Tracer::Event{
+                .name = name,
+                .category = category,
+                .arg_name = arg_name,
+                .arg_value = arg_value,
+                .start = std::chrono::steady_clock::now(),
+                .duration = {},
+                .thread_index = 0,
+            };
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+    TraceSpan(TraceSpan&&) = delete;
+    TraceSpan& operator=(TraceSpan&&) = delete;
+
+    ~TraceSpan() {
+        if (is_enabled_) {
+            event_.duration = std::chrono::steady_clock::now() - event_.start;
+            Tracer::Instance().Record(event_);
+        }
+    }
+
+private:
+    bool is_enabled_;
+    Tracer::Event event_{};
+};
+
+} // namespace NVis
@@ -0,0 +1,64 @@
+#include "tree_action.h"
+
+#include <cassert>
+
+namespace NVis {
+
+void ObservedTree::Apply(const TreeActionsBatch& actions) {
+    for (const auto& action : actions) {
+        switch (action.action_type) {
+        case ENodeAction::Create:
+        case ENodeAction::Change: {
+            assert(action.data.has_value() && "No data of a node to remember");
+            auto& shard = GetMutableShard(action.node_address);
+            auto is_new = shard.insert_or_assign(action.node_address, *action.data).second;
+            node_count_ += is_new ? 1 : 0;
+            break;
+        }
+        case ENodeAction::Delete:
+            // Looked up before writing, so that deleting an unknown node doesn't copy its shard.
+            if (auto shard = GetShard(GetShardIndex(action.node_address));
+                shard != nullptr && shard->contains(action.node_address)) {
+                GetMutableShard(action.node_address).erase(action.node_address);
+                --node_count_;
+            }
+            break;
+        case ENodeAction::MakeRoot:
+            root_ = action.node_address;
+            break;
+        case ENodeAction::Visit:
+        case ENodeAction::StartQuery:
+        case ENodeAction::EndQuery:
+            break;
+        }
+    }
+}
+
+void ObservedTree::AppendCreation(TreeActionsBatch& actions) const {
+    actions.reserve(actions.size() + node_count_ + 1);
+    ForEachNode([&actions](MemoryAddress address, const NodeInfo& info) {
+        actions.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Create, .data = info});
+    });
+    actions.emplace_back(TreeAction{.node_address = root_, .action_type = ENodeAction::MakeRoot});
+}
+
+ssize_t ObservedTree::GetShardIndex(MemoryAddress address) {
+    // Fibonacci hashing, so that nodes allocated next to each other spread over shards.
+    static constexpr uint64_t kMultiplier = 0x9E3779B97F4A7C15;
+    return static_cast<ssize_t>((reinterpret_cast<uintptr_t>(address) >> 4) * kMultiplier >> (64 - kShardBits));
+}
+
+auto ObservedTree::GetMutableShard(MemoryAddress address) -> Shard& {
+    if (shards_.empty()) {
+        shards_.resize(kShardCount);
+    }
+    auto& shard = shards_[GetShardIndex(address)];
+    if (!shard) {
+        shard = std::make_shared<Shard>();
+    } else if (shard.use_count() > 1) {
+        shard = std::make_shared<Shard>(*shard);
+    }
+    return *shard;
+}
+
+} // namespace NVis
@@ -1,7 +1,11 @@
 #pragma once
 
+#include "observer.h"
+
 #include <cstdint>
+#include <memory>
 #include <optional>
+#include <unordered_map>
 #include <vector>
 
 namespace NVis {
@@ -22,6 +26,8 @@ using MemoryAddress = void*;
 struct NodeInfo {
     std::vector<Key> keys;
     std::vector<MemoryAddress> children;
+
+    bool operator==(const NodeInfo&) const = default;
 };
 
 struct TreeAction {
@@ -34,4 +40,62 @@ struct TreeAction {
 
 using TreeActionsBatch = std::vector<TreeAction>;
 
+//! A tree as its observer knows it: the root and the last state of every node, by addresses. Nodes are kept in a fixed
+//! number of shards by address, which copies share until they change: a shard is copied on the first write to it. So
+//! a copy takes O(kShardCount) whatever the size of the tree, and copies taken now and then, like keyframes of
+//! `AnimationTimeline`, take only the memory of the shards changed in between.
+class ObservedTree {
+public:
+    using Shard = std::unordered_map<MemoryAddress, NodeInfo>;
+
+    static constexpr int kShardBits = 12;
+    static constexpr ssize_t kShardCount = ssize_t{1} << kShardBits;
+
+    //! Follows `Create`, `Change`, `Delete` and `MakeRoot` actions of `actions`, the rest change nothing.
+    void Apply(const TreeActionsBatch& actions);
+    //! Appends `Create` actions of all the nodes and `MakeRoot`, which bring an observer knowing nothing to this tree.
+    void AppendCreation(TreeActionsBatch& actions) const;
+
+    ssize_t GetNodeCount() const {
+        return node_count_;
+    }
+    template <typename TFunc>
+    void ForEachNode(TFunc&& func) const {
+        for (const auto& shard : shards_) {
+            if (shard) {
+                for (const auto& [address, info] : *shard) {
+                    func(address, info);
+                }
+            }
+        }
+    }
+    //! The `index`-th shard, null if it has never had nodes. Copies sharing a shard return the same one.
+    const Shard* GetShard(ssize_t index) const {
+        return shards_.empty() ? nullptr : shards_[index].get();
+    }
+
+private:
+    static ssize_t GetShardIndex(MemoryAddress address);
+    //! The shard of `address` for writing, copied first if it's shared.
+    Shard& GetMutableShard(MemoryAddress address);
+
+    MemoryAddress root_ = nullptr;
+    //! Empty until the first node comes, so that copies of empty trees cost nothing.
+    std::vector<std::shared_ptr<Shard>> shards_;
+    ssize_t node_count_ = 0;
+};
+
+//! Interest of an observer of `TreeActionsBatch` in actions of type `action`.
+constexpr InterestMask ActionInterest(ENodeAction action) {
+    return InterestMask{1} << static_cast<int>(action);
+}
+
+//! Interest in `data` of `Create` and `Change` actions. Without it these actions come with `std::nullopt` data.
+inline constexpr InterestMask kNodePayloadInterest = InterestMask{1} << 16;
+
+//! Interest in actions that change the shape of the tree, without their payloads.
+inline constexpr InterestMask kStructuralInterest =
+    ActionInterest(ENodeAction::Create) | ActionInterest(ENodeAction::Delete) | ActionInterest(ENodeAction::Change) |
+    ActionInterest(ENodeAction::MakeRoot);
+
 } // namespace NVis
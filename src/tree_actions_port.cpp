@@ -0,0 +1,550 @@
+#include "tree_actions_port.h"
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace NVis {
+
+void TreeActionsPort::Subscribe(Observer<TreeActionsBatch>* observer) {
+    assert(!is_coalescing_ && "Subscribing while coalescing would give an incomplete snapshot");
+    streams_.erase(observer);
+    observable_.Subscribe(observer);
+}
+
+void TreeActionsPort::SubscribeStreaming(Observer<TreeActionsBatch>* observer, ssize_t chunk_size) {
+    assert(!is_coalescing_ && "Subscribing while coalescing would give an incomplete snapshot");
+    assert(chunk_size > 0 && "Snapshot can't be streamed by empty chunks");
+    streams_[observer] = SnapshotStream{.observer = observer, .chunk_size = chunk_size};
+    // Observer starts from an empty structure, the rest comes in chunks.
+    observable_.SubscribeWithData(observer, {TreeAction{.action_type = ENodeAction::StartQuery},
+                                             TreeAction{.action_type = ENodeAction::EndQuery}});
+    PumpSnapshots();
+}
+
+void TreeActionsPort::PumpSnapshots() const {
+    if (is_coalescing_) {
+        return;
+    }
+    for (auto observer : ListStreamingObservers()) {
+        auto it = streams_.find(observer);
+        if (it == streams_.end()) {
+            continue;
+        }
+        auto& stream = it->second;
+        if (stream.is_held) {
+            continue;
+        }
+        TreeActionsBatch chunk;
+        chunk.emplace_back(TreeAction{.action_type = ENodeAction::StartQuery});
+        if (!IsRootKnown(stream)) {
+            EmitNextChunk(stream, chunk);
+        }
+        FinishStreamQuery(stream, &chunk);
+        chunk.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+        auto subscriber = stream.observer;
+        if (stream.is_complete) {
+            streams_.erase(it);
+            observable_.SetAlwaysFiltered(subscriber, false);
+        }
+        Deliver(subscriber, chunk);
+    }
+}
+
+bool TreeActionsPort::HasPendingSnapshots() const {
+    return !streams_.empty();
+}
+
+void TreeActionsPort::RestartSnapshots() const {
+    assert(!is_coalescing_ && "Restarting snapshots in the middle of a batch");
+    for (auto observer : ListStreamingObservers()) {
+        auto& stream = streams_.at(observer);
+        assert(!stream.is_held && "Restarting a snapshot before the summary of a batch");
+        std::vector<MemoryAddress> known;
+        if (auto root = get_root_(); stream.cut && root != nullptr) {
+            CollectKnown(root, *stream.cut, known);
+        }
+        stream.cut.reset();
+        stream.boundary.clear();
+        stream.touched.clear();
+        // Top-down, so the observer never has a node referring to a deleted one. Forgetting is chunked like
+        // learning, since the observer may have got almost the whole structure.
+        auto subscriber = stream.observer;
+        auto chunk_size = stream.chunk_size;
+        for (auto first = known.rbegin(); first != known.rend() && observable_.IsSubscribed(subscriber);) {
+            auto last = first + std::min<ssize_t>(chunk_size, known.rend() - first);
+            TreeActionsBatch chunk;
+            chunk.emplace_back(TreeAction{.action_type = ENodeAction::StartQuery});
+            for (; first != last; ++first) {
+                chunk.emplace_back(TreeAction{.node_address = *first, .action_type = ENodeAction::Delete});
+            }
+            chunk.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+            Deliver(subscriber, chunk);
+        }
+    }
+}
+
+void TreeActionsPort::Notify(TreeActionsBatch actions) const {
+    CountNotified(actions);
+    if (is_coalescing_) {
+        Coalesce(actions);
+        // Nodes may cross the cut of a stream in the middle of a batch, so streams follow it to tell the summary.
+        for (auto& [observer, stream] : streams_) {
+            FilterForStream(actions, stream, nullptr);
+        }
+        return;
+    }
+    bool is_query_finished = !actions.empty() && actions.back().action_type == ENodeAction::EndQuery;
+    {
+        TraceSpan span("Notify", "observer", "subscribers", observable_.GetSubscriberCount());
+        observable_.Notify(std::move(actions));
+    }
+    // Snapshots advance by one chunk per query, so writers are never paused for longer than a chunk takes.
+    if (is_query_finished && !streams_.empty()) {
+        PumpSnapshots();
+    }
+}
+
+void TreeActionsPort::NotifySummary(TreeActionsBatch summary) const {
+    is_delivering_summary_ = true;
+    Notify(std::move(summary));
+    is_delivering_summary_ = false;
+}
+
+void TreeActionsPort::StartCoalescing() {
+    assert(!is_coalescing_ && "Coalescing is already started");
+    is_coalescing_ = true;
+    is_root_changed_ = false;
+    coalesced_nodes_.clear();
+}
+
+TreeActionsBatch TreeActionsPort::StopCoalescing() {
+    assert(is_coalescing_ && "Coalescing wasn't started");
+    is_coalescing_ = false;
+    for (auto& [observer, stream] : streams_) {
+        stream.is_held = true;
+    }
+
+    TreeActionsBatch summary;
+    summary.emplace_back(TreeAction{.action_type = ENodeAction::StartQuery});
+    // Deletions go first so that an address which has been freed and then reused by a new node never appears twice
+    // in the drawing model.
+    for (const auto& [address, node] : coalesced_nodes_) {
+        if (node.action == ENodeAction::Delete) {
+            summary.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+        }
+    }
+    for (const auto& [address, node] : coalesced_nodes_) {
+        if (node.action != ENodeAction::Delete) {
+            summary.emplace_back(
+                TreeAction{.node_address = address, .action_type = node.action, .data = describe_node_(address)});
+        }
+    }
+    if (is_root_changed_) {
+        summary.emplace_back(TreeAction{.node_address = root_, .action_type = ENodeAction::MakeRoot});
+    }
+    summary.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    coalesced_nodes_.clear();
+    return summary;
+}
+
+bool TreeActionsPort::IsInterestedIn(InterestMask interest) const {
+    // Coalescing keeps nothing but the shape of the tree.
+    auto current_interest = is_coalescing_ ? kStructuralInterest : observable_.GetInterest();
+    return (current_interest & interest) != 0;
+}
+
+bool TreeActionsPort::IsCoalescing() const {
+    return is_coalescing_;
+}
+
+void TreeActionsPort::Coalesce(const TreeActionsBatch& actions) const {
+    for (const auto& action : actions) {
+        auto it = coalesced_nodes_.find(action.node_address);
+        switch (action.action_type) {
+        case ENodeAction::Visit:
+            [[fallthrough]];
+        case ENodeAction::StartQuery:
+            [[fallthrough]];
+        case ENodeAction::EndQuery:
+            break;
+        case ENodeAction::Create:
+            if (it == coalesced_nodes_.end()) {
+                coalesced_nodes_.emplace(action.node_address,
+                                         CoalescedNode{.action = ENodeAction::Create, .is_known = false});
+            } else {
+                assert(it->second.action == ENodeAction::Delete && "Creating an alive node");
+                // The address was freed and reused. For observers who knew the old node it's just a change.
+                it->second.action = it->second.is_known ? ENodeAction::Change : ENodeAction::Create;
+            }
+            break;
+        case ENodeAction::Delete:
+            if (it == coalesced_nodes_.end()) {
+                coalesced_nodes_.emplace(action.node_address,
+                                         CoalescedNode{.action = ENodeAction::Delete, .is_known = true});
+            } else if (!it->second.is_known) {
+                coalesced_nodes_.erase(it);
+            } else {
+                it->second.action = ENodeAction::Delete;
+            }
+            break;
+        case ENodeAction::Change:
+            if (it == coalesced_nodes_.end()) {
+                coalesced_nodes_.emplace(action.node_address,
+                                         CoalescedNode{.action = ENodeAction::Change, .is_known = true});
+            }
+            break;
+        case ENodeAction::MakeRoot:
+            is_root_changed_ = true;
+            root_ = action.node_address;
+            break;
+        }
+    }
+}
+
+std::optional<TreeActionsBatch> TreeActionsPort::FilterActions(const TreeActionsBatch& actions,
+                                                               const Observer<TreeActionsBatch>& observer) const {
+    auto it = streams_.find(&observer);
+    if (it == streams_.end()) {
+        return FilterByInterest(actions, observer.GetInterest());
+    }
+    auto& stream = it->second;
+    TreeActionsBatch rewritten;
+    if (is_delivering_summary_) {
+        rewritten = FilterSummaryForStream(stream);
+    } else {
+        FilterForStream(actions, stream, &rewritten);
+    }
+    if (stream.is_complete) {
+        observable_.SetAlwaysFiltered(stream.observer, false);
+        streams_.erase(it);
+    }
+    if (observer.GetInterest() != kInterestedInEverything) {
+        return FilterByInterest(rewritten, observer.GetInterest());
+    }
+    if (rewritten.empty()) {
+        return std::nullopt;
+    }
+    return rewritten;
+}
+
+std::optional<TreeActionsBatch> TreeActionsPort::FilterByInterest(const TreeActionsBatch& actions,
+                                                                  InterestMask interest) {
+    TreeActionsBatch filtered;
+    for (const auto& action : actions) {
+        if (!(interest & ActionInterest(action.action_type))) {
+            continue;
+        }
+        if (interest & kNodePayloadInterest) {
+            filtered.emplace_back(action);
+        } else {
+            filtered.emplace_back(TreeAction{.node_address = action.node_address, .action_type = action.action_type});
+        }
+    }
+    if (filtered.empty()) {
+        return std::nullopt;
+    }
+    return filtered;
+}
+
+void TreeActionsPort::FilterForStream(const TreeActionsBatch& actions, SnapshotStream& stream,
+                                      TreeActionsBatch* rewritten) const {
+    auto append = [rewritten](const TreeAction& action) {
+        if (rewritten != nullptr) {
+            rewritten->emplace_back(action);
+        }
+    };
+    for (ssize_t index = 0; index < std::ssize(actions); ++index) {
+        const auto& action = actions[index];
+        auto address = action.node_address;
+        switch (action.action_type) {
+        case ENodeAction::StartQuery:
+            append(action);
+            break;
+        case ENodeAction::EndQuery:
+            FinishStreamQuery(stream, rewritten);
+            append(action);
+            break;
+        case ENodeAction::Visit:
+            if (IsKnown(address, stream)) {
+                append(action);
+            }
+            break;
+        case ENodeAction::MakeRoot:
+            // Known root means that the whole structure is known. Otherwise the root comes with the last chunk.
+            if (address == nullptr || IsKnown(address, stream)) {
+                append(action);
+            }
+            break;
+        case ENodeAction::Delete: {
+            bool was_known = false;
+            if (auto touched = stream.touched.find(address); touched != stream.touched.end()) {
+                was_known = touched->second.is_known;
+            } else if (auto boundary = stream.boundary.find(address); boundary != stream.boundary.end()) {
+                was_known = boundary->second;
+            } else {
+                was_known = WasKnownLikeNeighbour(actions, index, stream);
+            }
+            stream.touched.try_emplace(address, StreamedNode{.was_known = was_known, .is_known = false})
+                .first->second.is_known = false;
+            if (was_known) {
+                append(action);
+            }
+            break;
+        }
+        case ENodeAction::Create:
+            [[fallthrough]];
+        case ENodeAction::Change: {
+            bool was_known = false;
+            if (auto touched = stream.touched.find(address); touched != stream.touched.end()) {
+                was_known = touched->second.is_known;
+            } else if (action.action_type == ENodeAction::Change) {
+                was_known = IsKnown(address, stream);
+            }
+            bool is_known = IsUpToCut(action.data ? action.data->keys : describe_node_(address).keys, stream);
+            stream.touched.try_emplace(address, StreamedNode{.was_known = was_known, .is_known = is_known})
+                .first->second.is_known = is_known;
+            if (is_known) {
+                auto forwarded = action;
+                forwarded.action_type = was_known ? ENodeAction::Change : ENodeAction::Create;
+                append(forwarded);
+            } else if (was_known) {
+                // The node has got keys from beyond the cut. It will come again with one of the next chunks, and so
+                // will its ancestors, which are beyond the cut already.
+                append(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+            }
+            break;
+        }
+        }
+    }
+}
+
+TreeActionsBatch TreeActionsPort::FilterSummaryForStream(SnapshotStream& stream) const {
+    struct Arrived {
+        MemoryAddress address;
+        bool was_known;
+        NodeInfo info;
+        ssize_t height;
+    };
+    TreeActionsBatch rewritten;
+    rewritten.emplace_back(TreeAction{.action_type = ENodeAction::StartQuery});
+    std::vector<Arrived> arrived;
+    for (const auto& [address, node] : stream.touched) {
+        if (node.is_known) {
+            arrived.emplace_back(Arrived{
+                .address = address, .was_known = node.was_known, .info = describe_node_(address), .height = 0});
+        } else if (node.was_known) {
+            rewritten.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+        }
+    }
+    // Children go before parents: their maximums aren't greater, and of the nodes with the same maximum the lower one
+    // goes first.
+    for (auto& node : arrived) {
+        for (auto child = node.info.children; !child.empty(); child = describe_node_(child.front()).children) {
+            ++node.height;
+        }
+    }
+    std::sort(arrived.begin(), arrived.end(), [](const Arrived& lhs, const Arrived& rhs) {
+        return std::pair(lhs.info.keys.back(), lhs.height) < std::pair(rhs.info.keys.back(), rhs.height);
+    });
+    for (auto& node : arrived) {
+        rewritten.emplace_back(TreeAction{.node_address = node.address,
+                                          .action_type = node.was_known ? ENodeAction::Change : ENodeAction::Create,
+                                          .data = std::move(node.info)});
+    }
+    stream.is_held = false;
+    FinishStreamQuery(stream, &rewritten);
+    rewritten.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    return rewritten;
+}
+
+void TreeActionsPort::FinishStreamQuery(SnapshotStream& stream, TreeActionsBatch* rewritten) const {
+    if (is_coalescing_ || stream.is_held) {
+        // Touched nodes are kept for the summary.
+        RebuildBoundary(stream);
+        return;
+    }
+    stream.touched.clear();
+    if (IsRootKnown(stream)) {
+        if (rewritten != nullptr) {
+            rewritten->emplace_back(TreeAction{.node_address = get_root_(), .action_type = ENodeAction::MakeRoot});
+        }
+        stream.boundary.clear();
+        stream.is_complete = true;
+        return;
+    }
+    RebuildBoundary(stream);
+}
+
+void TreeActionsPort::EmitNextChunk(SnapshotStream& stream, TreeActionsBatch& chunk) const {
+    struct Frame {
+        MemoryAddress address;
+        NodeInfo info;
+        //! Index of the child the path goes through.
+        ssize_t child_index;
+    };
+    // Path to the first leaf with keys beyond the cut, then to the next leaves in order. Nodes go to the chunk when
+    // their last child has gone, so every leaf comes with the ancestors having the same maximum.
+    std::vector<Frame> path;
+    auto descend = [this, &path](MemoryAddress vertex, const std::optional<Key>& cut) {
+        while (true) {
+            auto info = describe_node_(vertex);
+            auto is_leaf = info.children.empty();
+            ssize_t child_index =
+                cut && !is_leaf ? std::upper_bound(info.keys.begin(), info.keys.end(), *cut) - info.keys.begin() : 0;
+            auto next = is_leaf ? nullptr : info.children[child_index];
+            path.emplace_back(Frame{.address = vertex, .info = std::move(info), .child_index = child_index});
+            if (is_leaf) {
+                return;
+            }
+            vertex = next;
+        }
+    };
+    descend(get_root_(), stream.cut);
+    ssize_t emitted_count = 0;
+    while (!path.empty()) {
+        ssize_t unit_size = 1;
+        for (auto frame = path.rbegin() + 1;
+             frame != path.rend() && frame->child_index + 1 == std::ssize(frame->info.children); ++frame) {
+            ++unit_size;
+        }
+        if (emitted_count > 0 && emitted_count + unit_size > stream.chunk_size) {
+            break;
+        }
+        emitted_count += unit_size;
+        stream.cut = path.back().info.keys.back();
+        for (ssize_t index = 0; index < unit_size; ++index) {
+            auto& frame = path.back();
+            chunk.emplace_back(TreeAction{
+                .node_address = frame.address, .action_type = ENodeAction::Create, .data = std::move(frame.info)});
+            path.pop_back();
+        }
+        if (!path.empty()) {
+            auto& parent = path.back();
+            descend(parent.info.children[++parent.child_index], std::nullopt);
+        }
+    }
+}
+
+void TreeActionsPort::CollectKnown(MemoryAddress vertex, Key cut, std::vector<MemoryAddress>& known) const {
+    auto info = describe_node_(vertex);
+    // Children after the first one beyond the cut are unknown with all their subtrees.
+    for (ssize_t index = 0; index < std::ssize(info.children) && (index == 0 || info.keys[index - 1] <= cut);
+         ++index) {
+        CollectKnown(info.children[index], cut, known);
+    }
+    if (!info.keys.empty() && info.keys.back() <= cut) {
+        known.emplace_back(vertex);
+    }
+}
+
+void TreeActionsPort::RebuildBoundary(SnapshotStream& stream) const {
+    stream.boundary.clear();
+    // With nothing known, every node is beyond the cut whatever happens.
+    if (!stream.cut) {
+        return;
+    }
+    std::vector<std::pair<MemoryAddress, NodeInfo>> path;
+    ssize_t straddling_count = 0;
+    for (auto vertex = get_root_(); vertex != nullptr;) {
+        auto info = describe_node_(vertex);
+        auto child_index = std::upper_bound(info.keys.begin(), info.keys.end(), *stream.cut) - info.keys.begin();
+        if (info.children.empty() || child_index == std::ssize(info.keys)) {
+            break;
+        }
+        auto next = info.children[child_index];
+        path.emplace_back(vertex, std::move(info));
+        // Below the last node with children on both sides, the path goes through first children beyond the cut.
+        if (child_index > 0) {
+            straddling_count = std::ssize(path);
+        }
+        vertex = next;
+    }
+    for (ssize_t depth = 0; depth < straddling_count; ++depth) {
+        const auto& [vertex, info] = path[depth];
+        stream.boundary[vertex] = false;
+        for (ssize_t index = 0; index < std::ssize(info.children); ++index) {
+            stream.boundary[info.children[index]] = info.keys[index] <= *stream.cut;
+        }
+    }
+}
+
+bool TreeActionsPort::IsKnown(MemoryAddress address, const SnapshotStream& stream) const {
+    if (auto touched = stream.touched.find(address); touched != stream.touched.end()) {
+        return touched->second.is_known;
+    }
+    if (auto boundary = stream.boundary.find(address); boundary != stream.boundary.end()) {
+        return boundary->second;
+    }
+    return IsUpToCut(describe_node_(address).keys, stream);
+}
+
+bool TreeActionsPort::IsRootKnown(const SnapshotStream& stream) const {
+    auto root = get_root_();
+    return root == nullptr || IsUpToCut(describe_node_(root).keys, stream);
+}
+
+bool TreeActionsPort::IsUpToCut(const std::vector<Key>& keys, const SnapshotStream& stream) {
+    return stream.cut && !keys.empty() && keys.back() <= *stream.cut;
+}
+
+bool TreeActionsPort::WasKnownLikeNeighbour(const TreeActionsBatch& actions, ssize_t index,
+                                            const SnapshotStream& stream) const {
+    auto is_alive = [](const TreeAction& action) {
+        return action.action_type == ENodeAction::Create || action.action_type == ENodeAction::Change;
+    };
+    for (auto previous = index - 1; previous >= 0; --previous) {
+        if (is_alive(actions[previous])) {
+            return stream.touched.at(actions[previous].node_address).is_known;
+        }
+    }
+    for (auto next = index + 1; next < std::ssize(actions); ++next) {
+        if (is_alive(actions[next])) {
+            const auto& action = actions[next];
+            return IsUpToCut(action.data ? action.data->keys : describe_node_(action.node_address).keys, stream);
+        }
+    }
+    return false;
+}
+
+std::vector<const Observer<TreeActionsBatch>*> TreeActionsPort::ListStreamingObservers() const {
+    std::vector<const Observer<TreeActionsBatch>*> observers;
+    observers.reserve(streams_.size());
+    for (auto it = streams_.begin(); it != streams_.end();) {
+        if (observable_.IsSubscribed(it->first)) {
+            observers.emplace_back(it->first);
+            ++it;
+        } else {
+            it = streams_.erase(it);
+        }
+    }
+    return observers;
+}
+
+void TreeActionsPort::Deliver(Observer<TreeActionsBatch>* observer, const TreeActionsBatch& actions) const {
+    if (observer->GetInterest() == kInterestedInEverything) {
+        observable_.NotifyOne(observer, actions);
+    } else if (auto filtered = FilterByInterest(actions, observer->GetInterest())) {
+        observable_.NotifyOne(observer, *filtered);
+    }
+}
+
+void TreeActionsPort::CountNotified(const TreeActionsBatch& actions) const {
+    if constexpr (kMetricsEnabled) {
+        if (metrics_ == nullptr) {
+            return;
+        }
+        auto bytes = std::ssize(actions) * static_cast<ssize_t>(sizeof(TreeAction));
+        for (const auto& action : actions) {
+            if (action.data) {
+                bytes += std::ssize(action.data->keys) * static_cast<ssize_t>(sizeof(Key)) +
+                         std::ssize(action.data->children) * static_cast<ssize_t>(sizeof(MemoryAddress));
+            }
+        }
+        metrics_->Add(ETreeCounter::NotifiedActions, std::ssize(actions));
+        metrics_->Add(ETreeCounter::NotifiedBytes, bytes);
+    }
+}
+
+} // namespace NVis
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "observer.h"
+#include "tree_action.h"
+#include "tree_metrics.h"
+
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace NVis {
+
+//! Observable end of a data structure model. Normally forwards every batch of actions straight to subscribers. While
+//! coalescing, it instead folds incoming batches into the net effect they have on the structure, so a long run of
+//! operations can be published later as one summarized batch.
+//!
+//! Port looks into the structure only through two functions: `describe_node`, which returns the current state of an
+//! alive node, and `get_root`, which returns the address of the current root. If `metrics` is given, the port counts
+//! notified actions and their size there.
+class TreeActionsPort {
+public:
+    template <typename TSubscribeDataFunc, typename TDescribeNodeFunc, typename TGetRootFunc>
+    TreeActionsPort(TSubscribeDataFunc&& subscribe_data_func, TDescribeNodeFunc&& describe_node,
+                    TGetRootFunc&& get_root, TreeMetrics* metrics = nullptr)
+        : observable_(std::forward<TSubscribeDataFunc>(subscribe_data_func),
+                      [this](const TreeActionsBatch& actions, const Observer<TreeActionsBatch>& observer) {
+                          return this->FilterActions(actions, observer);
+                      }),
+          describe_node_(std::forward<TDescribeNodeFunc>(describe_node)),
+          get_root_(std::forward<TGetRootFunc>(get_root)),
+          metrics_(metrics) {}
+
+    //! Subscribes `observer` and sends it the whole structure at once.
+    void Subscribe(Observer<TreeActionsBatch>* observer);
+    //! Subscribes `observer` without building the whole snapshot. Instead the observer gets the structure in chunks of
+    //! at most `chunk_size` nodes (or of a leaf with its ancestors, if they are more): one after every query and one
+    //! on every `PumpSnapshots()`. Chunks go in post-order, so the observer knows exactly the nodes with maximums up
+    //! to the last key it has got, and the port keeps nothing per node to follow it. Live updates of such nodes are
+    //! delivered in between, so at any moment the observer sees a part of the current structure, closed downwards
+    //! (children of a known node are known). The last chunk ends with `MakeRoot`, after which the observer is an
+    //! ordinary subscriber.
+    void SubscribeStreaming(Observer<TreeActionsBatch>* observer, ssize_t chunk_size);
+    //! Sends the next chunk to every observer still receiving its snapshot.
+    void PumpSnapshots() const;
+    bool HasPendingSnapshots() const;
+    //! Makes observers receiving snapshots forget what they know and start over. Must be called before operations
+    //! which rebuild the structure wholesale, since their nodes can't be told apart by maximums while it happens.
+    void RestartSnapshots() const;
+
+    void Notify(TreeActionsBatch actions) const;
+    //! Delivers a summary returned by `StopCoalescing()`.
+    void NotifySummary(TreeActionsBatch summary) const;
+
+    //! Returns `true` if anyone will look at something of `interest`, so the producer can skip building the rest.
+    bool IsInterestedIn(InterestMask interest) const;
+
+    //! Starts folding notifications instead of delivering them. Payloads of actions are ignored while coalescing, so
+    //! there is no need to produce them.
+    void StartCoalescing();
+    //! Stops coalescing and returns a batch that brings observers from the state before `StartCoalescing()` to the
+    //! current one.
+    TreeActionsBatch StopCoalescing();
+    bool IsCoalescing() const;
+
+private:
+    struct CoalescedNode {
+        //! Net action, one of `Create`, `Delete` or `Change`.
+        ENodeAction action;
+        //! Whether observers have known this node before coalescing started.
+        bool is_known;
+    };
+
+    struct StreamedNode {
+        bool was_known;
+        bool is_known;
+    };
+
+    struct SnapshotStream {
+        Observer<TreeActionsBatch>* observer;
+        ssize_t chunk_size;
+        //! The observer knows exactly the nodes with maximums up to `cut`, or nothing if it's empty.
+        std::optional<Key> cut = std::nullopt;
+        //! Nodes with keys on both sides of the cut and their children, mapped to whether the observer knows them. Only
+        //! these can cross the cut when they exchange children, so their state before an operation is remembered.
+        std::unordered_map<MemoryAddress, bool> boundary = {};
+        //! Nodes touched by the current operation, or by batches whose summary hasn't been delivered yet, with their
+        //! state for the observer before and after.
+        std::unordered_map<MemoryAddress, StreamedNode> touched = {};
+        //! Set for streams which have followed a batch, until its summary is delivered. They stand still meanwhile,
+        //! since their observers live in the state before the batch.
+        bool is_held = false;
+        bool is_complete = false;
+    };
+
+    void Coalesce(const TreeActionsBatch& actions) const;
+    std::optional<TreeActionsBatch> FilterActions(const TreeActionsBatch& actions,
+                                                  const Observer<TreeActionsBatch>& observer) const;
+    static std::optional<TreeActionsBatch> FilterByInterest(const TreeActionsBatch& actions, InterestMask interest);
+
+    //! Rewrites live actions for an observer which hasn't got the whole snapshot yet and appends them to `rewritten`.
+    //! While coalescing there's nothing to deliver and `rewritten` is null, but the stream still follows the actions.
+    void FilterForStream(const TreeActionsBatch& actions, SnapshotStream& stream, TreeActionsBatch* rewritten) const;
+    //! Brings the observer from its state before the coalesced batches to the current one.
+    TreeActionsBatch FilterSummaryForStream(SnapshotStream& stream) const;
+    //! Finishes a query for the stream: completes it if the root is known and remembers the new boundary.
+    void FinishStreamQuery(SnapshotStream& stream, TreeActionsBatch* rewritten) const;
+    //! Appends `Create` actions for the next nodes in post-order after the cut to `chunk` and moves the cut.
+    void EmitNextChunk(SnapshotStream& stream, TreeActionsBatch& chunk) const;
+    //! Appends nodes of `vertex`'s subtree with maximums up to `cut` to `known` in post-order.
+    void CollectKnown(MemoryAddress vertex, Key cut, std::vector<MemoryAddress>& known) const;
+    void RebuildBoundary(SnapshotStream& stream) const;
+    bool IsKnown(MemoryAddress address, const SnapshotStream& stream) const;
+    bool IsRootKnown(const SnapshotStream& stream) const;
+    static bool IsUpToCut(const std::vector<Key>& keys, const SnapshotStream& stream);
+    //! Tells whether the observer has known a node deleted without being touched before in the same operation. Such a
+    //! node is being replaced, as compaction does, so it's on the same side of the cut as its replacement: the node
+    //! of the previous `Create` or `Change`, or of the next one if there's none.
+    bool WasKnownLikeNeighbour(const TreeActionsBatch& actions, ssize_t index, const SnapshotStream& stream) const;
+    //! Lists observers with streams and drops the streams of the ones which have unsubscribed. Observers may
+    //! (un)subscribe from their callbacks, so `streams_` can't be iterated while delivering to them.
+    std::vector<const Observer<TreeActionsBatch>*> ListStreamingObservers() const;
+    void Deliver(Observer<TreeActionsBatch>* observer, const TreeActionsBatch& actions) const;
+    void CountNotified(const TreeActionsBatch& actions) const;
+
+    // Snapshot pumping happens from const notifications, and it switches observers to ordinary filtering.
+    mutable Observable<TreeActionsBatch> observable_;
+    std::function<NodeInfo(MemoryAddress)> describe_node_;
+    std::function<MemoryAddress()> get_root_;
+    TreeMetrics* metrics_;
+    mutable std::unordered_map<const Observer<TreeActionsBatch>*, SnapshotStream> streams_;
+    bool is_coalescing_ = false;
+    mutable bool is_delivering_summary_ = false;
+    mutable bool is_root_changed_ = false;
+    mutable MemoryAddress root_ = nullptr;
+    mutable std::unordered_map<MemoryAddress, CoalescedNode> coalesced_nodes_;
+};
+
+} // namespace NVis
@@ -1,207 +1,243 @@
 #include "tree_drawing_model.h"
 
+#include "tracer.h"
+#include "tree_layout.h"
+
+#include <QBrush>
 #include <QColor>
-#include <QGraphicsRectItem>
-#include <QGraphicsTextItem>
-#include <QLine>
+#include <QFont>
+#include <QGraphicsItem>
+#include <QPainter>
 #include <QPen>
-#include <QRect>
+#include <QStyleOptionGraphicsItem>
 
-#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <optional>
-#include <unordered_map>
-#include <unordered_set>
+#include <thread>
 
 namespace NVis {
 
-class TreeDrawingModel::TreeDrawingModelImpl {
-    struct NodeForDraw {
-        std::vector<Key> keys;
-        std::vector<MemoryAddress> children;
-        QColor background_color = QColorConstants::White;
-    };
-
+namespace {
+//! The whole tree as one item, which paints only the rows, cells and lines crossing the exposed rectangle. Thousands of
+//! items per frame would cost more to create than to paint.
+class RenderDataItem : public QGraphicsItem {
 public:
-    void DrawActions(const TreeActionsBatch& actions, QGraphicsScene* scene) {
-        for (const auto& action : actions) {
-            switch (action.action_type) {
+    RenderDataItem() {
+        setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+        font_.setPixelSize(kLabelPixelSize);
+    }
 
-            case ENodeAction::StartQuery:
-                [[fallthrough]];
-            case ENodeAction::EndQuery:
-                break;
-            case ENodeAction::Create:
-                assert(!address_to_node_.contains(action.node_address) && "Creating already existed node");
-                assert(action.data.has_value() && "No data when creating new node");
-                address_to_node_[action.node_address] = NodeForDraw{
-                    .keys = action.data->keys,
-                    .children = action.data->children,
-                    .background_color = QColorConstants::Green,
-                };
-                break;
-            case ENodeAction::Delete:
-                assert(address_to_node_.contains(action.node_address) && "Deleting non-existing node");
-                address_to_node_.erase(action.node_address);
-                break;
-            case ENodeAction::Change:
-                assert(address_to_node_.contains(action.node_address) && "Changing non-existing node");
-                assert(action.data.has_value() && "No data when changing a node");
-                address_to_node_[action.node_address] = NodeForDraw{
-                    .keys = action.data->keys,
-                    .children = action.data->children,
-                    .background_color = QColorConstants::Yellow,
-                };
-                break;
-            case ENodeAction::MakeRoot:
-                assert((action.node_address == nullptr || address_to_node_.contains(action.node_address)) &&
-                       "Making a non-existing node a root");
-                root_ = action.node_address;
-                break;
-            case ENodeAction::Visit:
-                assert(address_to_node_.contains(action.node_address) && "Visiting a non-existing node");
-                address_to_node_[action.node_address].background_color = QColorConstants::Cyan;
-                break;
-            }
-        }
-        DrawTree(scene);
+    void SetData(const RenderData* data) {
+        prepareGeometryChange();
+        data_ = data;
+        update();
     }
 
-private:
-    void RecalculateLeafCounters() {
-        leaf_node_count_ = 0;
-        leaf_key_count_ = 0;
-        RecalculateLeafCountersRecursively(root_);
+    QRectF boundingRect() const override {
+        if (data_ == nullptr) {
+            return QRectF();
+        }
+        // Borders of the cells stick out by half of the pen.
+        return QRectF(0, 0, data_->width, data_->height).adjusted(-1, -1, 1, 1);
     }
 
-    void RecalculateLeafCountersRecursively(MemoryAddress vertex) {
-        if (vertex == nullptr) {
+    void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget*) override {
+        if (data_ == nullptr) {
             return;
         }
-        // Leaf is a node without children.
-        if (address_to_node_[vertex].children.empty()) {
-            leaf_node_count_ += 1;
-            leaf_key_count_ += std::ssize(address_to_node_[vertex].keys);
-        }
-        for (ssize_t i = 0; i < std::ssize(address_to_node_[vertex].children); ++i) {
-            RecalculateLeafCountersRecursively(address_to_node_[vertex].children[i]);
+        TraceSpan span("Paint", "drawing");
+        auto exposed = option->exposedRect;
+        painter->setPen(QPen());
+        painter->setFont(font_);
+        for (const auto& row : data_->rows) {
+            if (row.y > exposed.bottom()) {
+                break;
+            }
+            auto bottom = row.y + TreeLayout::kCellHeight;
+            // Lines go down to the next row, so they may be exposed while the cells are not.
+            if (bottom + TreeLayout::kMargin < exposed.top()) {
+                continue;
+            }
+            for (const auto& line : RenderData::VisibleLines(row, exposed.left(), exposed.right())) {
+                painter->drawLine(QLineF(line.from_x, bottom, line.to_x, bottom + TreeLayout::kMargin));
+            }
+            if (bottom < exposed.top()) {
+                continue;
+            }
+            for (const auto& cell : RenderData::VisibleCells(row, exposed.left(), exposed.right())) {
+                QRectF rectangle(cell.x, row.y, TreeLayout::kCellWidth, TreeLayout::kCellHeight);
+                painter->setBrush(QBrush(ColorOf(cell.highlight)));
+                painter->drawRect(rectangle);
+                auto label = cell.Label();
+                painter->drawText(rectangle, Qt::AlignCenter,
+                                  QString::fromLatin1(label.data(), static_cast<qsizetype>(label.size())));
+            }
         }
     }
 
-    void DrawTree(QGraphicsScene* scene) {
-        RecalculateLeafCounters();
-        visited_leaf_key_count_ = 0;
-        visited_leaf_node_count_ = 0;
-        visited_nodes_.clear();
-        scene->clear();
-        RecursiveDrawTree(root_, scene);
-        CleanBackgroundRecursively(root_);
-        // Garbage collecting. First we write all the nodes we don't need to store, then erase them.
-        std::unordered_set<MemoryAddress> nodes_to_delete;
-        for (const auto& [address, node] : address_to_node_) {
-            if (!visited_nodes_.contains(address)) {
-                nodes_to_delete.insert(address);
-            }
-        }
-        for (auto deleting_address : nodes_to_delete) {
-            address_to_node_.erase(deleting_address);
+private:
+    static constexpr int kLabelPixelSize = 12;
+
+    static QColor ColorOf(ECellHighlight highlight) {
+        switch (highlight) {
+        case ECellHighlight::Created:
+            return QColorConstants::Green;
+        case ECellHighlight::Changed:
+            return QColorConstants::Yellow;
+        case ECellHighlight::Visited:
+            return QColorConstants::Cyan;
+        case ECellHighlight::None:
+            break;
         }
+        return QColorConstants::White;
     }
 
-    //! Returns top-middle point of the rectangle, which bounds keys that are drawn on call.
-    std::optional<QPointF> RecursiveDrawTree(MemoryAddress vertex, QGraphicsScene* scene, ssize_t current_height = 0) {
-        if (vertex == nullptr) {
-            // One probably should think of `if (root == nullptr)` instead of using `optional`.
-            return std::nullopt;
+    const RenderData* data_ = nullptr;
+    QFont font_;
+};
+} // namespace
+
+//! Render data is triple-buffered: the worker lays out into its own buffer, then swaps it with the ready one, which
+//! the GUI thread swaps with the shown one when it gets to it. The lock is held only for the swaps, so neither thread
+//! waits for the other to lay out or to paint.
+class TreeDrawingModel::TreeDrawingModelImpl {
+    struct Job {
+        //! State to start over from, if any.
+        std::optional<TreeActionsBatch> state;
+        TreeActionsBatch actions;
+    };
+
+public:
+    explicit TreeDrawingModelImpl(QGraphicsScene* scene)
+        : scene_(scene), item_(new RenderDataItem), working_(std::make_unique<RenderData>()),
+          ready_(std::make_unique<RenderData>()), shown_(std::make_unique<RenderData>()) {
+        // The scene owns the item.
+        scene_->addItem(item_);
+        item_->SetData(shown_.get());
+        worker_ = std::jthread([this](std::stop_token stop) { Run(stop); });
+    }
+
+    void Queue(Job job) {
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.emplace_back(std::move(job));
         }
-        // Maybe "left to us" is better to understand than "lefter"...
-        auto lefter_leaf_node_count = visited_leaf_node_count_;
-        auto lefter_leaf_key_count = visited_leaf_key_count_;
-        visited_nodes_.emplace(vertex);
-        std::optional<QPointF> top_left_corner;
-        std::vector<QPointF> children_positions;
-        children_positions.reserve(address_to_node_[vertex].children.size());
-        // Important invariant of this function is that we first traverse through our children and only then draw
-        // ourselves.
-        for (ssize_t i = 0; i < std::ssize(address_to_node_[vertex].children); ++i) {
-            auto child_position = RecursiveDrawTree(address_to_node_[vertex].children[i], scene, current_height + 1);
-            assert(child_position.has_value() && "Incorrect position of rectangle when drawing");
-            children_positions.emplace_back(child_position.value());
+        has_jobs_.notify_one();
+    }
+
+    void Flush() {
+        {
+            std::unique_lock lock(mutex_);
+            is_idle_.wait(lock, [this]() { return jobs_.empty() && !is_busy_; });
         }
-        if (address_to_node_[vertex].children.empty()) {
-            visited_leaf_node_count_++;
-            visited_leaf_key_count_ += std::ssize(address_to_node_[vertex].keys);
+        ShowReady();
+    }
+
+    DrawingModelMemoryStats MemoryStats() const {
+        auto stats = shown_->stats;
+        for (const auto& row : shown_->rows) {
+            stats.render_data += MeasureVector(row.cells);
+            stats.render_data += MeasureVector(row.lines);
         }
-        qreal left_subtree_border = lefter_leaf_key_count * kCellWidth + lefter_leaf_node_count * kHorizontalMargin;
-        qreal right_subtree_border =
-            visited_leaf_key_count_ * kCellWidth + (visited_leaf_node_count_ - 1) * kHorizontalMargin;
-        // "A middle point of the node being drawn". Try to fit it in a variable's name. And yes, we could write
-        // `(l+r)/2` instead of `l+(r-l)/2`, but second option seems more precision-friendly and intuitive.
-        qreal drawing_node_midpoint = left_subtree_border + (right_subtree_border - left_subtree_border) / 2.0;
-        top_left_corner = QPointF(drawing_node_midpoint - address_to_node_[vertex].keys.size() * kCellWidth / 2.0,
-                                  current_height * (kCellHeight + kHorizontalMargin));
-
-        for (ssize_t i = 0; i < std::ssize(address_to_node_[vertex].keys); ++i) {
-            auto position_to_draw = QPointF(top_left_corner->x() + i * kCellWidth, top_left_corner->y());
-            auto rectangle_item = scene->addRect(position_to_draw.x(), position_to_draw.y(), kCellWidth, kCellHeight,
-                                                 QPen(), QBrush(address_to_node_[vertex].background_color));
-            auto text_item = scene->addText(QString::number(address_to_node_[vertex].keys[i]));
-            // Positioning in the center of Cell.
-            text_item->setPos(rectangle_item->mapToScene(rectangle_item->boundingRect().center()) +
-                              (text_item->boundingRect().topLeft() - text_item->boundingRect().center()));
-            // Scale text from the center.
-            text_item->setTransformOriginPoint(text_item->boundingRect().center());
-            // TODO: maybe common scale factor for all keys would look better.
-            auto text_scale_factor =
-                std::min(rectangle_item->boundingRect().width() / text_item->boundingRect().width(),
-                         rectangle_item->boundingRect().height() / text_item->boundingRect().height());
-            text_item->setScale(text_scale_factor);
-
-            if (!children_positions.empty()) {
-                scene->addLine(
-                    QLineF(QPointF(position_to_draw.x() + kCellWidth / 2.0, position_to_draw.y() + kCellHeight),
-                           children_positions[i]));
+        stats.render_data += MeasureVector(shown_->rows);
+        return stats;
+    }
+
+private:
+    void Run(std::stop_token stop) {
+        while (true) {
+            std::deque<Job> jobs;
+            {
+                std::unique_lock lock(mutex_);
+                if (!has_jobs_.wait(lock, stop, [this]() { return !jobs_.empty(); })) {
+                    return;
+                }
+                jobs.swap(jobs_);
+                is_busy_ = true;
+            }
+            TraceSpan span("PrepareFrame", "drawing", "batches", std::ssize(jobs));
+            // Everything queued while the previous frame was laid out goes into one frame, highlights add up.
+            for (const auto& job : jobs) {
+                if (job.state) {
+                    layout_.Reset();
+                    layout_.Apply(*job.state);
+                    // The state isn't news, only the actions of the frame are highlighted.
+                    layout_.ClearHighlights();
+                }
+                layout_.Apply(job.actions);
+            }
+            layout_.Layout(*working_);
+            {
+                std::lock_guard lock(mutex_);
+                std::swap(working_, ready_);
+                is_ready_fresh_ = true;
+                is_busy_ = false;
             }
+            is_idle_.notify_all();
+            QMetaObject::invokeMethod(scene_, [this]() { ShowReady(); }, Qt::QueuedConnection);
         }
-        return QPointF(drawing_node_midpoint, top_left_corner->y());
     }
 
-    void CleanBackgroundRecursively(MemoryAddress vertex) {
-        if (vertex == nullptr) {
-            return;
-        }
-        address_to_node_[vertex].background_color = QColorConstants::White;
-        for (ssize_t i = 0; i < std::ssize(address_to_node_[vertex].children); ++i) {
-            CleanBackgroundRecursively(address_to_node_[vertex].children[i]);
+    //! Runs on the GUI thread.
+    void ShowReady() {
+        {
+            std::lock_guard lock(mutex_);
+            if (!is_ready_fresh_) {
+                // Shown by an earlier call already.
+                return;
+            }
+            std::swap(ready_, shown_);
+            is_ready_fresh_ = false;
         }
+        item_->SetData(shown_.get());
+        scene_->setSceneRect(item_->boundingRect());
     }
 
-    static constexpr qreal kCellWidth = 50;
-    static constexpr qreal kCellHeight = 30;
-    static constexpr qreal kVerticalMargin = 50;
-    static constexpr qreal kHorizontalMargin = 50;
-
-    MemoryAddress root_ = nullptr;
-    //! Not only maps Model nodes' addresses to drawable nodes, but also owns them.
-    std::unordered_map<MemoryAddress, NodeForDraw> address_to_node_;
-
-    ssize_t leaf_node_count_;
-    ssize_t leaf_key_count_;
-    ssize_t visited_leaf_node_count_;
-    ssize_t visited_leaf_key_count_;
-    // This is for "garbage collection" purposes.
-    std::unordered_set<MemoryAddress> visited_nodes_;
+    QGraphicsScene* scene_;
+    RenderDataItem* item_;
+    //! Belongs to the worker.
+    TreeLayout layout_;
+    //! Belongs to the worker.
+    std::unique_ptr<RenderData> working_;
+    std::unique_ptr<RenderData> ready_;
+    //! Belongs to the GUI thread.
+    std::unique_ptr<RenderData> shown_;
+    bool is_ready_fresh_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable_any has_jobs_;
+    //! Whether the worker is laying out jobs taken from the queue.
+    bool is_busy_ = false;
+    std::condition_variable is_idle_;
+    std::deque<Job> jobs_;
+    // Declared last, so the worker stops before anything it uses is destroyed.
+    std::jthread worker_;
 };
 
-TreeDrawingModel::TreeDrawingModel() : impl_(std::make_unique<TreeDrawingModelImpl>()) {}
+TreeDrawingModel::TreeDrawingModel() : impl_(std::make_unique<TreeDrawingModelImpl>(&scene_)) {}
 
 TreeDrawingModel::~TreeDrawingModel() = default;
 
 void TreeDrawingModel::DrawActions(const TreeActionsBatch& actions) {
-    impl_->DrawActions(actions, &scene_);
+    impl_->Queue({.state = std::nullopt, .actions = actions});
+}
+
+void TreeDrawingModel::DrawFrame(const TimelineFrame& frame) {
+    impl_->Queue({.state = frame.state, .actions = frame.actions});
+}
+
+void TreeDrawingModel::Flush() {
+    impl_->Flush();
 }
 
 QGraphicsScene* TreeDrawingModel::GetScenePort() {
     return &scene_;
 }
 
+DrawingModelMemoryStats TreeDrawingModel::MemoryStats() const {
+    return impl_->MemoryStats();
+}
+
 } // namespace NVis
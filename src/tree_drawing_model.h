@@ -1,11 +1,15 @@
 #pragma once
 
+#include "animation_timeline.h"
+#include "memory_stats.h"
 #include "tree_action.h"
 
 #include <QGraphicsScene>
 
 namespace NVis {
 
+//! Draws batches of actions on its scene. Actions are applied and laid out on a worker thread, the GUI thread only
+//! swaps in the laid out data and paints the visible part of it, so a big tree doesn't freeze the window.
 class TreeDrawingModel {
     class TreeDrawingModelImpl;
 
@@ -13,12 +17,20 @@ public:
     TreeDrawingModel();
     ~TreeDrawingModel();
 
+    //! Queues `actions` to be drawn. Batches queued faster than they are laid out are drawn together.
     void DrawActions(const TreeActionsBatch& actions);
+    //! Forgets everything drawn so far and draws `frame` of a timeline: its state with its actions highlighted.
+    void DrawFrame(const TimelineFrame& frame);
+    //! Waits until everything queued is laid out and shows it. Needed only without an event loop, e.g. in tools.
+    void Flush();
     QGraphicsScene* GetScenePort();
+    //! Memory of what's shown on the scene now.
+    DrawingModelMemoryStats MemoryStats() const;
 
 private:
-    std::unique_ptr<TreeDrawingModelImpl> impl_;
+    // Declared first, so the worker is stopped before the scene it posts to is destroyed.
     QGraphicsScene scene_;
+    std::unique_ptr<TreeDrawingModelImpl> impl_;
 };
 
 } // namespace NVis
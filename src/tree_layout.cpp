@@ -0,0 +1,193 @@
+#include "tree_layout.h"
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+
+namespace NVis {
+
+std::string_view RenderCell::Label() const {
+    return std::string_view(label.data(), label_length);
+}
+
+std::span<const RenderCell> RenderData::VisibleCells(const RenderRow& row, double left, double right) {
+    auto first = std::partition_point(row.cells.begin(), row.cells.end(), [left](const RenderCell& cell) {
+        return cell.x + TreeLayout::kCellWidth < left;
+    });
+    auto last = std::partition_point(first, row.cells.end(), [right](const RenderCell& cell) {
+        return cell.x <= right;
+    });
+    return std::span<const RenderCell>(first, last);
+}
+
+std::span<const RenderLine> RenderData::VisibleLines(const RenderRow& row, double left, double right) {
+    // Both ends go left to right, so do the leftmost and the rightmost of them.
+    auto first = std::partition_point(row.lines.begin(), row.lines.end(), [left](const RenderLine& line) {
+        return std::max(line.from_x, line.to_x) < left;
+    });
+    auto last = std::partition_point(first, row.lines.end(), [right](const RenderLine& line) {
+        return std::min(line.from_x, line.to_x) <= right;
+    });
+    return std::span<const RenderLine>(first, last);
+}
+
+void TreeLayout::Apply(const TreeActionsBatch& actions) {
+    TraceSpan span("ApplyActions", "drawing");
+    for (const auto& action : actions) {
+        switch (action.action_type) {
+
+        case ENodeAction::StartQuery:
+            [[fallthrough]];
+        case ENodeAction::EndQuery:
+            break;
+        case ENodeAction::Create:
+            assert(!address_to_node_.contains(action.node_address) && "Creating already existed node");
+            assert(action.data.has_value() && "No data when creating new node");
+            address_to_node_[action.node_address] = NodeForDraw{
+                .keys = action.data->keys,
+                .children = action.data->children,
+                .highlight = ECellHighlight::Created,
+            };
+            break;
+        case ENodeAction::Delete:
+            assert(address_to_node_.contains(action.node_address) && "Deleting non-existing node");
+            address_to_node_.erase(action.node_address);
+            break;
+        case ENodeAction::Change:
+            assert(address_to_node_.contains(action.node_address) && "Changing non-existing node");
+            assert(action.data.has_value() && "No data when changing a node");
+            address_to_node_[action.node_address] = NodeForDraw{
+                .keys = action.data->keys,
+                .children = action.data->children,
+                .highlight = ECellHighlight::Changed,
+            };
+            break;
+        case ENodeAction::MakeRoot:
+            assert((action.node_address == nullptr || address_to_node_.contains(action.node_address)) &&
+                   "Making a non-existing node a root");
+            root_ = action.node_address;
+            break;
+        case ENodeAction::Visit:
+            assert(address_to_node_.contains(action.node_address) && "Visiting a non-existing node");
+            address_to_node_[action.node_address].highlight = ECellHighlight::Visited;
+            break;
+        }
+    }
+}
+
+void TreeLayout::Reset() {
+    root_ = nullptr;
+    address_to_node_.clear();
+}
+
+void TreeLayout::ClearHighlights() {
+    for (auto& [address, node] : address_to_node_) {
+        node.highlight = ECellHighlight::None;
+    }
+}
+
+void TreeLayout::Layout(RenderData& data) {
+    TraceSpan span("Layout", "drawing", "nodes", std::ssize(address_to_node_));
+    leaf_node_count_ = 0;
+    leaf_key_count_ = 0;
+    visited_leaf_node_count_ = 0;
+    visited_leaf_key_count_ = 0;
+    visited_nodes_.clear();
+    auto height = root_ == nullptr ? 0 : MeasureSubtree(root_);
+    // Rows keep their buffers from the previous layout.
+    data.rows.resize(height);
+    for (ssize_t depth = 0; depth < height; ++depth) {
+        auto& row = data.rows[depth];
+        row.y = depth * (kCellHeight + kMargin);
+        row.cells.clear();
+        row.lines.clear();
+    }
+    data.width = leaf_key_count_ * kCellWidth + std::max<ssize_t>(leaf_node_count_ - 1, 0) * kMargin;
+    data.height = height == 0 ? 0 : height * (kCellHeight + kMargin) - kMargin;
+    if (root_ != nullptr) {
+        LayoutSubtree(root_, 0, data);
+        // Garbage collecting: nodes which can't be reached aren't needed anymore. Without a root, either the tree is
+        // empty and its nodes have been deleted already, or the snapshot is still being streamed and the nodes got so
+        // far are not reachable yet.
+        TraceSpan gc_span("CollectGarbage", "drawing");
+        std::erase_if(address_to_node_, [this](const auto& item) { return !visited_nodes_.contains(item.first); });
+    }
+    ClearHighlights();
+    data.stats = MemoryStats();
+}
+
+DrawingModelMemoryStats TreeLayout::MemoryStats() const {
+    DrawingModelMemoryStats stats;
+    stats.node_count = std::ssize(address_to_node_);
+    stats.node_bytes = stats.node_count * static_cast<ssize_t>(sizeof(NodeForDraw));
+    for (const auto& [address, node] : address_to_node_) {
+        stats.keys += MeasureVector(node.keys);
+        stats.children += MeasureVector(node.children);
+    }
+    stats.address_to_node = MeasureHashTable(address_to_node_);
+    stats.visited_nodes = MeasureHashTable(visited_nodes_);
+    return stats;
+}
+
+ssize_t TreeLayout::MeasureSubtree(MemoryAddress vertex) {
+    const auto& node = address_to_node_[vertex];
+    // Leaf is a node without children.
+    if (node.children.empty()) {
+        leaf_node_count_ += 1;
+        leaf_key_count_ += std::ssize(node.keys);
+        return 1;
+    }
+    ssize_t height = 0;
+    for (auto child : node.children) {
+        height = std::max(height, MeasureSubtree(child));
+    }
+    return height + 1;
+}
+
+double TreeLayout::LayoutSubtree(MemoryAddress vertex, ssize_t depth, RenderData& data) {
+    // Maybe "left to us" is better to understand than "lefter"...
+    auto lefter_leaf_node_count = visited_leaf_node_count_;
+    auto lefter_leaf_key_count = visited_leaf_key_count_;
+    visited_nodes_.emplace(vertex);
+    const auto& node = address_to_node_[vertex];
+    auto& row = data.rows[depth];
+    // Children are laid out first, they tell where the node is. Their subtrees only add lines to the rows below, so
+    // the lines of this node stay together.
+    auto first_line = std::ssize(row.lines);
+    for (auto child : node.children) {
+        row.lines.emplace_back(RenderLine{.from_x = 0, .to_x = LayoutSubtree(child, depth + 1, data)});
+    }
+    if (node.children.empty()) {
+        visited_leaf_node_count_++;
+        visited_leaf_key_count_ += std::ssize(node.keys);
+    }
+    double left_subtree_border = lefter_leaf_key_count * kCellWidth + lefter_leaf_node_count * kMargin;
+    double right_subtree_border = visited_leaf_key_count_ * kCellWidth + (visited_leaf_node_count_ - 1) * kMargin;
+    // "A middle point of the node being drawn". And yes, we could write `(l+r)/2` instead of `l+(r-l)/2`, but second
+    // option seems more precision-friendly and intuitive.
+    double midpoint = left_subtree_border + (right_subtree_border - left_subtree_border) / 2.0;
+    double left = midpoint - std::ssize(node.keys) * kCellWidth / 2.0;
+    assert((node.children.empty() || node.children.size() == node.keys.size()) && "Node has a key per child");
+    for (ssize_t index = 0; index < std::ssize(node.keys); ++index) {
+        auto x = left + index * kCellWidth;
+        row.cells.emplace_back(MakeCell(x, node.keys[index], node.highlight));
+        if (!node.children.empty()) {
+            row.lines[first_line + index].from_x = x + kCellWidth / 2.0;
+        }
+    }
+    return midpoint;
+}
+
+RenderCell TreeLayout::MakeCell(double x, const Key& key, ECellHighlight highlight) {
+    RenderCell cell;
+    cell.x = x;
+    cell.highlight = highlight;
+    auto [end, error] = std::to_chars(cell.label.data(), cell.label.data() + cell.label.size(), key);
+    assert(error == std::errc() && "Label doesn't fit a cell");
+    cell.label_length = static_cast<uint8_t>(end - cell.label.data());
+    return cell;
+}
+
+} // namespace NVis
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "memory_stats.h"
+#include "tree_action.h"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace NVis {
+
+//! What has happened to the node of a cell in the drawn batch. The painter picks the colors.
+enum class ECellHighlight : uint8_t {
+    None,
+    Created,
+    Changed,
+    Visited,
+};
+
+//! A key drawn as a cell of `TreeLayout::kCellWidth` by `TreeLayout::kCellHeight`, with its label already formatted.
+struct RenderCell {
+    //! The longest label is the one of the minimal `Key`.
+    static constexpr ssize_t kMaxLabelLength = 11;
+
+    std::string_view Label() const;
+
+    //! Left edge. The top one is the one of the row.
+    double x = 0;
+    ECellHighlight highlight = ECellHighlight::None;
+    uint8_t label_length = 0;
+    std::array<char, kMaxLabelLength> label{};
+};
+
+//! A line from the bottom middle of a cell to the top middle of its child, which is in the next row.
+struct RenderLine {
+    double from_x = 0;
+    double to_x = 0;
+};
+
+struct RenderRow {
+    double y = 0;
+    //! Cells of the nodes of the same depth, left to right.
+    std::vector<RenderCell> cells;
+    //! Lines from the cells of the row down to the next one, left to right by both ends.
+    std::vector<RenderLine> lines;
+};
+
+//! Everything needed to paint a tree, laid out in advance, so painting only walks the visible part of it.
+struct RenderData {
+    //! Cells of `row` crossing the band between `left` and `right`. Takes O(log n).
+    static std::span<const RenderCell> VisibleCells(const RenderRow& row, double left, double right);
+    //! Lines of `row` whose horizontal extent crosses the band. Takes O(log n).
+    static std::span<const RenderLine> VisibleLines(const RenderRow& row, double left, double right);
+
+    std::vector<RenderRow> rows;
+    double width = 0;
+    double height = 0;
+    //! Memory of the layout state when the data was produced.
+    DrawingModelMemoryStats stats;
+};
+
+//! Drawing state of a tree: the nodes observers have been told about and what has happened to them lately. It's
+//! turned into `RenderData` with no help of the GUI, so it can be laid out on any thread.
+class TreeLayout {
+public:
+    static constexpr double kCellWidth = 50;
+    static constexpr double kCellHeight = 30;
+    //! Gap between the subtrees of adjacent leaves and between rows.
+    static constexpr double kMargin = 50;
+
+    void Apply(const TreeActionsBatch& actions);
+    //! Forgets all the nodes.
+    void Reset();
+    void ClearHighlights();
+
+    //! Lays out the nodes reachable from the root into `data`, reusing its buffers. Then forgets the nodes which
+    //! aren't reachable and clears highlights, so the next layout shows only what happens after this one.
+    void Layout(RenderData& data);
+
+    DrawingModelMemoryStats MemoryStats() const;
+
+private:
+    struct NodeForDraw {
+        std::vector<Key> keys;
+        std::vector<MemoryAddress> children;
+        ECellHighlight highlight = ECellHighlight::None;
+    };
+
+    //! Returns the height of the subtree of `vertex` and counts its leaves and their keys.
+    ssize_t MeasureSubtree(MemoryAddress vertex);
+    //! Lays out the subtree of `vertex`, which is at `depth`, and returns the middle of the top of it.
+    double LayoutSubtree(MemoryAddress vertex, ssize_t depth, RenderData& data);
+    static RenderCell MakeCell(double x, const Key& key, ECellHighlight highlight);
+
+    MemoryAddress root_ = nullptr;
+    //! Maps addresses of nodes of the tree to the drawable nodes and owns them.
+    std::unordered_map<MemoryAddress, NodeForDraw> address_to_node_;
+
+    ssize_t leaf_node_count_ = 0;
+    ssize_t leaf_key_count_ = 0;
+    ssize_t visited_leaf_node_count_ = 0;
+    ssize_t visited_leaf_key_count_ = 0;
+    //! Nodes reached by the last layout, the rest are garbage.
+    std::unordered_set<MemoryAddress> visited_nodes_;
+};
+
+} // namespace NVis
@@ -0,0 +1,82 @@
+#include "tree_metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <sstream>
+
+namespace NVis {
+
+int64_t LatencyHistogramSnapshot::Count() const {
+    int64_t result = 0;
+    for (auto count : buckets) {
+        result += count;
+    }
+    return result;
+}
+
+std::chrono::nanoseconds LatencyHistogramSnapshot::Percentile(double quantile) const {
+    auto total = Count();
+    if (total == 0) {
+        return std::chrono::nanoseconds{0};
+    }
+    // The smallest count of records that covers `quantile` of them, at least one.
+    auto rank = std::max<int64_t>(1, static_cast<int64_t>(std::ceil(quantile * static_cast<double>(total))));
+    int64_t seen = 0;
+    for (int bucket = 0; bucket < kBucketCount; ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return std::chrono::nanoseconds{int64_t{1} << bucket};
+        }
+    }
+    return std::chrono::nanoseconds{int64_t{1} << (kBucketCount - 1)};
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds latency) {
+    auto nanoseconds = static_cast<uint64_t>(std::max<int64_t>(0, latency.count()));
+    auto bucket = std::min<int>(std::bit_width(nanoseconds), LatencyHistogramSnapshot::kBucketCount - 1);
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+LatencyHistogramSnapshot LatencyHistogram::Snapshot() const {
+    LatencyHistogramSnapshot result;
+    for (int bucket = 0; bucket < LatencyHistogramSnapshot::kBucketCount; ++bucket) {
+        result.buckets[bucket] = buckets_[bucket].load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+TreeMetricsSnapshot TreeMetrics::Snapshot() const {
+    TreeMetricsSnapshot result;
+    for (int counter = 0; counter < kTreeCounterCount; ++counter) {
+        result.counters[counter] = counters_[counter].load(std::memory_order_relaxed);
+    }
+    for (int operation = 0; operation < kTreeOperationCount; ++operation) {
+        result.latencies[operation] = latencies_[operation].Snapshot();
+    }
+    return result;
+}
+
+std::string FormatMetrics(const TreeMetricsSnapshot& snapshot) {
+    static constexpr std::array<const char*, kTreeCounterCount> kCounterNames = {
+        "visits", "splits", "merges", "borrows", "root changes", "actions", "bytes",
+    };
+    static constexpr std::array<const char*, kTreeOperationCount> kOperationNames = {
+        "contains", "insert", "erase",
+    };
+
+    std::ostringstream result;
+    for (int counter = 0; counter < kTreeCounterCount; ++counter) {
+        result << kCounterNames[counter] << ": " << snapshot.counters[counter] << '\n';
+    }
+    for (int operation = 0; operation < kTreeOperationCount; ++operation) {
+        const auto& latency = snapshot.latencies[operation];
+        result << kOperationNames[operation] << ": n=" << latency.Count()
+               << " p50<=" << latency.Percentile(0.5).count() << "ns"
+               << " p99<=" << latency.Percentile(0.99).count() << "ns"
+               << " max<=" << latency.Percentile(1.0).count() << "ns\n";
+    }
+    return result.str();
+}
+
+} // namespace NVis
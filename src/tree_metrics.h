@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace NVis {
+
+//! Metrics are collected only in builds with `NVIS_ENABLE_METRICS` defined (see `METRICS` option of CMake). Otherwise
+//! every recording call is an empty inline function and snapshots are all zeros.
+#ifdef NVIS_ENABLE_METRICS
+inline constexpr bool kMetricsEnabled = true;
+#else
+inline constexpr bool kMetricsEnabled = false;
+#endif
+
+enum class ETreeOperation {
+    Contains,
+    Insert,
+    Erase,
+};
+
+inline constexpr int kTreeOperationCount = 3;
+
+enum class ETreeCounter {
+    //! Nodes visited by descents and by splits.
+    NodeVisits,
+    //! Iterations of `SplitNode`, one per split node.
+    Splits,
+    //! Nodes of `Erase` merged into a sibling which has had room for their key.
+    Merges,
+    //! Nodes of `Erase` merged into a full sibling, which then has been split. The net effect is a borrow.
+    Borrows,
+    RootChanges,
+    NotifiedActions,
+    //! Approximate size of notified actions with their payloads.
+    NotifiedBytes,
+};
+
+inline constexpr int kTreeCounterCount = 7;
+
+//! Plain copy of a `LatencyHistogram`. Bucket `i` counts latencies in `[2^(i-1), 2^i)` nanoseconds.
+struct LatencyHistogramSnapshot {
+    static constexpr int kBucketCount = 40;
+
+    int64_t Count() const;
+    //! Returns the upper bound of the bucket the `quantile` falls into, or zero if nothing was recorded.
+    std::chrono::nanoseconds Percentile(double quantile) const;
+
+    std::array<int64_t, kBucketCount> buckets{};
+};
+
+//! Histogram with power of two buckets. Recording is one relaxed increment, so it can be read from another thread.
+class LatencyHistogram {
+public:
+    void Record(std::chrono::nanoseconds latency);
+    LatencyHistogramSnapshot Snapshot() const;
+
+private:
+    std::array<std::atomic<int64_t>, LatencyHistogramSnapshot::kBucketCount> buckets_{};
+};
+
+struct TreeMetricsSnapshot {
+    int64_t Get(ETreeCounter counter) const {
+        return counters[static_cast<int>(counter)];
+    }
+    const LatencyHistogramSnapshot& GetLatency(ETreeOperation operation) const {
+        return latencies[static_cast<int>(operation)];
+    }
+
+    std::array<int64_t, kTreeCounterCount> counters{};
+    std::array<LatencyHistogramSnapshot, kTreeOperationCount> latencies{};
+};
+
+//! Human readable multiline summary of `snapshot`, suitable for an overlay.
+std::string FormatMetrics(const TreeMetricsSnapshot& snapshot);
+
+//! Hot-path counters and latencies of a tree. Recording never blocks and may happen on a worker thread while another
+//! thread takes snapshots.
+class TreeMetrics {
+public:
+    void Add(ETreeCounter counter, int64_t value = 1) {
+        if constexpr (kMetricsEnabled) {
+            counters_[static_cast<int>(counter)].fetch_add(value, std::memory_order_relaxed);
+        }
+    }
+
+    void RecordLatency(ETreeOperation operation, std::chrono::nanoseconds latency) {
+        if constexpr (kMetricsEnabled) {
+            latencies_[static_cast<int>(operation)].Record(latency);
+        }
+    }
+
+    TreeMetricsSnapshot Snapshot() const;
+
+private:
+    std::array<std::atomic<int64_t>, kTreeCounterCount> counters_{};
+    std::array<LatencyHistogram, kTreeOperationCount> latencies_{};
+};
+
+//! Records the time between its construction and destruction as a latency of `operation`. Doesn't even read the clock
+//! when metrics are disabled.
+class ScopedLatency {
+public:
+    ScopedLatency(TreeMetrics& metrics, ETreeOperation operation)
+        : metrics_(metrics), operation_(operation), start_(Now()) {}
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+    ScopedLatency(ScopedLatency&&) = delete;
+    ScopedLatency& operator=(ScopedLatency&&) = delete;
+
+    ~ScopedLatency() {
+        if constexpr (kMetricsEnabled) {
+            metrics_.RecordLatency(operation_, Now() - start_);
+        }
+    }
+
+private:
+    static std::chrono::steady_clock::time_point Now() {
+        if constexpr (kMetricsEnabled) {
+            return std::chrono::steady_clock::now();
+        } else {
+            return {};
+        }
+    }
+
+    TreeMetrics& metrics_;
+    ETreeOperation operation_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace NVis
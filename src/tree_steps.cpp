@@ -0,0 +1,95 @@
+#include "tree_steps.h"
+
+#include <cassert>
+#include <exception>
+#include <utility>
+
+namespace NVis {
+
+TreeSteps TreeSteps::promise_type::get_return_object() {
+    return TreeSteps(Handle::from_promise(*this));
+}
+
+std::suspend_always TreeSteps::promise_type::initial_suspend() noexcept {
+    return {};
+}
+
+std::suspend_always TreeSteps::promise_type::final_suspend() noexcept {
+    return {};
+}
+
+std::suspend_always TreeSteps::promise_type::yield_value(const TreeActionsBatch& actions) noexcept {
+    current = &actions;
+    return {};
+}
+
+void TreeSteps::promise_type::return_void() noexcept {
+    current = nullptr;
+}
+
+void TreeSteps::promise_type::unhandled_exception() noexcept {
+    // Trees don't throw, a half-done operation can't be recovered anyway.
+    std::terminate();
+}
+
+TreeSteps::TreeSteps(Handle handle) : handle_(handle) {}
+
+TreeSteps::TreeSteps(TreeSteps&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+TreeSteps& TreeSteps::operator=(TreeSteps&& other) noexcept {
+    if (this != &other) {
+        Destroy();
+        handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+}
+
+TreeSteps::~TreeSteps() {
+    Destroy();
+}
+
+bool TreeSteps::Next() {
+    if (IsDone()) {
+        return false;
+    }
+    handle_.promise().is_started = true;
+    handle_.resume();
+    return !handle_.done();
+}
+
+const TreeActionsBatch& TreeSteps::Current() const {
+    assert(handle_ && handle_.promise().current != nullptr && "No step to look at");
+    return *handle_.promise().current;
+}
+
+bool TreeSteps::IsDone() const {
+    return !handle_ || handle_.done();
+}
+
+void TreeSteps::Finish() {
+    while (Next()) {
+    }
+}
+
+void TreeSteps::Track(std::coroutine_handle<>& tracker) {
+    assert(handle_ && !handle_.promise().is_started && "Tracking an operation which has started on its own");
+    handle_.promise().tracker = &tracker;
+    tracker = handle_;
+}
+
+void TreeSteps::Destroy() {
+    if (!handle_) {
+        return;
+    }
+    auto& promise = handle_.promise();
+    // The owner may have run the operation without `Next()`, then it's done.
+    if (promise.is_started || handle_.done()) {
+        Finish();
+    } else if (promise.tracker != nullptr && *promise.tracker == handle_) {
+        *promise.tracker = nullptr;
+    }
+    handle_.destroy();
+    handle_ = nullptr;
+}
+
+} // namespace NVis
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "tree_action.h"
+
+#include <coroutine>
+
+namespace NVis {
+
+//! Operation of a tree running step by step: every `Next()` runs it up to the next batch of actions which observers
+//! get, so a consumer can pull the batches as slowly as it likes instead of storing all of them. The batch of the step
+//! is notified to observers as usual, `Current()` gives the same batch to the consumer.
+//!
+//! The operation starts on the first `Next()`. Until it's over, the tree is in the middle of a change, so anything
+//! else done with the tree first finishes the operation, as does destroying steps which have started. Steps destroyed
+//! before they've started drop the operation instead, nothing of it is done then.
+class [[nodiscard]] TreeSteps {
+public:
+    struct promise_type {
+        TreeSteps get_return_object();
+        std::suspend_always initial_suspend() noexcept;
+        std::suspend_always final_suspend() noexcept;
+        std::suspend_always yield_value(const TreeActionsBatch& actions) noexcept;
+        void return_void() noexcept;
+        [[noreturn]] void unhandled_exception() noexcept;
+
+        const TreeActionsBatch* current = nullptr;
+        //! Set by `Track()`.
+        std::coroutine_handle<>* tracker = nullptr;
+        bool is_started = false;
+    };
+
+    TreeSteps(TreeSteps&& other) noexcept;
+    TreeSteps& operator=(TreeSteps&& other) noexcept;
+    ~TreeSteps();
+
+    //! Runs the operation up to its next step. Returns `false` if the operation is over and there's no step.
+    bool Next();
+    //! The batch of the last step. Valid until the next call of `Next()`.
+    const TreeActionsBatch& Current() const;
+    bool IsDone() const;
+    //! Runs the rest of the operation at once.
+    void Finish();
+
+    //! Makes `tracker` hold the operation from now on, so that its owner can finish it at any moment, even before it
+    //! has started. The operation must reset `tracker` itself as its last step. Steps dropped before they've started
+    //! reset it instead.
+    void Track(std::coroutine_handle<>& tracker);
+
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit TreeSteps(Handle handle);
+    void Destroy();
+
+    Handle handle_;
+};
+
+} // namespace NVis
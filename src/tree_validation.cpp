@@ -0,0 +1,37 @@
+#include "tree_validation.h"
+
+#include <iostream>
+
+namespace NVis {
+
+const char* ToString(ETreeInvariant invariant) {
+    switch (invariant) {
+    case ETreeInvariant::ChildCount:
+        return "child count";
+    case ETreeInvariant::ValueCount:
+        return "value count";
+    case ETreeInvariant::Fanout:
+        return "fanout";
+    case ETreeInvariant::KeyOrder:
+        return "key order";
+    case ETreeInvariant::Separator:
+        return "separator";
+    case ETreeInvariant::LeafDepth:
+        return "leaf depth";
+    }
+    return "unknown";
+}
+
+std::ostream& operator<<(std::ostream& output, const TreeViolation& violation) {
+    return output << "broken invariant: " << ToString(violation.invariant) << " at node " << violation.node
+                  << " of depth " << violation.depth;
+}
+
+bool IsValidOrReport(const std::optional<TreeViolation>& violation) {
+    if (violation) {
+        std::cerr << "Incorrect tree, " << *violation << std::endl;
+    }
+    return !violation;
+}
+
+} // namespace NVis
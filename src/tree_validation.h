@@ -0,0 +1,58 @@
+#pragma once
+
+#include "tree_action.h"
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+namespace NVis {
+
+//! How much a tree checks itself after mutations in builds with asserts. Release builds never check, but `Audit()` is
+//! always there.
+enum class EValidationLevel : uint8_t {
+    //! No checks.
+    Off,
+    //! Every insert and erase checks the nodes on the path to its key, which takes O(log n), and every
+    //! `audit_period`-th mutation audits the whole tree.
+    Sampled,
+    //! Every mutation audits the whole tree, which takes O(n).
+    Full,
+};
+
+//! Mutations between two audits of the whole tree at `EValidationLevel::Sampled`, so they take O(n / 1024) amortized.
+inline constexpr ssize_t kDefaultAuditPeriod = 1024;
+
+//! Invariants of a B+ tree, as reported by `Audit()`.
+enum class ETreeInvariant : uint8_t {
+    //! An internal node has as many children as keys, and none of them is null.
+    ChildCount,
+    //! A leaf of a map has as many values as keys, an internal node has none.
+    ValueCount,
+    //! A node has from `kMinFanout` to `kMaxFanout` keys, the root has at least one.
+    Fanout,
+    //! Keys of a node increase, and keys of a child lie above the separator before it in the parent.
+    KeyOrder,
+    //! Every key of an internal node is the maximum of its child.
+    Separator,
+    //! All leaves are at the same depth.
+    LeafDepth,
+};
+
+const char* ToString(ETreeInvariant invariant);
+
+//! The first broken invariant `Audit()` has found, and the node where it's broken.
+struct TreeViolation {
+    ETreeInvariant invariant;
+    MemoryAddress node = nullptr;
+    //! Depth of the node, 0 for the root.
+    ssize_t depth = 0;
+};
+
+std::ostream& operator<<(std::ostream& output, const TreeViolation& violation);
+
+//! Writes `violation` to stderr if there's one, since an `assert` can only show a fixed message. Returns whether
+//! there's none.
+bool IsValidOrReport(const std::optional<TreeViolation>& violation);
+
+} // namespace NVis
@@ -1,57 +1,588 @@
 #pragma once
 
+#include "flat_tree_file.h"
+#include "key_ranges.h"
+#include "memory_stats.h"
+#include "membership_filter.h"
+#include "node_rules.h"
+#include "node_slabs.h"
 #include "observer.h"
+#include "packed_keys.h"
 #include "tree_action.h"
+#include "tree_actions_port.h"
+#include "tree_metrics.h"
+#include "tree_steps.h"
+#include "tree_validation.h"
 
+#include <atomic>
+#include <coroutine>
+#include <functional>
 #include <memory>
+#include <new>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace NVis {
 
-class TwoThreeTree {
+enum class EBatchOperation {
+    Insert,
+    Erase,
+};
+
+enum class ESetOperation {
+    Union,
+    Intersection,
+    Difference,
+};
+
+struct BatchResult {
+    //! Count of keys the operation has been applied to.
+    ssize_t processed_count = 0;
+    //! Count of keys which actually have been inserted or erased.
+    ssize_t changed_count = 0;
+    bool is_cancelled = false;
+};
+
+//! Value type of trees which store keys only.
+struct NoValue {};
+
+//! Key storage of nodes: vectors take the allocator of nodes, so that compaction moves their buffers into slabs as
+//! well. Other storages, like `PackedKeys`, use `SlabAllocator` themselves.
+template <typename TKeyStorage>
+struct NodeKeyStorage {
+    using Type = TKeyStorage;
+};
+template <typename T, typename TAllocator>
+struct NodeKeyStorage<std::vector<T, TAllocator>> {
+    using Type = std::vector<T, SlabAllocator<T>>;
+};
+
+//! B+ tree with every node except the root having from `kMinFanout` to `kMaxFanout` children, or keys for leaves.
+//! Keys are stored in leaves, and every internal node keeps maximums of its children as keys. The defaults give a 2-3
+//! tree, the one the visualizer and docs are about; wider nodes make descents shallower for large trees. Nodes are
+//! split in halves when they overflow and merged with a sibling when they underflow, so `kMaxFanout` must be at least
+//! `2 * kMinFanout - 1`.
+//!
+//! Nodes keep their keys in `TKeyStorage`, a sequence with the interface of `std::vector<Key>`. `PackedKeys` stores
+//! them bit-packed instead, for sets of dense keys in wide nodes.
+//!
+//! Unless `TValue` is `NoValue`, the tree is a map: every key of a leaf has a value in an array parallel to the keys.
+//! Internal nodes have no values, so descents don't touch them, and observers only see keys.
+template <ssize_t kMinFanout = 2, ssize_t kMaxFanout = 3, typename TKeyStorage = std::vector<Key>,
+          typename TValue = NoValue>
+class BPlusTree {
+    static_assert(kMinFanout >= 2 && kMaxFanout >= 2 * kMinFanout - 1, "Nodes can't be split or merged");
+
+    static constexpr bool kIsMap = !std::is_same_v<TValue, NoValue>;
+
+    struct NoValues {};
+    struct Node;
+    using NodeKeys = typename NodeKeyStorage<TKeyStorage>::Type;
+    using Children = std::vector<std::unique_ptr<Node>, SlabAllocator<std::unique_ptr<Node>>>;
+    using Values = std::vector<TValue, SlabAllocator<TValue>>;
+
     struct Node {
-        std::vector<Key> keys;
-        std::vector<std::unique_ptr<Node>> children;
-        Node* parent;
+        //! Nodes relocated by `CompactSlice` share slabs, see `NodeSlabs`, and so do their buffers. Placement new puts
+        //! them there and sets `slab`, so only deallocation needs to know. It's a destroying delete, which can read
+        //! `slab` before the node is gone.
+        static void operator delete(Node* vertex, std::destroying_delete_t) {
+            auto slab = vertex->slab;
+            vertex->~Node();
+            if (slab != nullptr) {
+                NodeSlabs::Instance().Release(slab);
+            } else {
+                ::operator delete(vertex);
+            }
+        }
+
+        NodeKeys keys;
+        Children children;
+        //! Values of keys of a leaf of a map, empty in internal nodes.
+        [[no_unique_address]] std::conditional_t<kIsMap, Values, NoValues> values = {};
+        NodeSlabs::Slab* slab = nullptr;
+    };
+
+    //! One step of a root-to-leaf path: a node and its index in the children array of the previous node of the path.
+    //! Nodes don't store pointers to their parents, mutations walk up along the path instead.
+    struct PathStep {
+        Node* node;
+        ssize_t index_in_parent;
+        //! Depths of the nearest steps up to this one which go to a child with a left or a right sibling. The key of
+        //! the parent before or at such a child bounds the keys of this node from below or from above. 0 if there's
+        //! no bound, as for the root.
+        ssize_t lower_bound_depth = 0;
+        ssize_t upper_bound_depth = 0;
+    };
+    using Path = std::vector<PathStep>;
+
+    //! Root of a standalone piece of a tree and its height, where leaves are of height 0.
+    struct Subtree {
+        std::unique_ptr<Node> root;
+        ssize_t height = -1;
+    };
+
+    //! Nodes touched by `Split` or `Join`. Only they are reported to observers, the rest of nodes stay as they were.
+    struct Restructuring {
+        void Create(const Node* vertex);
+        void Change(const Node* vertex);
+        void Destroy(Node* vertex);
+        //! Adds changes recorded in `parts`, which may have been recorded concurrently on disjoint subtrees.
+        void Absorb(const std::vector<Restructuring>& parts);
+
+        std::unordered_set<const Node*> created;
+        //! Nodes existing before the operation which have got other keys or children.
+        std::unordered_set<const Node*> changed;
+        //! Nodes existing before the operation which have been destroyed.
+        std::vector<MemoryAddress> destroyed;
     };
 
 public:
-    TwoThreeTree();
+    //! Most keys of a leaf or children of an internal node, for consumers which need to bound the size of a node.
+    static constexpr ssize_t kMaxNodeSize = kMaxFanout;
+
+    //! Remembered position in the tree, like the hint of `std::set::insert`. An access with a hint climbs from the leaf
+    //! of the hint only as far as needed and descends from there, and then moves the hint to its own leaf, so a hint
+    //! works as a cursor following a stream of nearby keys. A hint outdated by splits or merges is ignored.
+    class Hint {
+    private:
+        friend class BPlusTree;
+
+        const BPlusTree* tree_ = nullptr;
+        Path path_;
+        uint64_t version_ = 0;
+    };
+
+    BPlusTree();
+    //! Finishes an operation going step by step, if there's one, even if its steps haven't started, so that they can
+    //! outlive the tree.
+    ~BPlusTree();
 
-    //! Searches for the key `x` in 2-3 tree and returns erther it was found or not.
+    //! Searches for the key `x` in the tree and returns erther it was found or not.
     bool Contains(const Key& x) const;
 
-    //! Inserts the key `x` in 2-3 tree or do nothing if it already was there. Returns `true` if new key was added or
-    //! `false` if it already was there.
+    //! Accesses starting from `hint`, see `Hint`. Plain accesses start from the leaf of the previous access the same
+    //! way, so they take O(log d) for a key at distance d from the previous one, and inserting increasing keys takes
+    //! amortized O(1).
+    bool Contains(Hint& hint, const Key& x) const;
+    bool Insert(Hint& hint, const Key& x);
+    bool Erase(Hint& hint, const Key& x);
+    //! Returns a hint at the leaf of the last access.
+    Hint GetHint() const;
+
+    //! Returns all the keys of the tree in increasing order. Takes O(n).
+    std::vector<Key> GetKeys() const;
+
+    //! Inserts the key `x` in the tree or do nothing if it already was there. Returns `true` if new key was added or
+    //! `false` if it already was there. New keys of a map get value-initialized values.
     bool Insert(const Key& x);
 
-    //! Erases the key `x` from 2-3 tree if it was there or do nothing otherwise. Returns `true` if key was deleted or
+    //! Returns the value of the key `x` or null if there's no such key. The pointer is valid until the next change of
+    //! the map.
+    TValue* Find(const Key& x)
+        requires kIsMap;
+    const TValue* Find(const Key& x) const
+        requires kIsMap;
+
+    //! Inserts the key `x` with a value constructed from `args`. Does nothing if the key is already there, and `args`
+    //! aren't even moved from then. Returns `true` if the key was inserted.
+    template <typename... TArgs>
+    bool TryEmplace(const Key& x, TArgs&&... args)
+        requires kIsMap;
+
+    //! Inserts the key `x` with `value` or assigns `value` to the key if it's already there. Returns `true` if the key
+    //! was inserted.
+    bool InsertOrAssign(const Key& x, TValue value)
+        requires kIsMap;
+
+    //! Fills an empty map with `items`, which must be sorted by keys without repeats. Nodes are built level by level
+    //! from leaves up, which takes O(n) instead of O(n log n) for inserting items one by one. Observers get the whole
+    //! tree at once.
+    void Build(std::vector<std::pair<Key, TValue>> items)
+        requires kIsMap;
+    //! Same for a set of `keys`.
+    void Build(const std::vector<Key>& keys)
+        requires(!kIsMap);
+
+    //! Erases the key `x` from the tree if it was there or do nothing otherwise. Returns `true` if key was deleted or
     //! `false` otherwise.
     bool Erase(const Key& x);
 
+    //! Stepwise `Contains`, `Insert` and `Erase`, see `TreeSteps`. Steps are the batches the plain operation would
+    //! notify, one by one, and the operation goes on only when the next step is asked for, so a single operation can
+    //! be animated without storing all of its steps. Plain operations pay nothing for it but a check that no operation
+    //! is half-done. The tree tracks the steps from the moment they're made, and finishes the previous ones then.
+    TreeSteps ContainsSteps(Key x) const;
+    TreeSteps InsertSteps(Key x);
+    TreeSteps EraseSteps(Key x);
+
+    //! Moves all the keys greater or equal to `x` to `right`, which must be empty. Takes O(log n): the tree is cut
+    //! along the path to `x` and the pieces on each side are joined back together.
+    void Split(const Key& x, BPlusTree& right);
+    //! Mirror of `Split`: moves all the keys less than `x` to `left`, which must be empty. Takes O(log n).
+    void SplitLeft(const Key& x, BPlusTree& left);
+
+    //! Moves all the keys of `right` to the end of this tree, leaving `right` empty. Every key of `right` must be
+    //! greater than all the keys of this tree. Takes O(log n): the lower tree is hung on the spine of the higher one.
+    //! Observers of this tree get `Create` for every node coming from `right`, so it takes longer while someone
+    //! watches.
+    void Join(BPlusTree& right);
+    //! Mirror of `Join`: moves all the keys of `left` to the beginning of this tree, leaving `left` empty. Every key of
+    //! `left` must be less than all the keys of this tree. Takes O(log n), observers are notified like for `Join`.
+    void JoinLeft(BPlusTree& left);
+
+    //! Set operations replacing keys of this tree with their union, intersection or difference with keys of `other`.
+    //! `other` is taken apart and left empty. Both trees are cut by each other's ranges and the parts are joined back,
+    //! so it takes O(m log(n / m + 1)) for trees of sizes m <= n instead of inserting keys one by one. Independent
+    //! subtrees are combined on up to `thread_count` threads, one per hardware thread if it's not positive.
+    //! Not available for maps, which would need to choose between values of both trees.
+    void Union(BPlusTree& other, ssize_t thread_count = 0)
+        requires(!kIsMap);
+    void Intersection(BPlusTree& other, ssize_t thread_count = 0)
+        requires(!kIsMap);
+    void Difference(BPlusTree& other, ssize_t thread_count = 0)
+        requires(!kIsMap);
+
+    //! Applies `operation` to every key of `ranges` in order. Observers aren't notified about every step: the net
+    //! effect of the whole batch is kept as one summarized batch of actions until `PublishBatchSummary()` is called.
+    //! This way the batch can be applied from a worker thread, as long as no one else touches the tree meanwhile.
+    //! `stop` cancels the batch between two keys, `progress` (if not null) receives the count of processed keys.
+    BatchResult ApplyBatch(EBatchOperation operation, const std::vector<KeyRange>& ranges, std::stop_token stop = {},
+                           std::atomic<ssize_t>* progress = nullptr);
+
+    //! Sends the summary of the last `ApplyBatch` to observers. Must be called from the thread observers live in.
+    void PublishBatchSummary();
+
     void SubscribeObserver(Observer<TreeActionsBatch>* observer);
 
+    //! Subscribes `observer` without building the snapshot of the whole tree at once: it comes in chunks of at most
+    //! `chunk_size` nodes, one after every query, interleaved with live updates. See `TreeActionsPort`.
+    void SubscribeObserverStreaming(Observer<TreeActionsBatch>* observer, ssize_t chunk_size);
+
+    //! Advances snapshots of streaming observers by one chunk. Useful when the tree is idle.
+    void PumpSnapshots() const;
+
+    //! Writes the tree to `path` in the flat format of `FlatTreeFile`. Returns `false` if the file can't be written,
+    //! or if it's the file the tree is mapped from, which can't be rewritten under the mapping. Only 2-3 trees without
+    //! values fit the format.
+    bool SaveToFile(const std::string& path) const
+        requires(kMinFanout == 2 && kMaxFanout == FlatNode::kMaxKeys && !kIsMap);
+
+    //! Makes an empty tree read keys from a file written by `SaveToFile`. The file is mapped, not read: `Contains`
+    //! works on it right away, touching only the pages on its way, and it's converted to nodes on the first write.
+    //! Observers get the nodes of the file as they are, then see them replaced by the converted ones. Returns `false`
+    //! if the file isn't a valid tree file.
+    //!
+    //! `check` tells how much of the file is checked here; see `EFlatTreeCheck`. A lazily checked file is verified by
+    //! whatever reads the whole of it first: subscribing an observer, converting it or listing its keys. A malformed
+    //! one is let go then, leaving the tree empty, unless it's caught here already, which happens with observers.
+    bool MapFile(const std::string& path, EFlatTreeCheck check = EFlatTreeCheck::Lazy)
+        requires(kMinFanout == 2 && kMaxFanout == FlatNode::kMaxKeys && !kIsMap);
+
+    //! Puts a Bloom filter of keys in front of `Contains`, so most misses don't descend the tree at all, nor notify
+    //! about visits. `Insert` adds keys to the filter, erased keys pass it until it's rebuilt from the keys of the
+    //! tree, which happens once a half of its keys are erased or it's full. Operations bringing many keys at once, such
+    //! as `Join` or `Build`, rebuild it too, which takes O(n). Takes O(n) itself.
+    void EnableMembershipFilter();
+    void DisableMembershipFilter();
+    //! Returns how many misses the filter has rejected and what it costs, or `std::nullopt` if it's disabled.
+    std::optional<MembershipFilterStats> GetMembershipFilterStats() const;
+
+    //! Relocates nodes into contiguous slabs in depth-first order, bringing back the locality which long runs of
+    //! splits and merges scatter over the heap: a descent then reads nodes lying close to each other, and a subtree
+    //! takes a range of memory of its own. Runs one slice of a compaction pass, relocating at most `max_nodes` nodes,
+    //! so a pass can be spread between writes without pausing them for long. Writes between slices are fine, the
+    //! pass goes on from where it stopped in the changed tree. Each slice is a query for observers, where every
+    //! relocated node is created anew, its parent is changed or it becomes the root, and the old node is deleted.
+    //! Returns `true` when the pass is over; the next call starts a new one.
+    bool CompactSlice(ssize_t max_nodes);
+    //! Runs the rest of the current compaction pass, or a whole new one. Takes O(n).
+    void Compact();
+
+    //! Returns counters and latencies collected so far. Safe to call while a batch is applied on another thread. All
+    //! zeros unless metrics are enabled, see `kMetricsEnabled`.
+    TreeMetricsSnapshot GetMetrics() const;
+
+    //! Walks the whole tree and reports where its memory goes. Takes O(n).
+    TreeMemoryStats MemoryStats() const;
+
+    //! Checks every invariant of the tree, see `ETreeInvariant`, and returns the first one found broken, or
+    //! `std::nullopt` if the tree is valid. A mapped file is converted to nodes first, so that its nodes are checked
+    //! too and the violation points to a node which stays alive. Takes O(n).
+    std::optional<TreeViolation> Audit();
+    //! Sets how much mutations check the tree in builds with asserts, see `EValidationLevel`. The default is
+    //! `EValidationLevel::Sampled` with `kDefaultAuditPeriod`.
+    void SetValidationLevel(EValidationLevel level, ssize_t audit_period = kDefaultAuditPeriod);
+
 private:
+    //! Below this height subtrees are combined on the calling thread, starting a thread would cost more.
+    //! Subtrees of this height hold at least 128 keys whatever the fanout.
+    static constexpr ssize_t kMinParallelHeight = MinHeightHolding(kMinFanout, 128);
+
     //! Searches such a leaf in the tree that contains the first value greater or equal to `x`. If there's no such
-    //! one, returns the rightmost leaf.
-    Node* SearchByLowerBound(const Key& x) const;
+    //! one, returns the rightmost leaf. If `path` is given, the way from root to the leaf is written to it.
+    Node* SearchByLowerBound(const Key& x, Path* path = nullptr) const;
+    //! Same, starting from the finger: climbs `path_` to the lowest node whose range holds `x` and descends from it.
+    //! The path to the leaf is left in `path_`.
+    Node* SearchFromFinger(const Key& x) const;
+    //! The climbing part of `SearchFromFinger`: leaves in `path_` the lowest node whose range holds `x`, or the root if
+    //! it's empty.
+    void ClimbFinger(const Key& x) const;
+    //! The descending part: appends to `path_` the child of its last node which the descent to `x` goes to.
+    Node* DescendFinger(const Key& x) const;
+    //! Checks if `x` is in the range of the last node of `path_`.
+    bool IsUnderFinger(const Key& x) const;
+    //! Adds the `child_index`-th child of the last node of `path` to it.
+    static void AppendStep(Path& path, ssize_t child_index);
+    //! Drops nodes below `depth` from the finger after a mutation has destroyed them, outdating hints.
+    void CutFinger(ssize_t depth);
+    //! Drops the whole finger after an operation which has rebuilt the tree.
+    void ResetFinger();
+    template <typename TAccess>
+    bool AccessWithHint(Hint& hint, TAccess access) const;
+
+    //! Runs the rest of an operation going step by step, if there's one.
+    void FinishSteps() const;
+    //! Finishes the previous operation and makes the tree track `steps` instead.
+    TreeSteps TrackSteps(TreeSteps steps) const;
+    //! Bodies of `ContainsSteps`, `InsertSteps` and `EraseSteps`, which only have to be tracked.
+    TreeSteps MakeContainsSteps(Key x) const;
+    TreeSteps MakeInsertSteps(Key x);
+    TreeSteps MakeEraseSteps(Key x);
+    //! Stepwise versions of `SearchFromFinger`, `UpdateKeys(path_)` and `CutFinger(SplitNode(path_, depth))`, for the
+    //! stepwise operations to yield their steps.
+    TreeSteps SearchFromFingerSteps(Key x) const;
+    TreeSteps UpdateKeysSteps();
+    TreeSteps SplitNodeSteps(ssize_t depth);
 
-    //! Updates keys in parents of `vertex` if needed by pulling up information from children.
-    void UpdateKeys(Node* vertex);
+    //! Inserts `x` with a value constructed from `args`, or calls `on_found` with the value of `x` if it's already
+    //! there.
+    template <typename TOnFound, typename... TArgs>
+    bool Emplace(const Key& x, TOnFound on_found, TArgs&&... args);
+    TValue* FindValue(const Key& x) const
+        requires kIsMap;
+    //! Makes a leaf with `x` and a value constructed from `args` the root of an empty tree.
+    template <typename... TArgs>
+    TreeActionsBatch PlantRoot(const Key& x, TArgs&&... args);
+    //! Puts `x` with a value constructed from `args` into `leaf`, which doesn't have it yet.
+    template <typename... TArgs>
+    TreeActionsBatch InsertIntoLeaf(Node& leaf, const Key& x, TArgs&&... args);
+    //! Checks the tree and updates the membership filter after `x` has been inserted.
+    void CompleteInsert(const Key& x);
+    void CompleteErase(const Key& x);
+    //! Builds the levels of internal nodes above `level`, the leaves, and makes the top one the root.
+    void BuildAbove(std::vector<std::unique_ptr<Node>> level);
+    //! Splits `count` nodes or keys into as few groups of at most `kMaxFanout` as possible, sized evenly. Returns the
+    //! sizes of groups.
+    static std::vector<ssize_t> SplitEvenly(ssize_t count);
 
-    //! Splits a node in two nodes if it has more than 4 children (or keys), and all its parents that need it after
-    //! splitting the initial node.
-    void SplitNode(Node* vertex);
+    //! Index of the child of an internal `vertex` which the descent to `x` goes to.
+    static ssize_t LowerBoundChild(const Node& vertex, const Key& x);
 
-    //! Checks invariants of a tree and return `true` if tree is valid, `false` otherwise. Suitable for `assert`s.
-    bool IsValid(Node* vertex) const;
+    //! Updates keys in ancestors of the last node of `path` by pulling up information from children. Stops as soon as
+    //! some ancestor's key stays the same, since nothing above it can change then.
+    void UpdateKeys(const Path& path);
+    //! Sets the key of `path[depth - 1].node` for its child `path[depth].node`, one step of `UpdateKeys`. Returns
+    //! `std::nullopt` if the key is already right.
+    std::optional<TreeActionsBatch> RefreshSeparator(const Path& path, ssize_t depth);
 
-    static NodeInfo ProduceNodeInfo(const Node& martyr);
+    //! Splits a node `path[depth].node` in two nodes if it has more than `kMaxFanout` children (or keys), and all its
+    //! ancestors that need it after splitting the initial node. Returns the depth of the lowest node of `path` which
+    //! hasn't been split, or -1 if the root has been.
+    ssize_t SplitNode(const Path& path, ssize_t depth);
+    //! Splits `path[depth].node` and puts the halves into its parent, or under a new root. One step of `SplitNode`.
+    TreeActionsBatch SplitOnce(const Path& path, ssize_t depth);
+
+    //! Where `Erase` is on its way up: the `key_index`-th key (and child) of `vertex`, which is `path_[depth].node`, is
+    //! to be erased.
+    struct EraseLevel {
+        Node* vertex;
+        ssize_t depth;
+        ssize_t key_index;
+    };
+    enum class EEraseOutcome {
+        //! Nothing above the level has to change.
+        Done,
+        //! The underfull node has been merged into a sibling which needs to be split now.
+        Borrowed,
+        //! The underfull node has been merged into a sibling, and its parent has lost a key. The level is moved to it.
+        Merged,
+    };
+    struct Rebalancing {
+        EEraseOutcome outcome;
+        //! Nothing to notify about if empty.
+        TreeActionsBatch actions;
+    };
+    //! Erases the key (and child) of `level`, one step of `Erase`.
+    TreeActionsBatch EraseAtLevel(const EraseLevel& level);
+    //! Fixes the node of `level` if it has got too few keys. Moves `level` to the parent if the parent loses a key.
+    Rebalancing Rebalance(EraseLevel& level);
+
+    //! Splits in halves `vertex`, which has more than `kMaxFanout` keys. `vertex` is left without children.
+    static std::pair<std::unique_ptr<Node>, std::unique_ptr<Node>> SplitInHalves(Node& vertex);
+    //! Moves all the keys (and children) of `underfull` to the adjacent end of `sibling`, which is on the left of
+    //! `underfull` if `is_sibling_left`.
+    static void MoveAllInto(Node& underfull, Node& sibling, bool is_sibling_left);
+    //! Moves values of keys from `first` to `last` of a leaf `source` to `target`, before its `position`-th value.
+    //! Does nothing for internal nodes and for trees without values.
+    static void MoveValues(Node& source, ssize_t first, ssize_t last, Node& target, ssize_t position);
+
+    //! Moves the keys on one side of `x` to the empty `other`: the ones less than `x` if `is_other_left`, the rest
+    //! otherwise. Observers of both trees get the net changes.
+    void SplitInto(const Key& x, BPlusTree& other, bool is_other_left);
+    //! Moves nodes of `other` to this tree, `merge` combines the roots. Observers of both trees get the net changes.
+    void TakeOver(BPlusTree& other, const std::function<Subtree(Subtree, Subtree, Restructuring&)>& merge);
+    void ApplySetOperation(ESetOperation operation, BPlusTree& other, ssize_t thread_count);
+    //! Applies `operation` recursively: `others` is split by the ranges of children of `mine` and every child is
+    //! combined with its piece, in parallel while the subtrees are high enough.
+    static Subtree CombineSubtrees(ESetOperation operation, Subtree mine, Subtree others, ssize_t thread_count,
+                                   Restructuring& restructuring);
+    //! `pieces[i]` holds keys of the other tree which fall into the range of `i`-th key of `leaf`.
+    static Subtree CombineWithLeaf(ESetOperation operation, Subtree leaf, std::vector<Subtree> pieces,
+                                   Restructuring& restructuring);
+    static void DestroySubtree(Subtree tree, Restructuring& restructuring);
+
+    //! Splits `tree` into keys less than `x` and the rest, or into keys not greater than `x` and the rest if
+    //! `is_x_left`.
+    static std::pair<Subtree, Subtree> SplitSubtree(Subtree tree, const Key& x, bool is_x_left,
+                                                    Restructuring& restructuring);
+    //! Same as `SplitSubtree` for `path` going from `root` to the leaf where `x` belongs.
+    static std::pair<Subtree, Subtree> SplitAlongPath(std::unique_ptr<Node> root, const Path& path, const Key& x,
+                                                      bool is_x_left, Restructuring& restructuring);
+    //! Joins two subtrees, keys of `left` being less than keys of `right`. Both are proper trees except their roots,
+    //! which may have fewer than `kMinFanout` keys.
+    static Subtree JoinSubtrees(Subtree left, Subtree right, Restructuring& restructuring);
+    //! Splits `parent.children[index]` if it has more than `kMaxFanout` keys.
+    static void SplitChildIfFull(Node& parent, ssize_t index, Restructuring& restructuring);
+    static Subtree SplitRootIfFull(Subtree tree, Restructuring& restructuring);
+    //! Sets keys of an internal `vertex` to maximums of its children. Returns `true` if any key has changed.
+    static bool RefreshKeys(Node& vertex);
+    static ssize_t GetHeight(const Node* vertex);
+    static Key GetMinKey(const Node& vertex);
+
+    //! Tells observers about the nodes touched by `restructuring` and finishes the query. Nodes in `arrived` are new to
+    //! observers, since they come from another tree, and `departed` are the ones which have gone to another tree.
+    void NotifyRestructuring(const Restructuring& restructuring, const std::unordered_set<const Node*>& arrived,
+                             const std::vector<MemoryAddress>& departed) const;
+    //! Adds `vertex` and its ancestors to `marked` if `vertex` is in this tree.
+    void MarkWithAncestors(const Node* vertex, std::unordered_set<const Node*>& marked) const;
+    void TraverseForRestructuring(Node* vertex, const Restructuring& restructuring,
+                                  const std::unordered_set<const Node*>& arrived,
+                                  const std::unordered_set<const Node*>& on_paths, TreeActionsBatch& actions) const;
+    static void TraverseForNodes(Node* vertex, std::vector<MemoryAddress>& nodes);
+
+    //! Rebuilds the membership filter, if there's one, from the keys of the tree. Takes O(n).
+    void RebuildMembershipFilter();
+    //! Same, but only if the filter has got too many erased keys or too many keys in total.
+    void RefreshMembershipFilter();
+
+    //! Where the next node to relocate is: the owning pointer to it, in the root or in its parent.
+    struct CompactionTarget {
+        std::unique_ptr<Node>* slot = nullptr;
+        Node* parent = nullptr;
+    };
+    //! Follows `compaction_cursor_` from the root, moving it on past children which have been merged away since the
+    //! previous slice. Returns a null slot when the pass is over.
+    CompactionTarget ResolveCompactionCursor();
+    //! Moves the cursor past the node of `target` in pre-order: to its first child if it has one, to its next sibling
+    //! otherwise.
+    void AdvanceCompactionCursor(const CompactionTarget& target);
+    //! Nodes the next slice relocates and the bytes of the slab they take with their buffers.
+    struct CompactionSlice {
+        ssize_t node_count = 0;
+        ssize_t slab_bytes = 0;
+    };
+    //! Measures the next slice of at most `max_nodes` nodes, walking a copy of the cursor.
+    CompactionSlice MeasureCompactionSlice(ssize_t max_nodes);
+    //! Bytes of `slab` the node takes after `Relocate`: the node itself and buffers of exact size.
+    static ssize_t MeasureRelocated(const Node& vertex);
+    //! Moves the node of `target` to the next place in `slab`, with its keys, children and values in buffers of exact
+    //! size right after it, and returns the actions telling observers about it.
+    TreeActionsBatch Relocate(const CompactionTarget& target, NodeSlabs::Slab* slab);
+
+    //! Converts the mapped file to nodes, if there's one, and lets it go. Observers see every node of the file
+    //! replaced. Invariants beyond the ones `FlatTreeFile` checks aren't asserted here, so that `Audit` can report
+    //! them.
+    void Materialize();
+    //! Verifies the mapped file, if there's one, and lets it go if it's malformed. Returns whether the tree still has
+    //! the file.
+    bool VerifyFile();
+    //! Nodes of the mapped file are known to observers by their addresses in the mapping.
+    static MemoryAddress GetFlatAddress(const FlatNode& flat_node) {
+        return const_cast<FlatNode*>(&flat_node);
+    }
+    NodeInfo DescribeFlatNode(const FlatNode& flat_node) const;
+    MemoryAddress GetObservedRoot() const;
+    uint32_t AppendToFile(const Node& vertex, FlatTreeWriter& writer) const;
+
+    //! Audits the whole tree unless validation is off. Returns `false` if the tree is invalid, reporting the broken
+    //! invariant. Suitable for `assert`s.
+    bool IsValid() const;
+    //! Checks the tree after a mutation as much as `validation_level_` says: at `EValidationLevel::Sampled`, the path
+    //! to `touched` with the siblings of its nodes, if there's one, and the whole tree once in `audit_period_` calls.
+    //! Only for `assert`s, since it counts the calls.
+    bool IsValidAfterMutation(std::optional<Key> touched = std::nullopt);
+    //! Checks the invariants of `vertex` itself and of its links to its children. `lower` is the separator before the
+    //! node in its parent, if there's one.
+    static std::optional<TreeViolation> CheckNode(Node& vertex, ssize_t depth, std::optional<Key> lower);
+    //! Checks the nodes on the way from the root to the leaf where `x` belongs, and all their children: a split or a
+    //! merge on the way also changes the sibling it creates or takes keys from. Takes O(log n).
+    std::optional<TreeViolation> CheckPath(const Key& x) const;
+    //! `leaf_depth` is the depth of the first leaf met, or -1 before that.
+    static std::optional<TreeViolation> AuditSubtree(Node* vertex, ssize_t depth, std::optional<Key> lower,
+                                                     ssize_t& leaf_depth);
+
+    //! Notifies about visiting `vertex` if anyone is interested in it. Descent visits dominate the notification traffic
+    //! of read-heavy workloads, so they aren't even built for observers which don't need them.
+    void NotifyVisit(Node* vertex) const;
+    //! The batch `NotifyVisit` would notify, or `std::nullopt` if there's nobody to notify. Counts the visit.
+    std::optional<TreeActionsBatch> ProduceVisit(Node* vertex) const;
+    //! Returns `std::nullopt` when nobody would look at the payload, e.g. while a batch is being coalesced.
+    std::optional<NodeInfo> ProduceNodeInfo(const Node& martyr) const;
+    static NodeInfo DescribeNode(const Node& martyr);
     TreeActionsBatch ProduceWholeTreeInfo() const;
     void TraverseForTreeInfo(Node* vertex, TreeActionsBatch& info_storage) const;
+    static void TraverseForMemoryStats(const Node* vertex, TreeMemoryStats& stats,
+                                       std::unordered_set<const NodeSlabs::Slab*>& slabs);
+    static void TraverseForKeys(const Node* vertex, std::vector<Key>& keys);
+    //! Counts the keys of `vertex`'s subtree without collecting them.
+    static ssize_t CountKeys(const Node* vertex);
 
+    // Declared before `port_`, which counts notifications in it.
+    mutable TreeMetrics metrics_;
     std::unique_ptr<Node> root_;
-    Observable<TreeActionsBatch> port_;
+    //! Path of the last access, the finger the next one starts from. Mutations cut it to the nodes they haven't
+    //! destroyed. Mutable since `Contains` moves it too.
+    mutable Path path_;
+    //! Changes whenever nodes are destroyed or replaced, so hints taken before are known to be outdated.
+    uint64_t finger_version_ = 0;
+    TreeActionsPort port_;
+    std::optional<TreeActionsBatch> pending_batch_summary_;
+    //! Keys of the tree while it's backed by a file. The tree has no nodes then.
+    std::optional<FlatTreeFile> flat_file_;
+    //! Mutable since `Contains` counts its queries.
+    mutable std::optional<MembershipFilter> membership_filter_;
+    //! Child indices leading from the root to the next node to relocate in pre-order while a compaction pass is going
+    //! on. The first one indexes the root itself.
+    std::optional<std::vector<ssize_t>> compaction_cursor_;
+    EValidationLevel validation_level_ = EValidationLevel::Sampled;
+    ssize_t audit_period_ = kDefaultAuditPeriod;
+    ssize_t mutations_since_audit_ = 0;
+    //! The operation going step by step, if there's one, started or not. It resets the handle itself when it's over.
+    mutable std::coroutine_handle<> running_steps_;
 };
 
+using TwoThreeTree = BPlusTree<>;
+template <typename TValue>
+using TwoThreeMap = BPlusTree<2, 3, std::vector<Key>, TValue>;
+
+// Instantiated once in two_three_tree.cpp.
+extern template class BPlusTree<2, 3>;
+
 } // namespace NVis
+
+#include "two_three_tree_impl.h"
@@ -0,0 +1,2259 @@
+#pragma once
+
+#include "tracer.h"
+#include "two_three_tree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <thread>
+
+namespace NVis {
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::BPlusTree()
+    : root_(nullptr),
+      port_([this]() { return this->ProduceWholeTreeInfo(); },
+            [this](MemoryAddress address) {
+                if (flat_file_ && flat_file_->HoldsNode(address)) {
+                    return DescribeFlatNode(*static_cast<const FlatNode*>(address));
+                }
+                return DescribeNode(*static_cast<const Node*>(address));
+            },
+            [this]() { return this->GetObservedRoot(); }, &metrics_) {}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::~BPlusTree() {
+    FinishSteps();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Contains(const Key& x) const {
+    TraceSpan span("Contains", "tree", "key", x);
+    ScopedLatency latency(metrics_, ETreeOperation::Contains);
+    FinishSteps();
+    port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+    if (membership_filter_ && !membership_filter_->MayContain(x)) {
+        // A definite miss, there's nothing to descend for.
+        port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+        return false;
+    }
+    bool is_found = false;
+    if (flat_file_) {
+        // Descents of the file aren't shown, observers see visits once it's converted to nodes.
+        is_found = flat_file_->Contains(x);
+    } else if (auto node_found = SearchFromFinger(x); node_found != nullptr) {
+        is_found = std::binary_search(node_found->keys.begin(), node_found->keys.end(), x);
+    }
+    if (membership_filter_ && !is_found) {
+        membership_filter_->CountFalsePositive();
+    }
+    port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+    return is_found;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::vector<Key> BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::GetKeys() const {
+    FinishSteps();
+    std::vector<Key> keys;
+    if (flat_file_) {
+        // A malformed file has no keys, as it will have once it's let go.
+        if (!flat_file_->Verify()) {
+            return keys;
+        }
+        // Post-order visits leaves from left to right.
+        keys.reserve(flat_file_->GetKeyCount());
+        for (ssize_t index = 0; index < flat_file_->GetNodeCount(); ++index) {
+            const auto& flat_node = flat_file_->GetNode(index);
+            if (flat_node.child_count == 0) {
+                keys.insert(keys.end(), flat_node.keys.begin(), flat_node.keys.begin() + flat_node.key_count);
+            }
+        }
+        return keys;
+    }
+    TraverseForKeys(root_.get(), keys);
+    return keys;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Insert(const Key& x) {
+    return Emplace(x, [](auto& /* value */) {});
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TValue* BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Find(const Key& x)
+    requires kIsMap
+{
+    return FindValue(x);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+const TValue* BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Find(const Key& x) const
+    requires kIsMap
+{
+    return FindValue(x);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+template <typename... TArgs>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TryEmplace(const Key& x, TArgs&&... args)
+    requires kIsMap
+{
+    return Emplace(x, [](TValue& /* value */) {}, std::forward<TArgs>(args)...);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::InsertOrAssign(const Key& x, TValue value)
+    requires kIsMap
+{
+    // `value` is moved either to the new key or to the old value, never to both.
+    return Emplace(x, [&value](TValue& old_value) { old_value = std::move(value); }, std::move(value));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Build(std::vector<std::pair<Key, TValue>> items)
+    requires kIsMap
+{
+    TraceSpan span("Build", "tree", "items", std::ssize(items));
+    FinishSteps();
+    assert(root_ == nullptr && "Building a map which isn't empty");
+    assert(std::adjacent_find(items.begin(), items.end(),
+                              [](const auto& lhs, const auto& rhs) { return lhs.first >= rhs.first; }) == items.end() &&
+           "Items to build a map of aren't sorted by unique keys");
+    if (items.empty()) {
+        return;
+    }
+    std::vector<std::unique_ptr<Node>> level;
+    auto item = items.begin();
+    std::vector<Key> keys;
+    for (auto leaf_size : SplitEvenly(std::ssize(items))) {
+        auto leaf = std::make_unique<Node>();
+        keys.clear();
+        leaf->values.reserve(leaf_size);
+        for (auto last = item + leaf_size; item != last; ++item) {
+            keys.emplace_back(item->first);
+            leaf->values.emplace_back(std::move(item->second));
+        }
+        leaf->keys.assign(keys.begin(), keys.end());
+        level.emplace_back(std::move(leaf));
+    }
+    BuildAbove(std::move(level));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Build(const std::vector<Key>& keys)
+    requires(!kIsMap)
+{
+    TraceSpan span("Build", "tree", "keys", std::ssize(keys));
+    FinishSteps();
+    assert(root_ == nullptr && !flat_file_ && "Building a tree which isn't empty");
+    assert(std::adjacent_find(keys.begin(), keys.end(), std::greater_equal<Key>()) == keys.end() &&
+           "Keys to build a tree of aren't sorted or repeat");
+    if (keys.empty()) {
+        return;
+    }
+    std::vector<std::unique_ptr<Node>> level;
+    auto key = keys.begin();
+    for (auto leaf_size : SplitEvenly(std::ssize(keys))) {
+        level.emplace_back(std::make_unique<Node>(Node{.keys = NodeKeys(key, key + leaf_size), .children = {}}));
+        key += leaf_size;
+    }
+    BuildAbove(std::move(level));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::GetHint() const -> Hint {
+    FinishSteps();
+    Hint hint;
+    hint.tree_ = this;
+    hint.path_ = path_;
+    hint.version_ = finger_version_;
+    return hint;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Contains(Hint& hint, const Key& x) const {
+    return AccessWithHint(hint, [this, &x]() { return Contains(x); });
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Insert(Hint& hint, const Key& x) {
+    return AccessWithHint(hint, [this, &x]() { return Insert(x); });
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Erase(Hint& hint, const Key& x) {
+    return AccessWithHint(hint, [this, &x]() { return Erase(x); });
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+template <typename TAccess>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::AccessWithHint(Hint& hint, TAccess access) const {
+    // The finger is about to be swapped, so an operation going step by step can't be left to finish later.
+    FinishSteps();
+    if (hint.tree_ != this || hint.version_ != finger_version_) {
+        // The nodes of the hint may be gone, so the tree's own finger is used instead.
+        auto result = access();
+        hint = GetHint();
+        return result;
+    }
+    // The finger of the tree waits in the hint meanwhile, swapping doesn't copy the paths.
+    path_.swap(hint.path_);
+    auto result = access();
+    path_.swap(hint.path_);
+    if (hint.version_ != finger_version_) {
+        // The access has changed the structure, so the finger of the tree may refer to destroyed nodes. The one of the
+        // hint has been kept valid by the access.
+        path_ = hint.path_;
+        hint.version_ = finger_version_;
+    }
+    return result;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::FinishSteps() const {
+    // The operation resets the handle as its last step.
+    while (running_steps_) {
+        running_steps_.resume();
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TrackSteps(TreeSteps steps) const {
+    FinishSteps();
+    steps.Track(running_steps_);
+    return steps;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+template <typename TOnFound, typename... TArgs>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Emplace(const Key& x, [[maybe_unused]] TOnFound on_found,
+                                                                     TArgs&&... args) {
+    TraceSpan span("Insert", "tree", "key", x);
+    ScopedLatency latency(metrics_, ETreeOperation::Insert);
+    FinishSteps();
+    Materialize();
+    port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+    if (root_ == nullptr) {
+        port_.Notify(PlantRoot(x, std::forward<TArgs>(args)...));
+        CompleteInsert(x);
+        port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+        return true;
+    }
+    auto node_found = SearchFromFinger(x);
+    assert(node_found->children.empty() && "Descent in 2-3 tree returned not a leaf");
+
+    auto found = std::find(node_found->keys.begin(), node_found->keys.end(), x);
+    if (found != node_found->keys.end()) {
+        if constexpr (kIsMap) {
+            on_found(node_found->values[found - node_found->keys.begin()]);
+        }
+        assert(IsValidAfterMutation(x) && "Incorrect tree after insert");
+        port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+        return false;
+    }
+    port_.Notify(InsertIntoLeaf(*node_found, x, std::forward<TArgs>(args)...));
+    UpdateKeys(path_);
+    CutFinger(SplitNode(path_, std::ssize(path_) - 1));
+    CompleteInsert(x);
+
+    port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+    return true;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+template <typename... TArgs>
+TreeActionsBatch BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::PlantRoot(const Key& x, TArgs&&... args) {
+    assert(root_ == nullptr && "Planting a root into a non-empty tree");
+    root_ = std::make_unique<Node>(Node{.keys = {x}, .children = {}});
+    if constexpr (kIsMap) {
+        root_->values.emplace_back(std::forward<TArgs>(args)...);
+    }
+    metrics_.Add(ETreeCounter::RootChanges);
+    return {TreeAction{
+                .node_address = root_.get(), .action_type = ENodeAction::Create, .data = ProduceNodeInfo(*root_)},
+            TreeAction{.node_address = root_.get(), .action_type = ENodeAction::MakeRoot}};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+template <typename... TArgs>
+TreeActionsBatch BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::InsertIntoLeaf(Node& leaf, const Key& x,
+                                                                                       TArgs&&... args) {
+    auto position = std::find_if(leaf.keys.begin(), leaf.keys.end(), [&x](const Key& key) { return x < key; });
+    if constexpr (kIsMap) {
+        leaf.values.emplace(leaf.values.begin() + (position - leaf.keys.begin()), std::forward<TArgs>(args)...);
+    }
+    leaf.keys.emplace(position, x);
+    return {TreeAction{.node_address = &leaf, .action_type = ENodeAction::Change, .data = ProduceNodeInfo(leaf)}};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CompleteInsert(const Key& x) {
+    assert(IsValidAfterMutation(x) && "Incorrect tree after insert");
+    if (membership_filter_) {
+        membership_filter_->Add(x);
+        RefreshMembershipFilter();
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Erase(const Key& x) {
+    TraceSpan span("Erase", "tree", "key", x);
+    ScopedLatency latency(metrics_, ETreeOperation::Erase);
+    FinishSteps();
+    Materialize();
+    port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+    auto node_found = SearchFromFinger(x);
+    if (node_found == nullptr) {
+        port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+        return false;
+    }
+    assert(node_found->children.empty() && "Descent in 2-3 tree returned not a leaf");
+    EraseLevel level{.vertex = node_found,
+                     .depth = std::ssize(path_) - 1,
+                     .key_index = std::find(node_found->keys.begin(), node_found->keys.end(), x) -
+                                  node_found->keys.begin()};
+
+    if (level.key_index == std::ssize(node_found->keys)) {
+        assert(IsValidAfterMutation(x) && "Incorrect tree after erase");
+        port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+        return false;
+    }
+    while (true) {
+        auto is_leaf = level.vertex->children.empty();
+        port_.Notify(EraseAtLevel(level));
+        if (is_leaf) {
+            // Erasing a key of a leaf can lead to necessity of updating keys.
+            UpdateKeys(path_);
+        }
+        auto [outcome, actions] = Rebalance(level);
+        if (!actions.empty()) {
+            port_.Notify(std::move(actions));
+        }
+        if (outcome == EEraseOutcome::Borrowed) {
+            CutFinger(SplitNode(path_, level.depth));
+        }
+        if (outcome != EEraseOutcome::Merged) {
+            break;
+        }
+    }
+    CompleteErase(x);
+    port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+    return true;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeActionsBatch BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::EraseAtLevel(const EraseLevel& level) {
+    auto vertex = level.vertex;
+    vertex->keys.erase(vertex->keys.begin() + level.key_index);
+    if (vertex->children.empty()) {
+        if constexpr (kIsMap) {
+            vertex->values.erase(vertex->values.begin() + level.key_index);
+        }
+        // Processing a leaf. It has no children to delete.
+        return {TreeAction{
+            .node_address = vertex, .action_type = ENodeAction::Change, .data = ProduceNodeInfo(*vertex)}};
+    }
+    // Processing an internal vertex. No need to update keys, but need to also erase one of children.
+    auto erasing_address = vertex->children[level.key_index].get();
+    vertex->children.erase(vertex->children.begin() + level.key_index);
+    return {TreeAction{.node_address = erasing_address, .action_type = ENodeAction::Delete},
+            TreeAction{.node_address = vertex, .action_type = ENodeAction::Change, .data = ProduceNodeInfo(*vertex)}};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Rebalance(EraseLevel& level) -> Rebalancing {
+    auto vertex = level.vertex;
+    auto depth = level.depth;
+    if (std::ssize(vertex->keys) >= kMinFanout) {
+        // Nodes below `vertex` have been merged into their siblings.
+        CutFinger(depth);
+        return {.outcome = EEraseOutcome::Done, .actions = {}};
+    }
+    if (depth == 0) {
+        // Root may have fewer keys than other nodes, as long as it's not an internal node with a single child.
+        assert(root_.get() == vertex && "Path doesn't start at root");
+        if (vertex->children.size() == 1) {
+            auto old_root = root_.get();
+            root_ = std::move(root_->children[0]);
+            metrics_.Add(ETreeCounter::RootChanges);
+            CutFinger(-1);
+            return {.outcome = EEraseOutcome::Done,
+                    .actions = {TreeAction{.node_address = old_root, .action_type = ENodeAction::Delete},
+                                TreeAction{.node_address = root_.get(), .action_type = ENodeAction::MakeRoot}}};
+        }
+        if (vertex->keys.empty()) {
+            root_ = nullptr;
+            metrics_.Add(ETreeCounter::RootChanges);
+            CutFinger(-1);
+            return {.outcome = EEraseOutcome::Done,
+                    .actions = {TreeAction{.node_address = vertex, .action_type = ENodeAction::Delete},
+                                TreeAction{.action_type = ENodeAction::MakeRoot}}};
+        }
+        CutFinger(0);
+        return {.outcome = EEraseOutcome::Done, .actions = {}};
+    }
+    auto parent = path_[depth - 1].node;
+    auto in_parent_ind = path_[depth].index_in_parent;
+    assert(parent->children[in_parent_ind].get() == vertex && "Path doesn't match the tree");
+    Node* sibling;
+    ssize_t sibling_ind;
+    if (MergesIntoLeft(in_parent_ind)) {
+        // Merging to left sibling
+        sibling_ind = in_parent_ind - 1;
+        sibling = parent->children[sibling_ind].get();
+        MoveAllInto(*vertex, *sibling, true);
+        parent->keys[sibling_ind] = sibling->keys.back();
+    } else {
+        // Merging to right sibling
+        // After `vertex` is erased from `parent`, sibling takes its place.
+        sibling_ind = in_parent_ind;
+        sibling = parent->children[in_parent_ind + 1].get();
+        MoveAllInto(*vertex, *sibling, false);
+    }
+    if (std::ssize(sibling->keys) > kMaxFanout) {
+        parent->keys.erase(parent->keys.begin() + in_parent_ind);
+        parent->children.erase(parent->children.begin() + in_parent_ind);
+        metrics_.Add(ETreeCounter::Borrows);
+        path_[depth] = PathStep{.node = sibling, .index_in_parent = sibling_ind};
+        return {
+            .outcome = EEraseOutcome::Borrowed,
+            .actions = {TreeAction{.node_address = vertex, .action_type = ENodeAction::Delete},
+                        TreeAction{.node_address = sibling,
+                                   .action_type = ENodeAction::Change,
+                                   .data = ProduceNodeInfo(*sibling)},
+                        TreeAction{.node_address = parent,
+                                   .action_type = ENodeAction::Change,
+                                   .data = ProduceNodeInfo(*parent)}}};
+    }
+    metrics_.Add(ETreeCounter::Merges);
+    level = EraseLevel{.vertex = parent, .depth = depth - 1, .key_index = in_parent_ind};
+    return {.outcome = EEraseOutcome::Merged,
+            .actions = {TreeAction{.node_address = sibling,
+                                   .action_type = ENodeAction::Change,
+                                   .data = ProduceNodeInfo(*sibling)},
+                        TreeAction{.node_address = parent,
+                                   .action_type = ENodeAction::Change,
+                                   .data = ProduceNodeInfo(*parent)}}};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CompleteErase([[maybe_unused]] const Key& x) {
+    assert(IsValidAfterMutation(x) && "Incorrect tree after erase");
+    if (membership_filter_) {
+        membership_filter_->CountErased();
+        RefreshMembershipFilter();
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ContainsSteps(Key x) const {
+    return TrackSteps(MakeContainsSteps(x));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MakeContainsSteps(Key x) const {
+    TreeActionsBatch step = {TreeAction{.action_type = ENodeAction::StartQuery}};
+    port_.Notify(step);
+    co_yield step;
+    // A definite miss if the filter rejects `x`, there's nothing to descend for then.
+    if (!membership_filter_ || membership_filter_->MayContain(x)) {
+        bool is_found = false;
+        if (flat_file_) {
+            is_found = flat_file_->Contains(x);
+        } else if (root_ != nullptr) {
+            for (auto steps = SearchFromFingerSteps(x); steps.Next();) {
+                co_yield steps.Current();
+            }
+            const auto& keys = path_.back().node->keys;
+            is_found = std::binary_search(keys.begin(), keys.end(), x);
+        }
+        if (membership_filter_ && !is_found) {
+            membership_filter_->CountFalsePositive();
+        }
+    }
+    step = {TreeAction{.action_type = ENodeAction::EndQuery}};
+    port_.Notify(step);
+    co_yield step;
+    running_steps_ = nullptr;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::InsertSteps(Key x) {
+    return TrackSteps(MakeInsertSteps(x));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MakeInsertSteps(Key x) {
+    Materialize();
+    TreeActionsBatch step = {TreeAction{.action_type = ENodeAction::StartQuery}};
+    port_.Notify(step);
+    co_yield step;
+    if (root_ == nullptr) {
+        step = PlantRoot(x);
+        port_.Notify(step);
+        co_yield step;
+        CompleteInsert(x);
+    } else {
+        for (auto steps = SearchFromFingerSteps(x); steps.Next();) {
+            co_yield steps.Current();
+        }
+        auto& leaf = *path_.back().node;
+        if (std::find(leaf.keys.begin(), leaf.keys.end(), x) == leaf.keys.end()) {
+            step = InsertIntoLeaf(leaf, x);
+            port_.Notify(step);
+            co_yield step;
+            for (auto steps = UpdateKeysSteps(); steps.Next();) {
+                co_yield steps.Current();
+            }
+            for (auto steps = SplitNodeSteps(std::ssize(path_) - 1); steps.Next();) {
+                co_yield steps.Current();
+            }
+            CompleteInsert(x);
+        }
+    }
+    step = {TreeAction{.action_type = ENodeAction::EndQuery}};
+    port_.Notify(step);
+    co_yield step;
+    running_steps_ = nullptr;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::EraseSteps(Key x) {
+    return TrackSteps(MakeEraseSteps(x));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MakeEraseSteps(Key x) {
+    Materialize();
+    TreeActionsBatch step = {TreeAction{.action_type = ENodeAction::StartQuery}};
+    port_.Notify(step);
+    co_yield step;
+    if (root_ != nullptr) {
+        for (auto steps = SearchFromFingerSteps(x); steps.Next();) {
+            co_yield steps.Current();
+        }
+        auto leaf = path_.back().node;
+        EraseLevel level{.vertex = leaf,
+                         .depth = std::ssize(path_) - 1,
+                         .key_index = std::find(leaf->keys.begin(), leaf->keys.end(), x) - leaf->keys.begin()};
+        if (level.key_index != std::ssize(leaf->keys)) {
+            while (true) {
+                auto is_leaf = level.vertex->children.empty();
+                step = EraseAtLevel(level);
+                port_.Notify(step);
+                co_yield step;
+                if (is_leaf) {
+                    for (auto steps = UpdateKeysSteps(); steps.Next();) {
+                        co_yield steps.Current();
+                    }
+                }
+                auto rebalancing = Rebalance(level);
+                if (!rebalancing.actions.empty()) {
+                    step = std::move(rebalancing.actions);
+                    port_.Notify(step);
+                    co_yield step;
+                }
+                if (rebalancing.outcome == EEraseOutcome::Borrowed) {
+                    for (auto steps = SplitNodeSteps(level.depth); steps.Next();) {
+                        co_yield steps.Current();
+                    }
+                }
+                if (rebalancing.outcome != EEraseOutcome::Merged) {
+                    break;
+                }
+            }
+            CompleteErase(x);
+        }
+    }
+    step = {TreeAction{.action_type = ENodeAction::EndQuery}};
+    port_.Notify(step);
+    co_yield step;
+    running_steps_ = nullptr;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Split(const Key& x, BPlusTree& right) {
+    SplitInto(x, right, false);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitLeft(const Key& x, BPlusTree& left) {
+    SplitInto(x, left, true);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitInto(const Key& x, BPlusTree& other,
+                                                                      bool is_other_left) {
+    assert(&other != this && "Splitting a tree into itself");
+    TraceSpan span("Split", "tree", "key", x);
+    FinishSteps();
+    other.FinishSteps();
+    Materialize();
+    other.Materialize();
+    assert(other.root_ == nullptr && "Splitting a tree into a non-empty one");
+    assert(!port_.IsCoalescing() && !other.port_.IsCoalescing() && "Splitting a tree while a batch is applied");
+    port_.RestartSnapshots();
+    port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+    if (root_ == nullptr) {
+        port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+        return;
+    }
+    SearchByLowerBound(x, &path_);
+    Restructuring restructuring;
+    auto [left_part, right_part] = SplitAlongPath(std::move(root_), path_, x, false, restructuring);
+    root_ = std::move(is_other_left ? right_part.root : left_part.root);
+    other.root_ = std::move(is_other_left ? left_part.root : right_part.root);
+    ResetFinger();
+    other.ResetFinger();
+    assert(IsValidAfterMutation(x) && other.IsValidAfterMutation(x) && "Incorrect tree after split");
+    // Keys which have left this tree stay in its filter as false positives, so they are counted like erased ones.
+    if (membership_filter_) {
+        membership_filter_->CountErased(CountKeys(other.root_.get()));
+        RefreshMembershipFilter();
+    }
+    // Only if `other` has a filter: then it has to learn every key it has got anyway.
+    other.RebuildMembershipFilter();
+
+    std::vector<MemoryAddress> departed;
+    if (port_.IsInterestedIn(kStructuralInterest)) {
+        TraverseForNodes(other.root_.get(), departed);
+        std::erase_if(departed, [&restructuring](MemoryAddress address) {
+            return restructuring.created.contains(static_cast<const Node*>(address));
+        });
+    }
+    NotifyRestructuring(restructuring, {}, departed);
+    if (other.port_.IsInterestedIn(kStructuralInterest)) {
+        other.port_.Notify(other.ProduceWholeTreeInfo());
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Join(BPlusTree& right) {
+    TraceSpan span("Join", "tree");
+    TakeOver(right, [](Subtree left_part, Subtree right_part, Restructuring& restructuring) {
+        assert((left_part.root == nullptr || right_part.root == nullptr ||
+                left_part.root->keys.back() < GetMinKey(*right_part.root)) &&
+               "Joining trees with overlapping keys");
+        return JoinSubtrees(std::move(left_part), std::move(right_part), restructuring);
+    });
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::JoinLeft(BPlusTree& left) {
+    TraceSpan span("Join", "tree");
+    TakeOver(left, [](Subtree right_part, Subtree left_part, Restructuring& restructuring) {
+        assert((left_part.root == nullptr || right_part.root == nullptr ||
+                left_part.root->keys.back() < GetMinKey(*right_part.root)) &&
+               "Joining trees with overlapping keys");
+        return JoinSubtrees(std::move(left_part), std::move(right_part), restructuring);
+    });
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Union(BPlusTree& other, ssize_t thread_count)
+    requires(!kIsMap)
+{
+    TraceSpan span("Union", "tree");
+    ApplySetOperation(ESetOperation::Union, other, thread_count);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Intersection(BPlusTree& other, ssize_t thread_count)
+    requires(!kIsMap)
+{
+    TraceSpan span("Intersection", "tree");
+    ApplySetOperation(ESetOperation::Intersection, other, thread_count);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Difference(BPlusTree& other, ssize_t thread_count)
+    requires(!kIsMap)
+{
+    TraceSpan span("Difference", "tree");
+    ApplySetOperation(ESetOperation::Difference, other, thread_count);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+BatchResult BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ApplyBatch(EBatchOperation operation,
+                                                                               const std::vector<KeyRange>& ranges,
+                                                                               std::stop_token stop,
+                                                                               std::atomic<ssize_t>* progress) {
+    // Publishing progress on every key would make the counter's cache line bounce between threads for nothing.
+    static constexpr ssize_t kProgressGranularity = 1024;
+    FinishSteps();
+
+    TraceSpan span("ApplyBatch", "tree", "ranges", std::ssize(ranges));
+
+    BatchResult result;
+    // Converting the file inside of coalescing would make the summary describe every node of it.
+    Materialize();
+    port_.StartCoalescing();
+    for (const auto& range : ranges) {
+        for (Key key = range.first;; ++key) {
+            if (stop.stop_requested()) {
+                result.is_cancelled = true;
+                break;
+            }
+            bool is_changed = operation == EBatchOperation::Insert ? Insert(key) : Erase(key);
+            result.changed_count += is_changed ? 1 : 0;
+            ++result.processed_count;
+            if (progress && result.processed_count % kProgressGranularity == 0) {
+                progress->store(result.processed_count, std::memory_order_relaxed);
+            }
+            // Checking before incrementing to not overflow at the end of `Key`'s range.
+            if (key == range.last) {
+                break;
+            }
+        }
+        if (result.is_cancelled) {
+            break;
+        }
+    }
+    if (progress) {
+        progress->store(result.processed_count, std::memory_order_relaxed);
+    }
+    auto summary = port_.StopCoalescing();
+    if (pending_batch_summary_) {
+        // Previous summary hasn't been published. Observers still live in the state before it, so the two batches
+        // can be simply delivered one after another.
+        pending_batch_summary_->pop_back();
+        pending_batch_summary_->insert(pending_batch_summary_->end(), summary.begin() + 1, summary.end());
+    } else {
+        pending_batch_summary_ = std::move(summary);
+    }
+    return result;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::PublishBatchSummary() {
+    if (pending_batch_summary_) {
+        TraceSpan span("PublishBatchSummary", "tree", "actions", std::ssize(*pending_batch_summary_));
+        port_.NotifySummary(std::move(*pending_batch_summary_));
+        pending_batch_summary_.reset();
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SubscribeObserver(Observer<TreeActionsBatch>* observer) {
+    FinishSteps();
+    VerifyFile();
+    port_.Subscribe(observer);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SubscribeObserverStreaming(Observer<TreeActionsBatch>* observer,
+                                                                                   ssize_t chunk_size) {
+    FinishSteps();
+    VerifyFile();
+    port_.SubscribeStreaming(observer, chunk_size);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SaveToFile(const std::string& path) const
+    requires(kMinFanout == 2 && kMaxFanout == FlatNode::kMaxKeys && !kIsMap)
+{
+    FinishSteps();
+    if (flat_file_ && flat_file_->IsMappedFrom(path)) {
+        return false;
+    }
+    FlatTreeWriter writer(path);
+    if (flat_file_) {
+        for (ssize_t index = 0; index < flat_file_->GetNodeCount(); ++index) {
+            writer.Append(flat_file_->GetNode(index));
+        }
+        return writer.Finish(flat_file_->GetKeyCount());
+    }
+    if (root_) {
+        AppendToFile(*root_, writer);
+    }
+    return writer.Finish(MemoryStats().key_count);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MapFile(const std::string& path, EFlatTreeCheck check)
+    requires(kMinFanout == 2 && kMaxFanout == FlatNode::kMaxKeys && !kIsMap)
+{
+    FinishSteps();
+    assert(root_ == nullptr && !flat_file_ && "Mapping a file into a non-empty tree");
+    assert(!port_.IsCoalescing() && "Mapping a file in the middle of a batch");
+    flat_file_ = FlatTreeFile::Open(path, check);
+    if (!flat_file_) {
+        return false;
+    }
+    if (flat_file_->GetNodeCount() == 0) {
+        flat_file_.reset();
+        return true;
+    }
+    auto is_observed = port_.IsInterestedIn(kStructuralInterest);
+    // Observers get every node, so the file is read whole anyway.
+    if (is_observed && !VerifyFile()) {
+        return false;
+    }
+    RebuildMembershipFilter();
+    if (is_observed) {
+        port_.Notify(ProduceWholeTreeInfo());
+    }
+    return true;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::PumpSnapshots() const {
+    FinishSteps();
+    port_.PumpSnapshots();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::EnableMembershipFilter() {
+    FinishSteps();
+    membership_filter_.emplace();
+    RebuildMembershipFilter();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::DisableMembershipFilter() {
+    membership_filter_.reset();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::optional<MembershipFilterStats>
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::GetMembershipFilterStats() const {
+    if (!membership_filter_) {
+        return std::nullopt;
+    }
+    return membership_filter_->GetStats();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CompactSlice(ssize_t max_nodes) {
+    assert(max_nodes > 0 && "Compaction slice must relocate something");
+    TraceSpan span("CompactSlice", "tree", "max_nodes", max_nodes);
+    FinishSteps();
+    Materialize();
+    if (!compaction_cursor_) {
+        compaction_cursor_.emplace(1, 0);
+    }
+    // The slab fits the nodes left, so the last slice of a pass doesn't take a whole `max_nodes` of them.
+    auto slice = MeasureCompactionSlice(max_nodes);
+    auto slab = slice.node_count > 0 ? NodeSlabs::Instance().Allocate(slice.slab_bytes) : nullptr;
+    ssize_t relocated_count = 0;
+    port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+    auto target = ResolveCompactionCursor();
+    while (target.slot != nullptr && relocated_count < slice.node_count) {
+        port_.Notify(Relocate(target, slab));
+        ++relocated_count;
+        AdvanceCompactionCursor(target);
+        target = ResolveCompactionCursor();
+    }
+    assert(relocated_count == slice.node_count && "Slice has changed");
+    if (relocated_count > 0) {
+        NodeSlabs::Instance().Seal(slab);
+        ResetFinger();
+    }
+    auto is_over = target.slot == nullptr;
+    if (is_over) {
+        compaction_cursor_.reset();
+    }
+    assert(IsValidAfterMutation() && "Incorrect tree after compaction");
+    port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+    return is_over;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Compact() {
+    // Slices bound the size of slabs, so the memory of the old nodes goes back to the allocator as the pass goes.
+    static constexpr ssize_t kSliceNodes = 4096;
+    while (!CompactSlice(kSliceNodes)) {
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ResolveCompactionCursor() -> CompactionTarget {
+    auto& cursor = *compaction_cursor_;
+    while (!cursor.empty()) {
+        CompactionTarget target;
+        ssize_t depth = 0;
+        for (; depth < std::ssize(cursor); ++depth) {
+            auto parent = target.slot == nullptr ? nullptr : target.slot->get();
+            auto sibling_count = parent == nullptr ? (root_ ? 1 : 0) : std::ssize(parent->children);
+            if (cursor[depth] >= sibling_count) {
+                break;
+            }
+            target = CompactionTarget{
+                .slot = parent == nullptr ? &root_ : &parent->children[cursor[depth]],
+                .parent = parent,
+            };
+        }
+        if (depth == std::ssize(cursor)) {
+            return target;
+        }
+        // The children of the node at `depth - 1` are over, or fewer of them are left after merges.
+        cursor.resize(depth);
+        if (!cursor.empty()) {
+            ++cursor.back();
+        }
+    }
+    return CompactionTarget{};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::AdvanceCompactionCursor(const CompactionTarget& target) {
+    if ((*target.slot)->children.empty()) {
+        ++compaction_cursor_->back();
+    } else {
+        compaction_cursor_->emplace_back(0);
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MeasureCompactionSlice(ssize_t max_nodes)
+    -> CompactionSlice {
+    // Relocation doesn't change the shape of the tree, so the slice itself resolves the same nodes afterwards.
+    auto cursor = *compaction_cursor_;
+    CompactionSlice slice;
+    for (auto target = ResolveCompactionCursor(); target.slot != nullptr && slice.node_count < max_nodes;
+         target = ResolveCompactionCursor()) {
+        ++slice.node_count;
+        slice.slab_bytes += MeasureRelocated(**target.slot);
+        AdvanceCompactionCursor(target);
+    }
+    *compaction_cursor_ = std::move(cursor);
+    return slice;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+ssize_t BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MeasureRelocated(const Node& vertex) {
+    // Copies and reserved vectors take exactly the bytes in use.
+    auto bytes = NodeSlabs::RoundUp(sizeof(Node)) + NodeSlabs::RoundUp(MeasureVector(vertex.keys).used_bytes) +
+                 NodeSlabs::RoundUp(MeasureVector(vertex.children).used_bytes);
+    if constexpr (kIsMap) {
+        bytes += NodeSlabs::RoundUp(MeasureVector(vertex.values).used_bytes);
+    }
+    return bytes;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeActionsBatch BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Relocate(const CompactionTarget& target,
+                                                                                  NodeSlabs::Slab* slab) {
+    auto& old = **target.slot;
+    // Buffers follow the node in the slab, since they are carved in the order they are allocated.
+    auto place = NodeSlabs::Carve(slab, sizeof(Node));
+    assert(place != nullptr && "Slab is too small");
+    SlabAllocator<Node> allocator(slab);
+    auto relocated =
+        new (place) Node{.keys = NodeKeys(old.keys, allocator), .children = Children(allocator), .slab = slab};
+    relocated->children.reserve(old.children.size());
+    for (auto& child : old.children) {
+        relocated->children.emplace_back(std::move(child));
+    }
+    if constexpr (kIsMap) {
+        relocated->values = Values(allocator);
+        relocated->values.reserve(old.values.size());
+        for (auto& value : old.values) {
+            relocated->values.emplace_back(std::move(value));
+        }
+    }
+    TreeActionsBatch actions;
+    actions.emplace_back(TreeAction{
+        .node_address = relocated, .action_type = ENodeAction::Create, .data = ProduceNodeInfo(*relocated)});
+    actions.emplace_back(TreeAction{.node_address = &old, .action_type = ENodeAction::Delete});
+    target.slot->reset(relocated);
+    if (target.parent == nullptr) {
+        actions.emplace_back(TreeAction{.node_address = relocated, .action_type = ENodeAction::MakeRoot});
+    } else {
+        actions.emplace_back(TreeAction{.node_address = target.parent,
+                                        .action_type = ENodeAction::Change,
+                                        .data = ProduceNodeInfo(*target.parent)});
+    }
+    return actions;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeMetricsSnapshot BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::GetMetrics() const {
+    return metrics_.Snapshot();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeMemoryStats BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MemoryStats() const {
+    TreeMemoryStats stats;
+    if (flat_file_) {
+        stats.key_count = flat_file_->GetKeyCount();
+        stats.mapped_bytes = flat_file_->GetMappedBytes();
+    }
+    std::unordered_set<const NodeSlabs::Slab*> slabs;
+    TraverseForMemoryStats(root_.get(), stats, slabs);
+    stats.slab_count = std::ssize(slabs);
+    for (auto slab : slabs) {
+        stats.slab_bytes += slab->bytes;
+    }
+    stats.buffers += MeasureVector(path_);
+    if (membership_filter_) {
+        stats.membership_filter = membership_filter_->MeasureMemory();
+    }
+    return stats;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::optional<TreeViolation> BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Audit() {
+    TraceSpan span("Audit", "tree");
+    FinishSteps();
+    Materialize();
+    ssize_t leaf_depth = -1;
+    return AuditSubtree(root_.get(), 0, std::nullopt, leaf_depth);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SetValidationLevel(EValidationLevel level,
+                                                                                ssize_t audit_period) {
+    assert(audit_period > 0 && "Audit period must be positive");
+    validation_level_ = level;
+    audit_period_ = audit_period;
+    mutations_since_audit_ = 0;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SearchByLowerBound(const Key& x,
+                                                                                Path* path) const -> Node* {
+    if (path) {
+        path->clear();
+    }
+    auto vertex = root_.get();
+    if (vertex == nullptr) {
+        return nullptr;
+    }
+    if (path) {
+        path->emplace_back(PathStep{.node = vertex, .index_in_parent = -1});
+    }
+    NotifyVisit(vertex);
+    while (!vertex->children.empty()) {
+        auto next_index = LowerBoundChild(*vertex, x);
+        if (path) {
+            AppendStep(*path, next_index);
+        }
+        vertex = vertex->children[next_index].get();
+        NotifyVisit(vertex);
+    }
+    return vertex;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SearchFromFinger(const Key& x) const -> Node* {
+    if (root_ == nullptr) {
+        return nullptr;
+    }
+    ClimbFinger(x);
+    auto vertex = path_.back().node;
+    NotifyVisit(vertex);
+    while (!vertex->children.empty()) {
+        vertex = DescendFinger(x);
+        NotifyVisit(vertex);
+    }
+    return vertex;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SearchFromFingerSteps(Key x) const {
+    assert(root_ != nullptr && "Searching in an empty tree");
+    ClimbFinger(x);
+    for (auto vertex = path_.back().node;; vertex = DescendFinger(x)) {
+        if (auto visit = ProduceVisit(vertex)) {
+            port_.Notify(*visit);
+            co_yield *visit;
+        }
+        if (vertex->children.empty()) {
+            break;
+        }
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ClimbFinger(const Key& x) const {
+    if (path_.empty()) {
+        path_.emplace_back(PathStep{.node = root_.get(), .index_in_parent = -1});
+        return;
+    }
+    assert(path_.front().node == root_.get() && "Finger doesn't start at root");
+    // The root holds every key, so the climb stops at it at the latest.
+    while (!IsUnderFinger(x)) {
+        path_.pop_back();
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::DescendFinger(const Key& x) const -> Node* {
+    AppendStep(path_, LowerBoundChild(*path_.back().node, x));
+    return path_.back().node;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::IsUnderFinger(const Key& x) const {
+    const auto& step = path_.back();
+    if (step.lower_bound_depth > 0) {
+        const auto& bounding_step = path_[step.lower_bound_depth];
+        if (x <= path_[step.lower_bound_depth - 1].node->keys[bounding_step.index_in_parent - 1]) {
+            return false;
+        }
+    }
+    if (step.upper_bound_depth > 0) {
+        const auto& bounding_step = path_[step.upper_bound_depth];
+        if (path_[step.upper_bound_depth - 1].node->keys[bounding_step.index_in_parent] < x) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::AppendStep(Path& path, ssize_t child_index) {
+    const auto& parent = path.back();
+    auto depth = std::ssize(path);
+    auto child_count = std::ssize(parent.node->children);
+    path.emplace_back(PathStep{
+        .node = parent.node->children[child_index].get(),
+        .index_in_parent = child_index,
+        .lower_bound_depth = child_index > 0 ? depth : parent.lower_bound_depth,
+        .upper_bound_depth = child_index + 1 < child_count ? depth : parent.upper_bound_depth,
+    });
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CutFinger(ssize_t depth) {
+    if (depth + 1 < std::ssize(path_)) {
+        path_.resize(depth + 1);
+        ++finger_version_;
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ResetFinger() {
+    path_.clear();
+    ++finger_version_;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TValue* BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::FindValue(const Key& x) const
+    requires kIsMap
+{
+    TraceSpan span("Find", "tree", "key", x);
+    ScopedLatency latency(metrics_, ETreeOperation::Contains);
+    FinishSteps();
+    port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+    auto node_found = SearchFromFinger(x);
+    TValue* value = nullptr;
+    if (node_found != nullptr) {
+        auto position = std::lower_bound(node_found->keys.begin(), node_found->keys.end(), x);
+        if (position != node_found->keys.end() && *position == x) {
+            value = &node_found->values[position - node_found->keys.begin()];
+        }
+    }
+    port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+    return value;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::BuildAbove(std::vector<std::unique_ptr<Node>> level) {
+    while (level.size() > 1) {
+        std::vector<std::unique_ptr<Node>> parents;
+        auto child = level.begin();
+        for (auto parent_size : SplitEvenly(std::ssize(level))) {
+            auto parent = std::make_unique<Node>();
+            parent->children.assign(std::make_move_iterator(child), std::make_move_iterator(child + parent_size));
+            child += parent_size;
+            RefreshKeys(*parent);
+            parents.emplace_back(std::move(parent));
+        }
+        level = std::move(parents);
+    }
+    root_ = std::move(level.front());
+    ResetFinger();
+    assert(IsValid() && "Incorrect tree after build");
+    RebuildMembershipFilter();
+    if (port_.IsInterestedIn(kStructuralInterest)) {
+        port_.Notify(ProduceWholeTreeInfo());
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::vector<ssize_t> BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitEvenly(ssize_t count) {
+    auto group_count = (count + kMaxFanout - 1) / kMaxFanout;
+    // Groups differ by one at most, so none of them gets less than `kMinFanout` when there are several.
+    std::vector<ssize_t> sizes(group_count, count / group_count);
+    std::fill(sizes.begin(), sizes.begin() + count % group_count, count / group_count + 1);
+    return sizes;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+ssize_t BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::LowerBoundChild(const Node& vertex, const Key& x) {
+    // Binary search pays off for wide nodes and is no worse for 2-3 ones.
+    return ChildIndexFor(vertex.keys.begin(), vertex.keys.end(), x);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::UpdateKeys(const Path& path) {
+    assert(!path.empty() && "Trying to update keys along an empty path in 2-3-tree");
+    for (auto depth = std::ssize(path) - 1; depth > 0; --depth) {
+        auto actions = RefreshSeparator(path, depth);
+        if (!actions) {
+            break;
+        }
+        port_.Notify(std::move(*actions));
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::UpdateKeysSteps() {
+    assert(!path_.empty() && "Trying to update keys along an empty path in 2-3-tree");
+    for (auto depth = std::ssize(path_) - 1; depth > 0; --depth) {
+        auto actions = RefreshSeparator(path_, depth);
+        if (!actions) {
+            break;
+        }
+        port_.Notify(*actions);
+        co_yield *actions;
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::optional<TreeActionsBatch>
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::RefreshSeparator(const Path& path, ssize_t depth) {
+    auto child = path[depth].node;
+    auto vertex = path[depth - 1].node;
+    auto separator_index = path[depth].index_in_parent;
+    if (vertex->keys[separator_index] == child->keys.back()) {
+        return std::nullopt;
+    }
+    vertex->keys[separator_index] = child->keys.back();
+    return TreeActionsBatch{TreeAction{
+        .node_address = vertex,
+        .action_type = ENodeAction::Change,
+        .data = ProduceNodeInfo(*vertex),
+    }};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+ssize_t BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitNode(const Path& path, ssize_t depth) {
+    assert(depth >= 0 && depth < std::ssize(path) && "Trying to split a node out of path in 2-3-tree");
+    while (std::ssize(path[depth].node->keys) > kMaxFanout) {
+        NotifyVisit(path[depth].node);
+        port_.Notify(SplitOnce(path, depth));
+        if (depth == 0) {
+            return -1;
+        }
+        --depth;
+    }
+    return depth;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeSteps BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitNodeSteps(ssize_t depth) {
+    assert(depth >= 0 && depth < std::ssize(path_) && "Trying to split a node out of path in 2-3-tree");
+    while (depth >= 0 && std::ssize(path_[depth].node->keys) > kMaxFanout) {
+        if (auto visit = ProduceVisit(path_[depth].node)) {
+            port_.Notify(*visit);
+            co_yield *visit;
+        }
+        auto actions = SplitOnce(path_, depth);
+        port_.Notify(actions);
+        co_yield actions;
+        --depth;
+    }
+    CutFinger(depth);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeActionsBatch BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitOnce(const Path& path, ssize_t depth) {
+    auto vertex = path[depth].node;
+    assert(std::ssize(vertex->keys) <= 2 * kMaxFanout && "Some node in the tree has too many keys at split stage");
+    metrics_.Add(ETreeCounter::Splits);
+    auto [first_node, second_node] = SplitInHalves(*vertex);
+    if (depth == 0) {
+        // Splitting root -> creating new root.
+        assert(root_.get() == vertex && "Path doesn't start at root");
+
+        root_ = std::make_unique<Node>(
+            Node{.keys = {first_node->keys.back(), second_node->keys.back()}, .children = {}});
+        root_->children.emplace_back(std::move(first_node));
+        root_->children.emplace_back(std::move(second_node));
+        metrics_.Add(ETreeCounter::RootChanges);
+        return {TreeAction{.node_address = vertex, .action_type = ENodeAction::Delete},
+                TreeAction{.node_address = root_->children[0].get(),
+                           .action_type = ENodeAction::Create,
+                           .data = ProduceNodeInfo(*root_->children[0])},
+                TreeAction{.node_address = root_->children[1].get(),
+                           .action_type = ENodeAction::Create,
+                           .data = ProduceNodeInfo(*root_->children[1])},
+                TreeAction{
+                    .node_address = root_.get(), .action_type = ENodeAction::Create, .data = ProduceNodeInfo(*root_)},
+                TreeAction{.node_address = root_.get(), .action_type = ENodeAction::MakeRoot}};
+    }
+    auto parent = path[depth - 1].node;
+    auto inserting_index = path[depth].index_in_parent;
+    assert(parent->children[inserting_index].get() == vertex && "Path doesn't match the tree");
+
+    // We're inserting keys and children in reversed order because we don't move |inserting_index| and elements of
+    // vector move to the right of place of inserting.
+    parent->keys.erase(parent->keys.begin() + inserting_index);
+    parent->keys.emplace(parent->keys.begin() + inserting_index, second_node->keys.back());
+    parent->keys.emplace(parent->keys.begin() + inserting_index, first_node->keys.back());
+
+    parent->children.erase(parent->children.begin() + inserting_index);
+    parent->children.emplace(parent->children.begin() + inserting_index, std::move(second_node));
+    parent->children.emplace(parent->children.begin() + inserting_index, std::move(first_node));
+
+    return {TreeAction{.node_address = vertex, .action_type = ENodeAction::Delete},
+            TreeAction{.node_address = parent->children[inserting_index].get(),
+                       .action_type = ENodeAction::Create,
+                       .data = ProduceNodeInfo(*parent->children[inserting_index])},
+            TreeAction{.node_address = parent->children[inserting_index + 1].get(),
+                       .action_type = ENodeAction::Create,
+                       .data = ProduceNodeInfo(*parent->children[inserting_index + 1])},
+            TreeAction{.node_address = parent, .action_type = ENodeAction::Change, .data = ProduceNodeInfo(*parent)}};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitInHalves(Node& vertex)
+    -> std::pair<std::unique_ptr<Node>, std::unique_ptr<Node>> {
+    auto middle = SplitPoint(std::ssize(vertex.keys));
+    auto first_node =
+        std::make_unique<Node>(Node{.keys = {vertex.keys.begin(), vertex.keys.begin() + middle}, .children = {}});
+
+    auto second_node =
+        std::make_unique<Node>(Node{.keys = {vertex.keys.begin() + middle, vertex.keys.end()}, .children = {}});
+    MoveValues(vertex, middle, std::ssize(vertex.keys), *second_node, 0);
+    MoveValues(vertex, 0, middle, *first_node, 0);
+
+    if (!vertex.children.empty()) {
+        // Splitting not a leaf.
+        assert(vertex.children.size() == vertex.keys.size() && "Child count doesn't match key count when splitting a "
+                                                               "node in the tree");
+
+        first_node->children.assign(std::make_move_iterator(vertex.children.begin()),
+                                    std::make_move_iterator(vertex.children.begin() + middle));
+        second_node->children.assign(std::make_move_iterator(vertex.children.begin() + middle),
+                                     std::make_move_iterator(vertex.children.end()));
+        vertex.children.clear();
+    }
+    return {std::move(first_node), std::move(second_node)};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MoveAllInto(Node& underfull, Node& sibling,
+                                                                         bool is_sibling_left) {
+    assert(std::ssize(underfull.keys) < kMinFanout && "Merging a node which has enough keys");
+    MoveValues(underfull, 0, std::ssize(underfull.keys), sibling, is_sibling_left ? std::ssize(sibling.keys) : 0);
+    auto key_position = is_sibling_left ? sibling.keys.end() : sibling.keys.begin();
+    sibling.keys.insert(key_position, underfull.keys.begin(), underfull.keys.end());
+    auto child_position = is_sibling_left ? sibling.children.end() : sibling.children.begin();
+    sibling.children.insert(child_position, std::make_move_iterator(underfull.children.begin()),
+                            std::make_move_iterator(underfull.children.end()));
+    underfull.children.clear();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MoveValues(Node& source, ssize_t first, ssize_t last,
+                                                                        Node& target, ssize_t position) {
+    if constexpr (kIsMap) {
+        if (source.children.empty()) {
+            auto& values = source.values;
+            target.values.insert(target.values.begin() + position, std::make_move_iterator(values.begin() + first),
+                                 std::make_move_iterator(values.begin() + last));
+            values.erase(values.begin() + first, values.begin() + last);
+        }
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TakeOver(
+    BPlusTree& other, const std::function<Subtree(Subtree, Subtree, Restructuring&)>& merge) {
+    assert(&other != this && "Merging a tree with itself");
+    FinishSteps();
+    other.FinishSteps();
+    Materialize();
+    other.Materialize();
+    assert(!port_.IsCoalescing() && !other.port_.IsCoalescing() && "Merging trees while a batch is applied");
+    port_.RestartSnapshots();
+    other.port_.RestartSnapshots();
+    port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+    other.port_.Notify({TreeAction{.action_type = ENodeAction::StartQuery}});
+
+    auto is_observed = port_.IsInterestedIn(kStructuralInterest);
+    auto is_other_observed = other.port_.IsInterestedIn(kStructuralInterest);
+    std::vector<MemoryAddress> other_nodes;
+    if (is_observed || is_other_observed) {
+        TraverseForNodes(other.root_.get(), other_nodes);
+    }
+    std::unordered_set<const Node*> arrived;
+    if (is_observed) {
+        for (auto address : other_nodes) {
+            arrived.insert(static_cast<const Node*>(address));
+        }
+    }
+
+    Restructuring restructuring;
+    auto height = GetHeight(root_.get());
+    auto other_height = GetHeight(other.root_.get());
+    root_ = merge(Subtree{.root = std::move(root_), .height = height},
+                  Subtree{.root = std::move(other.root_), .height = other_height}, restructuring)
+                .root;
+    assert(IsValidAfterMutation() && "Incorrect tree after merging");
+    ResetFinger();
+    other.ResetFinger();
+    RebuildMembershipFilter();
+    other.RebuildMembershipFilter();
+    NotifyRestructuring(restructuring, arrived, {});
+
+    TreeActionsBatch other_actions;
+    if (is_other_observed) {
+        for (auto address : other_nodes) {
+            other_actions.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+        }
+        other_actions.emplace_back(TreeAction{.action_type = ENodeAction::MakeRoot});
+    }
+    other_actions.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    other.port_.Notify(std::move(other_actions));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ApplySetOperation(ESetOperation operation,
+                                                                               BPlusTree& other, ssize_t thread_count) {
+    if (thread_count <= 0) {
+        thread_count = std::max<ssize_t>(1, std::thread::hardware_concurrency());
+    }
+    TakeOver(other, [operation, thread_count](Subtree mine, Subtree others, Restructuring& restructuring) {
+        return CombineSubtrees(operation, std::move(mine), std::move(others), thread_count, restructuring);
+    });
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CombineSubtrees(ESetOperation operation, Subtree mine,
+                                                                             Subtree others, ssize_t thread_count,
+                                                                             Restructuring& restructuring) -> Subtree {
+    if (mine.root == nullptr || others.root == nullptr) {
+        // Union keeps whatever there is, intersection keeps nothing and difference keeps `mine`.
+        if (operation == ESetOperation::Union) {
+            return mine.root != nullptr ? std::move(mine) : std::move(others);
+        }
+        DestroySubtree(std::move(others), restructuring);
+        if (operation == ESetOperation::Intersection) {
+            DestroySubtree(std::move(mine), restructuring);
+            return {};
+        }
+        return mine;
+    }
+    auto& vertex = *mine.root;
+    auto is_parallel = thread_count > 1 && !vertex.children.empty() && mine.height >= kMinParallelHeight &&
+                       others.height >= kMinParallelHeight;
+    // `others` is cut by the maximums of children of `mine` (or by the keys of a leaf), each piece goes to the child
+    // whose range it falls into.
+    auto piece_count = std::ssize(vertex.keys);
+    std::vector<Subtree> pieces(piece_count);
+    for (ssize_t index = 0; index + 1 < piece_count; ++index) {
+        auto [left_piece, right_piece] = SplitSubtree(std::move(others), vertex.keys[index], true, restructuring);
+        pieces[index] = std::move(left_piece);
+        others = std::move(right_piece);
+    }
+    pieces.back() = std::move(others);
+    if (vertex.children.empty()) {
+        return CombineWithLeaf(operation, std::move(mine), std::move(pieces), restructuring);
+    }
+
+    std::vector<Subtree> results(piece_count);
+    auto combine_child = [&](ssize_t index, ssize_t child_thread_count, Restructuring& child_restructuring) {
+        results[index] = CombineSubtrees(operation,
+                                         Subtree{.root = std::move(vertex.children[index]), .height = mine.height - 1},
+                                         std::move(pieces[index]), child_thread_count, child_restructuring);
+    };
+    if (is_parallel) {
+        // Children have nothing in common, so they are combined concurrently, each recording its own changes.
+        std::vector<Restructuring> parts(piece_count);
+        auto child_thread_count = std::max<ssize_t>(1, thread_count / piece_count);
+        {
+            std::vector<std::jthread> workers;
+            for (ssize_t index = 1; index < piece_count; ++index) {
+                workers.emplace_back([&combine_child, &parts, index, child_thread_count]() {
+                    TraceSpan span("CombineSubtrees", "tree");
+                    combine_child(index, child_thread_count, parts[index]);
+                });
+            }
+            combine_child(0, child_thread_count, parts[0]);
+        }
+        restructuring.Absorb(parts);
+    } else {
+        for (ssize_t index = 0; index < piece_count; ++index) {
+            combine_child(index, thread_count, restructuring);
+        }
+    }
+    restructuring.Destroy(mine.root.get());
+    Subtree result;
+    for (auto& part : results) {
+        result = JoinSubtrees(std::move(result), std::move(part), restructuring);
+    }
+    return result;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CombineWithLeaf(ESetOperation operation, Subtree leaf,
+                                                                             std::vector<Subtree> pieces,
+                                                                             Restructuring& restructuring) -> Subtree {
+    const auto& keys = leaf.root->keys;
+    std::vector<Key> kept_keys;
+    Subtree result;
+    for (ssize_t index = 0; index < std::ssize(keys); ++index) {
+        const auto& key = keys[index];
+        auto [left_piece, right_piece] = SplitSubtree(std::move(pieces[index]), key, true, restructuring);
+        auto is_found = left_piece.root != nullptr && left_piece.root->keys.back() == key;
+        if (operation != ESetOperation::Union) {
+            if (is_found == (operation == ESetOperation::Intersection)) {
+                kept_keys.emplace_back(key);
+            }
+            DestroySubtree(std::move(left_piece), restructuring);
+            DestroySubtree(std::move(right_piece), restructuring);
+            continue;
+        }
+        result = JoinSubtrees(std::move(result), std::move(left_piece), restructuring);
+        if (!is_found) {
+            auto single = std::make_unique<Node>(Node{.keys = {key}, .children = {}});
+            restructuring.Create(single.get());
+            result = JoinSubtrees(std::move(result), Subtree{.root = std::move(single), .height = 0}, restructuring);
+        }
+        result = JoinSubtrees(std::move(result), std::move(right_piece), restructuring);
+    }
+    if (operation == ESetOperation::Union || kept_keys.empty()) {
+        restructuring.Destroy(leaf.root.get());
+        return result;
+    }
+    if (kept_keys.size() != keys.size()) {
+        leaf.root->keys.assign(kept_keys.begin(), kept_keys.end());
+        restructuring.Change(leaf.root.get());
+    }
+    return leaf;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::DestroySubtree(Subtree tree,
+                                                                            Restructuring& restructuring) {
+    std::vector<MemoryAddress> nodes;
+    TraverseForNodes(tree.root.get(), nodes);
+    for (auto address : nodes) {
+        restructuring.Destroy(static_cast<Node*>(address));
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitSubtree(Subtree tree, const Key& x, bool is_x_left,
+                                                                          Restructuring& restructuring)
+    -> std::pair<Subtree, Subtree> {
+    if (tree.root == nullptr) {
+        return {};
+    }
+    Path path = {PathStep{.node = tree.root.get(), .index_in_parent = -1}};
+    while (!path.back().node->children.empty()) {
+        auto index = LowerBoundChild(*path.back().node, x);
+        path.emplace_back(PathStep{.node = path.back().node->children[index].get(), .index_in_parent = index});
+    }
+    assert(std::ssize(path) == tree.height + 1 && "Height of a subtree is wrong");
+    return SplitAlongPath(std::move(tree.root), path, x, is_x_left, restructuring);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitAlongPath(std::unique_ptr<Node> root,
+                                                                            const Path& path, const Key& x,
+                                                                            bool is_x_left,
+                                                                            Restructuring& restructuring)
+    -> std::pair<Subtree, Subtree> {
+    auto leaf = path.back().node;
+    assert(leaf->children.empty() && "Path doesn't end at a leaf");
+    auto leaf_depth = std::ssize(path) - 1;
+
+    // Nodes of the path are taken apart: their children on the left of the path go to the left part, the ones on the
+    // right go to the right part.
+    std::vector<std::vector<std::unique_ptr<Node>>> left_pieces(leaf_depth);
+    std::vector<std::vector<std::unique_ptr<Node>>> right_pieces(leaf_depth);
+    auto vertex = std::move(root);
+    for (ssize_t depth = 0; depth < leaf_depth; ++depth) {
+        auto& children = vertex->children;
+        auto index = path[depth + 1].index_in_parent;
+        assert(children[index].get() == path[depth + 1].node && "Path doesn't match the tree");
+        left_pieces[depth].assign(std::make_move_iterator(children.begin()),
+                                  std::make_move_iterator(children.begin() + index));
+        right_pieces[depth].assign(std::make_move_iterator(children.begin() + index + 1),
+                                   std::make_move_iterator(children.end()));
+        auto next = std::move(children[index]);
+        restructuring.Destroy(vertex.get());
+        vertex = std::move(next);
+    }
+    assert(vertex.get() == leaf && "Path doesn't match the tree");
+
+    Subtree left_part;
+    Subtree right_part;
+    auto first_right = is_x_left ? std::upper_bound(leaf->keys.begin(), leaf->keys.end(), x)
+                                 : std::lower_bound(leaf->keys.begin(), leaf->keys.end(), x);
+    if (first_right == leaf->keys.begin()) {
+        right_part = Subtree{.root = std::move(vertex), .height = 0};
+    } else if (first_right == leaf->keys.end()) {
+        left_part = Subtree{.root = std::move(vertex), .height = 0};
+    } else {
+        auto right_leaf = std::make_unique<Node>(Node{.keys = {first_right, leaf->keys.end()}, .children = {}});
+        MoveValues(*leaf, first_right - leaf->keys.begin(), std::ssize(leaf->keys), *right_leaf, 0);
+        leaf->keys.erase(first_right, leaf->keys.end());
+        restructuring.Change(leaf);
+        restructuring.Create(right_leaf.get());
+        left_part = Subtree{.root = std::move(vertex), .height = 0};
+        right_part = Subtree{.root = std::move(right_leaf), .height = 0};
+    }
+    // Pieces get higher going up the path, so every join costs about the difference of heights of its operands, and
+    // all of them take O(log n) together.
+    for (auto depth = leaf_depth - 1; depth >= 0; --depth) {
+        auto height = leaf_depth - depth - 1;
+        for (auto piece = left_pieces[depth].rbegin(); piece != left_pieces[depth].rend(); ++piece) {
+            left_part = JoinSubtrees(Subtree{.root = std::move(*piece), .height = height}, std::move(left_part),
+                                     restructuring);
+        }
+        for (auto& piece : right_pieces[depth]) {
+            right_part = JoinSubtrees(std::move(right_part), Subtree{.root = std::move(piece), .height = height},
+                                      restructuring);
+        }
+    }
+    return {std::move(left_part), std::move(right_part)};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::JoinSubtrees(Subtree left, Subtree right,
+                                                                          Restructuring& restructuring) -> Subtree {
+    if (left.root == nullptr) {
+        return right;
+    }
+    if (right.root == nullptr) {
+        return left;
+    }
+    if (left.height == right.height) {
+        // A root with too few keys can't become a child, it's merged into the other root instead.
+        if (std::ssize(left.root->keys) < kMinFanout) {
+            MoveAllInto(*left.root, *right.root, false);
+            restructuring.Destroy(left.root.get());
+            restructuring.Change(right.root.get());
+            return SplitRootIfFull(std::move(right), restructuring);
+        }
+        if (std::ssize(right.root->keys) < kMinFanout) {
+            MoveAllInto(*right.root, *left.root, true);
+            restructuring.Destroy(right.root.get());
+            restructuring.Change(left.root.get());
+            return SplitRootIfFull(std::move(left), restructuring);
+        }
+        auto root =
+            std::make_unique<Node>(Node{.keys = {left.root->keys.back(), right.root->keys.back()}, .children = {}});
+        root->children.emplace_back(std::move(left.root));
+        root->children.emplace_back(std::move(right.root));
+        restructuring.Create(root.get());
+        return Subtree{.root = std::move(root), .height = left.height + 1};
+    }
+
+    auto is_left_higher = left.height > right.height;
+    auto& higher = is_left_higher ? left : right;
+    auto& lower = is_left_higher ? right : left;
+    auto edge_index = [is_left_higher](const Node& vertex) {
+        return is_left_higher ? std::ssize(vertex.children) - 1 : 0;
+    };
+    // The lower tree is hung on the spine of the higher one facing it, just above the level of its root.
+    std::vector<Node*> spine = {higher.root.get()};
+    for (auto height = higher.height; height > lower.height + 1; --height) {
+        spine.emplace_back(spine.back()->children[edge_index(*spine.back())].get());
+    }
+    auto parent = spine.back();
+    if (std::ssize(lower.root->keys) < kMinFanout) {
+        auto& neighbour = *parent->children[edge_index(*parent)];
+        MoveAllInto(*lower.root, neighbour, is_left_higher);
+        restructuring.Destroy(lower.root.get());
+        restructuring.Change(&neighbour);
+        SplitChildIfFull(*parent, edge_index(*parent), restructuring);
+    } else if (is_left_higher) {
+        parent->children.emplace_back(std::move(lower.root));
+    } else {
+        parent->children.emplace(parent->children.begin(), std::move(lower.root));
+    }
+    restructuring.Change(parent);
+    for (auto depth = std::ssize(spine) - 1; depth >= 0; --depth) {
+        if (RefreshKeys(*spine[depth])) {
+            restructuring.Change(spine[depth]);
+        }
+        if (depth > 0) {
+            SplitChildIfFull(*spine[depth - 1], edge_index(*spine[depth - 1]), restructuring);
+        }
+    }
+    return SplitRootIfFull(std::move(higher), restructuring);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitChildIfFull(Node& parent, ssize_t index,
+                                                                              Restructuring& restructuring) {
+    auto& child = parent.children[index];
+    if (std::ssize(child->keys) <= kMaxFanout) {
+        return;
+    }
+    auto [first_node, second_node] = SplitInHalves(*child);
+    restructuring.Destroy(child.get());
+    restructuring.Create(first_node.get());
+    restructuring.Create(second_node.get());
+    child = std::move(first_node);
+    parent.children.emplace(parent.children.begin() + index + 1, std::move(second_node));
+    RefreshKeys(parent);
+    restructuring.Change(&parent);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::SplitRootIfFull(Subtree tree,
+                                                                             Restructuring& restructuring) -> Subtree {
+    if (std::ssize(tree.root->keys) <= kMaxFanout) {
+        return tree;
+    }
+    auto [first_node, second_node] = SplitInHalves(*tree.root);
+    auto root =
+        std::make_unique<Node>(Node{.keys = {first_node->keys.back(), second_node->keys.back()}, .children = {}});
+    restructuring.Destroy(tree.root.get());
+    restructuring.Create(first_node.get());
+    restructuring.Create(second_node.get());
+    restructuring.Create(root.get());
+    root->children.emplace_back(std::move(first_node));
+    root->children.emplace_back(std::move(second_node));
+    return Subtree{.root = std::move(root), .height = tree.height + 1};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::RefreshKeys(Node& vertex) {
+    if (vertex.children.empty()) {
+        return false;
+    }
+    auto is_changed = vertex.keys.size() != vertex.children.size();
+    vertex.keys.resize(vertex.children.size());
+    for (ssize_t child_index = 0; child_index < std::ssize(vertex.children); ++child_index) {
+        const auto& max_key = vertex.children[child_index]->keys.back();
+        if (vertex.keys[child_index] != max_key) {
+            vertex.keys[child_index] = max_key;
+            is_changed = true;
+        }
+    }
+    return is_changed;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+ssize_t BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::GetHeight(const Node* vertex) {
+    ssize_t height = -1;
+    while (vertex != nullptr) {
+        ++height;
+        vertex = vertex->children.empty() ? nullptr : vertex->children.front().get();
+    }
+    return height;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+Key BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::GetMinKey(const Node& vertex) {
+    const auto* leaf = &vertex;
+    while (!leaf->children.empty()) {
+        leaf = leaf->children.front().get();
+    }
+    return leaf->keys.front();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Restructuring::Create(const Node* vertex) {
+    created.insert(vertex);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Restructuring::Change(const Node* vertex) {
+    if (!created.contains(vertex)) {
+        changed.insert(vertex);
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Restructuring::Destroy(Node* vertex) {
+    // Nodes which have lived only during the operation are of no interest to observers.
+    if (created.erase(vertex) == 0) {
+        changed.erase(vertex);
+        destroyed.emplace_back(vertex);
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Restructuring::Absorb(const std::vector<Restructuring>& parts) {
+    // Destroys go first: parts are recorded concurrently, so a node destroyed in one of them may have given its address
+    // to a node created in another.
+    for (const auto& part : parts) {
+        for (auto address : part.destroyed) {
+            Destroy(static_cast<Node*>(address));
+        }
+    }
+    for (const auto& part : parts) {
+        created.insert(part.created.begin(), part.created.end());
+    }
+    for (const auto& part : parts) {
+        for (auto vertex : part.changed) {
+            Change(vertex);
+        }
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::NotifyRestructuring(
+    const Restructuring& restructuring, const std::unordered_set<const Node*>& arrived,
+    const std::vector<MemoryAddress>& departed) const {
+    if (!port_.IsInterestedIn(kStructuralInterest)) {
+        port_.Notify({TreeAction{.action_type = ENodeAction::EndQuery}});
+        return;
+    }
+    TreeActionsBatch actions;
+    // Deletes go first, since created nodes may have taken addresses of destroyed ones.
+    for (auto address : restructuring.destroyed) {
+        if (!arrived.contains(static_cast<const Node*>(address))) {
+            actions.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+        }
+    }
+    for (auto address : departed) {
+        actions.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+    }
+    // A touched node doesn't necessarily make its parent touched, e.g. when its maximum stays the same. So touched
+    // nodes are looked up from the root to find all the ways to them. Nodes which have gone to another tree aren't
+    // found.
+    std::unordered_set<const Node*> on_paths;
+    for (const auto* touched : {&restructuring.created, &restructuring.changed}) {
+        for (auto vertex : *touched) {
+            MarkWithAncestors(vertex, on_paths);
+        }
+    }
+    TraverseForRestructuring(root_.get(), restructuring, arrived, on_paths, actions);
+    actions.emplace_back(TreeAction{.node_address = root_.get(), .action_type = ENodeAction::MakeRoot});
+    actions.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    port_.Notify(std::move(actions));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::MarkWithAncestors(
+    const Node* vertex, std::unordered_set<const Node*>& marked) const {
+    // Descending to the maximum of `vertex` passes through `vertex`, since separators are maximums of children.
+    std::vector<const Node*> path;
+    for (const Node* current = root_.get(); current != nullptr;) {
+        path.emplace_back(current);
+        if (current == vertex) {
+            marked.insert(path.begin(), path.end());
+            return;
+        }
+        current = current->children.empty()
+                      ? nullptr
+                      : current->children[LowerBoundChild(*current, vertex->keys.back())].get();
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TraverseForRestructuring(
+    Node* vertex, const Restructuring& restructuring, const std::unordered_set<const Node*>& arrived,
+    const std::unordered_set<const Node*>& on_paths, TreeActionsBatch& actions) const {
+    if (vertex == nullptr) {
+        return;
+    }
+    auto is_new = arrived.contains(vertex) || restructuring.created.contains(vertex);
+    // Other subtrees haven't been touched, observers know them already.
+    if (!is_new && !on_paths.contains(vertex)) {
+        return;
+    }
+    for (const auto& child : vertex->children) {
+        TraverseForRestructuring(child.get(), restructuring, arrived, on_paths, actions);
+    }
+    if (is_new || restructuring.changed.contains(vertex)) {
+        actions.emplace_back(TreeAction{.node_address = vertex,
+                                        .action_type = is_new ? ENodeAction::Create : ENodeAction::Change,
+                                        .data = ProduceNodeInfo(*vertex)});
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TraverseForNodes(Node* vertex,
+                                                                              std::vector<MemoryAddress>& nodes) {
+    if (vertex == nullptr) {
+        return;
+    }
+    nodes.emplace_back(vertex);
+    for (const auto& child : vertex->children) {
+        TraverseForNodes(child.get(), nodes);
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::RebuildMembershipFilter() {
+    if (membership_filter_) {
+        TraceSpan span("RebuildMembershipFilter", "tree");
+        membership_filter_->Rebuild(GetKeys());
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::RefreshMembershipFilter() {
+    if (membership_filter_ && membership_filter_->NeedsRebuild()) {
+        RebuildMembershipFilter();
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::Materialize() {
+    if (!VerifyFile()) {
+        return;
+    }
+    assert(root_ == nullptr && "Tree has nodes while it's backed by a file");
+    // Every node is replaced, so streams start over instead of following each of them.
+    auto is_observed = port_.IsInterestedIn(kStructuralInterest);
+    if (is_observed) {
+        port_.RestartSnapshots();
+    }
+    // Children go before parents in the file, so every node finds its children already built.
+    std::vector<std::unique_ptr<Node>> nodes(flat_file_->GetNodeCount());
+    for (ssize_t index = 0; index < std::ssize(nodes); ++index) {
+        const auto& flat_node = flat_file_->GetNode(index);
+        auto vertex = std::make_unique<Node>();
+        vertex->keys.assign(flat_node.keys.begin(), flat_node.keys.begin() + flat_node.key_count);
+        vertex->children.reserve(flat_node.child_count);
+        for (uint32_t child = 0; child < flat_node.child_count; ++child) {
+            vertex->children.emplace_back(std::move(nodes[flat_node.children[child]]));
+        }
+        nodes[index] = std::move(vertex);
+    }
+    root_ = std::move(nodes.back());
+    ResetFinger();
+    if (is_observed) {
+        auto actions = ProduceWholeTreeInfo();
+        actions.pop_back();
+        for (ssize_t index = 0; index < flat_file_->GetNodeCount(); ++index) {
+            auto address = GetFlatAddress(flat_file_->GetNode(index));
+            actions.emplace_back(TreeAction{.node_address = address, .action_type = ENodeAction::Delete});
+        }
+        actions.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+        port_.Notify(std::move(actions));
+    }
+    flat_file_.reset();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::VerifyFile() {
+    if (!flat_file_) {
+        return false;
+    }
+    if (!flat_file_->Verify()) {
+        // Nobody knows nodes of the file yet: observers subscribe and converting starts only after verifying it.
+        flat_file_.reset();
+        RebuildMembershipFilter();
+        return false;
+    }
+    return true;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+uint32_t BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::AppendToFile(const Node& vertex,
+                                                                              FlatTreeWriter& writer) const {
+    FlatNode flat_node{
+        .key_count = static_cast<uint32_t>(vertex.keys.size()),
+        .child_count = static_cast<uint32_t>(vertex.children.size()),
+        .keys = {},
+        .children = {},
+    };
+    std::copy(vertex.keys.begin(), vertex.keys.end(), flat_node.keys.begin());
+    for (ssize_t child = 0; child < std::ssize(vertex.children); ++child) {
+        flat_node.children[child] = AppendToFile(*vertex.children[child], writer);
+    }
+    return writer.Append(flat_node);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::IsValid() const {
+    if (validation_level_ == EValidationLevel::Off) {
+        return true;
+    }
+    // Not `Audit()`, which would finish the stepwise operation this may be called from.
+    ssize_t leaf_depth = -1;
+    return IsValidOrReport(AuditSubtree(root_.get(), 0, std::nullopt, leaf_depth));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+bool BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::IsValidAfterMutation(std::optional<Key> touched) {
+    switch (validation_level_) {
+    case EValidationLevel::Off:
+        return true;
+    case EValidationLevel::Sampled:
+        break;
+    case EValidationLevel::Full:
+        return IsValid();
+    }
+    if (++mutations_since_audit_ >= audit_period_) {
+        mutations_since_audit_ = 0;
+        return IsValid();
+    }
+    return !touched || IsValidOrReport(CheckPath(*touched));
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CheckNode(Node& vertex, ssize_t depth,
+                                                                       std::optional<Key> lower)
+    -> std::optional<TreeViolation> {
+    auto violation = [&](ETreeInvariant invariant) {
+        return TreeViolation{.invariant = invariant, .node = &vertex, .depth = depth};
+    };
+    auto key_count = std::ssize(vertex.keys);
+    if (!vertex.children.empty() && std::ssize(vertex.children) != key_count) {
+        return violation(ETreeInvariant::ChildCount);
+    }
+    for (const auto& child : vertex.children) {
+        if (child == nullptr) {
+            return violation(ETreeInvariant::ChildCount);
+        }
+    }
+    if constexpr (kIsMap) {
+        if (std::ssize(vertex.values) != (vertex.children.empty() ? key_count : 0)) {
+            return violation(ETreeInvariant::ValueCount);
+        }
+    }
+    if (key_count < (depth == 0 ? 1 : kMinFanout) || key_count > kMaxFanout) {
+        return violation(ETreeInvariant::Fanout);
+    }
+    if (lower && !(*lower < vertex.keys[0])) {
+        return violation(ETreeInvariant::KeyOrder);
+    }
+    for (ssize_t index = 1; index < key_count; ++index) {
+        if (!(vertex.keys[index - 1] < vertex.keys[index])) {
+            return violation(ETreeInvariant::KeyOrder);
+        }
+    }
+    for (ssize_t index = 0; index < std::ssize(vertex.children); ++index) {
+        const auto& child_keys = vertex.children[index]->keys;
+        if (child_keys.empty() || vertex.keys[index] != child_keys.back()) {
+            return violation(ETreeInvariant::Separator);
+        }
+    }
+    return std::nullopt;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::optional<TreeViolation> BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CheckPath(const Key& x) const {
+    // Leaves must be as deep as the leftmost one.
+    ssize_t height = 0;
+    for (auto vertex = root_.get(); vertex != nullptr && !vertex->children.empty();
+         vertex = vertex->children.front().get()) {
+        ++height;
+    }
+    if (root_ == nullptr) {
+        return std::nullopt;
+    }
+    if (auto violation = CheckNode(*root_, 0, std::nullopt)) {
+        return violation;
+    }
+    std::optional<Key> lower;
+    ssize_t depth = 0;
+    for (auto vertex = root_.get(); !vertex->children.empty(); ++depth) {
+        for (ssize_t index = 0; index < std::ssize(vertex->children); ++index) {
+            auto& child = *vertex->children[index];
+            auto child_lower = index > 0 ? std::optional<Key>(vertex->keys[index - 1]) : lower;
+            if (auto violation = CheckNode(child, depth + 1, child_lower)) {
+                return violation;
+            }
+            if (child.children.empty() != (depth + 1 == height)) {
+                return TreeViolation{.invariant = ETreeInvariant::LeafDepth, .node = &child, .depth = depth + 1};
+            }
+        }
+        auto index = LowerBoundChild(*vertex, x);
+        if (index > 0) {
+            lower = vertex->keys[index - 1];
+        }
+        vertex = vertex->children[index].get();
+    }
+    return std::nullopt;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+auto BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::AuditSubtree(Node* vertex, ssize_t depth,
+                                                                          std::optional<Key> lower,
+                                                                          ssize_t& leaf_depth)
+    -> std::optional<TreeViolation> {
+    if (vertex == nullptr) {
+        return std::nullopt;
+    }
+    if (auto violation = CheckNode(*vertex, depth, lower)) {
+        return violation;
+    }
+    if (vertex->children.empty()) {
+        if (leaf_depth == -1) {
+            leaf_depth = depth;
+        }
+        if (depth != leaf_depth) {
+            return TreeViolation{.invariant = ETreeInvariant::LeafDepth, .node = vertex, .depth = depth};
+        }
+        return std::nullopt;
+    }
+    for (ssize_t index = 0; index < std::ssize(vertex->children); ++index) {
+        auto child_lower = index == 0 ? lower : std::optional<Key>(vertex->keys[index - 1]);
+        if (auto violation = AuditSubtree(vertex->children[index].get(), depth + 1, child_lower, leaf_depth)) {
+            return violation;
+        }
+    }
+    return std::nullopt;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::NotifyVisit(Node* vertex) const {
+    if (auto visit = ProduceVisit(vertex)) {
+        port_.Notify(std::move(*visit));
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::optional<TreeActionsBatch>
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ProduceVisit(Node* vertex) const {
+    metrics_.Add(ETreeCounter::NodeVisits);
+    if (!port_.IsInterestedIn(ActionInterest(ENodeAction::Visit))) {
+        return std::nullopt;
+    }
+    return TreeActionsBatch{TreeAction{.node_address = vertex, .action_type = ENodeAction::Visit}};
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+std::optional<NodeInfo>
+BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ProduceNodeInfo(const Node& martyr) const {
+    if (!port_.IsInterestedIn(kNodePayloadInterest)) {
+        return std::nullopt;
+    }
+    return DescribeNode(martyr);
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+NodeInfo BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::DescribeNode(const Node& martyr) {
+    NodeInfo result;
+    result.keys.assign(martyr.keys.begin(), martyr.keys.end());
+    result.children.reserve(martyr.children.size());
+    for (auto& child : martyr.children) {
+        result.children.emplace_back(child.get());
+    }
+    return result;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+TreeActionsBatch BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::ProduceWholeTreeInfo() const {
+    TreeActionsBatch whole_actions;
+    whole_actions.emplace_back(TreeAction{.action_type = ENodeAction::StartQuery});
+    if (root_ == nullptr && flat_file_) {
+        // The file is in post-order already.
+        for (ssize_t index = 0; index < flat_file_->GetNodeCount(); ++index) {
+            const auto& flat_node = flat_file_->GetNode(index);
+            std::optional<NodeInfo> data;
+            if (port_.IsInterestedIn(kNodePayloadInterest)) {
+                data = DescribeFlatNode(flat_node);
+            }
+            whole_actions.emplace_back(TreeAction{.node_address = GetFlatAddress(flat_node),
+                                                  .action_type = ENodeAction::Create,
+                                                  .data = std::move(data)});
+        }
+    } else {
+        TraverseForTreeInfo(root_.get(), whole_actions);
+    }
+    whole_actions.emplace_back(TreeAction{.node_address = GetObservedRoot(), .action_type = ENodeAction::MakeRoot});
+    whole_actions.emplace_back(TreeAction{.action_type = ENodeAction::EndQuery});
+    return whole_actions;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+NodeInfo BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::DescribeFlatNode(const FlatNode& flat_node) const {
+    NodeInfo result;
+    result.keys.assign(flat_node.keys.begin(), flat_node.keys.begin() + flat_node.key_count);
+    result.children.reserve(flat_node.child_count);
+    for (uint32_t child = 0; child < flat_node.child_count; ++child) {
+        result.children.emplace_back(GetFlatAddress(flat_file_->GetNode(flat_node.children[child])));
+    }
+    return result;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+MemoryAddress BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::GetObservedRoot() const {
+    if (root_ == nullptr && flat_file_) {
+        return GetFlatAddress(flat_file_->GetNode(flat_file_->GetRootIndex()));
+    }
+    return root_.get();
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TraverseForTreeInfo(Node* vertex,
+                                                                                 TreeActionsBatch& info_storage) const {
+    if (vertex == nullptr) {
+        return;
+    }
+    for (ssize_t child_index = 0; child_index < std::ssize(vertex->children); ++child_index) {
+        TraverseForTreeInfo(vertex->children[child_index].get(), info_storage);
+    }
+    info_storage.emplace_back(
+        TreeAction{.node_address = vertex, .action_type = ENodeAction::Create, .data = ProduceNodeInfo(*vertex)});
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TraverseForMemoryStats(
+    const Node* vertex, TreeMemoryStats& stats, std::unordered_set<const NodeSlabs::Slab*>& slabs) {
+    if (vertex == nullptr) {
+        return;
+    }
+    ++stats.node_count;
+    stats.node_bytes += sizeof(Node);
+    if (vertex->slab != nullptr) {
+        ++stats.slab_node_count;
+        stats.slab_live_bytes += sizeof(Node);
+        slabs.insert(vertex->slab);
+    }
+    // A buffer which isn't a heap block of its own lies in the slab of its allocator, which a moved vector may bring
+    // to a node outside of the slab.
+    auto measure_buffer = [&stats, &slabs](VectorMemory& total, const auto& buffer) {
+        auto memory = MeasureVector(buffer);
+        total += memory;
+        auto bytes = memory.used_bytes + memory.slack_bytes;
+        if (bytes > 0 && memory.allocation_count == 0) {
+            stats.slab_live_bytes += bytes;
+            slabs.insert(buffer.get_allocator().GetSlab());
+        }
+    };
+    measure_buffer(stats.keys, vertex->keys);
+    measure_buffer(stats.children, vertex->children);
+    if constexpr (kIsMap) {
+        measure_buffer(stats.values, vertex->values);
+    }
+    if (vertex->children.empty()) {
+        ++stats.leaf_count;
+        stats.key_count += std::ssize(vertex->keys);
+    }
+    for (const auto& child : vertex->children) {
+        TraverseForMemoryStats(child.get(), stats, slabs);
+    }
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+ssize_t BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::CountKeys(const Node* vertex) {
+    if (vertex == nullptr) {
+        return 0;
+    }
+    if (vertex->children.empty()) {
+        return std::ssize(vertex->keys);
+    }
+    ssize_t count = 0;
+    for (const auto& child : vertex->children) {
+        count += CountKeys(child.get());
+    }
+    return count;
+}
+
+template <ssize_t kMinFanout, ssize_t kMaxFanout, typename TKeyStorage, typename TValue>
+void BPlusTree<kMinFanout, kMaxFanout, TKeyStorage, TValue>::TraverseForKeys(const Node* vertex,
+                                                                             std::vector<Key>& keys) {
+    if (vertex == nullptr) {
+        return;
+    }
+    if (vertex->children.empty()) {
+        keys.insert(keys.end(), vertex->keys.begin(), vertex->keys.end());
+    }
+    for (const auto& child : vertex->children) {
+        TraverseForKeys(child.get(), keys);
+    }
+}
+
+} // namespace NVis
@@ -10,7 +10,12 @@ Window::Window()
       key_edit_(new QLineEdit(this)),
       insert_button_(new QPushButton("Insert", this)),
       erase_button_(new QPushButton("Erase", this)),
-      search_button_(new QPushButton("Search", this)) {
+      search_button_(new QPushButton("Search", this)),
+      load_file_button_(new QPushButton("Load file", this)),
+      cancel_button_(new QPushButton("Cancel", this)),
+      progress_bar_(new QProgressBar(this)),
+      timeline_slider_(new QSlider(Qt::Horizontal, this)),
+      overlay_label_(new QLabel(view_)) {
 
     auto central_widget = new QWidget(this);
     setCentralWidget(central_widget);
@@ -21,6 +26,15 @@ Window::Window()
     layout->addWidget(insert_button_, 2, 0);
     layout->addWidget(erase_button_, 2, 1);
     layout->addWidget(search_button_, 2, 2);
+    layout->addWidget(load_file_button_, 3, 0);
+    layout->addWidget(progress_bar_, 3, 1);
+    layout->addWidget(cancel_button_, 3, 2);
+    layout->addWidget(timeline_slider_, 4, 0, 1, -1);
+    timeline_slider_->setRange(0, 0);
+    overlay_label_->setStyleSheet("QLabel { background-color: rgba(255, 255, 255, 200); font-family: monospace; }");
+    overlay_label_->setAttribute(Qt::WA_TransparentForMouseEvents);
+    overlay_label_->move(kOverlayMargin, kOverlayMargin);
+    overlay_label_->hide();
     setMinimumWidth(kWidth);
     setMinimumHeight(kHeight);
 }
@@ -45,4 +59,26 @@ QPushButton* Window::GetSearchButton() {
     return search_button_;
 }
 
+QPushButton* Window::GetLoadFileButton() {
+    return load_file_button_;
+}
+
+QPushButton* Window::GetCancelButton() {
+    return cancel_button_;
+}
+
+QProgressBar* Window::GetProgressBar() {
+    return progress_bar_;
+}
+
+QSlider* Window::GetTimelineSlider() {
+    return timeline_slider_;
+}
+
+void Window::SetOverlayText(const QString& text) {
+    overlay_label_->setText(text);
+    overlay_label_->adjustSize();
+    overlay_label_->setVisible(!text.isEmpty());
+}
+
 } // namespace NVis
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <QGraphicsView>
+#include <QLabel>
 #include <QLineEdit>
 #include <QMainWindow>
 #include <QObject>
+#include <QProgressBar>
 #include <QPushButton>
+#include <QSlider>
 
 namespace NVis {
 
@@ -23,16 +26,29 @@ public:
     QPushButton* GetInsertButton();
     QPushButton* GetEraseButton();
     QPushButton* GetSearchButton();
+    QPushButton* GetLoadFileButton();
+    QPushButton* GetCancelButton();
+    QProgressBar* GetProgressBar();
+    //! Scrubber over the operations drawn so far, to look at the tree as any of them has left it.
+    QSlider* GetTimelineSlider();
+    //! Shows `text` in the overlay at the corner of the view. The overlay stays hidden until it gets some text.
+    void SetOverlayText(const QString& text);
 
 private:
     static constexpr int kWidth = 1280;
     static constexpr int kHeight = 720;
+    static constexpr int kOverlayMargin = 8;
 
     QGraphicsView* view_;
     QLineEdit* key_edit_;
     QPushButton* insert_button_;
     QPushButton* erase_button_;
     QPushButton* search_button_;
+    QPushButton* load_file_button_;
+    QPushButton* cancel_button_;
+    QProgressBar* progress_bar_;
+    QSlider* timeline_slider_;
+    QLabel* overlay_label_;
 };
 
 } // namespace NVis
@@ -0,0 +1,118 @@
+#include "gtest/gtest.h"
+
+#include "src/animation_timeline.h"
+#include "src/two_three_tree.h"
+#include "tests/tree_mirror.h"
+
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace NVis {
+
+namespace {
+Observer<TreeActionsBatch> MakeRecorder(AnimationTimeline& timeline) {
+    return Observer<TreeActionsBatch>([&timeline](const TreeActionsBatch& actions) { timeline.Record(actions); },
+                                      [&timeline](const TreeActionsBatch& actions) { timeline.Record(actions); },
+                                      []() {});
+}
+
+constexpr Key kLargeTreeSize = 100'000;
+
+void FillLargeTree(TwoThreeTree& tree) {
+    for (Key key = 0; key < kLargeTreeSize; ++key) {
+        tree.Insert(key * 2);
+    }
+}
+
+std::vector<MirroredNodes> RecordRandomOperations(AnimationTimeline& timeline, ssize_t operation_count) {
+    constexpr int kSeed = 45;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> key_rng(0, 200);
+    std::bernoulli_distribution erase_rng(0.3);
+    TwoThreeTree tree;
+    auto recorder = MakeRecorder(timeline);
+    tree.SubscribeObserver(&recorder);
+    std::vector<MirroredNodes> states = {TakeSnapshot(tree)};
+    for (ssize_t operation = 0; operation < operation_count; ++operation) {
+        if (erase_rng(mt)) {
+            tree.Erase(key_rng(mt));
+        } else {
+            tree.Insert(key_rng(mt));
+        }
+        states.emplace_back(TakeSnapshot(tree));
+    }
+    return states;
+}
+} // namespace
+
+TEST(AnimationTimeline, SeeksToEveryOperation) {
+    constexpr ssize_t kOperationCount = 1'000;
+    AnimationTimeline timeline(16, 1 << 30);
+    auto states = RecordRandomOperations(timeline, kOperationCount);
+    ASSERT_EQ(timeline.GetFirstOperation(), 0);
+    ASSERT_EQ(timeline.GetOperationCount(), std::ssize(states));
+    // Backwards, so that nothing depends on the previous seek.
+    for (auto operation = std::ssize(states) - 1; operation >= 0; --operation) {
+        auto frame = timeline.Seek(timeline.GetFrameAfterOperation(operation));
+        ASSERT_EQ(ReadNodes(frame.state), states[operation]) << operation;
+    }
+    EXPECT_TRUE(timeline.Seek(timeline.GetFrameCount()).actions.empty());
+
+    // A frame is the state before it and the batch which was drawn then.
+    auto frame = timeline.GetFrameAfterOperation(kOperationCount / 2);
+    EXPECT_EQ(timeline.Seek(frame).actions.front().action_type, ENodeAction::StartQuery);
+}
+
+TEST(AnimationTimeline, StaysWithinBudget) {
+    constexpr ssize_t kOperationCount = 1'000;
+    constexpr ssize_t kBudget = 256 * 1024;
+    AnimationTimeline timeline(16, kBudget);
+    auto states = RecordRandomOperations(timeline, kOperationCount);
+    EXPECT_LE(timeline.MemoryBytes(), kBudget);
+    EXPECT_GT(timeline.GetFirstFrame(), 0);
+    ASSERT_GT(timeline.GetFirstOperation(), 0);
+    ASSERT_EQ(timeline.GetOperationCount(), std::ssize(states));
+    for (auto operation = timeline.GetFirstOperation(); operation < std::ssize(states); ++operation) {
+        auto frame = timeline.Seek(timeline.GetFrameAfterOperation(operation));
+        ASSERT_EQ(ReadNodes(frame.state), states[operation]) << operation;
+    }
+}
+
+TEST(AnimationTimeline, SharesUnchangedNodesBetweenKeyframes) {
+    constexpr ssize_t kOperationCount = 10;
+    AnimationTimeline timeline(1, 1 << 30);
+    TwoThreeTree tree;
+    FillLargeTree(tree);
+    auto recorder = MakeRecorder(timeline);
+    tree.SubscribeObserver(&recorder);
+    auto creation_bytes = timeline.MemoryBytes();
+    for (Key key = 0; key < kOperationCount; ++key) {
+        tree.Insert(key * 2 + 1);
+    }
+    // A keyframe on every frame, yet far from a copy of the tree each.
+    EXPECT_LT(timeline.MemoryBytes(), 2 * creation_bytes);
+    auto frame = timeline.Seek(timeline.GetFrameAfterOperation(kOperationCount / 2));
+    EXPECT_EQ(ReadNodes(frame.state).GetLeafKeys().size(), kLargeTreeSize + kOperationCount / 2);
+    EXPECT_EQ(ReadNodes(timeline.Seek(timeline.GetFrameCount()).state), TakeSnapshot(tree));
+}
+
+TEST(AnimationTimeline, StartsOverAfterBatchOverBudget) {
+    constexpr ssize_t kBudget = 256 * 1024;
+    AnimationTimeline timeline(16, kBudget);
+    TwoThreeTree tree;
+    FillLargeTree(tree);
+    auto recorder = MakeRecorder(timeline);
+    tree.SubscribeObserver(&recorder);
+    EXPECT_LE(timeline.MemoryBytes(), kBudget);
+    EXPECT_EQ(timeline.GetFirstFrame(), timeline.GetFrameCount());
+    EXPECT_EQ(ReadNodes(timeline.Seek(timeline.GetFrameCount()).state), TakeSnapshot(tree));
+
+    tree.Insert(1);
+    EXPECT_LE(timeline.MemoryBytes(), kBudget);
+    ASSERT_EQ(timeline.GetOperationCount() - timeline.GetFirstOperation(), 1);
+    auto frame = timeline.Seek(timeline.GetFrameAfterOperation(timeline.GetFirstOperation()));
+    EXPECT_EQ(ReadNodes(frame.state), TakeSnapshot(tree));
+}
+
+} // namespace NVis
@@ -0,0 +1,93 @@
+#include "gtest/gtest.h"
+
+#include "src/cache_aligned_allocator.h"
+#include "src/frozen_tree.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace NVis {
+
+namespace {
+//! Checks searches of all the keys and of the gaps around them against the sorted `keys`.
+void CheckAgainstSorted(const std::vector<Key>& keys) {
+    FrozenTree frozen(keys);
+    ASSERT_EQ(frozen.Size(), std::ssize(keys));
+    EXPECT_EQ(frozen.GetKeys(), keys);
+    std::vector<Key> queries;
+    for (auto key : keys) {
+        queries.insert(queries.end(), {key - 1, key, key + 1});
+    }
+    queries.emplace_back(keys.empty() ? 0 : keys.back() + 2);
+    for (auto x : queries) {
+        auto expected = std::lower_bound(keys.begin(), keys.end(), x);
+        auto it = frozen.LowerBound(x);
+        if (expected == keys.end()) {
+            EXPECT_EQ(it, frozen.end()) << x;
+        } else {
+            ASSERT_NE(it, frozen.end()) << x;
+            EXPECT_EQ(*it, *expected) << x;
+        }
+        EXPECT_EQ(frozen.Contains(x), std::binary_search(keys.begin(), keys.end(), x)) << x;
+    }
+}
+} // namespace
+
+TEST(FrozenTree, MatchesSortedVector) {
+    // Sizes around powers of two make the last level of the layout empty, full and anything in between.
+    for (Key size = 0; size <= 70; ++size) {
+        std::vector<Key> keys(size);
+        for (Key index = 0; index < size; ++index) {
+            keys[index] = index * 3;
+        }
+        CheckAgainstSorted(keys);
+    }
+    constexpr int kSeed = 41;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(-1'000'000, 1'000'000);
+    std::vector<Key> keys(5'000);
+    std::generate(keys.begin(), keys.end(), [&] { return rng(mt); });
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    CheckAgainstSorted(keys);
+}
+
+TEST(FrozenTree, ScansRanges) {
+    std::vector<Key> keys;
+    for (Key key = -500; key < 500; key += 7) {
+        keys.emplace_back(key);
+    }
+    FrozenTree frozen(keys);
+    for (Key from = -510; from < 510; from += 13) {
+        for (Key to = from; to < from + 100; to += 11) {
+            std::vector<Key> scanned;
+            for (auto it = frozen.LowerBound(from); it != frozen.end() && *it < to; ++it) {
+                scanned.emplace_back(*it);
+            }
+            EXPECT_EQ(scanned, std::vector<Key>(std::lower_bound(keys.begin(), keys.end(), from),
+                                                std::lower_bound(keys.begin(), keys.end(), to)));
+        }
+    }
+}
+
+TEST(FrozenTree, MeasuresMemory) {
+    FrozenTree frozen(std::vector<Key>{1, 2, 3});
+    auto memory = frozen.MeasureMemory();
+    EXPECT_EQ(memory.used_bytes, 4 * static_cast<ssize_t>(sizeof(Key)));
+    EXPECT_EQ(memory.allocation_count, 1);
+    EXPECT_EQ(FrozenTree().MeasureMemory().allocation_count, 0);
+}
+
+TEST(CacheAlignedAllocator, AlignsToCacheLines) {
+    for (ssize_t size : {1, 7, 1'000}) {
+        std::vector<Key, CacheAlignedAllocator<Key>> keys(size);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(keys.data()) % kCacheLineBytes, 0) << size;
+        // Rebinding for another type keeps the alignment.
+        std::vector<char, CacheAlignedAllocator<char>> bytes(size, 0, keys.get_allocator());
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(bytes.data()) % kCacheLineBytes, 0) << size;
+    }
+}
+
+} // namespace NVis
@@ -0,0 +1,50 @@
+#include "gtest/gtest.h"
+
+#include "src/key_ranges.h"
+
+#include <limits>
+
+namespace NVis {
+
+namespace {
+void ExpectRanges(std::string_view input, const std::vector<KeyRange>& expected) {
+    auto ranges = ParseKeyRanges(input);
+    ASSERT_TRUE(ranges.has_value()) << input;
+    ASSERT_EQ(ranges->size(), expected.size()) << input;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ((*ranges)[i].first, expected[i].first) << input;
+        EXPECT_EQ((*ranges)[i].last, expected[i].last) << input;
+    }
+}
+} // namespace
+
+TEST(KeyRanges, SingleKeys) {
+    ExpectRanges("5", {{5, 5}});
+    ExpectRanges("-17", {{-17, -17}});
+    ExpectRanges("1,2, 3\n4", {{1, 1}, {2, 2}, {3, 3}, {4, 4}});
+}
+
+TEST(KeyRanges, Ranges) {
+    ExpectRanges("1..1000000", {{1, 1'000'000}});
+    ExpectRanges("-5..-1, 7, 10..10", {{-5, -1}, {7, 7}, {10, 10}});
+}
+
+TEST(KeyRanges, Incorrect) {
+    EXPECT_FALSE(ParseKeyRanges("").has_value());
+    EXPECT_FALSE(ParseKeyRanges(" , ").has_value());
+    EXPECT_FALSE(ParseKeyRanges("abc").has_value());
+    EXPECT_FALSE(ParseKeyRanges("1, 2x").has_value());
+    EXPECT_FALSE(ParseKeyRanges("5..1").has_value());
+    EXPECT_FALSE(ParseKeyRanges("1..").has_value());
+    EXPECT_FALSE(ParseKeyRanges("1...3").has_value());
+    EXPECT_FALSE(ParseKeyRanges("99999999999").has_value());
+}
+
+TEST(KeyRanges, Count) {
+    EXPECT_EQ(CountKeys({{1, 10}, {5, 5}}), 11);
+    constexpr Key kMin = std::numeric_limits<Key>::min();
+    constexpr Key kMax = std::numeric_limits<Key>::max();
+    EXPECT_EQ(CountKeys({{kMin, kMax}}), ssize_t{1} << 32);
+}
+
+} // namespace NVis
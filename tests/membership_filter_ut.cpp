@@ -0,0 +1,64 @@
+#include "gtest/gtest.h"
+
+#include "src/membership_filter.h"
+
+#include <vector>
+
+namespace NVis {
+
+TEST(MembershipFilter, HasNoFalseNegatives) {
+    constexpr Key kKeyCount = 10'000;
+    MembershipFilter filter(kKeyCount);
+    for (Key key = 0; key < kKeyCount; ++key) {
+        filter.Add(key * 2);
+    }
+    for (Key key = 0; key < kKeyCount; ++key) {
+        ASSERT_TRUE(filter.MayContain(key * 2)) << key;
+    }
+    // Odd keys were never added, a few of them pass by chance.
+    ssize_t passed_count = 0;
+    for (Key key = 0; key < kKeyCount; ++key) {
+        if (filter.MayContain(key * 2 + 1)) {
+            filter.CountFalsePositive();
+            ++passed_count;
+        }
+    }
+    auto stats = filter.GetStats();
+    EXPECT_EQ(stats.query_count, 2 * kKeyCount);
+    EXPECT_EQ(stats.rejected_count, kKeyCount - passed_count);
+    EXPECT_EQ(stats.false_positive_count, passed_count);
+    EXPECT_LT(stats.FalsePositiveRate(), 0.05);
+    EXPECT_EQ(stats.memory.allocation_count, 1);
+    // One bit per key for 8 bits per key.
+    EXPECT_LE(stats.memory.used_bytes, kKeyCount + 64);
+}
+
+TEST(MembershipFilter, AsksForRebuild) {
+    MembershipFilter filter;
+    std::vector<Key> keys;
+    for (Key key = 0; !filter.NeedsRebuild(); ++key) {
+        filter.Add(key);
+        keys.emplace_back(key);
+    }
+    // Full at the minimum capacity.
+    EXPECT_EQ(std::ssize(keys), 1'025);
+    filter.Rebuild(keys);
+    EXPECT_FALSE(filter.NeedsRebuild());
+    auto stats = filter.GetStats();
+    EXPECT_EQ(stats.key_count, std::ssize(keys));
+    EXPECT_EQ(stats.rebuild_count, 1);
+
+    for (Key key = 0; key * 2 <= std::ssize(keys); ++key) {
+        EXPECT_FALSE(filter.NeedsRebuild());
+        filter.CountErased();
+    }
+    EXPECT_TRUE(filter.NeedsRebuild());
+    keys.resize(keys.size() / 2);
+    filter.Rebuild(keys);
+    EXPECT_EQ(filter.GetStats().stale_count, 0);
+    for (auto key : keys) {
+        EXPECT_TRUE(filter.MayContain(key));
+    }
+}
+
+} // namespace NVis
@@ -3,6 +3,7 @@
 #include "src/observer.h"
 
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 
@@ -127,4 +128,92 @@ TEST(ObserverCorrectness, Exception) {
     EXPECT_EQ(out.str(), "+1-");
 }
 
+TEST(ObserverCorrectness, SubscribesAndUnsubscribesFromCallbacks) {
+    std::stringstream out;
+    Observable<int> actor([]() { return 0; });
+    Observer<int> late([](int) {}, [&out](int x) { out << "l" << x; }, []() {});
+    Observer<int> last([](int) {}, [&out](int x) { out << "z" << x; }, []() {});
+    // The first observer unsubscribes itself and the last one, and subscribes a new one on the first notification.
+    std::optional<Observer<int>> first;
+    first.emplace([](int) {},
+                  [&](int x) {
+                      out << "f" << x;
+                      first->Unsubscribe();
+                      last.Unsubscribe();
+                      actor.Subscribe(&late);
+                  },
+                  []() {});
+    Observer<int> middle([](int) {}, [&out](int x) { out << "m" << x; }, []() {});
+    actor.Subscribe(&*first);
+    actor.Subscribe(&middle);
+    actor.Subscribe(&last);
+    actor.Notify(1);
+    actor.Notify(2);
+    EXPECT_EQ(out.str(), "f1m1m2l2");
+    EXPECT_FALSE(first->IsSubscribed());
+    EXPECT_FALSE(last.IsSubscribed());
+}
+
+TEST(ObserverInterest, UnionOfSubscribers) {
+    Observable<int> actor([]() { return 0; });
+    EXPECT_EQ(actor.GetInterest(), 0u);
+    auto first = std::make_unique<Observer<int>>([](int) {}, [](int) {}, []() {}, 0b01);
+    auto second = std::make_unique<Observer<int>>([](int) {}, [](int) {}, []() {}, 0b10);
+    actor.Subscribe(first.get());
+    EXPECT_EQ(actor.GetInterest(), 0b01u);
+    actor.Subscribe(second.get());
+    EXPECT_EQ(actor.GetInterest(), 0b11u);
+    first.reset();
+    EXPECT_EQ(actor.GetInterest(), 0b10u);
+    second->Unsubscribe();
+    EXPECT_EQ(actor.GetInterest(), 0u);
+}
+
+TEST(ObserverInterest, Filter) {
+    // Bit 0 is interest in even numbers, bit 1 in odd ones.
+    std::stringstream out;
+    Observable<int> actor([]() { return 1; }, [](const int& x, const Observer<int>& observer) -> std::optional<int> {
+        if (observer.GetInterest() & (InterestMask{1} << (x % 2))) {
+            return x;
+        }
+        return std::nullopt;
+    });
+    Observer<int> even([&out](int x) { out << "e" << x; }, [&out](int x) { out << "e" << x; }, []() {}, 0b01);
+    Observer<int> all([&out](int x) { out << "a" << x; }, [&out](int x) { out << "a" << x; }, []() {});
+    actor.Subscribe(&even);
+    actor.Subscribe(&all);
+    actor.Notify(2);
+    actor.Notify(3);
+    EXPECT_EQ(out.str(), "a1e2a2a3");
+}
+
+TEST(InplaceFunction, KeepsState) {
+    ssize_t destroyed = 0;
+    struct Counter {
+        ssize_t* destroyed;
+        ssize_t calls = 0;
+        ~Counter() {
+            ++*destroyed;
+        }
+        ssize_t operator()(ssize_t x) {
+            return x + ++calls;
+        }
+    };
+    {
+        InplaceFunction<ssize_t(ssize_t), kObserverCallbackCapacity> function(Counter{.destroyed = &destroyed});
+        destroyed = 0;
+        EXPECT_EQ(function(10), 11);
+        EXPECT_EQ(function(10), 12);
+    }
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST(StaticObservable, CallsEveryCallback) {
+    std::stringstream out;
+    auto actor = MakeStaticObservable<int>([&out](int x) { out << "a" << x; }, [&out](int x) { out << "b" << x; });
+    actor.Notify(1);
+    actor.Notify(2);
+    EXPECT_EQ(out.str(), "a1b1a2b2");
+}
+
 } // namespace NVis
@@ -0,0 +1,107 @@
+#include "gtest/gtest.h"
+
+#include "src/packed_keys.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace NVis {
+
+namespace {
+std::vector<Key> Unpack(const PackedKeys& keys) {
+    return std::vector<Key>(keys.begin(), keys.end());
+}
+} // namespace
+
+TEST(PackedKeys, EncodesAndDecodes) {
+    constexpr Key kMin = std::numeric_limits<Key>::min();
+    constexpr Key kMax = std::numeric_limits<Key>::max();
+    std::vector<std::vector<Key>> cases = {
+        {},
+        {7},
+        {5, 5, 5},
+        {kMin, kMax},
+        {kMax, 0, kMin, -1, 1},
+    };
+    std::vector<Key> dense(200);
+    for (Key index = 0; index < std::ssize(dense); ++index) {
+        dense[index] = 1'000'000 + index * 3;
+    }
+    cases.emplace_back(dense);
+    for (const auto& keys : cases) {
+        PackedKeys packed(keys.begin(), keys.end());
+        ASSERT_EQ(packed.size(), keys.size());
+        EXPECT_EQ(Unpack(packed), keys);
+        for (ssize_t index = 0; index < std::ssize(keys); ++index) {
+            EXPECT_EQ(packed[index], keys[index]);
+        }
+    }
+}
+
+TEST(PackedKeys, DenseKeysTakeFewBits) {
+    std::vector<Key> keys(1'000);
+    for (Key index = 0; index < std::ssize(keys); ++index) {
+        keys[index] = 500'000 + index;
+    }
+    PackedKeys packed(keys.begin(), keys.end());
+    // Differences within a block of 64 keys fit in 6 bits, plus a header word per block.
+    auto memory = packed.MeasureMemory();
+    EXPECT_LE(memory.used_bytes, std::ssize(keys) * 6 / 8 + 16 * 16);
+    EXPECT_EQ(memory.slack_bytes, 0);
+    EXPECT_EQ(memory.allocation_count, 1);
+}
+
+TEST(PackedKeys, SearchesInPlace) {
+    std::vector<Key> keys;
+    for (Key key = -300; key < 300; key += 7) {
+        keys.emplace_back(key);
+    }
+    PackedKeys packed(keys.begin(), keys.end());
+    for (Key x = -310; x < 310; ++x) {
+        EXPECT_EQ(std::lower_bound(packed.begin(), packed.end(), x) - packed.begin(),
+                  std::lower_bound(keys.begin(), keys.end(), x) - keys.begin());
+        EXPECT_EQ(std::binary_search(packed.begin(), packed.end(), x), std::binary_search(keys.begin(), keys.end(), x));
+    }
+}
+
+TEST(PackedKeys, MutatesLikeVector) {
+    constexpr int kSeed = 39;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(-1'000, 1'000);
+    std::vector<Key> expected;
+    PackedKeys packed;
+    for (int i = 0; i < 2'000; ++i) {
+        auto index = expected.empty() ? 0 : std::uniform_int_distribution<ssize_t>(0, std::ssize(expected) - 1)(mt);
+        // Keys stay in a narrow frame mostly, so `Set` is tried both in place and with re-encoding.
+        auto key = i % 10 == 0 ? rng(mt) * 1'000 : rng(mt);
+        switch (expected.empty() ? 0 : i % 4) {
+        case 0:
+            expected.insert(expected.begin() + index, key);
+            packed.insert(packed.begin() + index, key);
+            break;
+        case 1:
+            expected[index] = key;
+            packed[index] = key;
+            break;
+        case 2:
+            expected.erase(expected.begin() + index);
+            packed.erase(packed.begin() + index);
+            break;
+        default:
+            expected.insert(expected.end(), {key, key + 1});
+            packed.insert(packed.end(), expected.end() - 2, expected.end());
+            break;
+        }
+        ASSERT_EQ(Unpack(packed), expected) << i;
+    }
+    packed.resize(3);
+    expected.resize(3);
+    EXPECT_EQ(Unpack(packed), expected);
+    packed.clear();
+    EXPECT_TRUE(packed.empty());
+    EXPECT_EQ(packed.MeasureMemory().allocation_count, 0);
+}
+
+} // namespace NVis
@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+
+#include "src/sharded_tree.h"
+#include "tests/tree_mirror.h"
+
+#include <limits>
+#include <random>
+#include <set>
+
+namespace NVis {
+
+TEST(ShardedTree, RoutesLikeOneTree) {
+    static constexpr int kSeed = 35;
+    ShardedTree tree(4);
+    TreeMirror mirror;
+    tree.SubscribeObserver(mirror.GetObserver());
+
+    std::mt19937 mt(kSeed);
+    // Wide enough for keys to land in every shard.
+    std::uniform_int_distribution<Key> rng(std::numeric_limits<Key>::min(), std::numeric_limits<Key>::max());
+    std::vector<Key> pool(300);
+    for (auto& key : pool) {
+        key = rng(mt);
+    }
+    std::uniform_int_distribution<size_t> pick(0, pool.size() - 1);
+    std::set<Key> expected;
+    for (int i = 0; i < 2'000; ++i) {
+        Key key = pool[pick(mt)];
+        switch (i % 3) {
+        case 0:
+            EXPECT_EQ(tree.Insert(key), expected.insert(key).second);
+            break;
+        case 1:
+            EXPECT_EQ(tree.Erase(key), expected.erase(key) > 0);
+            break;
+        default:
+            EXPECT_EQ(tree.Contains(key), expected.contains(key));
+            break;
+        }
+    }
+    EXPECT_EQ(tree.Size(), std::ssize(expected));
+    EXPECT_EQ(mirror.GetNodes().GetLeafKeys(), std::vector<Key>(expected.begin(), expected.end()));
+
+    TreeMirror late;
+    tree.SubscribeObserver(late.GetObserver());
+    EXPECT_EQ(late.GetNodes().nodes.size(), mirror.GetNodes().nodes.size());
+    EXPECT_EQ(late.GetNodes().GetLeafKeys(), mirror.GetNodes().GetLeafKeys());
+}
+
+TEST(ShardedTree, BatchesInParallelAndRebalances) {
+    ShardedTree tree(4);
+    TreeMirror mirror;
+    tree.SubscribeObserver(mirror.GetObserver());
+
+    // Keys fall unevenly into two shards of the initial equal split.
+    auto result = tree.ApplyBatch(EBatchOperation::Insert, {{1, 3'000}, {-1'000, -1}});
+    EXPECT_EQ(result.processed_count, 4'000);
+    EXPECT_EQ(result.changed_count, 4'000);
+    EXPECT_EQ(tree.Size(), 4'000);
+    for (ssize_t shard = 0; shard < tree.GetShardCount(); ++shard) {
+        EXPECT_EQ(tree.GetShardSize(shard), 1'000) << shard;
+    }
+    EXPECT_EQ(tree.GetShardLowerBound(1), 1);
+    EXPECT_EQ(tree.GetShardLowerBound(2), 1'001);
+    EXPECT_EQ(tree.GetShardLowerBound(3), 2'001);
+
+    std::vector<Key> expected;
+    for (Key key = -1'000; key <= 3'000; ++key) {
+        if (key != 0) {
+            expected.emplace_back(key);
+        }
+    }
+    EXPECT_EQ(mirror.GetNodes().GetLeafKeys(), expected);
+
+    result = tree.ApplyBatch(EBatchOperation::Erase, {{-2'000, 2'000}});
+    EXPECT_EQ(result.changed_count, 3'000);
+    EXPECT_EQ(mirror.GetNodes().GetLeafKeys(), std::vector<Key>(expected.end() - 1'000, expected.end()));
+    for (Key key = 2'001; key <= 3'000; ++key) {
+        ASSERT_TRUE(tree.Contains(key));
+    }
+
+    // The remaining keys all sit in the last shard, and move down across every boundary.
+    tree.Rebalance();
+    for (ssize_t shard = 0; shard < tree.GetShardCount(); ++shard) {
+        EXPECT_EQ(tree.GetShardSize(shard), 250) << shard;
+    }
+    EXPECT_EQ(tree.GetShardLowerBound(1), 2'251);
+    EXPECT_EQ(tree.GetShardLowerBound(3), 2'751);
+    EXPECT_EQ(mirror.GetNodes().GetLeafKeys(), std::vector<Key>(expected.end() - 1'000, expected.end()));
+    EXPECT_FALSE(tree.Contains(2'000));
+    EXPECT_TRUE(tree.Contains(2'251));
+    EXPECT_EQ(tree.Erase(2'251), true);
+    EXPECT_EQ(tree.GetShardSize(1), 249);
+}
+
+TEST(ShardedTree, LooksUpManyKeys) {
+    static constexpr int kSeed = 135;
+    ShardedTree tree(4);
+    TreeMirror mirror;
+    tree.SubscribeObserver(mirror.GetObserver());
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(-5'000, 5'000);
+    std::set<Key> expected;
+    for (int i = 0; i < 2'000; ++i) {
+        auto key = rng(mt);
+        EXPECT_EQ(tree.Insert(key), expected.insert(key).second);
+    }
+
+    std::vector<Key> queries(3'000);
+    for (auto& key : queries) {
+        key = rng(mt);
+    }
+    auto found = tree.ContainsMany(queries);
+    ASSERT_EQ(std::ssize(found), std::ssize(queries));
+    for (ssize_t index = 0; index < std::ssize(queries); ++index) {
+        EXPECT_EQ(found[index], expected.contains(queries[index])) << queries[index];
+    }
+    EXPECT_TRUE(tree.ContainsMany({}).empty());
+    EXPECT_EQ(mirror.GetNodes().GetLeafKeys(), std::vector<Key>(expected.begin(), expected.end()));
+}
+
+} // namespace NVis
@@ -0,0 +1,198 @@
+#include "gtest/gtest.h"
+
+#include "src/shm_tree_transport.h"
+#include "src/two_three_tree.h"
+#include "tests/tree_mirror.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace NVis {
+
+namespace {
+std::string MakeSegmentName(const char* test) {
+    return "/nvis_ut_" + std::string(test) + "_" + std::to_string(getpid());
+}
+
+void RunRandomOperations(TwoThreeTree& tree, std::mt19937& mt, ssize_t operation_count) {
+    std::uniform_int_distribution<Key> key_rng(-300, 300);
+    std::bernoulli_distribution erase_rng(0.3);
+    for (ssize_t operation = 0; operation < operation_count; ++operation) {
+        if (erase_rng(mt)) {
+            tree.Erase(key_rng(mt));
+        } else {
+            tree.Insert(key_rng(mt));
+        }
+    }
+}
+} // namespace
+
+TEST(ShmTreeTransport, FollowsTree) {
+    constexpr int kSeed = 47;
+    auto name = MakeSegmentName("follows");
+    auto ring = ShmRing::Create(name, 1 << 16);
+    ASSERT_TRUE(ring.has_value());
+    ShmTreePublisher publisher(std::move(*ring));
+    auto consumer_ring = ShmRing::Open(name);
+    ASSERT_TRUE(consumer_ring.has_value());
+    ShmTreeView view(std::move(*consumer_ring));
+    TreeMirror seen;
+    view.SubscribeObserver(seen.GetObserver());
+
+    TwoThreeTree tree;
+    tree.Insert(1);
+    tree.SubscribeObserver(publisher.GetObserver());
+    EXPECT_EQ(view.Poll(), 1);
+    EXPECT_TRUE(view.IsSynced());
+    EXPECT_EQ(seen.GetNodes(), TakeSnapshot(tree));
+
+    std::mt19937 mt(kSeed);
+    for (ssize_t round = 0; round < 50; ++round) {
+        RunRandomOperations(tree, mt, 20);
+        publisher.ServeResync(tree);
+        EXPECT_GT(view.Poll(), 0);
+        ASSERT_EQ(seen.GetNodes(), TakeSnapshot(tree)) << round;
+    }
+    EXPECT_EQ(view.GetOverrunCount(), 0);
+    EXPECT_EQ(publisher.GetDroppedCount(), 0);
+}
+
+TEST(ShmTreeTransport, ResyncsAfterOverrun) {
+    constexpr int kSeed = 147;
+    auto name = MakeSegmentName("overrun");
+    auto ring = ShmRing::Create(name, 1 << 12);
+    ASSERT_TRUE(ring.has_value());
+    ShmTreePublisher publisher(std::move(*ring));
+    TwoThreeTree tree;
+    tree.SubscribeObserver(publisher.GetObserver());
+    auto consumer_ring = ShmRing::Open(name);
+    ASSERT_TRUE(consumer_ring.has_value());
+    ShmTreeView view(std::move(*consumer_ring));
+    TreeMirror seen;
+    view.SubscribeObserver(seen.GetObserver());
+
+    std::mt19937 mt(kSeed);
+    RunRandomOperations(tree, mt, 10);
+    // Nothing before the first snapshot is shown.
+    view.Poll();
+    EXPECT_FALSE(view.IsSynced());
+    publisher.ServeResync(tree);
+    view.Poll();
+    ASSERT_TRUE(view.IsSynced());
+    ASSERT_EQ(seen.GetNodes(), TakeSnapshot(tree));
+
+    // The ring is overrun many times over.
+    RunRandomOperations(tree, mt, 2'000);
+    view.Poll();
+    EXPECT_FALSE(view.IsSynced());
+    EXPECT_EQ(view.GetOverrunCount(), 1);
+    RunRandomOperations(tree, mt, 5);
+    publisher.ServeResync(tree);
+    RunRandomOperations(tree, mt, 5);
+    view.Poll();
+    ASSERT_TRUE(view.IsSynced());
+    EXPECT_EQ(seen.GetNodes(), TakeSnapshot(tree));
+
+    // The view sends what it knows to late subscribers.
+    TreeMirror late;
+    view.SubscribeObserver(late.GetObserver());
+    EXPECT_EQ(late.GetNodes(), seen.GetNodes());
+}
+
+TEST(ShmTreeTransport, ReadsWhileWriterRuns) {
+    constexpr int kSeed = 247;
+    auto name = MakeSegmentName("concurrent");
+    auto ring = ShmRing::Create(name, 1 << 13);
+    ASSERT_TRUE(ring.has_value());
+    ShmTreePublisher publisher(std::move(*ring));
+    TwoThreeTree tree;
+    tree.SubscribeObserver(publisher.GetObserver());
+    auto consumer_ring = ShmRing::Open(name);
+    ASSERT_TRUE(consumer_ring.has_value());
+    ShmTreeView view(std::move(*consumer_ring));
+    TreeMirror seen;
+    view.SubscribeObserver(seen.GetObserver());
+
+    std::atomic<bool> is_writing = true;
+    std::thread writer([&]() {
+        std::mt19937 mt(kSeed);
+        for (ssize_t round = 0; round < 300; ++round) {
+            RunRandomOperations(tree, mt, 10);
+            publisher.ServeResync(tree);
+        }
+        is_writing.store(false);
+    });
+    ssize_t delivered_count = 0;
+    while (is_writing.load()) {
+        delivered_count += view.Poll();
+    }
+    writer.join();
+    // The tree is still now, so the view catches up with it: it reads the rest of the ring, or gets a new snapshot if
+    // it has fallen behind. The writer may have finished before the reader has polled at all, so what's delivered is
+    // counted up to the end.
+    ssize_t round = 0;
+    do {
+        publisher.ServeResync(tree);
+        delivered_count += view.Poll();
+    } while (!view.IsSynced() && ++round < 1'000);
+    ASSERT_TRUE(view.IsSynced());
+    EXPECT_GT(delivered_count, 0);
+    EXPECT_EQ(seen.GetNodes(), TakeSnapshot(tree));
+}
+
+TEST(ShmTreeTransport, StreamsTreeLargerThanRing) {
+    constexpr int kSeed = 347;
+    constexpr ssize_t kCapacity = 1 << 10;
+    auto name = MakeSegmentName("large");
+    auto ring = ShmRing::Create(name, kCapacity);
+    ASSERT_TRUE(ring.has_value());
+    ShmTreePublisher publisher(std::move(*ring));
+    TwoThreeTree tree;
+    std::vector<Key> keys;
+    for (Key key = 0; key < 2'000; ++key) {
+        keys.emplace_back(key * 3);
+    }
+    tree.Build(keys);
+    auto consumer_ring = ShmRing::Open(name);
+    ASSERT_TRUE(consumer_ring.has_value());
+    ShmTreeView view(std::move(*consumer_ring));
+    TreeMirror seen;
+    view.SubscribeObserver(seen.GetObserver());
+
+    // The writer keeps changing the tree while the snapshot is streamed, and idles now and then.
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> key_rng(0, 6'000);
+    std::bernoulli_distribution idle_rng(0.5);
+    ssize_t round = 0;
+    for (; round < 1'000 && !view.IsSynced(); ++round) {
+        if (!idle_rng(mt)) {
+            tree.Insert(key_rng(mt));
+            tree.Erase(key_rng(mt));
+        }
+        publisher.ServeResync(tree);
+        view.Poll();
+    }
+    ASSERT_TRUE(view.IsSynced());
+    // A snapshot of the whole tree wouldn't fit the ring even once.
+    EXPECT_GT(std::ssize(seen.GetNodes().nodes) * 7, kCapacity);
+    EXPECT_GT(round, 1);
+    EXPECT_EQ(seen.GetNodes(), TakeSnapshot(tree));
+    EXPECT_EQ(publisher.GetDroppedCount(), 0);
+    EXPECT_EQ(view.GetOverrunCount(), 0);
+
+    for (round = 0; round < 50; ++round) {
+        tree.Insert(key_rng(mt));
+        tree.Erase(key_rng(mt));
+        publisher.ServeResync(tree);
+        view.Poll();
+        ASSERT_EQ(seen.GetNodes(), TakeSnapshot(tree)) << round;
+    }
+}
+
+} // namespace NVis
@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+
+#include "src/static_tree.h"
+#include "src/two_three_tree.h"
+#include "tests/tree_mirror.h"
+
+#include <array>
+#include <functional>
+#include <random>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace NVis {
+
+namespace {
+// A table built at compile time: the one-byte opcodes of some x86 jumps, calls and returns.
+constexpr StaticTwoThreeTree<16> kOpcodes{0xe8, 0xe9, 0xeb, 0xc3, 0xc2, 0xcb, 0xca, 0x7f, 0x70};
+
+static_assert(kOpcodes.GetSize() == 9);
+static_assert(kOpcodes.Contains(0xc3) && kOpcodes.Contains(0x70) && kOpcodes.Contains(0xeb));
+static_assert(!kOpcodes.Contains(0xc4) && !kOpcodes.Contains(0) && !kOpcodes.Contains(0xff));
+static_assert(kOpcodes.LowerBound(0x80) == 0xc2);
+static_assert(kOpcodes.LowerBound(0x70) == 0x70);
+static_assert(!kOpcodes.LowerBound(0xec).has_value());
+static_assert(kOpcodes.GetHeight() == 2);
+
+static_assert(StaticTwoThreeTree<1>().GetHeight() == -1);
+static_assert(!StaticTwoThreeTree<1>().Contains(0));
+
+template <ssize_t kMaxKeys>
+constexpr std::vector<Key> CollectKeys(const StaticTwoThreeTree<kMaxKeys>& tree) {
+    std::vector<Key> keys;
+    tree.VisitKeys([&keys](Key key) { keys.emplace_back(key); });
+    return keys;
+}
+
+static_assert(CollectKeys(kOpcodes) == std::vector<Key>{0x70, 0x7f, 0xc2, 0xc3, 0xca, 0xcb, 0xe8, 0xe9, 0xeb});
+
+//! Runs inserts and erases of pseudo-random keys against a plain array of flags and checks that the tree agrees with
+//! it. Merges, borrows and splits of every level happen on the way.
+constexpr bool MatchesFlags() {
+    constexpr Key kKeyCount = 64;
+    StaticTwoThreeTree<kKeyCount> tree;
+    std::array<bool, kKeyCount> flags{};
+    ssize_t size = 0;
+    uint32_t state = 50;
+    for (ssize_t operation = 0; operation < 1'000; ++operation) {
+        state = state * 1'664'525 + 1'013'904'223;
+        auto key = static_cast<Key>((state >> 8) % kKeyCount);
+        // Inserts prevail at first and erases later, so the tree grows and shrinks back.
+        auto is_erase = (state >> 24) % 100 < (operation < 500 ? 30 : 70);
+        auto changed = is_erase ? tree.Erase(key) : tree.Insert(key);
+        if (changed != (flags[key] == is_erase)) {
+            return false;
+        }
+        size += changed ? (is_erase ? -1 : 1) : 0;
+        flags[key] = !is_erase;
+        if (tree.GetSize() != size || tree.Contains(key) != flags[key]) {
+            return false;
+        }
+        // A full check is costly in constant evaluation, so it's done now and then.
+        for (Key checked = 0; operation % 50 == 0 && checked < kKeyCount; ++checked) {
+            if (tree.Contains(checked) != flags[checked]) {
+                return false;
+            }
+        }
+    }
+    for (Key key = 0; key < kKeyCount; ++key) {
+        tree.Erase(key);
+    }
+    return tree.GetSize() == 0 && tree.GetHeight() == -1;
+}
+
+static_assert(MatchesFlags());
+
+//! The tree is full, and takes every key back after it's emptied.
+constexpr bool RefillsAfterEmptied() {
+    StaticTwoThreeTree<64> tree;
+    for (int round = 0; round < 3; ++round) {
+        for (Key key = 0; key < 64; ++key) {
+            tree.Insert(round % 2 == 0 ? key : 63 - key);
+        }
+        if (tree.GetSize() != 64 || tree.LowerBound(0) != 0 || tree.LowerBound(63) != 63) {
+            return false;
+        }
+        for (Key key = 0; key < 64; ++key) {
+            tree.Erase(key);
+        }
+    }
+    return tree.GetSize() == 0;
+}
+
+static_assert(RefillsAfterEmptied());
+
+using Shape = std::vector<std::pair<ssize_t, std::vector<Key>>>;
+
+template <ssize_t kMaxKeys>
+Shape GetShape(const StaticTwoThreeTree<kMaxKeys>& tree) {
+    Shape shape;
+    tree.VisitNodes([&shape](ssize_t depth, std::span<const Key> keys) {
+        shape.emplace_back(depth, std::vector<Key>(keys.begin(), keys.end()));
+    });
+    return shape;
+}
+
+//! Depths and keys of the nodes of `tree` in pre-order, as a snapshot for observers shows them.
+Shape GetShape(TwoThreeTree& tree) {
+    auto snapshot = TakeSnapshot(tree);
+    Shape shape;
+    std::function<void(MemoryAddress, ssize_t)> visit = [&](MemoryAddress node, ssize_t depth) {
+        const auto& info = snapshot.nodes.at(node);
+        shape.emplace_back(depth, info.keys);
+        for (auto child : info.children) {
+            visit(child, depth + 1);
+        }
+    };
+    if (snapshot.root != nullptr) {
+        visit(snapshot.root, 0);
+    }
+    return shape;
+}
+} // namespace
+
+TEST(StaticTree, BuildsSameShapeAsTwoThreeTree) {
+    static constexpr int kSeed = 50;
+    static constexpr Key kKeyCount = 500;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> key_rng(0, kKeyCount - 1);
+    std::bernoulli_distribution erase_rng(0.45);
+    TwoThreeTree tree;
+    StaticTwoThreeTree<kKeyCount> static_tree;
+    for (ssize_t operation = 0; operation < 5'000; ++operation) {
+        auto key = key_rng(mt);
+        if (erase_rng(mt)) {
+            ASSERT_EQ(static_tree.Erase(key), tree.Erase(key)) << operation;
+        } else {
+            ASSERT_EQ(static_tree.Insert(key), tree.Insert(key)) << operation;
+        }
+        if (operation % 50 == 0) {
+            ASSERT_EQ(GetShape(static_tree), GetShape(tree)) << operation;
+        }
+    }
+    EXPECT_EQ(GetShape(static_tree), GetShape(tree));
+    std::vector<Key> keys;
+    static_tree.VisitKeys([&keys](Key key) { keys.emplace_back(key); });
+    EXPECT_EQ(keys, tree.GetKeys());
+}
+
+} // namespace NVis
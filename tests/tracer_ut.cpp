@@ -0,0 +1,63 @@
+#include "gtest/gtest.h"
+
+#include "src/tracer.h"
+
+#include <sstream>
+#include <thread>
+
+namespace NVis {
+
+namespace {
+std::string WriteTrace() {
+    std::ostringstream output;
+    Tracer::Instance().WriteChromeJson(output);
+    return output.str();
+}
+
+ssize_t CountOccurrences(const std::string& text, const std::string& pattern) {
+    ssize_t result = 0;
+    for (auto position = text.find(pattern); position != std::string::npos;
+         position = text.find(pattern, position + 1)) {
+        ++result;
+    }
+    return result;
+}
+} // namespace
+
+TEST(Tracer, RecordsNestedSpans) {
+    Tracer::Instance().Start();
+    {
+        TraceSpan outer("Outer", "test", "key", 42);
+        TraceSpan inner("Inner", "test");
+    }
+    std::jthread([]() { TraceSpan span("Worker", "test"); }).join();
+    Tracer::Instance().Stop();
+
+    auto trace = WriteTrace();
+    EXPECT_EQ(trace.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0);
+    EXPECT_EQ(CountOccurrences(trace, "\"ph\":\"X\""), 3);
+    EXPECT_EQ(CountOccurrences(trace, "\"args\":{\"key\":42}"), 1);
+    EXPECT_EQ(CountOccurrences(trace, "\"name\":\"Inner\",\"cat\":\"test\""), 1);
+    // Every span belongs to a thread track.
+    EXPECT_EQ(CountOccurrences(trace, "\"tid\":"), 3);
+    EXPECT_EQ(CountOccurrences(trace, "e+"), 0);
+}
+
+TEST(Tracer, OffByDefaultAndAfterStop) {
+    Tracer::Instance().Start();
+    Tracer::Instance().Stop();
+    {
+        TraceSpan span("Ignored", "test");
+    }
+    EXPECT_EQ(WriteTrace().find("Ignored"), std::string::npos);
+
+    // Span started while tracing was off isn't recorded even if tracing is on at its end.
+    {
+        TraceSpan span("Late", "test");
+        Tracer::Instance().Start();
+    }
+    Tracer::Instance().Stop();
+    EXPECT_EQ(WriteTrace().find("Late"), std::string::npos);
+}
+
+} // namespace NVis
@@ -0,0 +1,153 @@
+#include "gtest/gtest.h"
+
+#include "src/tree_layout.h"
+#include "src/two_three_tree.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace NVis {
+
+namespace {
+std::vector<const RenderCell*> AllCells(const RenderData& data) {
+    std::vector<const RenderCell*> cells;
+    for (const auto& row : data.rows) {
+        for (const auto& cell : row.cells) {
+            cells.emplace_back(&cell);
+        }
+    }
+    return cells;
+}
+
+bool IsHighlighted(const RenderData& data) {
+    auto cells = AllCells(data);
+    return std::any_of(cells.begin(), cells.end(),
+                       [](const RenderCell* cell) { return cell->highlight != ECellHighlight::None; });
+}
+} // namespace
+
+TEST(TreeLayout, LaysOutEveryKey) {
+    constexpr int kSeed = 46;
+    constexpr ssize_t kKeyCount = 2'000;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> key_rng(-1'000'000, 1'000'000);
+    TreeLayout layout;
+    TwoThreeTree tree;
+    Observer<TreeActionsBatch> observer([&layout](const TreeActionsBatch& actions) { layout.Apply(actions); },
+                                        [&layout](const TreeActionsBatch& actions) { layout.Apply(actions); }, []() {});
+    tree.SubscribeObserver(&observer);
+    std::vector<Key> keys;
+    for (ssize_t index = 0; index < kKeyCount; ++index) {
+        auto key = key_rng(mt);
+        if (tree.Insert(key)) {
+            keys.emplace_back(key);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    RenderData data;
+    layout.Layout(data);
+    ASSERT_GT(std::ssize(data.rows), 1);
+    EXPECT_EQ(data.stats.node_count, tree.MemoryStats().node_count);
+    for (ssize_t depth = 0; depth < std::ssize(data.rows); ++depth) {
+        const auto& row = data.rows[depth];
+        EXPECT_EQ(row.y, depth * (TreeLayout::kCellHeight + TreeLayout::kMargin));
+        for (ssize_t index = 1; index < std::ssize(row.cells); ++index) {
+            EXPECT_GE(row.cells[index].x, row.cells[index - 1].x + TreeLayout::kCellWidth);
+        }
+        for (ssize_t index = 1; index < std::ssize(row.lines); ++index) {
+            EXPECT_GT(row.lines[index].from_x, row.lines[index - 1].from_x);
+            EXPECT_GT(row.lines[index].to_x, row.lines[index - 1].to_x);
+        }
+        // Every cell but the ones of leaves has a line to its child.
+        if (depth + 1 < std::ssize(data.rows)) {
+            EXPECT_EQ(row.lines.size(), row.cells.size());
+        } else {
+            EXPECT_TRUE(row.lines.empty());
+        }
+    }
+    // Leaves hold all the keys in order.
+    const auto& leaves = data.rows.back().cells;
+    ASSERT_EQ(leaves.size(), keys.size());
+    for (ssize_t index = 0; index < std::ssize(keys); ++index) {
+        EXPECT_EQ(leaves[index].Label(), std::to_string(keys[index]));
+    }
+    EXPECT_EQ(data.width, leaves.back().x + TreeLayout::kCellWidth);
+    EXPECT_EQ(data.height, data.rows.back().y + TreeLayout::kCellHeight);
+}
+
+TEST(TreeLayout, FindsVisibleCellsAndLines) {
+    constexpr int kSeed = 146;
+    TreeLayout layout;
+    TwoThreeTree tree;
+    Observer<TreeActionsBatch> observer([&layout](const TreeActionsBatch& actions) { layout.Apply(actions); },
+                                        [&layout](const TreeActionsBatch& actions) { layout.Apply(actions); }, []() {});
+    tree.SubscribeObserver(&observer);
+    for (Key key = 0; key < 500; ++key) {
+        tree.Insert(key * 7 % 500);
+    }
+    RenderData data;
+    layout.Layout(data);
+
+    std::mt19937 mt(kSeed);
+    std::uniform_real_distribution<double> x_rng(-100, data.width + 100);
+    for (ssize_t attempt = 0; attempt < 200; ++attempt) {
+        auto left = x_rng(mt);
+        auto right = x_rng(mt);
+        if (left > right) {
+            std::swap(left, right);
+        }
+        for (const auto& row : data.rows) {
+            auto cells = RenderData::VisibleCells(row, left, right);
+            auto expected_cells = std::count_if(row.cells.begin(), row.cells.end(), [&](const RenderCell& cell) {
+                return cell.x + TreeLayout::kCellWidth >= left && cell.x <= right;
+            });
+            EXPECT_EQ(std::ssize(cells), expected_cells);
+            for (const auto& cell : cells) {
+                EXPECT_TRUE(cell.x + TreeLayout::kCellWidth >= left && cell.x <= right);
+            }
+            auto lines = RenderData::VisibleLines(row, left, right);
+            auto expected_lines = std::count_if(row.lines.begin(), row.lines.end(), [&](const RenderLine& line) {
+                return std::max(line.from_x, line.to_x) >= left && std::min(line.from_x, line.to_x) <= right;
+            });
+            EXPECT_EQ(std::ssize(lines), expected_lines);
+        }
+    }
+}
+
+TEST(TreeLayout, HighlightsOnlyNews) {
+    TreeLayout layout;
+    TwoThreeTree tree;
+    Observer<TreeActionsBatch> observer([&layout](const TreeActionsBatch& actions) { layout.Apply(actions); },
+                                        [&layout](const TreeActionsBatch& actions) { layout.Apply(actions); }, []() {});
+    tree.SubscribeObserver(&observer);
+    for (Key key = 0; key < 100; ++key) {
+        tree.Insert(key);
+    }
+    RenderData data;
+    layout.Layout(data);
+    EXPECT_TRUE(IsHighlighted(data));
+    layout.Layout(data);
+    EXPECT_FALSE(IsHighlighted(data));
+
+    tree.Contains(50);
+    layout.Layout(data);
+    auto cells = AllCells(data);
+    EXPECT_EQ(std::count_if(cells.begin(), cells.end(),
+                            [](const RenderCell* cell) { return cell->highlight == ECellHighlight::Visited; }),
+              std::count_if(cells.begin(), cells.end(),
+                            [](const RenderCell* cell) { return cell->highlight != ECellHighlight::None; }));
+    EXPECT_TRUE(IsHighlighted(data));
+
+    // Buffers are reused and shrink with the tree.
+    for (Key key = 0; key < 100; ++key) {
+        tree.Erase(key);
+    }
+    layout.Layout(data);
+    EXPECT_TRUE(data.rows.empty());
+    EXPECT_EQ(data.stats.node_count, 0);
+}
+
+} // namespace NVis
@@ -0,0 +1,43 @@
+#include "gtest/gtest.h"
+
+#include "src/tree_metrics.h"
+
+namespace NVis {
+
+TEST(LatencyHistogram, Percentiles) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.Snapshot().Percentile(0.5).count(), 0);
+    for (int i = 0; i < 99; ++i) {
+        histogram.Record(std::chrono::nanoseconds{100});
+    }
+    histogram.Record(std::chrono::microseconds{100});
+
+    auto snapshot = histogram.Snapshot();
+    EXPECT_EQ(snapshot.Count(), 100);
+    EXPECT_EQ(snapshot.Percentile(0.5).count(), 128);
+    EXPECT_EQ(snapshot.Percentile(0.99).count(), 128);
+    EXPECT_EQ(snapshot.Percentile(1.0).count(), 131'072);
+}
+
+TEST(LatencyHistogram, ClampsOutliers) {
+    LatencyHistogram histogram;
+    histogram.Record(std::chrono::nanoseconds{-5});
+    histogram.Record(std::chrono::hours{24 * 365});
+
+    auto snapshot = histogram.Snapshot();
+    EXPECT_EQ(snapshot.buckets.front(), 1);
+    EXPECT_EQ(snapshot.buckets.back(), 1);
+}
+
+TEST(TreeMetrics, SnapshotFollowsEnabling) {
+    TreeMetrics metrics;
+    metrics.Add(ETreeCounter::Splits, 3);
+    metrics.RecordLatency(ETreeOperation::Insert, std::chrono::nanoseconds{10});
+
+    auto snapshot = metrics.Snapshot();
+    EXPECT_EQ(snapshot.Get(ETreeCounter::Splits), kMetricsEnabled ? 3 : 0);
+    EXPECT_EQ(snapshot.GetLatency(ETreeOperation::Insert).Count(), kMetricsEnabled ? 1 : 0);
+    EXPECT_NE(FormatMetrics(snapshot).find("splits"), std::string::npos);
+}
+
+} // namespace NVis
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "gtest/gtest.h"
+
+#include "src/observer.h"
+#include "src/tree_action.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace NVis {
+
+//! Nodes of a tree by their addresses, as its observer knows them. Ordered, so tests can look at nodes in the order of
+//! their addresses.
+struct MirroredNodes {
+    MemoryAddress root = nullptr;
+    std::map<MemoryAddress, NodeInfo> nodes;
+
+    bool operator==(const MirroredNodes&) const = default;
+
+    //! Keys of leaves reachable from the root, from left to right.
+    std::vector<Key> GetLeafKeys() const {
+        std::vector<Key> keys;
+        CollectLeafKeys(root, keys);
+        return keys;
+    }
+
+private:
+    void CollectLeafKeys(MemoryAddress vertex, std::vector<Key>& keys) const {
+        if (vertex == nullptr) {
+            return;
+        }
+        const auto& node = nodes.at(vertex);
+        if (node.children.empty()) {
+            keys.insert(keys.end(), node.keys.begin(), node.keys.end());
+        }
+        for (auto child : node.children) {
+            CollectLeafKeys(child, keys);
+        }
+    }
+};
+
+//! Follows the batches an observer of a tree gets, like the drawing model does, and checks that they make sense one
+//! after another: only unknown nodes are created and only known ones are changed, deleted or visited. Nodes of a
+//! batch may come in any order, so the root and the children of the nodes it has touched are checked to be known once
+//! it's over.
+class TreeMirror {
+public:
+    TreeMirror()
+        : observer_([this](const TreeActionsBatch& actions) { Apply(actions); },
+                    [this](const TreeActionsBatch& actions) { Apply(actions); }, []() {}) {}
+
+    Observer<TreeActionsBatch>* GetObserver() {
+        return &observer_;
+    }
+
+    const MirroredNodes& GetNodes() const {
+        return mirrored_;
+    }
+
+    //! Follows `actions` as if the observer has got them.
+    void Apply(const TreeActionsBatch& actions) {
+        ASSERT_FALSE(actions.empty());
+        std::vector<MemoryAddress> touched;
+        for (const auto& action : actions) {
+            switch (action.action_type) {
+            case ENodeAction::Create:
+                ASSERT_FALSE(mirrored_.nodes.contains(action.node_address));
+                mirrored_.nodes[action.node_address] = *action.data;
+                touched.emplace_back(action.node_address);
+                ++touched_count_;
+                break;
+            case ENodeAction::Change:
+                ASSERT_TRUE(mirrored_.nodes.contains(action.node_address));
+                mirrored_.nodes[action.node_address] = *action.data;
+                touched.emplace_back(action.node_address);
+                ++touched_count_;
+                break;
+            case ENodeAction::Delete:
+                ASSERT_EQ(mirrored_.nodes.erase(action.node_address), 1);
+                ++touched_count_;
+                break;
+            case ENodeAction::MakeRoot:
+                mirrored_.root = action.node_address;
+                break;
+            case ENodeAction::Visit:
+                ASSERT_TRUE(mirrored_.nodes.contains(action.node_address));
+                break;
+            case ENodeAction::StartQuery:
+            case ENodeAction::EndQuery:
+                break;
+            }
+        }
+        ASSERT_TRUE(mirrored_.root == nullptr || mirrored_.nodes.contains(mirrored_.root));
+        for (auto address : touched) {
+            // A node may have been deleted after it was touched.
+            auto it = mirrored_.nodes.find(address);
+            if (it == mirrored_.nodes.end()) {
+                continue;
+            }
+            for (auto child : it->second.children) {
+                ASSERT_TRUE(mirrored_.nodes.contains(child));
+            }
+        }
+    }
+
+    //! Checks that the mirror is the same as a fresh snapshot of `tree`.
+    template <typename TTree>
+    void ExpectSameAs(TTree& tree) const;
+
+    //! Count of `Create`, `Change` and `Delete` actions followed since the last call.
+    ssize_t TakeTouchedCount() {
+        return std::exchange(touched_count_, 0);
+    }
+
+private:
+    MirroredNodes mirrored_;
+    ssize_t touched_count_ = 0;
+    Observer<TreeActionsBatch> observer_;
+};
+
+//! Nodes of `tree` as a fresh snapshot shows them.
+template <typename TTree>
+MirroredNodes TakeSnapshot(TTree& tree) {
+    TreeMirror mirror;
+    tree.SubscribeObserver(mirror.GetObserver());
+    return mirror.GetNodes();
+}
+
+//! Nodes created by `actions`, such as a snapshot of a tree.
+inline MirroredNodes ReadNodes(const TreeActionsBatch& actions) {
+    TreeMirror mirror;
+    mirror.Apply(actions);
+    return mirror.GetNodes();
+}
+
+template <typename TTree>
+void TreeMirror::ExpectSameAs(TTree& tree) const {
+    auto snapshot = TakeSnapshot(tree);
+    EXPECT_EQ(mirrored_.root, snapshot.root);
+    ASSERT_EQ(mirrored_.nodes.size(), snapshot.nodes.size());
+    for (const auto& [address, info] : snapshot.nodes) {
+        ASSERT_TRUE(mirrored_.nodes.contains(address));
+        EXPECT_EQ(mirrored_.nodes.at(address).keys, info.keys);
+        EXPECT_EQ(mirrored_.nodes.at(address).children, info.children);
+    }
+}
+
+} // namespace NVis
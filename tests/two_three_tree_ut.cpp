@@ -1,12 +1,22 @@
 #include "gtest/gtest.h"
 
 #include "src/public.h"
+#include "src/frozen_tree.h"
 #include "src/two_three_tree.h"
+#include "tests/tree_mirror.h"
 
 #include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
 #include <random>
+#include <utility>
 #include <set>
+#include <sstream>
+#include <string>
 
 namespace NVis {
 
@@ -156,4 +166,1368 @@ TEST(TreeBig, RandomLifetimes) {
     }
 }
 
+TEST(TreeBatch, AppliesRanges) {
+    TwoThreeTree tree;
+    auto result = tree.ApplyBatch(EBatchOperation::Insert, {{1, 1000}, {500, 1500}});
+    EXPECT_EQ(result.processed_count, 2001);
+    EXPECT_EQ(result.changed_count, 1500);
+    EXPECT_FALSE(result.is_cancelled);
+    result = tree.ApplyBatch(EBatchOperation::Erase, {{2, 1500}});
+    EXPECT_EQ(result.changed_count, 1499);
+    EXPECT_TRUE(tree.Contains(1));
+    EXPECT_FALSE(tree.Contains(2));
+}
+
+TEST(TreeBatch, Cancel) {
+    TwoThreeTree tree;
+    std::stop_source stop;
+    stop.request_stop();
+    auto result = tree.ApplyBatch(EBatchOperation::Insert, {{1, 1000}}, stop.get_token());
+    EXPECT_TRUE(result.is_cancelled);
+    EXPECT_EQ(result.processed_count, 0);
+    EXPECT_FALSE(tree.Contains(1));
+}
+
+TEST(TreeBatch, SummaryReproducesTree) {
+    // Replays every batch observer gets on a map of nodes, like drawing model does, and checks that the result is
+    // the same as a fresh snapshot of the tree.
+    TreeMirror replayed;
+    ssize_t notification_count = 0;
+    Observer<TreeActionsBatch> counter([](const TreeActionsBatch&) {},
+                                       [&](const TreeActionsBatch&) { ++notification_count; }, []() {});
+    TwoThreeTree tree;
+    for (Key key = 0; key < 20; ++key) {
+        tree.Insert(key * 100);
+    }
+    tree.SubscribeObserver(replayed.GetObserver());
+    tree.SubscribeObserver(&counter);
+    tree.ApplyBatch(EBatchOperation::Insert, {{1, 3000}});
+    tree.ApplyBatch(EBatchOperation::Erase, {{500, 2900}});
+    EXPECT_EQ(notification_count, 0);
+    tree.PublishBatchSummary();
+    EXPECT_EQ(notification_count, 1);
+    replayed.ExpectSameAs(tree);
+}
+
+TEST(TreeInterest, StructuralObserver) {
+    ssize_t visit_count = 0;
+    ssize_t payload_count = 0;
+    ssize_t structural_count = 0;
+    Observer<TreeActionsBatch> observer([](const TreeActionsBatch&) {},
+                                        [&](const TreeActionsBatch& actions) {
+                                            for (const auto& action : actions) {
+                                                visit_count += action.action_type == ENodeAction::Visit;
+                                                payload_count += action.data.has_value();
+                                                structural_count += action.action_type != ENodeAction::Visit;
+                                            }
+                                        },
+                                        []() {}, kStructuralInterest);
+    TwoThreeTree tree;
+    tree.SubscribeObserver(&observer);
+    for (Key key = 0; key < 100; ++key) {
+        tree.Insert(key);
+    }
+    for (Key key = 0; key < 100; ++key) {
+        EXPECT_TRUE(tree.Contains(key));
+    }
+    EXPECT_EQ(visit_count, 0);
+    EXPECT_EQ(payload_count, 0);
+    EXPECT_GT(structural_count, 0);
+
+    ssize_t full_visit_count = 0;
+    Observer<TreeActionsBatch> full_observer([](const TreeActionsBatch&) {},
+                                             [&](const TreeActionsBatch& actions) {
+                                                 for (const auto& action : actions) {
+                                                     full_visit_count += action.action_type == ENodeAction::Visit;
+                                                 }
+                                             },
+                                             []() {});
+    tree.SubscribeObserver(&full_observer);
+    tree.Contains(5);
+    EXPECT_GT(full_visit_count, 0);
+    EXPECT_EQ(visit_count, 0);
+}
+
+TEST(TreeStreaming, ConsistentWithLiveUpdates) {
+    // Replays what a late streaming observer gets while the tree is being changed, checking on every step that it
+    // never refers to nodes it doesn't know. In the end its view must match a fresh snapshot.
+    constexpr int kSeed = 28;
+    constexpr ssize_t kChunkSize = 16;
+    TwoThreeTree tree;
+    tree.ApplyBatch(EBatchOperation::Insert, {{0, 5'000}});
+    TreeMirror streamed;
+    ssize_t max_chunk_creates = 0;
+    Observer<TreeActionsBatch> observer(
+        [&](const TreeActionsBatch& actions) { streamed.Apply(actions); },
+        [&](const TreeActionsBatch& actions) {
+            auto creates = std::count_if(actions.begin(), actions.end(),
+                                         [](const auto& action) { return action.action_type == ENodeAction::Create; });
+            max_chunk_creates = std::max<ssize_t>(max_chunk_creates, creates);
+            streamed.Apply(actions);
+        },
+        []() {});
+    tree.SubscribeObserverStreaming(&observer, kChunkSize);
+
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(0, 6'000);
+    for (int i = 0; i < 100; ++i) {
+        Key key = rng(mt);
+        if (i % 3 == 0) {
+            tree.Erase(key);
+        } else if (i % 3 == 1) {
+            tree.Insert(key);
+        } else {
+            tree.Contains(key);
+        }
+    }
+    EXPECT_EQ(streamed.GetNodes().root, nullptr);
+    for (int i = 0; i < 1000; ++i) {
+        tree.PumpSnapshots();
+    }
+    EXPECT_NE(streamed.GetNodes().root, nullptr);
+    EXPECT_LE(max_chunk_creates, kChunkSize);
+    streamed.ExpectSameAs(tree);
+    // After the snapshot is complete, observer is an ordinary one.
+    tree.Insert(-1);
+    streamed.ExpectSameAs(tree);
+}
+
+TEST(TreeStreaming, FollowsEveryKindOfChange) {
+    // Late streaming observers must keep up with whatever happens to the tree before their snapshots are complete:
+    // single keys, batches, compaction and splits with joins, which make them start over.
+    constexpr int kSeed = 28;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> key_rng(0, 3'000);
+    std::uniform_int_distribution<int> operation_rng(0, 7);
+    for (ssize_t chunk_size : {1, 7, 64}) {
+        TwoThreeTree tree;
+        tree.ApplyBatch(EBatchOperation::Insert, {{0, 2'000}});
+        tree.PublishBatchSummary();
+        TreeMirror replayed;
+        tree.SubscribeObserverStreaming(replayed.GetObserver(), chunk_size);
+        for (int i = 0; i < 500; ++i) {
+            auto key = key_rng(mt);
+            switch (operation_rng(mt)) {
+            case 0:
+                tree.Insert(key);
+                break;
+            case 1:
+                tree.Erase(key);
+                break;
+            case 2:
+                tree.Contains(key);
+                break;
+            case 3:
+                tree.CompactSlice(50);
+                break;
+            case 4:
+                tree.ApplyBatch(i % 2 == 0 ? EBatchOperation::Insert : EBatchOperation::Erase, {{key, key + 200}});
+                tree.PublishBatchSummary();
+                break;
+            case 5: {
+                TwoThreeTree right;
+                tree.Split(key, right);
+                tree.Join(right);
+                break;
+            }
+            default:
+                tree.PumpSnapshots();
+                break;
+            }
+            ASSERT_FALSE(testing::Test::HasFatalFailure()) << chunk_size << " " << i;
+        }
+        for (int i = 0; i < 10'000; ++i) {
+            tree.PumpSnapshots();
+        }
+        replayed.ExpectSameAs(tree);
+    }
+}
+
+TEST(TreeSplitJoin, SplitsAndJoinsBack) {
+    constexpr int kSeed = 36;
+    std::mt19937 mt(kSeed);
+    for (Key size : {0, 1, 2, 3, 4, 7, 30, 1'000}) {
+        std::vector<Key> keys;
+        for (Key key = 0; key < size; ++key) {
+            keys.emplace_back(key * 2);
+        }
+        for (Key split_key = -1; split_key <= size * 2 + 1; split_key += size < 30 ? 1 : 37) {
+            TwoThreeTree left;
+            auto shuffled = keys;
+            std::shuffle(shuffled.begin(), shuffled.end(), mt);
+            for (auto key : shuffled) {
+                left.Insert(key);
+            }
+            TwoThreeTree right;
+            left.Split(split_key, right);
+            auto middle = std::lower_bound(keys.begin(), keys.end(), split_key);
+            ASSERT_EQ(left.GetKeys(), std::vector<Key>(keys.begin(), middle)) << size << " " << split_key;
+            ASSERT_EQ(right.GetKeys(), std::vector<Key>(middle, keys.end())) << size << " " << split_key;
+
+            left.Join(right);
+            ASSERT_EQ(left.GetKeys(), keys) << size << " " << split_key;
+            EXPECT_TRUE(right.GetKeys().empty());
+            // The mirrored pair takes the lower keys off and puts them back.
+            TwoThreeTree lower;
+            left.SplitLeft(split_key, lower);
+            ASSERT_EQ(lower.GetKeys(), std::vector<Key>(keys.begin(), middle)) << size << " " << split_key;
+            ASSERT_EQ(left.GetKeys(), std::vector<Key>(middle, keys.end())) << size << " " << split_key;
+            left.JoinLeft(lower);
+            ASSERT_EQ(left.GetKeys(), keys) << size << " " << split_key;
+            EXPECT_TRUE(lower.GetKeys().empty());
+            // Both trees stay usable.
+            EXPECT_TRUE(left.Insert(-3));
+            EXPECT_TRUE(right.Insert(5));
+            EXPECT_EQ(left.Erase(split_key), split_key >= 0 && split_key % 2 == 0 && split_key < size * 2);
+        }
+    }
+}
+
+TEST(TreeSplitJoin, JoinsTreesOfDifferentHeights) {
+    for (Key left_size : {1, 2, 5, 500}) {
+        for (Key right_size : {1, 2, 5, 500}) {
+            TwoThreeTree left;
+            TwoThreeTree right;
+            std::vector<Key> expected;
+            for (Key key = 0; key < left_size; ++key) {
+                left.Insert(key);
+                expected.emplace_back(key);
+            }
+            for (Key key = 1'000; key < 1'000 + right_size; ++key) {
+                right.Insert(key);
+                expected.emplace_back(key);
+            }
+            left.Join(right);
+            ASSERT_EQ(left.GetKeys(), expected) << left_size << " " << right_size;
+            for (auto key : expected) {
+                ASSERT_TRUE(left.Erase(key));
+            }
+        }
+    }
+}
+
+TEST(TreeSplitJoin, ObserversFollowBothTrees) {
+    TreeMirror left_view;
+    TreeMirror right_view;
+    TwoThreeTree left;
+    TwoThreeTree right;
+    left.ApplyBatch(EBatchOperation::Insert, {{0, 3'000}});
+    left.SubscribeObserver(left_view.GetObserver());
+    right.SubscribeObserver(right_view.GetObserver());
+    for (Key split_key : {1'234, 1'000, 2'999, 17}) {
+        left.Split(split_key, right);
+        left_view.ExpectSameAs(left);
+        right_view.ExpectSameAs(right);
+        left.Join(right);
+        left_view.ExpectSameAs(left);
+        right_view.ExpectSameAs(right);
+        left.SplitLeft(split_key, right);
+        left_view.ExpectSameAs(left);
+        right_view.ExpectSameAs(right);
+        left.JoinLeft(right);
+        left_view.ExpectSameAs(left);
+        right_view.ExpectSameAs(right);
+    }
+
+    // Joining a small tree takes a few nodes of the spine, however large the other tree is.
+    right.Insert(5'000);
+    left_view.TakeTouchedCount();
+    left.Join(right);
+    EXPECT_LE(left_view.TakeTouchedCount(), 30);
+    left_view.ExpectSameAs(left);
+    left.Split(5'000, right);
+    EXPECT_LE(left_view.TakeTouchedCount(), 30);
+    left_view.ExpectSameAs(left);
+    right_view.ExpectSameAs(right);
+}
+
+TEST(TreeSetAlgebra, MatchesStdSets) {
+    constexpr int kSeed = 37;
+    std::mt19937 mt(kSeed);
+    auto random_keys = [&mt](ssize_t count, Key max_key) {
+        std::uniform_int_distribution<Key> rng(0, max_key);
+        std::set<Key> keys;
+        while (std::ssize(keys) < count) {
+            keys.insert(rng(mt));
+        }
+        return keys;
+    };
+    auto fill = [](TwoThreeTree& tree, const std::set<Key>& keys) {
+        std::vector<KeyRange> ranges;
+        for (auto key : keys) {
+            ranges.emplace_back(KeyRange{key, key});
+        }
+        tree.ApplyBatch(EBatchOperation::Insert, ranges);
+    };
+    for (auto [mine_size, others_size] : {std::pair<ssize_t, ssize_t>{0, 10}, {10, 0}, {1, 1}, {3, 50}, {50, 3},
+                                          {2'000, 40}, {40, 2'000}, {1'500, 1'500}}) {
+        for (ssize_t thread_count : {1, 4}) {
+            auto mine_keys = random_keys(mine_size, 20'000);
+            auto others_keys = random_keys(others_size, 20'000);
+            for (auto operation : {ESetOperation::Union, ESetOperation::Intersection, ESetOperation::Difference}) {
+                std::vector<Key> expected;
+                if (operation == ESetOperation::Union) {
+                    std::set_union(mine_keys.begin(), mine_keys.end(), others_keys.begin(), others_keys.end(),
+                                   std::back_inserter(expected));
+                } else if (operation == ESetOperation::Intersection) {
+                    std::set_intersection(mine_keys.begin(), mine_keys.end(), others_keys.begin(), others_keys.end(),
+                                          std::back_inserter(expected));
+                } else {
+                    std::set_difference(mine_keys.begin(), mine_keys.end(), others_keys.begin(), others_keys.end(),
+                                        std::back_inserter(expected));
+                }
+                TwoThreeTree mine;
+                TwoThreeTree others;
+                fill(mine, mine_keys);
+                fill(others, others_keys);
+                if (operation == ESetOperation::Union) {
+                    mine.Union(others, thread_count);
+                } else if (operation == ESetOperation::Intersection) {
+                    mine.Intersection(others, thread_count);
+                } else {
+                    mine.Difference(others, thread_count);
+                }
+                ASSERT_EQ(mine.GetKeys(), expected) << mine_size << " " << others_size << " " << thread_count;
+                EXPECT_TRUE(others.GetKeys().empty());
+            }
+        }
+    }
+}
+
+TEST(TreeSetAlgebra, ObserversFollowBothTrees) {
+    // Keys are inserted one by one: creates of a batch summary don't come children first, unlike the ones of single
+    // operations and set operations, which the replayed view checks.
+    auto insert = [](TwoThreeTree& tree, Key first, Key last) {
+        for (Key key = first; key <= last; ++key) {
+            tree.Insert(key);
+        }
+    };
+    TreeMirror mine_view;
+    TreeMirror others_view;
+    TwoThreeTree mine;
+    TwoThreeTree others;
+    mine.ApplyBatch(EBatchOperation::Insert, {{0, 3'000}});
+    mine.SubscribeObserver(mine_view.GetObserver());
+    others.SubscribeObserver(others_view.GetObserver());
+    insert(others, -100, 100);
+    insert(others, 1'000, 1'500);
+    insert(others, 2'990, 4'000);
+    mine.Union(others, 4);
+    mine_view.ExpectSameAs(mine);
+    others_view.ExpectSameAs(others);
+
+    insert(others, 500, 2'500);
+    mine.Difference(others, 4);
+    mine_view.ExpectSameAs(mine);
+    others_view.ExpectSameAs(others);
+
+    insert(others, 0, 300);
+    insert(others, 3'000, 3'100);
+    mine.Intersection(others, 4);
+    mine_view.ExpectSameAs(mine);
+    others_view.ExpectSameAs(others);
+    EXPECT_EQ(std::ssize(mine.GetKeys()), 301 + 101);
+}
+
+namespace {
+template <class Tree>
+void CheckAgainstStdSet() {
+    constexpr int kSeed = 38;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(0, 3'000);
+    Tree tree;
+    std::set<Key> expected;
+    for (int i = 0; i < 6'000; ++i) {
+        Key key = rng(mt);
+        switch (i % 3) {
+        case 0:
+            ASSERT_EQ(tree.Insert(key), expected.insert(key).second);
+            break;
+        case 1:
+            ASSERT_EQ(tree.Contains(key), expected.contains(key));
+            break;
+        default:
+            // Erase keys which are there, or the tree would only grow.
+            auto it = expected.lower_bound(key);
+            key = it == expected.end() ? key : *it;
+            ASSERT_EQ(tree.Erase(key), expected.erase(key) > 0);
+            break;
+        }
+    }
+    ASSERT_EQ(tree.GetKeys(), std::vector<Key>(expected.begin(), expected.end()));
+
+    Tree right;
+    tree.Split(1'500, right);
+    auto middle = expected.lower_bound(1'500);
+    EXPECT_EQ(tree.GetKeys(), std::vector<Key>(expected.begin(), middle));
+    EXPECT_EQ(right.GetKeys(), std::vector<Key>(middle, expected.end()));
+
+    Tree others;
+    for (Key key = 0; key <= 3'000; key += 7) {
+        others.Insert(key);
+        expected.insert(key);
+    }
+    tree.Join(right);
+    tree.Union(others, 4);
+    EXPECT_EQ(tree.GetKeys(), std::vector<Key>(expected.begin(), expected.end()));
+}
+} // namespace
+
+TEST(TreeFanout, WideNodes) {
+    CheckAgainstStdSet<BPlusTree<3, 5>>();
+    CheckAgainstStdSet<BPlusTree<4, 8>>();
+    CheckAgainstStdSet<BPlusTree<32, 64>>();
+
+    BPlusTree<32, 64> wide;
+    TwoThreeTree narrow;
+    for (Key key = 0; key < 2'000; ++key) {
+        wide.Insert(key);
+        narrow.Insert(key);
+    }
+    auto wide_stats = wide.MemoryStats();
+    // Leaves are at least half full, and there's only a couple of levels above them.
+    EXPECT_LE(wide_stats.leaf_count, 2'000 / 32);
+    EXPECT_LE(wide_stats.node_count - wide_stats.leaf_count, 3);
+    EXPECT_LT(wide_stats.node_count * 10, narrow.MemoryStats().node_count);
+}
+
+TEST(TreeFanout, PackedKeys) {
+    CheckAgainstStdSet<BPlusTree<2, 3, PackedKeys>>();
+    CheckAgainstStdSet<BPlusTree<32, 64, PackedKeys>>();
+
+    BPlusTree<32, 64, PackedKeys> packed;
+    BPlusTree<32, 64> plain;
+    packed.ApplyBatch(EBatchOperation::Insert, {{100'000, 120'000}});
+    plain.ApplyBatch(EBatchOperation::Insert, {{100'000, 120'000}});
+    EXPECT_EQ(packed.GetKeys(), plain.GetKeys());
+    auto packed_stats = packed.MemoryStats();
+    auto plain_stats = plain.MemoryStats();
+    EXPECT_EQ(packed_stats.key_count, 20'001);
+    // Dense keys take a byte or less instead of four.
+    EXPECT_LT(packed_stats.keys.used_bytes * 3, plain_stats.keys.used_bytes);
+    EXPECT_LT(packed_stats.BytesPerKey(), plain_stats.BytesPerKey());
+}
+
+namespace {
+template <class Map>
+void CheckAgainstStdMap() {
+    constexpr int kSeed = 40;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(0, 2'000);
+    Map map;
+    std::map<Key, std::string> expected;
+    for (int i = 0; i < 6'000; ++i) {
+        Key key = rng(mt);
+        auto value = std::to_string(i);
+        switch (i % 4) {
+        case 0:
+            ASSERT_EQ(map.TryEmplace(key, value), expected.try_emplace(key, value).second);
+            break;
+        case 1:
+            ASSERT_EQ(map.InsertOrAssign(key, value), expected.insert_or_assign(key, value).second);
+            break;
+        case 2: {
+            auto found = map.Find(key);
+            ASSERT_EQ(found != nullptr, expected.contains(key));
+            if (found != nullptr) {
+                ASSERT_EQ(*found, expected.at(key));
+            }
+            break;
+        }
+        default:
+            ASSERT_EQ(map.Erase(key), expected.erase(key) > 0);
+            break;
+        }
+    }
+    Map right;
+    map.Split(1'000, right);
+    map.Join(right);
+    ASSERT_EQ(std::ssize(map.GetKeys()), std::ssize(expected));
+    for (const auto& [key, value] : expected) {
+        ASSERT_NE(map.Find(key), nullptr);
+        EXPECT_EQ(*map.Find(key), value);
+    }
+}
+} // namespace
+
+TEST(TreeMap, MatchesStdMap) {
+    CheckAgainstStdMap<TwoThreeMap<std::string>>();
+    CheckAgainstStdMap<BPlusTree<4, 8, std::vector<Key>, std::string>>();
+    CheckAgainstStdMap<BPlusTree<4, 8, PackedKeys, std::string>>();
+}
+
+TEST(TreeMap, MovesValuesOnlyWhenInserting) {
+    TwoThreeMap<std::unique_ptr<int>> map;
+    auto value = std::make_unique<int>(1);
+    EXPECT_TRUE(map.TryEmplace(5, std::move(value)));
+    EXPECT_EQ(value, nullptr);
+    value = std::make_unique<int>(2);
+    EXPECT_FALSE(map.TryEmplace(5, std::move(value)));
+    ASSERT_NE(value, nullptr);
+    EXPECT_EQ(**map.Find(5), 1);
+    EXPECT_FALSE(map.InsertOrAssign(5, std::move(value)));
+    EXPECT_EQ(**map.Find(5), 2);
+    EXPECT_TRUE(map.Insert(7));
+    EXPECT_EQ(*map.Find(7), nullptr);
+    EXPECT_EQ(map.Find(6), nullptr);
+    const auto& const_map = map;
+    EXPECT_EQ(**const_map.Find(5), 2);
+}
+
+TEST(TreeMap, BuildsFromSortedItems) {
+    for (Key size : {0, 1, 2, 3, 4, 5, 10, 100, 1'000}) {
+        std::vector<std::pair<Key, std::string>> items;
+        for (Key key = 0; key < size; ++key) {
+            items.emplace_back(key * 3, std::to_string(key));
+        }
+        TwoThreeMap<std::string> map;
+        TreeMirror replayed;
+        map.SubscribeObserver(replayed.GetObserver());
+        map.Build(items);
+        replayed.ExpectSameAs(map);
+        ASSERT_EQ(std::ssize(map.GetKeys()), size);
+        for (const auto& [key, value] : items) {
+            ASSERT_NE(map.Find(key), nullptr) << size << " " << key;
+            EXPECT_EQ(*map.Find(key), value);
+        }
+        // The built tree is an ordinary one.
+        EXPECT_TRUE(map.InsertOrAssign(1, "one"));
+        EXPECT_EQ(map.Erase(0), size > 0);
+        EXPECT_EQ(*map.Find(1), "one");
+
+        BPlusTree<16, 32, std::vector<Key>, std::string> wide;
+        wide.Build(items);
+        EXPECT_EQ(std::ssize(wide.GetKeys()), size);
+        EXPECT_EQ(wide.MemoryStats().values.used_bytes, size * static_cast<ssize_t>(sizeof(std::string)));
+    }
+}
+
+TEST(TreeFrozen, FreezesAndThaws) {
+    constexpr int kSeed = 41;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(-10'000, 10'000);
+    TwoThreeTree tree;
+    for (int i = 0; i < 2'000; ++i) {
+        tree.Insert(rng(mt));
+    }
+    auto keys = tree.GetKeys();
+    auto frozen = Freeze(tree);
+    EXPECT_EQ(frozen.GetKeys(), keys);
+    for (Key x = -10'010; x <= 10'010; x += 3) {
+        EXPECT_EQ(frozen.Contains(x), tree.Contains(x)) << x;
+    }
+
+    TwoThreeTree thawed;
+    TreeMirror replayed;
+    thawed.SubscribeObserver(replayed.GetObserver());
+    Thaw(frozen, thawed);
+    replayed.ExpectSameAs(thawed);
+    EXPECT_EQ(thawed.GetKeys(), keys);
+    // The thawed tree changes as usual.
+    EXPECT_TRUE(thawed.Insert(20'000));
+    EXPECT_TRUE(thawed.Erase(keys.front()));
+    EXPECT_FALSE(thawed.Contains(keys.front()));
+
+    EXPECT_EQ(Freeze(TwoThreeTree()).Size(), 0);
+}
+
+TEST(TreeFinger, NearbyAccessesClimbLittle) {
+    if (!kMetricsEnabled) {
+        GTEST_SKIP() << "Metrics are compiled out";
+    }
+    constexpr Key kKeyCount = 2'000;
+    TwoThreeTree tree;
+    auto visits = [&tree]() { return tree.GetMetrics().Get(ETreeCounter::NodeVisits); };
+    for (Key key = 0; key < kKeyCount; ++key) {
+        EXPECT_TRUE(tree.Insert(key));
+    }
+    // A descent from the root would visit about 11 nodes, splits visit a node each and there's less than one per
+    // insert.
+    auto after_inserts = visits();
+    EXPECT_LT(after_inserts, 4 * kKeyCount);
+    for (Key key = 0; key < kKeyCount; ++key) {
+        EXPECT_TRUE(tree.Contains(key));
+    }
+    auto after_scan = visits();
+    EXPECT_LT(after_scan - after_inserts, 3 * kKeyCount);
+    for (Key key = kKeyCount - 1; key >= 0; key -= 2) {
+        EXPECT_TRUE(tree.Erase(key));
+    }
+    EXPECT_LT(visits() - after_scan, 3 * kKeyCount);
+}
+
+TEST(TreeFinger, HintsFollowStreams) {
+    constexpr Key kStreamLength = 1'000;
+    constexpr Key kSecondStream = 1'000'000;
+    TwoThreeTree tree;
+    std::set<Key> expected;
+    TreeMirror replayed;
+    tree.SubscribeObserver(replayed.GetObserver());
+    TwoThreeTree::Hint first;
+    TwoThreeTree::Hint second;
+    for (Key key = 0; key < kStreamLength; ++key) {
+        EXPECT_TRUE(tree.Insert(first, key));
+        EXPECT_TRUE(tree.Insert(second, kSecondStream + key));
+        EXPECT_FALSE(tree.Insert(first, key / 2));
+        expected.insert({key, kSecondStream + key});
+    }
+    replayed.ExpectSameAs(tree);
+    EXPECT_EQ(tree.GetKeys(), std::vector<Key>(expected.begin(), expected.end()));
+    for (Key key = 0; key < kStreamLength; key += 3) {
+        EXPECT_TRUE(tree.Contains(first, key));
+        EXPECT_FALSE(tree.Contains(second, kSecondStream - key - 1));
+        EXPECT_TRUE(tree.Erase(second, kSecondStream + key));
+        expected.erase(kSecondStream + key);
+    }
+    replayed.ExpectSameAs(tree);
+    EXPECT_EQ(tree.GetKeys(), std::vector<Key>(expected.begin(), expected.end()));
+
+    // Hints of another tree and the ones outdated by rebuilding are ignored.
+    TwoThreeTree other;
+    other.Insert(5);
+    auto foreign = other.GetHint();
+    EXPECT_TRUE(tree.Contains(foreign, 0));
+    auto outdated = tree.GetHint();
+    TwoThreeTree right;
+    tree.Split(kSecondStream, right);
+    EXPECT_FALSE(tree.Contains(outdated, kSecondStream + 1));
+    EXPECT_TRUE(right.Contains(outdated, kSecondStream + 1));
+    tree.Join(right);
+    EXPECT_TRUE(tree.Erase(outdated, kSecondStream + 1));
+}
+
+namespace {
+//! Types of actions of every batch, to compare batches of different trees.
+std::vector<std::vector<ENodeAction>> ActionTypes(const std::vector<TreeActionsBatch>& batches) {
+    std::vector<std::vector<ENodeAction>> types;
+    for (const auto& actions : batches) {
+        auto& batch_types = types.emplace_back();
+        for (const auto& action : actions) {
+            batch_types.emplace_back(action.action_type);
+        }
+    }
+    return types;
+}
+} // namespace
+
+TEST(TreeSteps, MatchesPlainOperations) {
+    constexpr int kSeed = 44;
+    constexpr ssize_t kQueryCount = 2'000;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> key_rng(0, 300);
+    std::uniform_int_distribution<int> type_rng(0, 2);
+    TwoThreeTree plain;
+    TwoThreeTree stepwise;
+    std::vector<TreeActionsBatch> plain_batches;
+    std::vector<TreeActionsBatch> notified_batches;
+    Observer<TreeActionsBatch> plain_observer(
+        [](const TreeActionsBatch&) {}, [&plain_batches](const TreeActionsBatch& actions) {
+            plain_batches.emplace_back(actions);
+        }, []() {});
+    Observer<TreeActionsBatch> stepwise_observer(
+        [](const TreeActionsBatch&) {}, [&notified_batches](const TreeActionsBatch& actions) {
+            notified_batches.emplace_back(actions);
+        }, []() {});
+    TreeMirror replayed;
+    plain.SubscribeObserver(&plain_observer);
+    stepwise.SubscribeObserver(&stepwise_observer);
+    stepwise.SubscribeObserver(replayed.GetObserver());
+    for (ssize_t query = 0; query < kQueryCount; ++query) {
+        auto key = key_rng(mt);
+        auto type = static_cast<QueryType>(type_rng(mt));
+        plain_batches.clear();
+        notified_batches.clear();
+        auto steps = type == QueryType::Insert  ? stepwise.InsertSteps(key)
+                     : type == QueryType::Erase ? stepwise.EraseSteps(key)
+                                                : stepwise.ContainsSteps(key);
+        // Nothing happens until a step is asked for.
+        EXPECT_TRUE(notified_batches.empty());
+        std::vector<TreeActionsBatch> steps_batches;
+        while (steps.Next()) {
+            steps_batches.emplace_back(steps.Current());
+            // A step is notified as soon as it's made.
+            ASSERT_EQ(notified_batches.size(), steps_batches.size());
+        }
+        switch (type) {
+        case QueryType::Insert:
+            plain.Insert(key);
+            break;
+        case QueryType::Erase:
+            plain.Erase(key);
+            break;
+        case QueryType::Check:
+            plain.Contains(key);
+            break;
+        }
+        EXPECT_EQ(ActionTypes(steps_batches), ActionTypes(notified_batches));
+        EXPECT_EQ(ActionTypes(steps_batches), ActionTypes(plain_batches));
+    }
+    EXPECT_EQ(stepwise.GetKeys(), plain.GetKeys());
+    replayed.ExpectSameAs(stepwise);
+}
+
+TEST(TreeSteps, OtherOperationsFinishSteps) {
+    TwoThreeTree tree;
+    TreeMirror replayed;
+    tree.SubscribeObserver(replayed.GetObserver());
+    for (Key key = 0; key < 100; ++key) {
+        tree.Insert(key);
+    }
+    auto insert = tree.InsertSteps(1'000);
+    ASSERT_TRUE(insert.Next());
+    ASSERT_TRUE(insert.Next());
+    EXPECT_EQ(insert.Current().front().action_type, ENodeAction::Visit);
+    EXPECT_TRUE(tree.Contains(1'000));
+    EXPECT_TRUE(insert.IsDone());
+    EXPECT_FALSE(insert.Next());
+
+    // Dropping steps finishes the operation, even if it hasn't started.
+    {
+        auto erase = tree.EraseSteps(1'000);
+        ASSERT_TRUE(erase.Next());
+    }
+    EXPECT_FALSE(tree.Contains(1'000));
+    // Unless it hasn't started, then it's dropped.
+    {
+        auto erase = tree.EraseSteps(5);
+    }
+    EXPECT_TRUE(tree.Contains(5));
+    // A new stepwise operation finishes the previous one too, once it's made.
+    auto first = tree.EraseSteps(6);
+    ASSERT_TRUE(first.Next());
+    auto second = tree.ContainsSteps(6);
+    EXPECT_TRUE(first.IsDone());
+    ASSERT_TRUE(second.Next());
+    second.Finish();
+    // Steps which haven't started yet are finished by other operations too.
+    auto third = tree.EraseSteps(7);
+    EXPECT_FALSE(tree.Contains(7));
+    EXPECT_TRUE(third.IsDone());
+    EXPECT_EQ(std::ssize(tree.GetKeys()), 98);
+    replayed.ExpectSameAs(tree);
+}
+
+TEST(TreeSteps, OutliveTree) {
+    auto tree = std::make_unique<TwoThreeTree>();
+    for (Key key = 0; key < 10; ++key) {
+        tree->Insert(key);
+    }
+    auto unstarted = tree->InsertSteps(10);
+    tree.reset();
+    EXPECT_TRUE(unstarted.IsDone());
+    EXPECT_FALSE(unstarted.Next());
+
+    tree = std::make_unique<TwoThreeTree>();
+    for (Key key = 0; key < 10; ++key) {
+        tree->Insert(key);
+    }
+    auto started = tree->EraseSteps(5);
+    ASSERT_TRUE(started.Next());
+    tree.reset();
+    EXPECT_TRUE(started.IsDone());
+}
+
+TEST(TreeMembershipFilter, MatchesStdSet) {
+    constexpr int kSeed = 42;
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(0, 4'000);
+    TwoThreeTree tree;
+    EXPECT_FALSE(tree.GetMembershipFilterStats());
+    tree.EnableMembershipFilter();
+    std::set<Key> expected;
+    for (int i = 0; i < 20'000; ++i) {
+        auto key = rng(mt);
+        switch (i % 3) {
+        case 0:
+            EXPECT_EQ(tree.Insert(key), expected.insert(key).second);
+            break;
+        case 1:
+            // Erasing much makes the filter get rebuilt.
+            EXPECT_EQ(tree.Erase(key), expected.erase(key) > 0);
+            break;
+        default:
+            ASSERT_EQ(tree.Contains(key), expected.contains(key)) << i;
+            break;
+        }
+    }
+    auto stats = tree.GetMembershipFilterStats();
+    ASSERT_TRUE(stats);
+    EXPECT_EQ(stats->query_count, 20'000 / 3);
+    EXPECT_GT(stats->rejected_count, 0);
+    EXPECT_GT(stats->rebuild_count, 1);
+    EXPECT_EQ(tree.MemoryStats().membership_filter.used_bytes, stats->memory.used_bytes);
+
+    // Keys coming from another tree get to the filter too.
+    TwoThreeTree right;
+    right.EnableMembershipFilter();
+    tree.Split(2'000, right);
+    for (Key key = 0; key <= 4'000; ++key) {
+        EXPECT_EQ(tree.Contains(key) || right.Contains(key), expected.contains(key)) << key;
+    }
+    tree.Join(right);
+    for (Key key = 0; key <= 4'000; ++key) {
+        EXPECT_EQ(tree.Contains(key), expected.contains(key)) << key;
+    }
+    tree.DisableMembershipFilter();
+    EXPECT_EQ(tree.MemoryStats().membership_filter.allocation_count, 0);
+}
+
+TEST(TreeMembershipFilter, ForgetsKeysSplitAway) {
+    TwoThreeTree tree;
+    for (Key key = 0; key < 1'000; ++key) {
+        tree.Insert(key);
+    }
+    tree.EnableMembershipFilter();
+    TwoThreeTree right;
+    tree.Split(900, right);
+    // A tenth of the keys has left, which isn't enough for a rebuild yet.
+    EXPECT_EQ(tree.GetMembershipFilterStats()->stale_count, 100);
+    TwoThreeTree rest;
+    tree.Split(400, rest);
+    EXPECT_EQ(tree.GetMembershipFilterStats()->stale_count, 0);
+    EXPECT_EQ(tree.GetMembershipFilterStats()->key_count, 400);
+    EXPECT_FALSE(tree.Contains(400));
+    EXPECT_TRUE(tree.Contains(399));
+}
+
+TEST(TreeMembershipFilter, MissesSkipDescent) {
+    if (!kMetricsEnabled) {
+        GTEST_SKIP() << "Metrics are compiled out";
+    }
+    TwoThreeTree tree;
+    for (Key key = 0; key < 1'000; ++key) {
+        tree.Insert(key * 2);
+    }
+    tree.EnableMembershipFilter();
+    // The last access has been at the other end of the tree, so this one descends from the root. Others climb from
+    // the leaf of the previous one, which takes no more visits.
+    auto before = tree.GetMetrics().Get(ETreeCounter::NodeVisits);
+    EXPECT_TRUE(tree.Contains(0));
+    auto descent_visits = tree.GetMetrics().Get(ETreeCounter::NodeVisits) - before;
+    before += descent_visits;
+    for (Key key = 0; key < 1'000; ++key) {
+        EXPECT_FALSE(tree.Contains(key * 2 + 1));
+    }
+    auto stats = tree.GetMembershipFilterStats();
+    // Only the rare false positives descend.
+    EXPECT_LE(tree.GetMetrics().Get(ETreeCounter::NodeVisits) - before,
+              stats->false_positive_count * descent_visits);
+    EXPECT_EQ(stats->rejected_count + stats->false_positive_count, 1'000);
+    EXPECT_LT(stats->FalsePositiveRate(), 0.05);
+}
+
+TEST(TreeMetrics, CountsStructuralChanges) {
+    if (!kMetricsEnabled) {
+        GTEST_SKIP() << "Metrics are compiled out";
+    }
+    TwoThreeTree tree;
+    for (Key key = 1; key <= 1000; ++key) {
+        tree.Insert(key);
+    }
+    auto after_inserts = tree.GetMetrics();
+    EXPECT_GT(after_inserts.Get(ETreeCounter::Splits), 0);
+    // First root, then one more for every level grown by a split of the root.
+    EXPECT_GE(after_inserts.Get(ETreeCounter::RootChanges), 6);
+    EXPECT_EQ(after_inserts.Get(ETreeCounter::Merges), 0);
+    EXPECT_GT(after_inserts.Get(ETreeCounter::NodeVisits), 1000);
+    EXPECT_GT(after_inserts.Get(ETreeCounter::NotifiedBytes), after_inserts.Get(ETreeCounter::NotifiedActions));
+    EXPECT_EQ(after_inserts.GetLatency(ETreeOperation::Insert).Count(), 1000);
+
+    for (Key key = 1; key <= 1000; ++key) {
+        EXPECT_TRUE(tree.Contains(key));
+        tree.Erase(key);
+    }
+    auto after_erases = tree.GetMetrics();
+    EXPECT_GT(after_erases.Get(ETreeCounter::Merges) + after_erases.Get(ETreeCounter::Borrows), 0);
+    // Every level is gone, the last one with the last key.
+    EXPECT_GE(after_erases.Get(ETreeCounter::RootChanges), 2 * after_inserts.Get(ETreeCounter::RootChanges));
+    EXPECT_EQ(after_erases.GetLatency(ETreeOperation::Contains).Count(), 1000);
+    EXPECT_EQ(after_erases.GetLatency(ETreeOperation::Erase).Count(), 1000);
+}
+
+TEST(TreeMemory, AccountsNodesAndKeys) {
+    TwoThreeTree tree;
+    auto empty = tree.MemoryStats();
+    EXPECT_EQ(empty.node_count, 0);
+    EXPECT_EQ(empty.TotalBytes(), 0);
+    EXPECT_EQ(empty.BytesPerKey(), 0.0);
+
+    for (Key key = 1; key <= 1000; ++key) {
+        tree.Insert(key);
+    }
+    auto stats = tree.MemoryStats();
+    EXPECT_EQ(stats.key_count, 1000);
+    EXPECT_GE(stats.leaf_count, 1000 / 3);
+    EXPECT_LE(stats.leaf_count, 1000 / 2);
+    EXPECT_GT(stats.node_count, stats.leaf_count);
+    // Every node owns its keys, and every node but the root is owned by a parent.
+    EXPECT_EQ(stats.children.used_bytes, (stats.node_count - 1) * static_cast<ssize_t>(sizeof(void*)));
+    EXPECT_GE(stats.keys.used_bytes, (stats.key_count + stats.node_count - stats.leaf_count) * sizeof(Key));
+    EXPECT_GE(stats.keys.slack_bytes, 0);
+    EXPECT_GE(stats.AllocationCount(), 2 * stats.node_count);
+    EXPECT_GT(stats.BytesPerKey(), static_cast<double>(sizeof(Key)));
+}
+
+namespace {
+void Churn(TwoThreeTree& tree, std::set<Key>& keys, std::mt19937& mt, ssize_t operation_count) {
+    std::uniform_int_distribution<Key> key_rng(0, 2'000);
+    std::bernoulli_distribution erase_rng(0.4);
+    for (ssize_t operation = 0; operation < operation_count; ++operation) {
+        auto key = key_rng(mt);
+        if (erase_rng(mt)) {
+            tree.Erase(key);
+            keys.erase(key);
+        } else {
+            tree.Insert(key);
+            keys.insert(key);
+        }
+    }
+}
+} // namespace
+
+TEST(TreeCompaction, LaysNodesOutInPreOrder) {
+    static constexpr int kSeed = 48;
+    std::mt19937 mt(kSeed);
+    TwoThreeTree tree;
+    std::set<Key> keys;
+    Churn(tree, keys, mt, 5'000);
+    tree.Compact();
+    auto expected = std::vector<Key>(keys.begin(), keys.end());
+    EXPECT_EQ(tree.GetKeys(), expected);
+    for (Key key = -10; key <= 2'010; ++key) {
+        ASSERT_EQ(tree.Contains(key), keys.contains(key)) << key;
+    }
+
+    // The tree fits one slice, so it's in one slab, where every node goes before its children and children go in
+    // order.
+    auto [root, nodes] = TakeSnapshot(tree);
+    ASSERT_LT(std::ssize(nodes), 4096);
+    EXPECT_EQ(root, nodes.begin()->first);
+    for (const auto& [address, info] : nodes) {
+        auto previous = address;
+        for (auto child : info.children) {
+            EXPECT_TRUE(std::less<>()(previous, child));
+            previous = child;
+        }
+    }
+    EXPECT_EQ(tree.MemoryStats().slab_node_count, std::ssize(nodes));
+
+    // Another pass relocates the nodes once more, keys stay where they were.
+    tree.Insert(3'000);
+    tree.Compact();
+    keys.insert(3'000);
+    expected.assign(keys.begin(), keys.end());
+    EXPECT_EQ(tree.GetKeys(), expected);
+}
+
+TEST(TreeCompaction, SlicesInterleaveWithWrites) {
+    static constexpr int kSeed = 148;
+    std::mt19937 mt(kSeed);
+    TwoThreeTree tree;
+    std::set<Key> keys;
+    Churn(tree, keys, mt, 2'000);
+    TreeMirror replayed;
+    tree.SubscribeObserver(replayed.GetObserver());
+
+    ssize_t node_count = tree.MemoryStats().node_count;
+    ssize_t slice_count = 0;
+    while (true) {
+        replayed.TakeTouchedCount();
+        auto is_over = tree.CompactSlice(7);
+        // A node is created and deleted, and its parent is changed unless it's the root.
+        EXPECT_LE(replayed.TakeTouchedCount(), 7 * 3);
+        replayed.ExpectSameAs(tree);
+        ++slice_count;
+        if (is_over) {
+            break;
+        }
+        Churn(tree, keys, mt, 3);
+        ASSERT_LT(slice_count, node_count) << "Compaction pass doesn't end";
+    }
+    EXPECT_GT(slice_count, 1);
+    auto expected = std::vector<Key>(keys.begin(), keys.end());
+    EXPECT_EQ(tree.GetKeys(), expected);
+    Churn(tree, keys, mt, 500);
+    replayed.ExpectSameAs(tree);
+    expected.assign(keys.begin(), keys.end());
+    EXPECT_EQ(tree.GetKeys(), expected);
+}
+
+TEST(TreeCompaction, KeepsValuesOfMaps) {
+    TwoThreeMap<std::string> map;
+    for (Key key = 0; key < 300; ++key) {
+        map.InsertOrAssign(key, std::to_string(key));
+    }
+    for (Key key = 0; key < 300; key += 3) {
+        map.Erase(key);
+    }
+    map.Compact();
+    for (Key key = 0; key < 300; ++key) {
+        auto value = map.Find(key);
+        ASSERT_EQ(value != nullptr, key % 3 != 0) << key;
+        if (value != nullptr) {
+            EXPECT_EQ(*value, std::to_string(key));
+        }
+    }
+}
+
+TEST(TreeCompaction, FreesSlabsWithTheirNodes) {
+    auto slab_count = NodeSlabs::Instance().GetSlabCount();
+    {
+        TwoThreeTree tree;
+        for (Key key = 0; key < 1'000; ++key) {
+            tree.Insert(key);
+        }
+        auto scattered = tree.MemoryStats();
+        while (!tree.CompactSlice(100)) {
+        }
+        auto compacted = tree.MemoryStats();
+        EXPECT_EQ(compacted.slab_node_count, compacted.node_count);
+        // Buffers of nodes go into the slabs along with them.
+        EXPECT_GT(scattered.AllocationCount(), 2 * scattered.node_count);
+        EXPECT_EQ(compacted.AllocationCount(), compacted.slab_count + compacted.buffers.allocation_count);
+        EXPECT_GT(NodeSlabs::Instance().GetSlabCount(), slab_count);
+
+        // Slabs go away once all of their nodes are merged away.
+        for (Key key = 0; key < 1'000; ++key) {
+            tree.Erase(key);
+        }
+        EXPECT_EQ(NodeSlabs::Instance().GetSlabCount(), slab_count);
+        for (Key key = 0; key < 1'000; ++key) {
+            tree.Insert(key);
+        }
+        tree.Compact();
+        EXPECT_GT(NodeSlabs::Instance().GetSlabCount(), slab_count);
+    }
+    EXPECT_EQ(NodeSlabs::Instance().GetSlabCount(), slab_count);
+
+    // A slab takes only as much as the nodes left to relocate need.
+    auto slab_bytes = NodeSlabs::Instance().GetSlabBytes();
+    TwoThreeTree small;
+    for (Key key = 0; key < 10; ++key) {
+        small.Insert(key);
+    }
+    EXPECT_TRUE(small.CompactSlice(4'096));
+    auto compacted = small.MemoryStats();
+    EXPECT_EQ(compacted.slab_count, 1);
+    EXPECT_EQ(NodeSlabs::Instance().GetSlabBytes() - slab_bytes, compacted.slab_bytes);
+    EXPECT_EQ(compacted.slab_live_bytes,
+              compacted.node_bytes + compacted.keys.used_bytes + compacted.children.used_bytes);
+    // Only the header and rounding of objects up to the alignment aren't taken.
+    EXPECT_LT(compacted.DeadSlabBytes(),
+              static_cast<ssize_t>(sizeof(NodeSlabs::Slab)) + 3 * compacted.node_count * NodeSlabs::kAlignment);
+}
+
+TEST(TreeCompaction, ReportsSlabsPinnedBySurvivors) {
+    TwoThreeMap<std::string> map;
+    for (Key key = 0; key < 1'000; ++key) {
+        map.InsertOrAssign(key, std::to_string(key));
+    }
+    map.Compact();
+    EXPECT_EQ(map.MemoryStats().values.allocation_count, 0);
+
+    // Growing buffers leave the slab for the heap, and shrinking nodes free their places in it.
+    for (Key key = 1'000; key < 1'100; ++key) {
+        map.InsertOrAssign(key, std::to_string(key));
+    }
+    for (Key key = 0; key < 1'000; ++key) {
+        if (key % 100 != 0) {
+            map.Erase(key);
+        }
+    }
+    auto pinned = map.MemoryStats();
+    EXPECT_GT(pinned.slab_count, 0);
+    EXPECT_GT(pinned.DeadSlabBytes(), 4 * pinned.slab_live_bytes);
+    EXPECT_GT(pinned.TotalBytes(), pinned.slab_bytes);
+    for (Key key = 0; key < 1'100; ++key) {
+        auto value = map.Find(key);
+        ASSERT_EQ(value != nullptr, key >= 1'000 || key % 100 == 0) << key;
+        if (value != nullptr) {
+            EXPECT_EQ(*value, std::to_string(key));
+        }
+    }
+
+    // Compacting the survivors lets the old slabs go.
+    auto slab_bytes = NodeSlabs::Instance().GetSlabBytes();
+    map.Compact();
+    auto compacted = map.MemoryStats();
+    EXPECT_LT(compacted.DeadSlabBytes(), pinned.DeadSlabBytes());
+    EXPECT_LT(NodeSlabs::Instance().GetSlabBytes(), slab_bytes);
+
+    // Packed keys take their words from slabs as well.
+    BPlusTree<3, 6, PackedKeys> packed;
+    for (Key key = 0; key < 600; ++key) {
+        packed.Insert(key);
+    }
+    packed.Compact();
+    EXPECT_EQ(packed.MemoryStats().keys.allocation_count, 0);
+    for (Key key = 0; key < 600; key += 2) {
+        packed.Erase(key);
+    }
+    EXPECT_FALSE(packed.Audit().has_value());
+    for (Key key = 0; key < 600; ++key) {
+        ASSERT_EQ(packed.Contains(key), key % 2 == 1) << key;
+    }
+}
+
+TEST(TreeValidation, AuditsValidTrees) {
+    static constexpr int kSeed = 49;
+    for (auto level : {EValidationLevel::Off, EValidationLevel::Sampled, EValidationLevel::Full}) {
+        std::mt19937 mt(kSeed);
+        TwoThreeTree tree;
+        tree.SetValidationLevel(level, 7);
+        std::set<Key> keys;
+        Churn(tree, keys, mt, 2'000);
+        EXPECT_FALSE(tree.Audit().has_value());
+        TwoThreeTree right;
+        tree.Split(1'000, right);
+        tree.Join(right);
+        tree.Compact();
+        EXPECT_FALSE(tree.Audit().has_value());
+    }
+
+    BPlusTree<3, 6, PackedKeys> wide;
+    for (Key key = 0; key < 3'000; key += 2) {
+        wide.Insert(key);
+    }
+    for (Key key = 0; key < 3'000; key += 3) {
+        wide.Erase(key);
+    }
+    EXPECT_FALSE(wide.Audit().has_value());
+}
+
+namespace {
+//! Writes a 2-3 tree file of `nodes` as they are, children before parents, without checking them.
+std::optional<TreeViolation> AuditFile(const std::vector<FlatNode>& nodes) {
+    auto path = (std::filesystem::temp_directory_path() / "nvis_tree_validation_ut.bin").string();
+    FlatTreeWriter writer(path);
+    for (const auto& node : nodes) {
+        writer.Append(node);
+    }
+    EXPECT_TRUE(writer.Finish(0));
+    TwoThreeTree tree;
+    EXPECT_TRUE(tree.MapFile(path));
+    // The tree is still mapped, and converting it to nodes mustn't trip over what's broken before it's reported.
+    auto violation = tree.Audit();
+    std::filesystem::remove(path);
+    return violation;
+}
+
+FlatNode MakeLeaf(std::vector<Key> keys) {
+    FlatNode node{.key_count = static_cast<uint32_t>(keys.size()), .child_count = 0, .keys = {}, .children = {}};
+    std::copy(keys.begin(), keys.end(), node.keys.begin());
+    return node;
+}
+
+FlatNode MakeInternal(std::vector<Key> keys, std::vector<uint32_t> children) {
+    auto node = MakeLeaf(keys);
+    node.child_count = static_cast<uint32_t>(children.size());
+    std::copy(children.begin(), children.end(), node.children.begin());
+    return node;
+}
+} // namespace
+
+TEST(TreeValidation, ReportsBrokenInvariant) {
+    EXPECT_FALSE(AuditFile({MakeLeaf({1, 2}), MakeLeaf({3, 4}), MakeInternal({2, 4}, {0, 1})}).has_value());
+
+    auto separator = AuditFile({MakeLeaf({1, 2}), MakeLeaf({3, 4}), MakeInternal({2, 5}, {0, 1})});
+    ASSERT_TRUE(separator.has_value());
+    EXPECT_EQ(separator->invariant, ETreeInvariant::Separator);
+    EXPECT_EQ(separator->depth, 0);
+    std::ostringstream report;
+    report << *separator;
+    EXPECT_NE(report.str().find("separator"), std::string::npos) << report.str();
+
+    auto order = AuditFile({MakeLeaf({1, 5}), MakeLeaf({3, 6}), MakeInternal({5, 6}, {0, 1})});
+    ASSERT_TRUE(order.has_value());
+    EXPECT_EQ(order->invariant, ETreeInvariant::KeyOrder);
+    EXPECT_EQ(order->depth, 1);
+
+    auto fanout = AuditFile({MakeLeaf({1}), MakeLeaf({2, 3}), MakeInternal({1, 3}, {0, 1})});
+    ASSERT_TRUE(fanout.has_value());
+    EXPECT_EQ(fanout->invariant, ETreeInvariant::Fanout);
+
+    auto depth = AuditFile({MakeLeaf({1, 2}), MakeLeaf({3, 4}), MakeLeaf({5, 6}), MakeInternal({4, 6}, {1, 2}),
+                            MakeInternal({2, 6}, {0, 3})});
+    ASSERT_TRUE(depth.has_value());
+    EXPECT_EQ(depth->invariant, ETreeInvariant::LeafDepth);
+    EXPECT_EQ(depth->depth, 2);
+}
+
+TEST(TreeFile, MapsAndMaterializesLazily) {
+    static constexpr int kSeed = 34;
+    auto path = (std::filesystem::temp_directory_path() / "nvis_tree_file_ut.bin").string();
+
+    std::mt19937 mt(kSeed);
+    std::uniform_int_distribution<Key> rng(-5'000, 5'000);
+    std::set<Key> keys;
+    TwoThreeTree source;
+    for (int i = 0; i < 3'000; ++i) {
+        Key key = rng(mt);
+        keys.insert(key);
+        source.Insert(key);
+    }
+    ASSERT_TRUE(source.SaveToFile(path));
+
+    TwoThreeTree mapped;
+    ASSERT_TRUE(mapped.MapFile(path));
+    auto stats = mapped.MemoryStats();
+    EXPECT_EQ(stats.node_count, 0);
+    EXPECT_EQ(stats.key_count, std::ssize(keys));
+    EXPECT_EQ(stats.mapped_bytes, static_cast<ssize_t>(std::filesystem::file_size(path)));
+    for (Key key = -5'100; key <= 5'100; ++key) {
+        ASSERT_EQ(mapped.Contains(key), keys.contains(key)) << key;
+    }
+
+    // The first write converts the file to nodes.
+    EXPECT_TRUE(mapped.Insert(100'000));
+    keys.insert(100'000);
+    stats = mapped.MemoryStats();
+    EXPECT_EQ(stats.mapped_bytes, 0);
+    EXPECT_EQ(stats.key_count, std::ssize(keys));
+    EXPECT_GE(stats.node_count, source.MemoryStats().node_count);
+    for (Key key = -5'100; key <= 5'100; ++key) {
+        ASSERT_EQ(mapped.Contains(key), keys.contains(key)) << key;
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(TreeFile, ObserversSeeMappedTree) {
+    auto path = (std::filesystem::temp_directory_path() / "nvis_tree_file_observers_ut.bin").string();
+    TwoThreeTree source;
+    for (Key key = 1; key <= 100; ++key) {
+        source.Insert(key);
+    }
+    ASSERT_TRUE(source.SaveToFile(path));
+
+    TreeMirror mirror;
+    TwoThreeTree mapped;
+    mapped.SubscribeObserver(mirror.GetObserver());
+    ASSERT_TRUE(mapped.MapFile(path));
+    EXPECT_NE(mirror.GetNodes().root, nullptr);
+    EXPECT_EQ(std::ssize(mirror.GetNodes().nodes), source.MemoryStats().node_count);
+    EXPECT_EQ(mirror.GetNodes().GetLeafKeys(), source.GetKeys());
+    // Snapshots are served from the file, which stays mapped until the first write.
+    TreeMirror late_mirror;
+    mapped.SubscribeObserver(late_mirror.GetObserver());
+    EXPECT_EQ(late_mirror.GetNodes(), mirror.GetNodes());
+    TreeMirror stream_mirror;
+    mapped.SubscribeObserverStreaming(stream_mirror.GetObserver(), 7);
+    mapped.PumpSnapshots();
+    EXPECT_EQ(mapped.MemoryStats().node_count, 0);
+
+    // Converting replaces every node for observers, whether they have got the whole snapshot or a part of it.
+    ASSERT_TRUE(mapped.Insert(1'000));
+    EXPECT_GT(mapped.MemoryStats().node_count, 0);
+    mirror.ExpectSameAs(mapped);
+    late_mirror.ExpectSameAs(mapped);
+    while (stream_mirror.GetNodes().root == nullptr) {
+        mapped.PumpSnapshots();
+    }
+    stream_mirror.ExpectSameAs(mapped);
+    std::filesystem::remove(path);
+}
+
+TEST(TreeFile, RejectsForeignFiles) {
+    auto path = (std::filesystem::temp_directory_path() / "nvis_tree_file_foreign_ut.bin").string();
+    std::ofstream(path) << "definitely not a tree, but long enough to have a header";
+    TwoThreeTree tree;
+    EXPECT_FALSE(tree.MapFile(path));
+    EXPECT_FALSE(tree.MapFile(path + ".missing"));
+
+    TwoThreeTree empty;
+    ASSERT_TRUE(empty.SaveToFile(path));
+    EXPECT_TRUE(tree.MapFile(path));
+    EXPECT_FALSE(tree.Contains(1));
+    EXPECT_TRUE(tree.Insert(1));
+    std::filesystem::remove(path);
+}
+
+TEST(TreeFile, RejectsMalformedNodes) {
+    auto path = (std::filesystem::temp_directory_path() / "nvis_tree_file_malformed_ut.bin").string();
+    auto maps = [&path](const std::vector<FlatNode>& nodes) {
+        FlatTreeWriter writer(path);
+        for (const auto& node : nodes) {
+            writer.Append(node);
+        }
+        EXPECT_TRUE(writer.Finish(0));
+        TwoThreeTree tree;
+        return tree.MapFile(path, EFlatTreeCheck::Full);
+    };
+    EXPECT_TRUE(maps({MakeLeaf({1, 2}), MakeLeaf({3, 4}), MakeInternal({2, 4}, {0, 1})}));
+    // A child after its parent, or the parent itself.
+    EXPECT_FALSE(maps({MakeLeaf({1, 2}), MakeInternal({2, 4}, {0, 2}), MakeLeaf({3, 4})}));
+    EXPECT_FALSE(maps({MakeLeaf({1, 2}), MakeInternal({2, 4}, {0, 1})}));
+    // A child far out of the file.
+    EXPECT_FALSE(maps({MakeLeaf({1, 2}), MakeInternal({2, 4}, {0, 1'000'000})}));
+    // A child shared by two parents.
+    EXPECT_FALSE(maps({MakeLeaf({1, 2}), MakeInternal({1, 2}, {0, 0})}));
+    EXPECT_FALSE(maps({MakeLeaf({1, 2}), MakeLeaf({3, 4}), MakeInternal({2, 4}, {0, 1}), MakeInternal({2, 4}, {0, 1}),
+                       MakeInternal({4, 5}, {2, 3})}));
+    // A node which isn't the root without a parent.
+    EXPECT_FALSE(maps({MakeLeaf({1, 2}), MakeLeaf({3, 4}), MakeLeaf({5, 6}), MakeInternal({2, 4}, {0, 1})}));
+    // Too many or too few keys, or children not matching keys.
+    auto oversized = MakeLeaf({1, 2, 3});
+    oversized.key_count = 4;
+    EXPECT_FALSE(maps({oversized}));
+    EXPECT_FALSE(maps({MakeLeaf({})}));
+    auto childless = MakeInternal({2, 4}, {0, 1});
+    childless.child_count = 1;
+    EXPECT_FALSE(maps({MakeLeaf({1, 2}), MakeLeaf({3, 4}), childless}));
+    // Unsorted or repeated keys.
+    EXPECT_FALSE(maps({MakeLeaf({2, 1})}));
+    EXPECT_FALSE(maps({MakeLeaf({1, 1})}));
+
+    // Checked lazily, a malformed file is mapped, and descents only trust the nodes they have checked on their way.
+    {
+        FlatTreeWriter writer(path);
+        writer.Append(MakeLeaf({1, 2}));
+        writer.Append(MakeLeaf({3, 4}));
+        writer.Append(oversized);
+        writer.Append(MakeInternal({2, 4, 6}, {0, 1, 2}));
+        ASSERT_TRUE(writer.Finish(0));
+    }
+    TwoThreeTree lazy;
+    ASSERT_TRUE(lazy.MapFile(path));
+    EXPECT_TRUE(lazy.Contains(1));
+    EXPECT_TRUE(lazy.Contains(4));
+    EXPECT_FALSE(lazy.Contains(5));
+    // Whatever reads the whole file lets it go.
+    EXPECT_TRUE(lazy.GetKeys().empty());
+    EXPECT_TRUE(lazy.Insert(5));
+    EXPECT_EQ(lazy.GetKeys(), std::vector<Key>{5});
+    EXPECT_FALSE(lazy.Audit().has_value());
+    TreeMirror mirror;
+    TwoThreeTree observed;
+    observed.SubscribeObserver(mirror.GetObserver());
+    EXPECT_FALSE(observed.MapFile(path));
+    EXPECT_EQ(mirror.GetNodes().root, nullptr);
+    std::filesystem::remove(path);
+}
+
+TEST(TreeFile, RefusesSavingOverMappedFile) {
+    auto path = (std::filesystem::temp_directory_path() / "nvis_tree_file_self_ut.bin").string();
+    TwoThreeTree source;
+    for (Key key = 0; key < 100; ++key) {
+        source.Insert(key);
+    }
+    ASSERT_TRUE(source.SaveToFile(path));
+    TwoThreeTree tree;
+    ASSERT_TRUE(tree.MapFile(path));
+    // Rewriting the file would pull it from under the mapping.
+    EXPECT_FALSE(tree.SaveToFile(path));
+    auto same_path = std::filesystem::path(path).parent_path() / "." / "nvis_tree_file_self_ut.bin";
+    EXPECT_FALSE(tree.SaveToFile(same_path.string()));
+    EXPECT_TRUE(tree.Contains(99));
+    // Another file is fine, and so is the same one once the tree isn't mapped anymore.
+    ASSERT_TRUE(tree.SaveToFile(path + ".copy"));
+    EXPECT_TRUE(tree.Insert(100));
+    EXPECT_TRUE(tree.SaveToFile(path));
+    TwoThreeTree reread;
+    ASSERT_TRUE(reread.MapFile(path));
+    EXPECT_TRUE(reread.Contains(100));
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + ".copy");
+}
+
 } // namespace NVis